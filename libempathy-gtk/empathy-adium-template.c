@@ -0,0 +1,340 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libempathy/empathy-time.h>
+
+#include "empathy-adium-template.h"
+
+typedef enum {
+	SLOT_LITERAL,
+	SLOT_MESSAGE,
+	SLOT_MESSAGE_CLASSES,
+	SLOT_USER_ICON_PATH,
+	SLOT_SENDER,
+	SLOT_SENDER_SCREEN_NAME,
+	SLOT_SERVICE,
+	SLOT_SHORT_TIME,
+	SLOT_TIME,
+} AdiumSlotType;
+
+typedef struct {
+	AdiumSlotType type;
+	/* SLOT_LITERAL: the chunk in EmpathyAdiumTemplate::literals */
+	gsize         offset;
+	gsize         len;
+	/* SLOT_TIME: owned strftime format, or NULL for the default one */
+	gchar        *format;
+} AdiumSlot;
+
+struct _EmpathyAdiumTemplate {
+	/* All the literal chunks, already escaped for a JavaScript string */
+	GString *literals;
+	GArray  *slots;
+};
+
+static const struct {
+	const gchar   *keyword;
+	gsize          len;
+	AdiumSlotType  type;
+} keywords[] = {
+	{ "%message%", 9, SLOT_MESSAGE },
+	{ "%messageClasses%", 16, SLOT_MESSAGE_CLASSES },
+	{ "%userIconPath%", 14, SLOT_USER_ICON_PATH },
+	{ "%sender%", 8, SLOT_SENDER },
+	{ "%senderScreenName%", 18, SLOT_SENDER_SCREEN_NAME },
+	/* %senderDisplayName% -
+	 * "The serverside (remotely set) name of the sender,
+	 *  such as an MSN display name."
+	 *
+	 * We don't have access to that yet so we use local
+	 * alias instead.*/
+	{ "%senderDisplayName%", 19, SLOT_SENDER },
+	{ "%service%", 9, SLOT_SERVICE },
+	{ "%shortTime%", 11, SLOT_SHORT_TIME },
+};
+
+/* Escapes @str for a double-quoted JavaScript string, dropping end of
+ * lines. Stops at @len bytes or at the first nul byte. */
+void
+empathy_adium_escape_append (GString     *string,
+			     const gchar *str,
+			     gssize       len)
+{
+	const gchar *end;
+
+	if (str == NULL) {
+		return;
+	}
+
+	if (len < 0) {
+		len = strlen (str);
+	} else {
+		const gchar *nul = memchr (str, '\0', len);
+
+		if (nul != NULL) {
+			len = nul - str;
+		}
+	}
+
+	end = str + len;
+	while (str < end) {
+		const gchar *run = str;
+
+		/* Copy the bytes which need no escaping in one go */
+		while (str < end && *str != '\\' && *str != '\"' && *str != '\n') {
+			str++;
+		}
+		g_string_append_len (string, run, str - run);
+
+		if (str == end) {
+			break;
+		}
+
+		switch (*str) {
+		case '\\':
+			/* \ becomes \\ */
+			g_string_append (string, "\\\\");
+			break;
+		case '\"':
+			/* " becomes \" */
+			g_string_append (string, "\\\"");
+			break;
+		default:
+			/* Remove end of lines */
+			break;
+		}
+		str++;
+	}
+}
+
+static void
+adium_template_add_slot (EmpathyAdiumTemplate *tmpl,
+			 AdiumSlotType         type,
+			 gchar                *format)
+{
+	AdiumSlot slot = { type, 0, 0, format };
+
+	g_array_append_val (tmpl->slots, slot);
+}
+
+static void
+adium_template_add_literal (EmpathyAdiumTemplate *tmpl,
+			    const gchar          *str,
+			    gsize                 len)
+{
+	AdiumSlot *last = NULL;
+	gsize      offset = tmpl->literals->len;
+
+	empathy_adium_escape_append (tmpl->literals, str, len);
+
+	if (tmpl->slots->len > 0) {
+		last = &g_array_index (tmpl->slots, AdiumSlot,
+				       tmpl->slots->len - 1);
+	}
+
+	/* Literals are contiguous, so consecutive chunks merge */
+	if (last != NULL && last->type == SLOT_LITERAL) {
+		last->len = tmpl->literals->len - last->offset;
+	} else {
+		AdiumSlot slot = { SLOT_LITERAL, offset,
+				   tmpl->literals->len - offset, NULL };
+
+		g_array_append_val (tmpl->slots, slot);
+	}
+}
+
+EmpathyAdiumTemplate *
+empathy_adium_template_new (const gchar *html)
+{
+	EmpathyAdiumTemplate *tmpl;
+	const gchar          *cur;
+	const gchar          *literal;
+
+	g_return_val_if_fail (html != NULL, NULL);
+
+	tmpl = g_slice_new (EmpathyAdiumTemplate);
+	tmpl->literals = g_string_sized_new (strlen (html));
+	tmpl->slots = g_array_new (FALSE, FALSE, sizeof (AdiumSlot));
+
+	literal = html;
+	cur = html;
+	while (*cur != '\0') {
+		const gchar *keyword_start = cur;
+		gboolean     found = FALSE;
+		guint        i;
+
+		if (*cur != '%') {
+			cur++;
+			continue;
+		}
+
+		for (i = 0; i < G_N_ELEMENTS (keywords); i++) {
+			if (strncmp (cur, keywords[i].keyword,
+				     keywords[i].len) == 0) {
+				adium_template_add_literal (tmpl, literal,
+							    cur - literal);
+				adium_template_add_slot (tmpl,
+							 keywords[i].type,
+							 NULL);
+				cur += keywords[i].len;
+				found = TRUE;
+				break;
+			}
+		}
+
+		if (!found && strncmp (cur, "%time", 5) == 0) {
+			gchar *format = NULL;
+
+			adium_template_add_literal (tmpl, literal,
+						    cur - literal);
+			cur += 5;
+
+			/* Time can be in 2 formats:
+			 * %time% or %time{strftime format}%
+			 * Extract the time format if provided. */
+			if (*cur == '{') {
+				const gchar *end;
+
+				end = strstr (cur + 1, "}%");
+				if (end == NULL) {
+					/* Invalid string: drop "%time{" and
+					 * the character following it */
+					cur++;
+					if (*cur != '\0') {
+						cur++;
+					}
+					literal = cur;
+					continue;
+				}
+				format = g_strndup (cur + 1,
+						    end - (cur + 1));
+				cur = end + 2;
+			} else if (*cur != '\0') {
+				cur++;
+			}
+
+			adium_template_add_slot (tmpl, SLOT_TIME, format);
+			found = TRUE;
+		}
+
+		if (found) {
+			literal = cur;
+		} else {
+			cur = keyword_start + 1;
+		}
+	}
+
+	adium_template_add_literal (tmpl, literal, cur - literal);
+
+	return tmpl;
+}
+
+void
+empathy_adium_template_free (EmpathyAdiumTemplate *tmpl)
+{
+	guint i;
+
+	if (tmpl == NULL) {
+		return;
+	}
+
+	for (i = 0; i < tmpl->slots->len; i++) {
+		g_free (g_array_index (tmpl->slots, AdiumSlot, i).format);
+	}
+
+	g_array_free (tmpl->slots, TRUE);
+	g_string_free (tmpl->literals, TRUE);
+	g_slice_free (EmpathyAdiumTemplate, tmpl);
+}
+
+/* Appends the template with its slots replaced, escaped for a double-quoted
+ * JavaScript string. */
+void
+empathy_adium_template_render (EmpathyAdiumTemplate *tmpl,
+			       GString              *string,
+			       const gchar          *message,
+			       const gchar          *avatar_filename,
+			       const gchar          *name,
+			       const gchar          *contact_id,
+			       const gchar          *service_name,
+			       const gchar          *message_classes,
+			       time_t                timestamp,
+			       gboolean              is_backlog)
+{
+	guint i;
+
+	g_return_if_fail (tmpl != NULL);
+
+	for (i = 0; i < tmpl->slots->len; i++) {
+		const AdiumSlot *slot;
+		gchar           *time_str;
+
+		slot = &g_array_index (tmpl->slots, AdiumSlot, i);
+
+		switch (slot->type) {
+		case SLOT_LITERAL:
+			g_string_append_len (string,
+					     tmpl->literals->str + slot->offset,
+					     slot->len);
+			break;
+		case SLOT_MESSAGE:
+			empathy_adium_escape_append (string, message, -1);
+			break;
+		case SLOT_MESSAGE_CLASSES:
+			empathy_adium_escape_append (string, message_classes, -1);
+			break;
+		case SLOT_USER_ICON_PATH:
+			empathy_adium_escape_append (string, avatar_filename, -1);
+			break;
+		case SLOT_SENDER:
+			empathy_adium_escape_append (string, name, -1);
+			break;
+		case SLOT_SENDER_SCREEN_NAME:
+			empathy_adium_escape_append (string, contact_id, -1);
+			break;
+		case SLOT_SERVICE:
+			empathy_adium_escape_append (string, service_name, -1);
+			break;
+		case SLOT_SHORT_TIME:
+			time_str = empathy_time_to_string_local (timestamp,
+				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			empathy_adium_escape_append (string, time_str, -1);
+			g_free (time_str);
+			break;
+		case SLOT_TIME:
+			if (slot->format != NULL) {
+				time_str = empathy_time_to_string_local (timestamp,
+					slot->format);
+			} else if (is_backlog) {
+				time_str = empathy_time_to_string_local (timestamp,
+					EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
+			} else {
+				time_str = empathy_time_to_string_local (timestamp,
+					EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			}
+			empathy_adium_escape_append (string, time_str, -1);
+			g_free (time_str);
+			break;
+		}
+	}
+}
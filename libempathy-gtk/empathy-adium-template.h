@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_ADIUM_TEMPLATE_H__
+#define __EMPATHY_ADIUM_TEMPLATE_H__
+
+#include <time.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An Adium message template (Content.html, Status.html, ...) split once
+ * into literal chunks and %keyword% slots */
+typedef struct _EmpathyAdiumTemplate EmpathyAdiumTemplate;
+
+EmpathyAdiumTemplate *empathy_adium_template_new    (const gchar          *html);
+void                  empathy_adium_template_free   (EmpathyAdiumTemplate *tmpl);
+void                  empathy_adium_template_render (EmpathyAdiumTemplate *tmpl,
+						     GString              *string,
+						     const gchar          *message,
+						     const gchar          *avatar_filename,
+						     const gchar          *name,
+						     const gchar          *contact_id,
+						     const gchar          *service_name,
+						     const gchar          *message_classes,
+						     time_t                timestamp,
+						     gboolean              is_backlog);
+void                  empathy_adium_escape_append   (GString              *string,
+						     const gchar          *str,
+						     gssize                len);
+
+G_END_DECLS
+
+#endif /*  __EMPATHY_ADIUM_TEMPLATE_H__ */
@@ -52,6 +52,8 @@
 #define TIMESTAMP_INTERVAL 300
 
 #define MAX_LINES 800
+/* Lines removed at once when going over MAX_LINES */
+#define TRIM_LINES (MAX_LINES / 10)
 #define MAX_SCROLL_TIME 0.4 /* seconds */
 #define SCROLL_DELAY 33     /* milliseconds */
 
@@ -72,6 +74,9 @@ typedef struct {
 	GConfClient          *gconf_client;
 	EmpathySmileyManager *smiley_manager;
 	gboolean              only_if_date;
+	GArray               *tokens;
+	/* GtkTextMarks where each message or event starts, oldest first */
+	GQueue               *boundaries;
 } EmpathyChatTextViewPriv;
 
 static void chat_text_view_iface_init (EmpathyChatViewIface *iface);
@@ -184,7 +189,6 @@ chat_text_view_create_tags (EmpathyChatTextView *view)
 	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
 	GtkTextTag              *tag;
 
-	gtk_text_buffer_create_tag (priv->buffer, EMPATHY_CHAT_TEXT_VIEW_TAG_CUT, NULL);
 	gtk_text_buffer_create_tag (priv->buffer, EMPATHY_CHAT_TEXT_VIEW_TAG_HIGHLIGHT, NULL);
 	gtk_text_buffer_create_tag (priv->buffer, EMPATHY_CHAT_TEXT_VIEW_TAG_SPACING, NULL);
 	gtk_text_buffer_create_tag (priv->buffer, EMPATHY_CHAT_TEXT_VIEW_TAG_TIME, NULL);
@@ -356,48 +360,75 @@ chat_text_view_is_scrolled_down (EmpathyChatTextView *view)
 	return TRUE;
 }
 
+/* Marks the end of the buffer as the start of a new message block, the
+ * only places where the buffer gets trimmed */
+static void
+chat_text_view_add_boundary (EmpathyChatTextView *view)
+{
+	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
+	GtkTextIter              iter;
+	GtkTextMark             *mark;
+
+	gtk_text_buffer_get_end_iter (priv->buffer, &iter);
+	mark = gtk_text_buffer_create_mark (priv->buffer, NULL, &iter, TRUE);
+	g_queue_push_tail (priv->boundaries, mark);
+}
+
+static void
+chat_text_view_clear_boundaries (EmpathyChatTextView *view)
+{
+	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
+	GtkTextMark             *mark;
+
+	while ((mark = g_queue_pop_head (priv->boundaries)) != NULL) {
+		gtk_text_buffer_delete_mark (priv->buffer, mark);
+	}
+}
+
 static void
 chat_text_view_maybe_trim_buffer (EmpathyChatTextView *view)
 {
 	EmpathyChatTextViewPriv *priv;
-	GtkTextIter         top, bottom;
-	gint                line;
-	gint                remove_;
-	GtkTextTagTable    *table;
-	GtkTextTag         *tag;
+	GtkTextIter              top, bottom;
+	GtkTextMark             *mark;
+	GList                   *l;
+	GtkTextMark             *cut = NULL;
+	gint                     remove_;
 
 	priv = GET_PRIV (view);
 
-	gtk_text_buffer_get_end_iter (priv->buffer, &bottom);
-	line = gtk_text_iter_get_line (&bottom);
-	if (line < MAX_LINES) {
+	/* The line count is cached by the buffer, so this check is cheap */
+	if (gtk_text_buffer_get_line_count (priv->buffer) <= MAX_LINES) {
 		return;
 	}
 
-	remove_ = line - MAX_LINES;
-	gtk_text_buffer_get_start_iter (priv->buffer, &top);
-
-	bottom = top;
-	if (!gtk_text_iter_forward_lines (&bottom, remove_)) {
-		return;
+	/* Remove whole message blocks, and enough of them to stay below
+	 * MAX_LINES for a while */
+	remove_ = gtk_text_buffer_get_line_count (priv->buffer) - MAX_LINES +
+		TRIM_LINES;
+
+	/* Cut at the first block starting after the lines to remove or, if
+	 * there is none, at the last block */
+	for (l = priv->boundaries->head; l != NULL; l = l->next) {
+		cut = l->data;
+		gtk_text_buffer_get_iter_at_mark (priv->buffer, &bottom, cut);
+		if (gtk_text_iter_get_line (&bottom) >= remove_) {
+			break;
+		}
 	}
 
-	/* Track backwords to a place where we can safely cut, we don't do it in
-	  * the middle of a tag.
-	  */
-	table = gtk_text_buffer_get_tag_table (priv->buffer);
-	tag = gtk_text_tag_table_lookup (table, EMPATHY_CHAT_TEXT_VIEW_TAG_CUT);
-	if (!tag) {
+	gtk_text_buffer_get_start_iter (priv->buffer, &top);
+	if (cut == NULL || gtk_text_iter_equal (&top, &bottom)) {
 		return;
 	}
 
-	if (!gtk_text_iter_forward_to_tag_toggle (&bottom, tag)) {
-		return;
-	}
+	/* The boundaries up to the cut would all end up at the top */
+	do {
+		mark = g_queue_pop_head (priv->boundaries);
+		gtk_text_buffer_delete_mark (priv->buffer, mark);
+	} while (mark != cut);
 
-	if (!gtk_text_iter_equal (&top, &bottom)) {
-		gtk_text_buffer_delete (priv->buffer, &top, &bottom);
-	}
+	gtk_text_buffer_delete (priv->buffer, &top, &bottom);
 }
 
 static void
@@ -579,6 +610,9 @@ chat_text_view_finalize (GObject *object)
 		g_source_remove (priv->scroll_timeout);
 	}
 	g_object_unref (priv->smiley_manager);
+	g_array_free (priv->tokens, TRUE);
+	/* The marks themselves belong to the buffer */
+	g_queue_free (priv->boundaries);
 
 	G_OBJECT_CLASS (empathy_chat_text_view_parent_class)->finalize (object);
 }
@@ -635,6 +669,8 @@ empathy_chat_text_view_init (EmpathyChatTextView *view)
 	priv->last_timestamp = 0;
 	priv->allow_scrolling = TRUE;
 	priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
+	priv->tokens = empathy_string_tokens_new ();
+	priv->boundaries = g_queue_new ();
 
 	g_object_set (view,
 		      "wrap-mode", GTK_WRAP_WORD_CHAR,
@@ -744,6 +780,7 @@ chat_text_view_append_message (EmpathyChatView *view,
 	bottom = chat_text_view_is_scrolled_down (text_view);
 
 	chat_text_view_maybe_trim_buffer (EMPATHY_CHAT_TEXT_VIEW (view));
+	chat_text_view_add_boundary (text_view);
 
 	timestamp = empathy_message_get_timestamp (msg);
 	chat_text_maybe_append_date_and_time (text_view, timestamp);
@@ -781,6 +818,7 @@ chat_text_view_append_event (EmpathyChatView *view,
 
 	bottom = chat_text_view_is_scrolled_down (text_view);
 	chat_text_view_maybe_trim_buffer (EMPATHY_CHAT_TEXT_VIEW (view));
+	chat_text_view_add_boundary (text_view);
 	chat_text_maybe_append_date_and_time (text_view,
 					      empathy_time_get_current ());
 
@@ -839,6 +877,8 @@ chat_text_view_clear (EmpathyChatView *view)
 
 	g_return_if_fail (EMPATHY_IS_CHAT_TEXT_VIEW (view));
 
+	chat_text_view_clear_boundaries (EMPATHY_CHAT_TEXT_VIEW (view));
+
 	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (view));
 	gtk_text_buffer_set_text (buffer, "", -1);
 
@@ -1352,69 +1392,51 @@ empathy_chat_text_view_set_only_if_date (EmpathyChatTextView *view,
 }
 
 static void
-chat_text_view_replace_link (const gchar *text,
-			     gssize len,
-			     gpointer match_data,
-			     gpointer user_data)
-{
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
-
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert_with_tags_by_name (buffer, &iter,
-						  text, len,
-						  EMPATHY_CHAT_TEXT_VIEW_TAG_LINK,
-						  NULL);
-}
-
-static void
-chat_text_view_replace_smiley (const gchar *text,
-			       gssize len,
-			       gpointer match_data,
-			       gpointer user_data)
-{
-	EmpathySmileyHit *hit = match_data;
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
-
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert_pixbuf (buffer, &iter, hit->pixbuf);
-}
-
-static void
-chat_text_view_replace_verbatim (const gchar *text,
-				 gssize len,
-				 gpointer match_data,
-				 gpointer user_data)
+chat_text_view_insert_tokens (EmpathyChatTextView *view,
+			      const gchar         *text)
 {
-	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
-	GtkTextIter iter;
+	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
+	GtkTextIter              iter;
+	guint                    i;
 
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert (buffer, &iter, text, len);
+	gtk_text_buffer_get_end_iter (priv->buffer, &iter);
+	for (i = 0; i < priv->tokens->len; i++) {
+		EmpathyStringToken *token;
+		const gchar        *str;
+		gint                len;
+
+		token = &g_array_index (priv->tokens, EmpathyStringToken, i);
+		str = text + token->start;
+		len = token->end - token->start;
+
+		switch (token->type) {
+		case EMPATHY_STRING_TOKEN_LINK:
+			gtk_text_buffer_insert_with_tags_by_name (priv->buffer,
+								  &iter,
+								  str, len,
+								  EMPATHY_CHAT_TEXT_VIEW_TAG_LINK,
+								  NULL);
+			break;
+		case EMPATHY_STRING_TOKEN_SMILEY:
+			gtk_text_buffer_insert_pixbuf (priv->buffer, &iter,
+						       token->pixbuf);
+			break;
+		case EMPATHY_STRING_TOKEN_TEXT:
+		case EMPATHY_STRING_TOKEN_NEWLINE:
+		default:
+			gtk_text_buffer_insert (priv->buffer, &iter, str, len);
+			break;
+		}
+	}
 }
 
-static EmpathyStringParser string_parsers[] = {
-	{empathy_string_match_link, chat_text_view_replace_link},
-	{empathy_string_match_all, chat_text_view_replace_verbatim},
-	{NULL, NULL}
-};
-
-static EmpathyStringParser string_parsers_with_smiley[] = {
-	{empathy_string_match_link, chat_text_view_replace_link},
-	{empathy_string_match_smiley, chat_text_view_replace_smiley},
-	{empathy_string_match_all, chat_text_view_replace_verbatim},
-	{NULL, NULL}
-};
-
 void
 empathy_chat_text_view_append_body (EmpathyChatTextView *view,
 				    const gchar         *body,
 				    const gchar         *tag)
 {
 	EmpathyChatTextViewPriv *priv = GET_PRIV (view);
-	EmpathyStringParser     *parsers;
-	gboolean                 use_smileys;
+	EmpathyStringTokenizeFlags flags;
 	GtkTextIter              start_iter;
 	GtkTextIter              iter;
 	GtkTextMark             *mark;
@@ -1422,20 +1444,19 @@ empathy_chat_text_view_append_body (EmpathyChatTextView *view,
 
 	/* Check if we have to parse smileys */
 	gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
-	use_smileys = g_settings_get_boolean (gsettings_chat,
-			EMPATHY_PREFS_CHAT_SHOW_SMILEYS);
-
-	if (use_smileys)
-		parsers = string_parsers_with_smiley;
-	else
-		parsers = string_parsers;
+	flags = EMPATHY_STRING_TOKENIZE_LINKS;
+	if (g_settings_get_boolean (gsettings_chat,
+			EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+		flags |= EMPATHY_STRING_TOKENIZE_SMILEYS;
 
 	/* Create a mark at the place we'll start inserting */
 	gtk_text_buffer_get_end_iter (priv->buffer, &start_iter);
 	mark = gtk_text_buffer_create_mark (priv->buffer, NULL, &start_iter, TRUE);
 
 	/* Parse text for links/smileys and insert in the buffer */
-	empathy_string_parser_substr (body, -1, parsers, priv->buffer);
+	g_array_set_size (priv->tokens, 0);
+	empathy_string_tokenize (body, -1, flags, priv->tokens);
+	chat_text_view_insert_tokens (view, body);
 
 	/* Insert a newline after the text inserted */
 	gtk_text_buffer_get_end_iter (priv->buffer, &iter);
@@ -1464,7 +1485,6 @@ empathy_chat_text_view_append_spacing (EmpathyChatTextView *view)
 						  &iter,
 						  "\n",
 						  -1,
-						  EMPATHY_CHAT_TEXT_VIEW_TAG_CUT,
 						  EMPATHY_CHAT_TEXT_VIEW_TAG_SPACING,
 						  NULL);
 }
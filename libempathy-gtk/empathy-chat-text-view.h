@@ -59,7 +59,6 @@ struct _EmpathyChatTextViewClass {
 				EmpathyMessage      *message);
 };
 
-#define EMPATHY_CHAT_TEXT_VIEW_TAG_CUT "cut"
 #define EMPATHY_CHAT_TEXT_VIEW_TAG_HIGHLIGHT "highlight"
 #define EMPATHY_CHAT_TEXT_VIEW_TAG_SPACING "spacing"
 #define EMPATHY_CHAT_TEXT_VIEW_TAG_TIME "time"
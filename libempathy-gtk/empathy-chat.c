@@ -38,8 +38,11 @@
 #include <telepathy-glib/account-manager.h>
 #include <telepathy-glib/util.h>
 #include <telepathy-logger/log-manager.h>
+#include <telepathy-logger/entry-text.h>
 #include <libempathy/empathy-contact-list.h>
 #include <libempathy/empathy-gsettings.h>
+#include <libempathy/empathy-log-index.h>
+#include <libempathy/empathy-message-batch.h>
 #include <libempathy/empathy-utils.h>
 #include <libempathy/empathy-dispatcher.h>
 
@@ -54,6 +57,10 @@
 #include "empathy-ui-utils.h"
 #include "empathy-string-parser.h"
 
+#ifdef HAVE_WEBKIT
+#include "empathy-theme-adium.h"
+#endif
+
 #define DEBUG_FLAG EMPATHY_DEBUG_CHAT
 #include <libempathy/empathy-debug.h>
 
@@ -1123,6 +1130,11 @@ chat_message_received (EmpathyChat *chat, EmpathyMessage *message)
 
 	empathy_chat_view_append_message (chat->view, message);
 
+	/* Keep the log window calendar up to date */
+	empathy_log_index_message_logged (priv->account, priv->id,
+		priv->handle_type == TP_HANDLE_TYPE_ROOM,
+		empathy_message_get_timestamp (message));
+
 	/* We received a message so the contact is no longer composing */
 	chat_state_changed_cb (priv->tp_chat, sender,
 			       TP_CHANNEL_CHAT_STATE_ACTIVE,
@@ -2070,29 +2082,112 @@ chat_input_populate_popup_cb (GtkTextView *view,
 }
 
 
+/* What empathy_message_equal() compares */
+typedef struct {
+	time_t  timestamp;
+	gchar  *body;
+} MessageFingerprint;
+
+static guint
+message_fingerprint_hash (gconstpointer key)
+{
+	const MessageFingerprint *fingerprint = key;
+
+	/* tp_strdiff() doesn't tell NULL from "" */
+	return g_str_hash (fingerprint->body != NULL ? fingerprint->body : "") ^
+		(guint) fingerprint->timestamp;
+}
+
 static gboolean
-chat_log_filter (TplEntry *log,
-		 gpointer user_data)
+message_fingerprint_equal (gconstpointer a,
+			   gconstpointer b)
+{
+	const MessageFingerprint *fingerprint_a = a;
+	const MessageFingerprint *fingerprint_b = b;
+
+	return fingerprint_a->timestamp == fingerprint_b->timestamp &&
+		!tp_strdiff (fingerprint_a->body, fingerprint_b->body);
+}
+
+static void
+message_fingerprint_free (MessageFingerprint *fingerprint)
+{
+	g_free (fingerprint->body);
+	g_slice_free (MessageFingerprint, fingerprint);
+}
+
+/* Returns the set of the pending messages' fingerprints, or NULL if there
+ * are none. The log manager calls the filter from its own thread, which
+ * only reads the set. */
+static GHashTable *
+chat_dup_pending_fingerprints (EmpathyChat *chat)
 {
-	EmpathyChat *chat = user_data;
-	EmpathyMessage *message;
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const GList *pending;
+	GHashTable      *fingerprints;
+	const GList     *pending;
 
-	g_return_val_if_fail (TPL_IS_ENTRY (log), FALSE);
-	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
+	if (priv->tp_chat == NULL) {
+		return NULL;
+	}
 
 	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
-	message = empathy_message_from_tpl_log_entry (log);
+	if (pending == NULL) {
+		return NULL;
+	}
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data)) {
-			return FALSE;
-		}
+	fingerprints = g_hash_table_new_full (message_fingerprint_hash,
+					      message_fingerprint_equal,
+					      (GDestroyNotify) message_fingerprint_free,
+					      NULL);
+
+	for (; pending != NULL; pending = g_list_next (pending)) {
+		MessageFingerprint *fingerprint;
+
+		fingerprint = g_slice_new (MessageFingerprint);
+		fingerprint->timestamp =
+			empathy_message_get_timestamp (pending->data);
+		fingerprint->body =
+			g_strdup (empathy_message_get_body (pending->data));
+		g_hash_table_insert (fingerprints, fingerprint, fingerprint);
 	}
 
-	g_object_unref (message);
-	return TRUE;
+	return fingerprints;
+}
+
+static gboolean
+chat_fingerprints_contain (GHashTable  *fingerprints,
+			   time_t       timestamp,
+			   const gchar *body)
+{
+	MessageFingerprint fingerprint;
+
+	if (fingerprints == NULL) {
+		return FALSE;
+	}
+
+	fingerprint.timestamp = timestamp;
+	fingerprint.body = (gchar *) body;
+
+	return g_hash_table_lookup (fingerprints, &fingerprint) != NULL;
+}
+
+/* Skips the entries which are still pending, they are displayed after the
+ * backlog. @user_data is the set of chat_dup_pending_fingerprints(). */
+static gboolean
+chat_log_filter (TplEntry *log,
+		 gpointer user_data)
+{
+	GHashTable *fingerprints = user_data;
+
+	g_return_val_if_fail (TPL_IS_ENTRY (log), FALSE);
+
+	if (!TPL_IS_ENTRY_TEXT (log)) {
+		return TRUE;
+	}
+
+	return !chat_fingerprints_contain (fingerprints,
+		tpl_entry_get_timestamp (log),
+		tpl_entry_text_get_message (TPL_ENTRY_TEXT (log)));
 }
 
 
@@ -2118,16 +2213,28 @@ show_pending_messages (EmpathyChat *chat) {
 }
 
 
+/* The backlog being retrieved. The chat and its view are kept alive until
+ * it is, and the log manager's thread reads its own copy of the
+ * fingerprints. */
+typedef struct {
+	EmpathyChat     *chat;
+	EmpathyChatView *view;
+	GHashTable      *fingerprints;
+} BacklogData;
+
 static void
 got_filtered_messages_cb (GObject *manager,
 		GAsyncResult *result,
 		gpointer user_data)
 {
-	GList *l;
+	BacklogData *data = user_data;
 	GList *messages;
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
+	EmpathyMessageBatch *batch;
+	EmpathyChat *chat = data->chat;
 	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GHashTable *pending;
 	GError *error = NULL;
+	guint i;
 
 	if (!tpl_log_manager_get_filtered_messages_finish (TPL_LOG_MANAGER (manager),
 		result, &messages, &error)) {
@@ -2138,19 +2245,37 @@ got_filtered_messages_cb (GObject *manager,
 		goto out;
 	}
 
-	for (l = messages; l; l = g_list_next (l)) {
+	/* Backlog senders share their EmpathyContact */
+	batch = empathy_message_batch_new (messages);
+	g_list_foreach (messages, (GFunc) g_object_unref, NULL);
+	g_list_free (messages);
+
+	/* Messages received during the retrieval are pending too by now, and
+	 * may have been logged before the filter saw them */
+	pending = chat_dup_pending_fingerprints (chat);
+
+	for (i = 0; i < empathy_message_batch_get_length (batch); i++) {
+		const EmpathyMessageRecord *record;
 		EmpathyMessage *message;
-		g_assert (TPL_IS_ENTRY (l->data));
 
-		message = empathy_message_from_tpl_log_entry (l->data);
-		g_object_unref (l->data);
+		record = empathy_message_batch_get_record (batch, i);
+		if (chat_fingerprints_contain (pending, record->timestamp,
+					       record->body)) {
+			continue;
+		}
 
+		message = empathy_message_batch_dup_message (batch, i);
 		empathy_chat_view_append_message (chat->view, message);
 		g_object_unref (message);
 	}
-	g_list_free (messages);
+	empathy_message_batch_free (batch);
+
+	if (pending != NULL) {
+		g_hash_table_destroy (pending);
+	}
 
 out:
+
 	/* in case of TPL error, skip backlog and show pending messages */
 	priv->can_show_pending = TRUE;
 	show_pending_messages (chat);
@@ -2162,12 +2287,20 @@ out:
 
 	/* Turn back on scrolling */
 	empathy_chat_view_scroll (chat->view, TRUE);
+
+	if (data->fingerprints != NULL) {
+		g_hash_table_destroy (data->fingerprints);
+	}
+	g_object_unref (data->view);
+	g_object_unref (data->chat);
+	g_slice_free (BacklogData, data);
 }
 
 static void
 chat_add_logs (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
+	BacklogData     *data;
 	gboolean         is_chatroom;
 
 	if (!priv->id) {
@@ -2181,17 +2314,156 @@ chat_add_logs (EmpathyChat *chat)
 	is_chatroom = priv->handle_type == TP_HANDLE_TYPE_ROOM;
 
 	priv->retrieving_backlogs = TRUE;
+
+	data = g_slice_new (BacklogData);
+	data->chat = g_object_ref (chat);
+	data->view = g_object_ref (chat->view);
+	data->fingerprints = chat_dup_pending_fingerprints (chat);
+
 	tpl_log_manager_get_filtered_messages_async (priv->log_manager,
 							      priv->account,
 							      priv->id,
 							      is_chatroom,
-							      5,
+							      g_settings_get_int (priv->gsettings_chat,
+								      EMPATHY_PREFS_CHAT_BACKLOG_LENGTH),
 							      chat_log_filter,
-							      chat,
+							      data->fingerprints,
 							      got_filtered_messages_cb,
-							      (gpointer) chat);
+							      data);
+}
+
+#ifdef HAVE_WEBKIT
+/* Number of messages fetched back each time the user scrolls up to
+ * messages the view has pruned */
+#define OLDER_MESSAGES_FETCH 50
+
+/* Number of message blocks a chat keeps displayed, older ones are pruned
+ * and fetched back from the logs on demand */
+#define MAX_DISPLAYED_MESSAGES 1000
+
+typedef struct {
+	EmpathyChat       *chat;
+	EmpathyThemeAdium *view;
+	/* The oldest message still displayed */
+	time_t             before;
+	guint              before_hash;
+	gboolean           before_found;
+	GHashTable        *fingerprints;
+} OlderMessagesData;
+
+static gboolean
+chat_older_log_filter (TplEntry *log,
+		       gpointer user_data)
+{
+	OlderMessagesData *data = user_data;
+	time_t timestamp;
+
+	timestamp = tpl_entry_get_timestamp (log);
+	if (timestamp > data->before) {
+		return FALSE;
+	}
+
+	/* Timestamps only have a one second resolution: entries logged
+	 * during the same second as the oldest displayed message are only
+	 * older if they come after it, as entries are given newest first. */
+	if (timestamp == data->before && !data->before_found) {
+		const gchar *body = NULL;
+
+		if (TPL_IS_ENTRY_TEXT (log)) {
+			body = tpl_entry_text_get_message (TPL_ENTRY_TEXT (log));
+		}
+		if (data->before_hash != 0 &&
+		    g_str_hash (body != NULL ? body : "") == data->before_hash) {
+			data->before_found = TRUE;
+		}
+		return FALSE;
+	}
+
+	return chat_log_filter (log, data->fingerprints);
+}
+
+static void
+got_older_messages_cb (GObject *manager,
+		       GAsyncResult *result,
+		       gpointer user_data)
+{
+	OlderMessagesData *data = user_data;
+	GList *entries = NULL;
+	GList *messages = NULL;
+	EmpathyMessageBatch *batch;
+	GError *error = NULL;
+	guint n_entries;
+	guint i;
+
+	if (!tpl_log_manager_get_filtered_messages_finish (TPL_LOG_MANAGER (manager),
+		result, &entries, &error)) {
+		DEBUG ("Failed to retrieve older logs: %s", error->message);
+		g_error_free (error);
+	}
+
+	batch = empathy_message_batch_new (entries);
+	n_entries = g_list_length (entries);
+	g_list_foreach (entries, (GFunc) g_object_unref, NULL);
+	g_list_free (entries);
+
+	for (i = empathy_message_batch_get_length (batch); i > 0; i--) {
+		messages = g_list_prepend (messages,
+			empathy_message_batch_dup_message (batch, i - 1));
+	}
+	empathy_message_batch_free (batch);
+
+	empathy_theme_adium_prepend_messages (data->view, messages);
+
+	/* Fewer messages than asked for: the logs start there */
+	if (messages != NULL && n_entries < OLDER_MESSAGES_FETCH) {
+		empathy_theme_adium_prepend_messages (data->view, NULL);
+	}
+
+	g_list_foreach (messages, (GFunc) g_object_unref, NULL);
+	g_list_free (messages);
+
+	g_object_unref (data->chat);
+	g_object_unref (data->view);
+	if (data->fingerprints != NULL) {
+		g_hash_table_destroy (data->fingerprints);
+	}
+	g_slice_free (OlderMessagesData, data);
 }
 
+static void
+chat_older_messages_needed_cb (EmpathyThemeAdium *view,
+			       glong before,
+			       guint before_hash,
+			       EmpathyChat *chat)
+{
+	EmpathyChatPriv   *priv = GET_PRIV (chat);
+	OlderMessagesData *data;
+
+	if (!priv->id || priv->tp_chat == NULL) {
+		empathy_theme_adium_prepend_messages (view, NULL);
+		return;
+	}
+
+	data = g_slice_new (OlderMessagesData);
+	data->chat = g_object_ref (chat);
+	data->view = g_object_ref (view);
+	data->before = before;
+	data->before_hash = before_hash;
+	data->before_found = FALSE;
+	data->fingerprints = chat_dup_pending_fingerprints (chat);
+
+	tpl_log_manager_get_filtered_messages_async (priv->log_manager,
+		priv->account,
+		priv->id,
+		priv->handle_type == TP_HANDLE_TYPE_ROOM,
+		OLDER_MESSAGES_FETCH,
+		chat_older_log_filter,
+		data,
+		got_older_messages_cb,
+		data);
+}
+#endif
+
 static gint
 chat_contacts_completion_func (const gchar *s1,
 			       const gchar *s2,
@@ -2634,6 +2906,16 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+#ifdef HAVE_WEBKIT
+	if (EMPATHY_IS_THEME_ADIUM (chat->view)) {
+		g_object_set (chat->view,
+			      "max-messages", MAX_DISPLAYED_MESSAGES,
+			      NULL);
+		g_signal_connect (chat->view, "older-messages-needed",
+				  G_CALLBACK (chat_older_messages_needed_cb),
+				  chat);
+	}
+#endif
 	gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
 			   GTK_WIDGET (chat->view));
 	gtk_widget_show (GTK_WIDGET (chat->view));
@@ -68,6 +68,16 @@ typedef struct {
 	guint                       setup_idle_id;
 	gboolean                    dispose_has_run;
 	GHashTable                  *status_icons;
+	/* Contacts which joined the list since the last main loop iteration,
+	 * owning a reference. They are added at once, see
+	 * contact_list_store_add_pending_cb(). */
+	GQueue                      pending_added;
+	/* EmpathyContact -> its link in pending_added */
+	GHashTable                  *pending_added_links;
+	guint                       pending_added_id;
+	/* reffed EmpathyContact -> owned GCancellable of its pending avatar
+	 * load operation */
+	GHashTable                  *avatar_cancellables;
 } EmpathyContactListStorePriv;
 
 typedef struct {
@@ -88,6 +98,11 @@ typedef struct {
 	gboolean                remove;
 } ShowActiveData;
 
+typedef struct {
+	EmpathyContactListStore *store; /* weak */
+	GCancellable            *cancellable; /* owned */
+} LoadAvatarData;
+
 static void             contact_list_store_dispose                  (GObject                       *object);
 static void             contact_list_store_get_property              (GObject                       *object,
 								      guint                          param_id,
@@ -127,6 +142,13 @@ static void             contact_list_store_remove_contact            (EmpathyCon
 								      EmpathyContact                *contact);
 static void             contact_list_store_contact_update            (EmpathyContactListStore       *store,
 								      EmpathyContact                *contact);
+static void             contact_list_store_load_avatar               (EmpathyContactListStore       *store,
+								      EmpathyContact                *contact);
+static void             contact_list_store_cancel_avatar_load        (EmpathyContactListStore       *store,
+								      EmpathyContact                *contact);
+static void             contact_list_store_contact_update_iters      (EmpathyContactListStore       *store,
+								      EmpathyContact                *contact,
+								      GList                         *iters);
 static void             contact_list_store_contact_updated_cb        (EmpathyContact                *contact,
 								      GParamSpec                    *param,
 								      EmpathyContactListStore       *store);
@@ -318,6 +340,9 @@ empathy_contact_list_store_init (EmpathyContactListStore *store)
 						      (GSourceFunc) contact_list_store_inibit_active_cb,
 						      store);
 	priv->status_icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->pending_added_links = g_hash_table_new (NULL, NULL);
+	priv->avatar_cancellables = g_hash_table_new_full (NULL, NULL,
+		g_object_unref, g_object_unref);
 	contact_list_store_setup (store);
 }
 
@@ -325,12 +350,17 @@ static void
 contact_list_store_dispose (GObject *object)
 {
 	EmpathyContactListStorePriv *priv = GET_PRIV (object);
-	GList                       *contacts, *l;
+	GList                       *contacts, *cancellables, *l;
 
 	if (priv->dispose_has_run)
 		return;
 	priv->dispose_has_run = TRUE;
 
+	/* Cancel any pending avatar load operations */
+	cancellables = g_hash_table_get_values (priv->avatar_cancellables);
+	g_list_foreach (cancellables, (GFunc) g_cancellable_cancel, NULL);
+	g_list_free (cancellables);
+
 	contacts = empathy_contact_list_get_members (priv->list);
 	for (l = contacts; l; l = l->next) {
 		g_signal_handlers_disconnect_by_func (l->data,
@@ -363,7 +393,16 @@ contact_list_store_dispose (GObject *object)
 		g_source_remove (priv->setup_idle_id);
 	}
 
+	if (priv->pending_added_id != 0) {
+		g_source_remove (priv->pending_added_id);
+	}
+
+	g_queue_foreach (&priv->pending_added, (GFunc) g_object_unref, NULL);
+	g_queue_clear (&priv->pending_added);
+	g_hash_table_destroy (priv->pending_added_links);
+
 	g_hash_table_destroy (priv->status_icons);
+	g_hash_table_destroy (priv->avatar_cancellables);
 	G_OBJECT_CLASS (empathy_contact_list_store_parent_class)->dispose (object);
 }
 
@@ -881,6 +920,65 @@ contact_list_store_remove_contact_and_disconnect (EmpathyContactListStore *store
 	contact_list_store_remove_contact (store, contact);
 }
 
+static gboolean
+contact_list_store_add_pending_cb (gpointer user_data)
+{
+	EmpathyContactListStore     *store = user_data;
+	EmpathyContactListStorePriv *priv = GET_PRIV (store);
+	GtkTreeSortable             *sortable = GTK_TREE_SORTABLE (store);
+	EmpathyContact              *contact;
+	gint                         sort_column_id;
+	GtkSortType                  order;
+	gboolean                     resort;
+
+	priv->pending_added_id = 0;
+
+	/* Joining a big chat room adds thousands of members at once. Sorting
+	 * them once at the end is cheaper than sorting each new row. */
+	resort = g_queue_get_length (&priv->pending_added) > 1 &&
+		gtk_tree_sortable_get_sort_column_id (sortable,
+						      &sort_column_id, &order);
+	if (resort) {
+		DEBUG ("Adding %u contacts",
+			g_queue_get_length (&priv->pending_added));
+		gtk_tree_sortable_set_sort_column_id (sortable,
+			GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, order);
+	}
+
+	g_hash_table_remove_all (priv->pending_added_links);
+	while ((contact = g_queue_pop_head (&priv->pending_added)) != NULL) {
+		contact_list_store_add_contact_and_connect (store, contact);
+		g_object_unref (contact);
+	}
+
+	if (resort) {
+		gtk_tree_sortable_set_sort_column_id (sortable,
+			sort_column_id, order);
+	}
+
+	return FALSE;
+}
+
+/* Returns TRUE if @contact was waiting to be added, and forgets it */
+static gboolean
+contact_list_store_cancel_pending (EmpathyContactListStore *store,
+				   EmpathyContact          *contact)
+{
+	EmpathyContactListStorePriv *priv = GET_PRIV (store);
+	GList                       *link;
+
+	link = g_hash_table_lookup (priv->pending_added_links, contact);
+	if (link == NULL) {
+		return FALSE;
+	}
+
+	g_hash_table_remove (priv->pending_added_links, contact);
+	g_queue_delete_link (&priv->pending_added, link);
+	g_object_unref (contact);
+
+	return TRUE;
+}
+
 static void
 contact_list_store_members_changed_cb (EmpathyContactList      *list_iface,
 				       EmpathyContact          *contact,
@@ -900,8 +998,20 @@ contact_list_store_members_changed_cb (EmpathyContactList      *list_iface,
 		is_member ? "added" : "removed");
 
 	if (is_member) {
-		contact_list_store_add_contact_and_connect (store, contact);
-	} else {
+		if (g_hash_table_lookup (priv->pending_added_links, contact) != NULL) {
+			return;
+		}
+
+		/* Add the members of this batch together */
+		g_queue_push_tail (&priv->pending_added, g_object_ref (contact));
+		g_hash_table_insert (priv->pending_added_links, contact,
+				     priv->pending_added.tail);
+
+		if (priv->pending_added_id == 0) {
+			priv->pending_added_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+				contact_list_store_add_pending_cb, store, NULL);
+		}
+	} else if (!contact_list_store_cancel_pending (store, contact)) {
 		contact_list_store_remove_contact_and_disconnect (store, contact);
 	}
 }
@@ -921,6 +1031,11 @@ contact_list_store_favourites_changed_cb (EmpathyContactList      *list_iface,
 		empathy_contact_get_handle (contact),
 		is_favourite ? "now" : "no longer");
 
+	/* Pending contacts are added with their current state */
+	if (g_hash_table_lookup (priv->pending_added_links, contact) != NULL) {
+		return;
+	}
+
 	contact_list_store_remove_contact (store, contact);
 	contact_list_store_add_contact (store, contact);
 }
@@ -947,7 +1062,9 @@ contact_list_store_member_renamed_cb (EmpathyContactList      *list_iface,
 	contact_list_store_add_contact_and_connect (store, new_contact);
 
 	/* remove old contact */
-	contact_list_store_remove_contact_and_disconnect (store, old_contact);
+	if (!contact_list_store_cancel_pending (store, old_contact)) {
+		contact_list_store_remove_contact_and_disconnect (store, old_contact);
+	}
 }
 
 static void
@@ -966,6 +1083,10 @@ contact_list_store_groups_changed_cb (EmpathyContactList      *list_iface,
 		empathy_contact_get_id (contact),
 		empathy_contact_get_handle (contact));
 
+	if (g_hash_table_lookup (priv->pending_added_links, contact) != NULL) {
+		return;
+	}
+
 	/* We do this to make sure the groups are correct, if not, we
 	 * would have to check the groups already set up for each
 	 * contact and then see what has been updated.
@@ -1006,6 +1127,7 @@ contact_list_store_add_contact (EmpathyContactListStore *store,
 	EmpathyContactListStorePriv *priv;
 	GtkTreeIter                 iter;
 	GList                      *groups = NULL, *l;
+	GList                      *iters = NULL;
 	TpConnection               *connection;
 	EmpathyContactListFlags     flags = 0;
 	char                       *protocol_name;
@@ -1049,6 +1171,7 @@ contact_list_store_add_contact (EmpathyContactListStore *store,
 
 		add_contact_to_store (GTK_TREE_STORE (store), &iter, parent,
 				      contact, flags);
+		iters = g_list_prepend (iters, gtk_tree_iter_copy (&iter));
 	}
 
 	g_free (protocol_name);
@@ -1060,6 +1183,7 @@ contact_list_store_add_contact (EmpathyContactListStore *store,
 		contact_list_store_get_group (store, l->data, &iter_group, NULL, NULL, FALSE);
 
 		add_contact_to_store (GTK_TREE_STORE (store), &iter, &iter_group, contact, flags);
+		iters = g_list_prepend (iters, gtk_tree_iter_copy (&iter));
 		g_free (l->data);
 	}
 	g_list_free (groups);
@@ -1073,9 +1197,11 @@ contact_list_store_add_contact (EmpathyContactListStore *store,
 			&iter_group, NULL, NULL, TRUE);
 
 		add_contact_to_store (GTK_TREE_STORE (store), &iter, &iter_group, contact, flags);
+		iters = g_list_prepend (iters, gtk_tree_iter_copy (&iter));
 	}
 
-	contact_list_store_contact_update (store, contact);
+	/* The rows are known, no need to look for them in the whole model */
+	contact_list_store_contact_update_iters (store, contact, g_list_reverse (iters));
 }
 
 static void
@@ -1088,6 +1214,8 @@ contact_list_store_remove_contact (EmpathyContactListStore *store,
 
 	priv = GET_PRIV (store);
 
+	contact_list_store_cancel_avatar_load (store, contact);
+
 	iters = contact_list_store_find_contact (store, contact);
 	if (!iters) {
 		return;
@@ -1115,14 +1243,116 @@ contact_list_store_remove_contact (EmpathyContactListStore *store,
 	g_list_free (iters);
 }
 
+static void
+contact_list_store_cancel_avatar_load (EmpathyContactListStore *store,
+				       EmpathyContact          *contact)
+{
+	EmpathyContactListStorePriv *priv = GET_PRIV (store);
+	GCancellable                *cancellable;
+
+	cancellable = g_hash_table_lookup (priv->avatar_cancellables, contact);
+	if (cancellable == NULL) {
+		return;
+	}
+
+	g_cancellable_cancel (cancellable);
+	g_hash_table_remove (priv->avatar_cancellables, contact);
+}
+
+static void
+contact_list_store_avatar_pixbuf_received_cb (EmpathyContact *contact,
+					      GAsyncResult   *result,
+					      LoadAvatarData *data)
+{
+	GError    *error = NULL;
+	GdkPixbuf *pixbuf;
+
+	pixbuf = empathy_pixbuf_avatar_from_contact_scaled_finish (contact,
+		result, &error);
+
+	if (error != NULL) {
+		DEBUG ("Failed to load the avatar of contact %s: %s",
+			empathy_contact_get_alias (contact), error->message);
+		g_clear_error (&error);
+	}
+	else if (data->store != NULL &&
+		 !g_cancellable_is_cancelled (data->cancellable)) {
+		GList *iters, *l;
+
+		iters = contact_list_store_find_contact (data->store, contact);
+		for (l = iters; l; l = l->next) {
+			gtk_tree_store_set (GTK_TREE_STORE (data->store), l->data,
+					    EMPATHY_CONTACT_LIST_STORE_COL_PIXBUF_AVATAR, pixbuf,
+					    -1);
+		}
+		g_list_foreach (iters, (GFunc) gtk_tree_iter_free, NULL);
+		g_list_free (iters);
+	}
+
+	if (pixbuf != NULL) {
+		g_object_unref (pixbuf);
+	}
+
+	if (data->store != NULL) {
+		EmpathyContactListStorePriv *priv = GET_PRIV (data->store);
+
+		g_object_remove_weak_pointer (G_OBJECT (data->store),
+					      (gpointer *) &data->store);
+
+		/* Unless a newer load superseded this one */
+		if (!priv->dispose_has_run &&
+		    g_hash_table_lookup (priv->avatar_cancellables, contact) ==
+		    data->cancellable) {
+			g_hash_table_remove (priv->avatar_cancellables, contact);
+		}
+	}
+
+	g_object_unref (data->cancellable);
+	g_slice_free (LoadAvatarData, data);
+}
+
+/* Decodes the avatar of @contact off the main thread, and sets it on its
+ * rows once done */
+static void
+contact_list_store_load_avatar (EmpathyContactListStore *store,
+				EmpathyContact          *contact)
+{
+	EmpathyContactListStorePriv *priv = GET_PRIV (store);
+	LoadAvatarData              *data;
+
+	contact_list_store_cancel_avatar_load (store, contact);
+
+	data = g_slice_new (LoadAvatarData);
+	data->store = store;
+	g_object_add_weak_pointer (G_OBJECT (store), (gpointer *) &data->store);
+	data->cancellable = g_cancellable_new ();
+
+	g_hash_table_insert (priv->avatar_cancellables, g_object_ref (contact),
+			     g_object_ref (data->cancellable));
+	empathy_pixbuf_avatar_from_contact_scaled_async (contact, 32, 32,
+		data->cancellable,
+		(GAsyncReadyCallback) contact_list_store_avatar_pixbuf_received_cb,
+		data);
+}
+
 static void
 contact_list_store_contact_update (EmpathyContactListStore *store,
 				   EmpathyContact          *contact)
+{
+	contact_list_store_contact_update_iters (store, contact,
+		contact_list_store_find_contact (store, contact));
+}
+
+/* Takes ownership of @iters, the rows of @contact */
+static void
+contact_list_store_contact_update_iters (EmpathyContactListStore *store,
+					 EmpathyContact          *contact,
+					 GList                   *iters)
 {
 	EmpathyContactListStorePriv *priv;
 	ShowActiveData             *data;
 	GtkTreeModel               *model;
-	GList                      *iters, *l;
+	GList                      *l;
 	gboolean                    in_list;
 	gboolean                    should_be_in_list;
 	gboolean                    was_online = TRUE;
@@ -1132,14 +1362,12 @@ contact_list_store_contact_update (EmpathyContactListStore *store,
 	gboolean                    do_set_active = FALSE;
 	gboolean                    do_set_refresh = FALSE;
 	gboolean                    show_avatar = FALSE;
-	GdkPixbuf                  *pixbuf_avatar;
 	GdkPixbuf                  *pixbuf_status;
 
 	priv = GET_PRIV (store);
 
 	model = GTK_TREE_MODEL (store);
 
-	iters = contact_list_store_find_contact (store, contact);
 	if (!iters) {
 		in_list = FALSE;
 	} else {
@@ -1226,12 +1454,13 @@ contact_list_store_contact_update (EmpathyContactListStore *store,
 	if (priv->show_avatars && !priv->is_compact) {
 		show_avatar = TRUE;
 	}
-	pixbuf_avatar = empathy_pixbuf_avatar_from_contact_scaled (contact, 32, 32);
+	if (set_model) {
+		contact_list_store_load_avatar (store, contact);
+	}
 	pixbuf_status = contact_list_store_get_contact_status_icon (store, contact);
 	for (l = iters; l && set_model; l = l->next) {
 		gtk_tree_store_set (GTK_TREE_STORE (store), l->data,
 				    EMPATHY_CONTACT_LIST_STORE_COL_ICON_STATUS, pixbuf_status,
-				    EMPATHY_CONTACT_LIST_STORE_COL_PIXBUF_AVATAR, pixbuf_avatar,
 				    EMPATHY_CONTACT_LIST_STORE_COL_PIXBUF_AVATAR_VISIBLE, show_avatar,
 				    EMPATHY_CONTACT_LIST_STORE_COL_NAME, empathy_contact_get_alias (contact),
 				    EMPATHY_CONTACT_LIST_STORE_COL_PRESENCE_TYPE,
@@ -1251,10 +1480,6 @@ contact_list_store_contact_update (EmpathyContactListStore *store,
 				    -1);
 	}
 
-	if (pixbuf_avatar) {
-		g_object_unref (pixbuf_avatar);
-	}
-
 	if (priv->show_active && do_set_active) {
 		contact_list_store_contact_set_active (store, contact, do_set_active, do_set_refresh);
 
@@ -57,6 +57,10 @@
 /* Time in seconds after connecting which we wait before active users are enabled */
 #define ACTIVE_USER_WAIT_TO_ENABLE_TIME 5
 
+/* Number of queued updates above which the sort function is detached while
+ * they are applied, trading a per-row reorder for a single re-sort */
+#define UPDATE_DETACH_SORT_THRESHOLD 16
+
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyIndividualStore)
 typedef struct
 {
@@ -71,24 +75,21 @@ typedef struct
   guint setup_idle_id;
   gboolean dispose_has_run;
   GHashTable *status_icons;
-  /* List of owned GCancellables for each pending avatar load operation */
-  GList *avatar_cancellables;
+  /* reffed FolksIndividual -> owned GCancellable of its pending avatar load
+   * operation */
+  GHashTable *avatar_cancellables;
+  /* FolksIndividual -> owned GQueue of owned GtkTreeIters, one per row the
+   * individual appears in. Keys are not reffed: the rows hold a reference. */
+  GHashTable *folks_individual_cache;
+  /* owned group name -> owned GtkTreeIter of the top-level group row */
+  GHashTable *empathy_group_cache;
+  /* Set of reffed FolksIndividuals waiting for update_idle_id */
+  GHashTable *pending_updates;
+  guint update_idle_id;
+  guint n_updates_queued;
+  guint n_updates_coalesced;
 } EmpathyIndividualStorePriv;
 
-typedef struct
-{
-  GtkTreeIter iter;
-  const gchar *name;
-  gboolean found;
-} FindGroup;
-
-typedef struct
-{
-  FolksIndividual *individual;
-  gboolean found;
-  GList *iters;
-} FindContact;
-
 typedef struct
 {
   EmpathyIndividualStore *self;
@@ -108,6 +109,14 @@ enum
   PROP_SORT_CRITERIUM
 };
 
+enum
+{
+  INDIVIDUAL_REMOVED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 /* prototypes to break cycles */
 static void individual_store_contact_update (EmpathyIndividualStore *self,
     FolksIndividual *individual);
@@ -155,17 +164,26 @@ individual_can_audio_video_call (FolksIndividual *individual,
 }
 
 static void
-add_individual_to_store (GtkTreeStore *self,
+individual_store_free_iters (GQueue *queue)
+{
+  g_queue_foreach (queue, (GFunc) gtk_tree_iter_free, NULL);
+  g_queue_free (queue);
+}
+
+static void
+add_individual_to_store (EmpathyIndividualStore *self,
     GtkTreeIter *iter,
     GtkTreeIter *parent,
     FolksIndividual *individual)
 {
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
   gboolean can_audio_call, can_video_call;
+  GQueue *queue;
 
   individual_can_audio_video_call (individual, &can_audio_call,
       &can_video_call);
 
-  gtk_tree_store_insert_with_values (self, iter, parent, 0,
+  gtk_tree_store_insert_with_values (GTK_TREE_STORE (self), iter, parent, 0,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME,
       folks_individual_get_alias (individual),
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, individual,
@@ -174,34 +192,18 @@ add_individual_to_store (GtkTreeStore *self,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_AUDIO_CALL, can_audio_call,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_VIDEO_CALL, can_video_call,
       -1);
-}
-
-static gboolean
-individual_store_get_group_foreach (GtkTreeModel *model,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    FindGroup *fg)
-{
-  gchar *str;
-  gboolean is_group;
-
-  /* Groups are only at the top level. */
-  if (gtk_tree_path_get_depth (path) != 1)
-    return FALSE;
 
-  gtk_tree_model_get (model, iter,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &str,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, &is_group, -1);
-
-  if (is_group && !tp_strdiff (str, fg->name))
+  /* GtkTreeStore iters persist until their row is removed, so they can be
+   * cached directly; GtkTreeRowReferences would make every insertion and
+   * removal walk all the references held on the model. */
+  queue = g_hash_table_lookup (priv->folks_individual_cache, individual);
+  if (queue == NULL)
     {
-      fg->found = TRUE;
-      fg->iter = *iter;
+      queue = g_queue_new ();
+      g_hash_table_insert (priv->folks_individual_cache, individual, queue);
     }
 
-  g_free (str);
-
-  return fg->found;
+  g_queue_push_tail (queue, gtk_tree_iter_copy (iter));
 }
 
 static void
@@ -216,19 +218,14 @@ individual_store_get_group (EmpathyIndividualStore *self,
   GtkTreeModel *model;
   GtkTreeIter iter_group;
   GtkTreeIter iter_separator;
-  FindGroup fg;
+  GtkTreeIter *iter;
 
   priv = GET_PRIV (self);
 
-  memset (&fg, 0, sizeof (fg));
-
-  fg.name = name;
-
   model = GTK_TREE_MODEL (self);
-  gtk_tree_model_foreach (model,
-      (GtkTreeModelForeachFunc) individual_store_get_group_foreach, &fg);
+  iter = g_hash_table_lookup (priv->empathy_group_cache, name);
 
-  if (!fg.found)
+  if (iter == NULL)
     {
       if (created)
         *created = TRUE;
@@ -243,6 +240,9 @@ individual_store_get_group (EmpathyIndividualStore *self,
           EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, is_fake_group,
           -1);
 
+      g_hash_table_insert (priv->empathy_group_cache, g_strdup (name),
+          gtk_tree_iter_copy (&iter_group));
+
       if (iter_group_to_set)
         *iter_group_to_set = iter_group;
 
@@ -260,9 +260,9 @@ individual_store_get_group (EmpathyIndividualStore *self,
         *created = FALSE;
 
       if (iter_group_to_set)
-        *iter_group_to_set = fg.iter;
+        *iter_group_to_set = *iter;
 
-      iter_separator = fg.iter;
+      iter_separator = *iter;
 
       if (gtk_tree_model_iter_next (model, &iter_separator))
         {
@@ -277,51 +277,41 @@ individual_store_get_group (EmpathyIndividualStore *self,
     }
 }
 
-static gboolean
-individual_store_find_contact_foreach (GtkTreeModel *model,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    FindContact *fc)
-{
-  FolksIndividual *individual;
-
-  gtk_tree_model_get (model, iter,
-      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual, -1);
-
-  if (individual == fc->individual)
-    {
-      fc->found = TRUE;
-      fc->iters = g_list_append (fc->iters, gtk_tree_iter_copy (iter));
-    }
-
-  tp_clear_object (&individual);
-
-  return FALSE;
-}
-
 static GList *
 individual_store_find_contact (EmpathyIndividualStore *self,
     FolksIndividual *individual)
 {
   EmpathyIndividualStorePriv *priv;
-  GtkTreeModel *model;
-  GList *l = NULL;
-  FindContact fc;
+  GQueue *queue;
+  GList *l, *iters = NULL;
 
   priv = GET_PRIV (self);
 
-  memset (&fc, 0, sizeof (fc));
+  queue = g_hash_table_lookup (priv->folks_individual_cache, individual);
+  if (queue == NULL)
+    return NULL;
 
-  fc.individual = individual;
+  for (l = g_queue_peek_tail_link (queue); l != NULL; l = l->prev)
+    iters = g_list_prepend (iters, gtk_tree_iter_copy (l->data));
 
-  model = GTK_TREE_MODEL (self);
-  gtk_tree_model_foreach (model,
-      (GtkTreeModelForeachFunc) individual_store_find_contact_foreach, &fc);
+  return iters;
+}
+
+/* Drops the avatar @individual is waiting for, once it is superseded or
+ * its rows went away */
+static void
+individual_store_cancel_avatar_load (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
+  GCancellable *cancellable;
 
-  if (fc.found)
-    l = fc.iters;
+  cancellable = g_hash_table_lookup (priv->avatar_cancellables, individual);
+  if (cancellable == NULL)
+    return;
 
-  return l;
+  g_cancellable_cancel (cancellable);
+  g_hash_table_remove (priv->avatar_cancellables, individual);
 }
 
 static void
@@ -330,18 +320,26 @@ individual_store_remove_individual (EmpathyIndividualStore *self,
 {
   EmpathyIndividualStorePriv *priv;
   GtkTreeModel *model;
-  GList *iters, *l;
+  GQueue *queue;
+  GList *l;
 
   priv = GET_PRIV (self);
 
-  iters = individual_store_find_contact (self, individual);
-  if (iters == NULL)
+  individual_store_cancel_avatar_load (self, individual);
+
+  queue = g_hash_table_lookup (priv->folks_individual_cache, individual);
+  if (queue == NULL)
     return;
 
+  /* Drop the cached iters before the rows they point to go away. The rows
+   * hold the only reference the store has on the individual. */
+  g_hash_table_steal (priv->folks_individual_cache, individual);
+  g_object_ref (individual);
+
   /* Clean up model */
   model = GTK_TREE_MODEL (self);
 
-  for (l = iters; l; l = l->next)
+  for (l = queue->head; l; l = l->next)
     {
       GtkTreeIter parent;
 
@@ -352,6 +350,13 @@ individual_store_remove_individual (EmpathyIndividualStore *self,
       if (gtk_tree_model_iter_parent (model, &parent, l->data) &&
           gtk_tree_model_iter_n_children (model, &parent) <= 2)
         {
+          gchar *group;
+
+          gtk_tree_model_get (model, &parent,
+              EMPATHY_INDIVIDUAL_STORE_COL_NAME, &group, -1);
+          g_hash_table_remove (priv->empathy_group_cache, group);
+          g_free (group);
+
           gtk_tree_store_remove (GTK_TREE_STORE (self), &parent);
         }
       else
@@ -360,8 +365,10 @@ individual_store_remove_individual (EmpathyIndividualStore *self,
         }
     }
 
-  g_list_foreach (iters, (GFunc) gtk_tree_iter_free, NULL);
-  g_list_free (iters);
+  individual_store_free_iters (queue);
+
+  g_signal_emit (self, signals[INDIVIDUAL_REMOVED], 0, individual);
+  g_object_unref (individual);
 }
 
 static void
@@ -414,8 +421,7 @@ individual_store_add_individual (EmpathyIndividualStore *self,
               &iter_group, NULL, NULL, TRUE);
         }
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, parent,
-          individual);
+      add_individual_to_store (self, &iter, parent, individual);
     }
 
   g_free (protocol_name);
@@ -428,8 +434,7 @@ individual_store_add_individual (EmpathyIndividualStore *self,
       individual_store_get_group (self, l->data, &iter_group, NULL, NULL,
           FALSE);
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, &iter_group,
-          individual);
+      add_individual_to_store (self, &iter, &iter_group, individual);
     }
   g_list_free (groups);
   if (group_set != NULL)
@@ -444,8 +449,7 @@ individual_store_add_individual (EmpathyIndividualStore *self,
       individual_store_get_group (self, EMPATHY_INDIVIDUAL_STORE_FAVORITE,
           &iter_group, NULL, NULL, TRUE);
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, &iter_group,
-          individual);
+      add_individual_to_store (self, &iter, &iter_group, individual);
     }
 
   individual_store_contact_update (self, individual);
@@ -600,7 +604,8 @@ individual_avatar_pixbuf_received_cb (FolksIndividual *individual,
           error->message);
       g_clear_error (&error);
     }
-  else if (data->store != NULL)
+  else if (data->store != NULL &&
+      !g_cancellable_is_cancelled (data->cancellable))
     {
       GList *iters, *l;
 
@@ -620,8 +625,12 @@ individual_avatar_pixbuf_received_cb (FolksIndividual *individual,
 
       g_object_remove_weak_pointer (G_OBJECT (data->store),
           (gpointer *) &data->store);
-      priv->avatar_cancellables = g_list_remove (priv->avatar_cancellables,
-          data->cancellable);
+
+      /* unless a newer load superseded this one */
+      if (!priv->dispose_has_run &&
+          g_hash_table_lookup (priv->avatar_cancellables, individual) ==
+              data->cancellable)
+        g_hash_table_remove (priv->avatar_cancellables, individual);
     }
 
   g_object_unref (data->cancellable);
@@ -719,15 +728,17 @@ individual_store_contact_update (EmpathyIndividualStore *self,
       show_avatar = TRUE;
     }
 
-  /* Load the avatar asynchronously */
+  /* Load the avatar asynchronously, instead of the one still pending */
+  individual_store_cancel_avatar_load (self, individual);
+
   load_avatar_data = g_slice_new (LoadAvatarData);
   load_avatar_data->store = self;
   g_object_add_weak_pointer (G_OBJECT (self),
       (gpointer *) &load_avatar_data->store);
   load_avatar_data->cancellable = g_cancellable_new ();
 
-  priv->avatar_cancellables = g_list_prepend (priv->avatar_cancellables,
-      load_avatar_data->cancellable);
+  g_hash_table_insert (priv->avatar_cancellables, g_object_ref (individual),
+      g_object_ref (load_avatar_data->cancellable));
   empathy_pixbuf_avatar_from_individual_scaled_async (individual, 32, 32,
       load_avatar_data->cancellable,
       (GAsyncReadyCallback) individual_avatar_pixbuf_received_cb,
@@ -785,15 +796,104 @@ individual_store_contact_update (EmpathyIndividualStore *self,
   g_list_free (iters);
 }
 
+static void
+individual_store_apply_sort (EmpathyIndividualStore *self)
+{
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
+
+  switch (priv->sort_criterium)
+    {
+    case EMPATHY_INDIVIDUAL_STORE_SORT_STATE:
+      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+          EMPATHY_INDIVIDUAL_STORE_COL_STATUS, GTK_SORT_ASCENDING);
+      break;
+
+    case EMPATHY_INDIVIDUAL_STORE_SORT_NAME:
+      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, GTK_SORT_ASCENDING);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static gboolean
+individual_store_update_idle_cb (EmpathyIndividualStore *self)
+{
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
+  GHashTable *pending;
+  GHashTableIter iter;
+  gpointer individual;
+  gboolean detach_sort;
+
+  priv->update_idle_id = 0;
+
+  /* Updates queued while this pass runs go to a fresh set and get their own
+   * pass */
+  pending = priv->pending_updates;
+  priv->pending_updates = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+
+  detach_sort = g_hash_table_size (pending) > UPDATE_DETACH_SORT_THRESHOLD;
+
+  DEBUG ("Applying %u queued individual updates%s",
+      g_hash_table_size (pending), detach_sort ? ", sort detached" : "");
+
+  if (detach_sort)
+    {
+      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+          GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+    }
+
+  g_hash_table_iter_init (&iter, pending);
+  while (g_hash_table_iter_next (&iter, &individual, NULL))
+    individual_store_contact_update (self, individual);
+
+  if (detach_sort)
+    individual_store_apply_sort (self);
+
+  g_hash_table_destroy (pending);
+
+  return FALSE;
+}
+
+static void
+individual_store_queue_update (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
+
+  priv->n_updates_queued++;
+
+  if (g_hash_table_lookup_extended (priv->pending_updates, individual,
+          NULL, NULL))
+    {
+      priv->n_updates_coalesced++;
+      return;
+    }
+
+  g_hash_table_insert (priv->pending_updates, g_object_ref (individual),
+      NULL);
+
+  /* Run before GTK+ resizes and redraws, so each frame sees every update
+   * received since the previous one */
+  if (priv->update_idle_id == 0)
+    {
+      priv->update_idle_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+          (GSourceFunc) individual_store_update_idle_cb, self, NULL);
+    }
+}
+
 static void
 individual_store_individual_updated_cb (FolksIndividual *individual,
     GParamSpec *param,
     EmpathyIndividualStore *self)
 {
-  DEBUG ("Individual'%s' updated, checking roster is in sync...",
+  DEBUG ("Individual'%s' updated, queueing roster sync...",
       folks_individual_get_alias (individual));
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -803,14 +903,14 @@ individual_store_contact_updated_cb (EmpathyContact *contact,
 {
   FolksIndividual *individual;
 
-  DEBUG ("Contact '%s' updated, checking roster is in sync...",
+  DEBUG ("Contact '%s' updated, queueing roster sync...",
       empathy_contact_get_alias (contact));
 
   individual = g_object_get_data (G_OBJECT (contact), "individual");
   if (individual == NULL)
     return;
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -904,6 +1004,11 @@ individual_store_remove_individual_and_disconnect (
     EmpathyIndividualStore *self,
     FolksIndividual *individual)
 {
+  EmpathyIndividualStorePriv *priv = GET_PRIV (self);
+
+  /* A pending update would add the individual back */
+  g_hash_table_remove (priv->pending_updates, individual);
+
   individual_store_disconnect_individual (self, individual);
   individual_store_remove_individual (self, individual);
 }
@@ -1053,19 +1158,16 @@ static void
 individual_store_dispose (GObject *object)
 {
   EmpathyIndividualStorePriv *priv = GET_PRIV (object);
-  GList *individuals, *l;
+  GList *individuals, *cancellables, *l;
 
   if (priv->dispose_has_run)
     return;
   priv->dispose_has_run = TRUE;
 
   /* Cancel any pending avatar load operations */
-  for (l = priv->avatar_cancellables; l != NULL; l = l->next)
-    {
-      /* The cancellables are freed in individual_avatar_pixbuf_received_cb() */
-      g_cancellable_cancel (G_CANCELLABLE (l->data));
-    }
-  g_list_free (priv->avatar_cancellables);
+  cancellables = g_hash_table_get_values (priv->avatar_cancellables);
+  g_list_foreach (cancellables, (GFunc) g_cancellable_cancel, NULL);
+  g_list_free (cancellables);
 
   individuals = empathy_individual_manager_get_members (priv->manager);
   for (l = individuals; l; l = l->next)
@@ -1095,7 +1197,17 @@ individual_store_dispose (GObject *object)
       g_source_remove (priv->setup_idle_id);
     }
 
+  if (priv->update_idle_id != 0)
+    {
+      g_source_remove (priv->update_idle_id);
+    }
+
+  g_hash_table_destroy (priv->pending_updates);
+
   g_hash_table_destroy (priv->status_icons);
+  g_hash_table_destroy (priv->folks_individual_cache);
+  g_hash_table_destroy (priv->empathy_group_cache);
+  g_hash_table_destroy (priv->avatar_cancellables);
   G_OBJECT_CLASS (empathy_individual_store_parent_class)->dispose (object);
 }
 
@@ -1226,6 +1338,16 @@ empathy_individual_store_class_init (EmpathyIndividualStoreClass *klass)
           EMPATHY_TYPE_INDIVIDUAL_STORE_SORT,
           EMPATHY_INDIVIDUAL_STORE_SORT_NAME, G_PARAM_READWRITE));
 
+  /* The row-deleted signals don't tell which individual went away */
+  signals[INDIVIDUAL_REMOVED] =
+      g_signal_new ("individual-removed",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0,
+      NULL, NULL,
+      g_cclosure_marshal_VOID__OBJECT,
+      G_TYPE_NONE, 1, FOLKS_TYPE_INDIVIDUAL);
+
   g_type_class_add_private (object_class,
       sizeof (EmpathyIndividualStorePriv));
 }
@@ -1536,6 +1658,14 @@ empathy_individual_store_init (EmpathyIndividualStore *self)
       (GSourceFunc) individual_store_inhibit_active_cb, self);
   priv->status_icons =
       g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  priv->folks_individual_cache = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) individual_store_free_iters);
+  priv->empathy_group_cache = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+  priv->pending_updates = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+  priv->avatar_cancellables = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, g_object_unref);
   individual_store_setup (self);
 }
 
@@ -1706,6 +1836,8 @@ empathy_individual_store_set_show_groups (EmpathyIndividualStore *self,
        * added twice */
       GList *contacts;
 
+      g_hash_table_remove_all (priv->folks_individual_cache);
+      g_hash_table_remove_all (priv->empathy_group_cache);
       gtk_tree_store_clear (GTK_TREE_STORE (self));
       contacts = empathy_individual_manager_get_members (priv->manager);
 
@@ -1776,23 +1908,37 @@ empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
 
   priv->sort_criterium = sort_criterium;
 
-  switch (sort_criterium)
-    {
-    case EMPATHY_INDIVIDUAL_STORE_SORT_STATE:
-      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
-          EMPATHY_INDIVIDUAL_STORE_COL_STATUS, GTK_SORT_ASCENDING);
-      break;
+  individual_store_apply_sort (self);
 
-    case EMPATHY_INDIVIDUAL_STORE_SORT_NAME:
-      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
-          EMPATHY_INDIVIDUAL_STORE_COL_NAME, GTK_SORT_ASCENDING);
-      break;
+  g_object_notify (G_OBJECT (self), "sort-criterium");
+}
 
-    default:
-      g_assert_not_reached ();
-    }
+/**
+ * empathy_individual_store_get_update_counters:
+ * @self: an #EmpathyIndividualStore
+ * @n_queued: return location for the number of individual updates received,
+ *   or %NULL
+ * @n_coalesced: return location for the number of those updates which were
+ *   merged into an update already waiting to be applied, or %NULL
+ *
+ * Retrieves statistics about the batching of contact list updates.
+ */
+void
+empathy_individual_store_get_update_counters (EmpathyIndividualStore *self,
+    guint *n_queued,
+    guint *n_coalesced)
+{
+  EmpathyIndividualStorePriv *priv;
 
-  g_object_notify (G_OBJECT (self), "sort-criterium");
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+
+  priv = GET_PRIV (self);
+
+  if (n_queued != NULL)
+    *n_queued = priv->n_updates_queued;
+
+  if (n_coalesced != NULL)
+    *n_coalesced = priv->n_updates_coalesced;
 }
 
 gboolean
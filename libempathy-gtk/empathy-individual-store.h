@@ -123,6 +123,11 @@ void empathy_individual_store_set_sort_criterium (
     EmpathyIndividualStore *store,
     EmpathyIndividualStoreSort sort_criterium);
 
+void empathy_individual_store_get_update_counters (
+    EmpathyIndividualStore *store,
+    guint *n_queued,
+    guint *n_coalesced);
+
 gboolean empathy_individual_store_row_separator_func (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer data);
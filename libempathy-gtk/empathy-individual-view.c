@@ -78,6 +78,17 @@ typedef struct
   GtkTreeModelFilter *filter;
   GtkWidget *search_widget;
 
+  /* FolksIndividual (owned) -> itself, for the individuals which didn't
+   * match the current search text. The previous set is only available while
+   * refiltering for a text which narrows the previous one. */
+  GHashTable *search_rejected;
+  GHashTable *search_rejected_previous;
+
+  /* owned string (group name) -> set of reffed FolksIndividuals, the members
+   * of the group which are currently visible, kept up to date from the
+   * store's signals. A group row is visible iff its set is not empty. */
+  GHashTable *group_visible_members;
+
   guint expand_groups_idle_handler;
   /* owned string (group name) -> bool (whether to expand/contract) */
   GHashTable *expand_groups;
@@ -156,6 +167,14 @@ static guint signals[LAST_SIGNAL];
 G_DEFINE_TYPE (EmpathyIndividualView, empathy_individual_view,
     GTK_TYPE_TREE_VIEW);
 
+/* prototypes to break cycles */
+static void individual_view_refilter (EmpathyIndividualView *view);
+static gboolean individual_view_is_visible_individual (
+    EmpathyIndividualView *self,
+    FolksIndividual *individual,
+    gboolean is_online,
+    gboolean is_searching);
+
 static void
 individual_view_tooltip_destroy_cb (GtkWidget *widget,
     EmpathyIndividualView *view)
@@ -1296,7 +1315,22 @@ individual_view_search_text_notify_cb (EmpathyLiveSearch *search,
   GtkTreeIter iter;
   gboolean set_cursor = FALSE;
 
-  gtk_tree_model_filter_refilter (priv->filter);
+  /* When the new text narrows the previous one, individuals which were
+   * rejected don't need to be matched again */
+  if (empathy_live_search_is_narrowing (search))
+    {
+      priv->search_rejected_previous = priv->search_rejected;
+      priv->search_rejected = g_hash_table_new_full (NULL, NULL,
+          g_object_unref, NULL);
+    }
+  else
+    {
+      g_hash_table_remove_all (priv->search_rejected);
+    }
+
+  individual_view_refilter (view);
+
+  tp_clear_pointer (&priv->search_rejected_previous, g_hash_table_unref);
 
   /* Set cursor on the first contact. If it is already set on a group,
    * set it on its first child contact. Note that first child of a group
@@ -1392,6 +1426,8 @@ individual_view_search_hide_cb (EmpathyLiveSearch *search,
   GtkTreeIter iter;
   gboolean valid = FALSE;
 
+  g_hash_table_remove_all (priv->search_rejected);
+
   /* block expand or collapse handlers, they would write the
    * expand or collapsed setting to file otherwise */
   g_signal_handlers_block_by_func (view,
@@ -1594,35 +1630,141 @@ individual_view_row_has_child_toggled_cb (GtkTreeModel *model,
   g_free (name);
 }
 
-/* FIXME: This is a workaround for bgo#621076 */
+static gboolean
+individual_view_group_is_visible (EmpathyIndividualView *view,
+    const gchar *group)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  GHashTable *members;
+
+  members = g_hash_table_lookup (priv->group_visible_members, group);
+
+  return members != NULL && g_hash_table_size (members) > 0;
+}
+
+/* Let the filter re-evaluate the group row, whose visibility depends on its
+ * members rather than on its own columns. The filter doesn't do it when a
+ * member is inserted, changed or removed: bgo#621076. */
+static void
+individual_view_group_visibility_changed (GtkTreeModel *model,
+    GtkTreeIter *group_iter)
+{
+  GtkTreePath *path;
+
+  path = gtk_tree_model_get_path (model, group_iter);
+  gtk_tree_model_row_changed (model, path, group_iter);
+  gtk_tree_path_free (path);
+}
+
+static gboolean
+individual_view_is_searching (EmpathyIndividualView *view)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+
+  return priv->search_widget != NULL &&
+      gtk_widget_get_visible (priv->search_widget);
+}
+
+/* Adds or removes the individual of the member row @iter from the visible
+ * members of its group. Returns %TRUE if the group became visible or hidden
+ * because of it. */
+static gboolean
+individual_view_update_member (EmpathyIndividualView *view,
+    GtkTreeModel *model,
+    GtkTreeIter *group_iter,
+    GtkTreeIter *iter,
+    gboolean is_searching)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  FolksIndividual *individual;
+  GHashTable *members;
+  gchar *group;
+  gboolean is_online, visible, was_visible;
+
+  gtk_tree_model_get (model, iter,
+      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_ONLINE, &is_online,
+      -1);
+
+  /* A separator, or a row not filled in yet */
+  if (individual == NULL)
+    return FALSE;
+
+  visible = individual_view_is_visible_individual (view, individual,
+      is_online, is_searching);
+
+  gtk_tree_model_get (model, group_iter,
+      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &group, -1);
+
+  members = g_hash_table_lookup (priv->group_visible_members, group);
+  if (members == NULL && visible)
+    {
+      members = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+      g_hash_table_insert (priv->group_visible_members, group, members);
+      group = NULL;
+    }
+
+  g_free (group);
+
+  if (members == NULL)
+    {
+      g_object_unref (individual);
+      return FALSE;
+    }
+
+  was_visible = g_hash_table_size (members) > 0;
+
+  if (!visible)
+    g_hash_table_remove (members, individual);
+  else if (g_hash_table_lookup (members, individual) == NULL)
+    g_hash_table_insert (members, g_object_ref (individual), individual);
+
+  g_object_unref (individual);
+
+  return was_visible != (g_hash_table_size (members) > 0);
+}
+
+/* Finds the visible members of each group again, when what makes an
+ * individual visible changed. The filter needs to be refiltered then. */
 static void
-individual_view_verify_group_visibility (EmpathyIndividualView *view,
-    GtkTreePath *path)
+individual_view_group_members_rebuild (EmpathyIndividualView *view)
 {
   EmpathyIndividualViewPriv *priv = GET_PRIV (view);
   GtkTreeModel *model;
-  GtkTreePath *parent_path;
-  GtkTreeIter parent_iter;
+  GtkTreeIter group_iter, iter;
+  gboolean is_searching;
+  gboolean valid;
 
-  if (gtk_tree_path_get_depth (path) < 2)
-    return;
+  g_hash_table_remove_all (priv->group_visible_members);
 
-  /* A group row is visible if and only if at least one if its child is visible.
-   * So when a row is inserted/deleted/changed in the base model, that could
-   * modify the visibility of its parent in the filter model.
-  */
+  if (priv->store == NULL)
+    return;
 
   model = GTK_TREE_MODEL (priv->store);
-  parent_path = gtk_tree_path_copy (path);
-  gtk_tree_path_up (parent_path);
-  if (gtk_tree_model_get_iter (model, &parent_iter, parent_path))
+  is_searching = individual_view_is_searching (view);
+
+  for (valid = gtk_tree_model_get_iter_first (model, &group_iter);
+       valid; valid = gtk_tree_model_iter_next (model, &group_iter))
     {
-      /* This tells the filter to verify the visibility of that row, and
-       * show/hide it if necessary */
-      gtk_tree_model_row_changed (GTK_TREE_MODEL (priv->store),
-              parent_path, &parent_iter);
+      gboolean child_valid;
+
+      for (child_valid = gtk_tree_model_iter_children (model, &iter,
+              &group_iter);
+           child_valid; child_valid = gtk_tree_model_iter_next (model, &iter))
+        {
+          individual_view_update_member (view, model, &group_iter, &iter,
+              is_searching);
+        }
     }
-  gtk_tree_path_free (parent_path);
+}
+
+static void
+individual_view_refilter (EmpathyIndividualView *view)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+
+  individual_view_group_members_rebuild (view);
+  gtk_tree_model_filter_refilter (priv->filter);
 }
 
 static void
@@ -1631,7 +1773,15 @@ individual_view_store_row_changed_cb (GtkTreeModel *model,
   GtkTreeIter *iter,
   EmpathyIndividualView *view)
 {
-  individual_view_verify_group_visibility (view, path);
+  GtkTreeIter group_iter;
+
+  /* Only the members of a group make it visible */
+  if (!gtk_tree_model_iter_parent (model, &group_iter, iter))
+    return;
+
+  if (individual_view_update_member (view, model, &group_iter, iter,
+          individual_view_is_searching (view)))
+    individual_view_group_visibility_changed (model, &group_iter);
 }
 
 static void
@@ -1639,44 +1789,161 @@ individual_view_store_row_deleted_cb (GtkTreeModel *model,
   GtkTreePath *path,
   EmpathyIndividualView *view)
 {
-  individual_view_verify_group_visibility (view, path);
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+
+  /* The members of the groups are forgotten in
+   * individual_view_store_individual_removed_cb(), but clearing the store
+   * doesn't tell about them */
+  if (gtk_tree_model_iter_n_children (model, NULL) == 0)
+    g_hash_table_remove_all (priv->group_visible_members);
 }
 
-static gboolean
-individual_view_is_visible_individual (EmpathyIndividualView *self,
-    FolksIndividual *individual,
-    gboolean is_online,
-    gboolean is_searching)
+static void
+individual_view_store_individual_removed_cb (EmpathyIndividualStore *store,
+  FolksIndividual *individual,
+  EmpathyIndividualView *view)
 {
-  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
-  EmpathyLiveSearch *live = EMPATHY_LIVE_SEARCH (priv->search_widget);
-  const gchar *str;
-  GList *personas, *l;
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  GtkTreeModel *model = GTK_TREE_MODEL (store);
+  GHashTable *emptied = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  GtkTreeIter group_iter;
+  gboolean valid;
 
-  /* We're only giving the visibility wrt filtering here, not things like
-   * presence. */
-  if (priv->show_untrusted == FALSE &&
-      folks_individual_get_trust_level (individual) == FOLKS_TRUST_LEVEL_NONE)
+  g_hash_table_iter_init (&iter, priv->group_visible_members);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      return FALSE;
+      GHashTable *members = value;
+
+      if (!g_hash_table_remove (members, individual) ||
+          g_hash_table_size (members) > 0)
+        continue;
+
+      if (emptied == NULL)
+        emptied = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+            NULL);
+
+      g_hash_table_insert (emptied, g_strdup (key), GINT_TO_POINTER (TRUE));
+      g_hash_table_iter_remove (&iter);
     }
 
-  if (is_searching == FALSE)
-    return (priv->show_offline || is_online);
+  if (emptied == NULL)
+    return;
 
-  /* check alias name */
-  str = folks_individual_get_alias (individual);
+  /* Hide the groups left with no visible member, unless they are gone */
+  for (valid = gtk_tree_model_get_iter_first (model, &group_iter);
+       valid; valid = gtk_tree_model_iter_next (model, &group_iter))
+    {
+      gboolean is_group;
+      gchar *group;
 
-  if (empathy_live_search_match (live, str))
-    return TRUE;
+      gtk_tree_model_get (model, &group_iter,
+          EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, &is_group,
+          EMPATHY_INDIVIDUAL_STORE_COL_NAME, &group,
+          -1);
+
+      if (is_group && g_hash_table_lookup (emptied, group) != NULL)
+        individual_view_group_visibility_changed (model, &group_iter);
+
+      g_free (group);
+    }
+
+  g_hash_table_destroy (emptied);
+}
+
+/* Words of the strings the live search matches an individual against,
+ * shared by all views and dropped when the alias or the personas change */
+typedef struct
+{
+  GPtrArray *alias_words;
+  /* GPtrArray of words for each TpfPersona's display id */
+  GPtrArray *id_words;
+} IndividualSearchKeys;
+
+static GQuark
+individual_search_keys_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-individual-search-keys");
+
+  return quark;
+}
+
+static void
+individual_search_keys_free (IndividualSearchKeys *keys)
+{
+  if (keys->alias_words != NULL)
+    g_ptr_array_unref (keys->alias_words);
+  g_ptr_array_unref (keys->id_words);
+  g_slice_free (IndividualSearchKeys, keys);
+}
+
+static void individual_search_keys_alias_changed_cb (FolksIndividual *individual,
+    GParamSpec *pspec,
+    gpointer user_data);
+static void individual_search_keys_personas_changed_cb (
+    FolksIndividual *individual,
+    GList *added,
+    GList *removed,
+    gpointer user_data);
+
+static void
+individual_search_keys_invalidate (FolksIndividual *individual)
+{
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_search_keys_alias_changed_cb, NULL);
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_search_keys_personas_changed_cb, NULL);
+
+  g_object_set_qdata (G_OBJECT (individual), individual_search_keys_quark (),
+      NULL);
+}
+
+static void
+individual_search_keys_alias_changed_cb (FolksIndividual *individual,
+    GParamSpec *pspec,
+    gpointer user_data)
+{
+  individual_search_keys_invalidate (individual);
+}
+
+static void
+individual_search_keys_personas_changed_cb (FolksIndividual *individual,
+    GList *added,
+    GList *removed,
+    gpointer user_data)
+{
+  individual_search_keys_invalidate (individual);
+}
+
+static IndividualSearchKeys *
+individual_search_keys_get (FolksIndividual *individual)
+{
+  IndividualSearchKeys *keys;
+  GList *personas, *l;
+
+  keys = g_object_get_qdata (G_OBJECT (individual),
+      individual_search_keys_quark ());
+  if (keys != NULL)
+    return keys;
+
+  keys = g_slice_new0 (IndividualSearchKeys);
+  keys->alias_words = empathy_live_search_strip_utf8_string (
+      folks_individual_get_alias (individual));
+  keys->id_words = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_ptr_array_unref);
 
-  /* check contact id, remove the @server.com part */
+  /* contact ids, without the @server.com part */
   personas = folks_individual_get_personas (individual);
   for (l = personas; l; l = l->next)
     {
+      const gchar *str;
       const gchar *p;
       gchar *dup_str = NULL;
-      gboolean visible;
+      GPtrArray *words;
 
       if (!TPF_IS_PERSONA (l->data))
         continue;
@@ -1686,9 +1953,45 @@ individual_view_is_visible_individual (EmpathyIndividualView *self,
       if (p != NULL)
         str = dup_str = g_strndup (str, p - str);
 
-      visible = empathy_live_search_match (live, str);
+      words = empathy_live_search_strip_utf8_string (str);
+      if (words != NULL)
+        g_ptr_array_add (keys->id_words, words);
+
       g_free (dup_str);
-      if (visible)
+    }
+
+  g_object_set_qdata_full (G_OBJECT (individual),
+      individual_search_keys_quark (), keys,
+      (GDestroyNotify) individual_search_keys_free);
+
+  g_signal_connect (individual, "notify::alias",
+      G_CALLBACK (individual_search_keys_alias_changed_cb), NULL);
+  g_signal_connect (individual, "personas-changed",
+      G_CALLBACK (individual_search_keys_personas_changed_cb), NULL);
+
+  return keys;
+}
+
+static gboolean
+individual_view_match_individual (EmpathyIndividualView *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  EmpathyLiveSearch *live = EMPATHY_LIVE_SEARCH (priv->search_widget);
+  IndividualSearchKeys *keys;
+  guint i;
+
+  keys = individual_search_keys_get (individual);
+
+  /* check alias name */
+  if (empathy_live_search_match_words (live, keys->alias_words))
+    return TRUE;
+
+  /* check contact ids */
+  for (i = 0; i < keys->id_words->len; i++)
+    {
+      if (empathy_live_search_match_words (live,
+              g_ptr_array_index (keys->id_words, i)))
         return TRUE;
     }
 
@@ -1698,22 +2001,52 @@ individual_view_is_visible_individual (EmpathyIndividualView *self,
   return FALSE;
 }
 
+static gboolean
+individual_view_is_visible_individual (EmpathyIndividualView *self,
+    FolksIndividual *individual,
+    gboolean is_online,
+    gboolean is_searching)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  gboolean visible;
+
+  /* We're only giving the visibility wrt filtering here, not things like
+   * presence. */
+  if (priv->show_untrusted == FALSE &&
+      folks_individual_get_trust_level (individual) == FOLKS_TRUST_LEVEL_NONE)
+    {
+      return FALSE;
+    }
+
+  if (is_searching == FALSE)
+    return (priv->show_offline || is_online);
+
+  if (priv->search_rejected_previous != NULL &&
+      g_hash_table_lookup (priv->search_rejected_previous, individual) != NULL)
+    visible = FALSE;
+  else
+    visible = individual_view_match_individual (self, individual);
+
+  if (visible)
+    g_hash_table_remove (priv->search_rejected, individual);
+  else
+    g_hash_table_insert (priv->search_rejected, g_object_ref (individual),
+        individual);
+
+  return visible;
+}
+
 static gboolean
 individual_view_filter_visible_func (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer user_data)
 {
   EmpathyIndividualView *self = EMPATHY_INDIVIDUAL_VIEW (user_data);
-  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
   FolksIndividual *individual = NULL;
-  gboolean is_group, is_separator, valid;
-  GtkTreeIter child_iter;
+  gboolean is_group, is_separator;
+  gchar *group;
   gboolean visible, is_online;
-  gboolean is_searching = TRUE;
-
-  if (priv->search_widget == NULL ||
-      !gtk_widget_get_visible (priv->search_widget))
-     is_searching = FALSE;
+  gboolean is_searching = individual_view_is_searching (self);
 
   gtk_tree_model_get (model, iter,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, &is_group,
@@ -1729,14 +2062,6 @@ individual_view_filter_visible_func (GtkTreeModel *model,
 
       g_object_unref (individual);
 
-      /* FIXME: Work around bgo#626552/bgo#621076 */
-      if (visible == TRUE)
-        {
-          GtkTreePath *path = gtk_tree_model_get_path (model, iter);
-          individual_view_verify_group_visibility (self, path);
-          gtk_tree_path_free (path);
-        }
-
       return visible;
     }
 
@@ -1746,28 +2071,14 @@ individual_view_filter_visible_func (GtkTreeModel *model,
   /* Not a contact, not a separator, must be a group */
   g_return_val_if_fail (is_group, FALSE);
 
-  /* only show groups which are not empty */
-  for (valid = gtk_tree_model_iter_children (model, &child_iter, iter);
-       valid; valid = gtk_tree_model_iter_next (model, &child_iter))
-    {
-      gtk_tree_model_get (model, &child_iter,
-        EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual,
-        EMPATHY_INDIVIDUAL_STORE_COL_IS_ONLINE, &is_online,
-        -1);
-
-      if (individual == NULL)
-        continue;
-
-      visible = individual_view_is_visible_individual (self, individual,
-          is_online, is_searching);
-      g_object_unref (individual);
-
-      /* show group if it has at least one visible contact in it */
-      if (visible == TRUE)
-        return TRUE;
-    }
+  /* only show groups which have at least one visible contact in them, as
+   * tracked from the store's signals */
+  gtk_tree_model_get (model, iter,
+      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &group, -1);
+  visible = individual_view_group_is_visible (self, group);
+  g_free (group);
 
-  return FALSE;
+  return visible;
 }
 
 static void
@@ -1960,6 +2271,8 @@ individual_view_finalize (GObject *object)
   if (priv->expand_groups_idle_handler != 0)
     g_source_remove (priv->expand_groups_idle_handler);
   g_hash_table_destroy (priv->expand_groups);
+  g_hash_table_destroy (priv->search_rejected);
+  g_hash_table_destroy (priv->group_visible_members);
 
   G_OBJECT_CLASS (empathy_individual_view_parent_class)->finalize (object);
 }
@@ -2130,6 +2443,10 @@ empathy_individual_view_init (EmpathyIndividualView *view)
 
   priv->expand_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       (GDestroyNotify) g_free, NULL);
+  priv->search_rejected = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+  priv->group_visible_members = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, (GDestroyNotify) g_hash_table_unref);
 
   gtk_tree_view_set_row_separator_func (GTK_TREE_VIEW (view),
       empathy_individual_store_row_separator_func, NULL, NULL);
@@ -2536,7 +2853,7 @@ empathy_individual_view_set_show_offline (EmpathyIndividualView *self,
   priv->show_offline = show_offline;
 
   g_object_notify (G_OBJECT (self), "show-offline");
-  gtk_tree_model_filter_refilter (priv->filter);
+  individual_view_refilter (self);
 }
 
 gboolean
@@ -2560,7 +2877,7 @@ empathy_individual_view_set_show_untrusted (EmpathyIndividualView *self,
   priv->show_untrusted = show_untrusted;
 
   g_object_notify (G_OBJECT (self), "show-untrusted");
-  gtk_tree_model_filter_refilter (priv->filter);
+  individual_view_refilter (self);
 }
 
 EmpathyIndividualStore *
@@ -2589,6 +2906,8 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
           individual_view_store_row_changed_cb, self);
       g_signal_handlers_disconnect_by_func (priv->store,
           individual_view_store_row_deleted_cb, self);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_individual_removed_cb, self);
 
       g_signal_handlers_disconnect_by_func (priv->filter,
           individual_view_row_has_child_toggled_cb, self);
@@ -2598,6 +2917,7 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
 
   tp_clear_object (&priv->filter);
   tp_clear_object (&priv->store);
+  g_hash_table_remove_all (priv->group_visible_members);
 
   /* Set the new store */
   priv->store = store;
@@ -2606,6 +2926,9 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
     {
       g_object_ref (store);
 
+      /* The filter shows the groups with visible members */
+      individual_view_group_members_rebuild (self);
+
       /* Create a new filter */
       priv->filter = GTK_TREE_MODEL_FILTER (gtk_tree_model_filter_new (
           GTK_TREE_MODEL (priv->store), NULL));
@@ -2617,12 +2940,15 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
       gtk_tree_view_set_model (GTK_TREE_VIEW (self),
           GTK_TREE_MODEL (priv->filter));
 
+      /* After the filter's handlers, which ignore the parents */
       tp_g_signal_connect_object (priv->store, "row-changed",
           G_CALLBACK (individual_view_store_row_changed_cb), self, 0);
       tp_g_signal_connect_object (priv->store, "row-inserted",
           G_CALLBACK (individual_view_store_row_changed_cb), self, 0);
       tp_g_signal_connect_object (priv->store, "row-deleted",
           G_CALLBACK (individual_view_store_row_deleted_cb), self, 0);
+      tp_g_signal_connect_object (priv->store, "individual-removed",
+          G_CALLBACK (individual_view_store_individual_removed_cb), self, 0);
     }
 }
 
@@ -42,6 +42,10 @@ typedef struct
   GtkWidget *hook_widget;
 
   GPtrArray *stripped_words;
+
+  /* Text of the previous search, and whether the current text extends it */
+  gchar *previous_text;
+  gboolean narrowing;
 } EmpathyLiveSearchPriv;
 
 enum
@@ -246,6 +250,34 @@ live_search_match_words (const gchar *string,
   return TRUE;
 }
 
+static gboolean
+live_search_match_stripped_words (GPtrArray *words,
+    GPtrArray *prefixes)
+{
+  guint i, j;
+
+  if (prefixes == NULL)
+    return TRUE;
+
+  if (words == NULL)
+    return FALSE;
+
+  /* Each prefix has to be the beginning of at least one of the words */
+  for (i = 0; i < prefixes->len; i++)
+    {
+      const gchar *prefix = g_ptr_array_index (prefixes, i);
+      gboolean found = FALSE;
+
+      for (j = 0; j < words->len && !found; j++)
+        found = g_str_has_prefix (g_ptr_array_index (words, j), prefix);
+
+      if (!found)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 live_search_entry_key_pressed_cb (GtkEntry *entry,
     GdkEventKey *event,
@@ -292,6 +324,13 @@ live_search_text_changed (GtkEntry *entry,
 
   priv->stripped_words = strip_utf8_string (text);
 
+  /* If the new text only appends to the previous one, everything it matches
+   * was already matched by the previous text. */
+  priv->narrowing = !EMP_STR_EMPTY (priv->previous_text) &&
+      g_str_has_prefix (text, priv->previous_text);
+  g_free (priv->previous_text);
+  priv->previous_text = g_strdup (text);
+
   g_object_notify (G_OBJECT (self), "text");
 }
 
@@ -406,6 +445,8 @@ live_search_finalize (GObject *obj)
   if (priv->stripped_words != NULL)
     g_ptr_array_unref (priv->stripped_words);
 
+  g_free (priv->previous_text);
+
   if (G_OBJECT_CLASS (empathy_live_search_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (empathy_live_search_parent_class)->finalize (obj);
 }
@@ -685,3 +726,80 @@ empathy_live_search_match_string (const gchar *string,
   return match;
 }
 
+
+/**
+ * empathy_live_search_strip_utf8_string:
+ * @string: a string to split, must be valid UTF-8.
+ *
+ * Splits @string into words, lower-cased and without accentuation marks, in
+ * the form expected by empathy_live_search_match_words(). This is meant to be
+ * cached by callers matching the same strings over and over.
+ *
+ * Returns: a new #GPtrArray of strings, or %NULL if @string has no word.
+ **/
+GPtrArray *
+empathy_live_search_strip_utf8_string (const gchar *string)
+{
+  return strip_utf8_string (string);
+}
+
+/**
+ * empathy_live_search_match_words:
+ * @self: a #EmpathyLiveSearch
+ * @words: words returned by empathy_live_search_strip_utf8_string(), or %NULL
+ *
+ * Same as empathy_live_search_match(), but on a pre-stripped string.
+ *
+ * Returns: %TRUE if a match is found, %FALSE otherwise.
+ **/
+gboolean
+empathy_live_search_match_words (EmpathyLiveSearch *self,
+    GPtrArray *words)
+{
+  EmpathyLiveSearchPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_LIVE_SEARCH (self), FALSE);
+
+  priv = GET_PRIV (self);
+
+  return live_search_match_stripped_words (words, priv->stripped_words);
+}
+
+/**
+ * empathy_live_search_is_narrowing:
+ * @self: a #EmpathyLiveSearch
+ *
+ * Returns: %TRUE if the current text extends the previous one, in which case
+ * strings not matching the previous text can't match the current one either.
+ **/
+gboolean
+empathy_live_search_is_narrowing (EmpathyLiveSearch *self)
+{
+  EmpathyLiveSearchPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_LIVE_SEARCH (self), FALSE);
+
+  priv = GET_PRIV (self);
+
+  return priv->narrowing;
+}
+
+gboolean
+empathy_live_search_match_string_words (const gchar *string,
+    const gchar *prefix)
+{
+  GPtrArray *words;
+  GPtrArray *prefixes;
+  gboolean match;
+
+  words = strip_utf8_string (string);
+  prefixes = strip_utf8_string (prefix);
+  match = live_search_match_stripped_words (words, prefixes);
+
+  if (words != NULL)
+    g_ptr_array_unref (words);
+  if (prefixes != NULL)
+    g_ptr_array_unref (prefixes);
+
+  return match;
+}
@@ -65,9 +65,16 @@ void empathy_live_search_set_text (EmpathyLiveSearch *self,
 gboolean empathy_live_search_match (EmpathyLiveSearch *self,
     const gchar *string);
 
+GPtrArray *empathy_live_search_strip_utf8_string (const gchar *string);
+gboolean empathy_live_search_match_words (EmpathyLiveSearch *self,
+    GPtrArray *words);
+gboolean empathy_live_search_is_narrowing (EmpathyLiveSearch *self);
+
 /* Made public for unit tests */
 gboolean empathy_live_search_match_string (const gchar *string,
    const gchar *prefix);
+gboolean empathy_live_search_match_string_words (const gchar *string,
+   const gchar *prefix);
 
 G_END_DECLS
 
@@ -35,7 +35,9 @@
 
 #include <libempathy/empathy-chatroom-manager.h>
 #include <libempathy/empathy-chatroom.h>
+#include <libempathy/empathy-log-index.h>
 #include <libempathy/empathy-message.h>
+#include <libempathy/empathy-message-batch.h>
 #include <libempathy/empathy-utils.h>
 #include <libempathy/empathy-time.h>
 
@@ -48,6 +50,27 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_OTHER
 #include <libempathy/empathy-debug.h>
 
+/* Messages appended to a chat view a few at a time, so a busy day of logs
+ * doesn't freeze the window. The first page is rendered right away, the
+ * rest in time-sliced idle batches, or sooner when scrolling reaches the
+ * end of what is rendered. */
+#define LOG_RENDER_FIRST_PAGE 100
+#define LOG_RENDER_SLICE 0.010
+
+typedef void (*LogRenderDoneFunc) (gpointer user_data);
+
+typedef struct {
+	EmpathyChatView   *view;
+	GtkAdjustment     *adjustment;
+	gulong             value_changed_id;
+	/* The messages of the day, and the first one not rendered yet */
+	EmpathyMessageBatch *batch;
+	guint              next;
+	guint              idle_id;
+	LogRenderDoneFunc  done;
+	gpointer           user_data;
+} LogRender;
+
 typedef struct {
 	GtkWidget         *window;
 
@@ -72,6 +95,10 @@ typedef struct {
 	gchar             *last_find;
 
 	TplLogManager     *log_manager;
+	EmpathyLogIndex   *log_index;
+
+	LogRender          render_find;
+	LogRender          render_chats;
 
 	/* Those are only used while waiting for the account chooser to be ready */
 	TpAccount         *selected_account;
@@ -88,6 +115,7 @@ static void     log_window_find_changed_cb                 (GtkTreeSelection *se
 static void     log_window_find_populate                   (EmpathyLogWindow *window,
 							    const gchar      *search_criteria);
 static void     log_window_find_setup                      (EmpathyLogWindow *window);
+static void     log_window_find_rendered_cb                (gpointer          user_data);
 static void     log_window_button_find_clicked_cb          (GtkWidget        *widget,
 							    EmpathyLogWindow *window);
 static void     log_window_entry_find_activate_cb          (GtkWidget        *widget,
@@ -127,6 +155,7 @@ enum {
 	COL_FIND_IS_CHATROOM,
 	COL_FIND_DATE,
 	COL_FIND_DATE_READABLE,
+	COL_FIND_RANK,
 	COL_FIND_COUNT
 };
 
@@ -141,6 +170,168 @@ enum {
 
 static EmpathyLogWindow *log_window = NULL;
 
+static void
+log_render_cancel (LogRender *render)
+{
+	if (render->idle_id != 0) {
+		g_source_remove (render->idle_id);
+		render->idle_id = 0;
+	}
+
+	empathy_message_batch_free (render->batch);
+	render->batch = NULL;
+	render->next = 0;
+}
+
+static gboolean
+log_render_is_pending (LogRender *render)
+{
+	return render->batch != NULL &&
+		render->next < empathy_message_batch_get_length (render->batch);
+}
+
+/* Only the displayed messages become an EmpathyMessage */
+static void
+log_render_append_next (LogRender *render)
+{
+	EmpathyMessage *message;
+
+	message = empathy_message_batch_dup_message (render->batch,
+						     render->next++);
+	empathy_chat_view_append_message (render->view, message);
+	g_object_unref (message);
+}
+
+static void
+log_render_finished (LogRender *render)
+{
+	if (render->idle_id != 0) {
+		g_source_remove (render->idle_id);
+		render->idle_id = 0;
+	}
+
+	/* The displayed messages hold the contacts they need */
+	empathy_message_batch_free (render->batch);
+	render->batch = NULL;
+	render->next = 0;
+
+	/* Turn back on scrolling, which shows the most recent messages */
+	empathy_chat_view_scroll (render->view, TRUE);
+
+	if (render->done != NULL) {
+		render->done (render->user_data);
+	}
+}
+
+/* Renders messages for at most @seconds, or all of them if negative */
+static void
+log_render_batch (LogRender *render,
+		  gdouble    seconds)
+{
+	GTimer *timer;
+
+	if (!log_render_is_pending (render)) {
+		return;
+	}
+
+	timer = g_timer_new ();
+
+	while (log_render_is_pending (render)) {
+		log_render_append_next (render);
+
+		if (seconds >= 0 && g_timer_elapsed (timer, NULL) >= seconds) {
+			break;
+		}
+	}
+
+	g_timer_destroy (timer);
+
+	if (!log_render_is_pending (render)) {
+		log_render_finished (render);
+	}
+}
+
+static gboolean
+log_render_idle_cb (gpointer user_data)
+{
+	LogRender *render = user_data;
+
+	log_render_batch (render, LOG_RENDER_SLICE);
+
+	/* log_render_finished() removed the source once done */
+	return render->idle_id != 0;
+}
+
+static void
+log_render_value_changed_cb (GtkAdjustment *adjustment,
+			     LogRender     *render)
+{
+	gdouble page_size;
+
+	if (!log_render_is_pending (render)) {
+		return;
+	}
+
+	/* Less than a page left below the visible one */
+	page_size = gtk_adjustment_get_page_size (adjustment);
+	if (gtk_adjustment_get_value (adjustment) + 2 * page_size >=
+	    gtk_adjustment_get_upper (adjustment)) {
+		log_render_batch (render, LOG_RENDER_SLICE);
+	}
+}
+
+static void
+log_render_init (LogRender         *render,
+		 EmpathyChatView   *view,
+		 GtkWidget         *scrolled_window,
+		 LogRenderDoneFunc  done,
+		 gpointer           user_data)
+{
+	render->view = view;
+	render->adjustment = gtk_scrolled_window_get_vadjustment (
+		GTK_SCROLLED_WINDOW (scrolled_window));
+	render->value_changed_id = g_signal_connect (render->adjustment,
+		"value-changed", G_CALLBACK (log_render_value_changed_cb),
+		render);
+	render->batch = NULL;
+	render->next = 0;
+	render->done = done;
+	render->user_data = user_data;
+}
+
+static void
+log_render_destroy (LogRender *render)
+{
+	log_render_cancel (render);
+	g_signal_handler_disconnect (render->adjustment,
+				     render->value_changed_id);
+}
+
+/* Takes @entries, rendering the first page of them now */
+static void
+log_render_start (LogRender *render,
+		  GList     *entries)
+{
+	log_render_cancel (render);
+
+	/* The entries are not needed once copied into the batch */
+	render->batch = empathy_message_batch_new (entries);
+	g_list_foreach (entries, (GFunc) g_object_unref, NULL);
+	g_list_free (entries);
+
+	while (log_render_is_pending (render) &&
+	       render->next < LOG_RENDER_FIRST_PAGE) {
+		log_render_append_next (render);
+	}
+
+	if (log_render_is_pending (render)) {
+		render->idle_id = g_idle_add_full (G_PRIORITY_LOW,
+			log_render_idle_cb, render, NULL);
+	} else {
+		log_render_finished (render);
+	}
+}
+
 static void
 account_manager_prepared_cb (GObject *source_object,
 			     GAsyncResult *result,
@@ -235,6 +426,10 @@ empathy_log_window_show (TpAccount  *account,
 
 	log_window = g_new0 (EmpathyLogWindow, 1);
 	log_window->log_manager = tpl_log_manager_dup_singleton ();
+	log_window->log_index = empathy_log_index_dup_singleton ();
+
+	/* Catch up with what was logged since the last search */
+	empathy_log_index_update_async (log_window->log_index, NULL, NULL);
 
 	window = log_window;
 
@@ -293,6 +488,12 @@ empathy_log_window_show (TpAccount  *account,
 			   GTK_WIDGET (window->chatview_chats));
 	gtk_widget_show (GTK_WIDGET (window->chatview_chats));
 
+	log_render_init (&window->render_find, window->chatview_find,
+			 window->scrolledwindow_find,
+			 log_window_find_rendered_cb, window);
+	log_render_init (&window->render_chats, window->chatview_chats,
+			 window->scrolledwindow_chats, NULL, NULL);
+
 	/* Account chooser for chats */
 	window->account_chooser_chats = empathy_account_chooser_new ();
 	account_chooser = EMPATHY_ACCOUNT_CHOOSER (window->account_chooser_chats);
@@ -335,8 +536,12 @@ static void
 log_window_destroy_cb (GtkWidget       *widget,
 		       EmpathyLogWindow *window)
 {
+	log_render_destroy (&window->render_find);
+	log_render_destroy (&window->render_chats);
+
 	g_free (window->last_find);
 	g_object_unref (window->log_manager);
+	g_object_unref (window->log_index);
 	tp_clear_object (&window->selected_account);
 	g_free (window->selected_chat_id);
 
@@ -363,6 +568,35 @@ log_window_entry_find_changed_cb (GtkWidget       *entry,
 	gtk_widget_set_sensitive (window->button_find, is_sensitive);
 }
 
+/* Matches may still be in the messages which are not rendered yet */
+static void
+log_window_find_update_buttons (EmpathyLogWindow *window)
+{
+	gboolean can_do_previous;
+	gboolean can_do_next;
+
+	empathy_chat_view_find_abilities (window->chatview_find,
+			window->last_find,
+			FALSE,
+			&can_do_previous,
+			&can_do_next);
+	gtk_widget_set_sensitive (window->button_previous, can_do_previous);
+	gtk_widget_set_sensitive (window->button_next, can_do_next ||
+			log_render_is_pending (&window->render_find));
+}
+
+static void
+log_window_find_rendered_cb (gpointer user_data)
+{
+	EmpathyLogWindow *window = user_data;
+
+	/* Highlight the messages rendered since the first page too */
+	empathy_chat_view_highlight (window->chatview_find,
+			window->last_find,
+			FALSE);
+	log_window_find_update_buttons (window);
+}
+
 static void
 got_messages_for_date_cb (GObject *manager,
                        GAsyncResult *result,
@@ -370,9 +604,6 @@ got_messages_for_date_cb (GObject *manager,
 {
 	EmpathyLogWindow *window = user_data;
 	GList         *messages;
-	GList         *l;
-	gboolean       can_do_previous;
-	gboolean       can_do_next;
 	GError        *error = NULL;
 
 	if (log_window == NULL)
@@ -388,36 +619,21 @@ got_messages_for_date_cb (GObject *manager,
 			return;
 	}
 
-	for (l = messages; l; l = l->next) {
-			EmpathyMessage *message;
+	/* Only the first page is rendered yet */
+	log_render_start (&window->render_find, messages);
 
-			g_assert (TPL_IS_ENTRY (l->data));
-
-			message = empathy_message_from_tpl_log_entry (l->data);
-			g_object_unref (l->data);
-			empathy_chat_view_append_message (window->chatview_find, message);
-			g_object_unref (message);
+	/* Highlight and find messages, log_window_find_rendered_cb() already
+	 * did the former if everything got rendered */
+	if (log_render_is_pending (&window->render_find)) {
+		empathy_chat_view_highlight (window->chatview_find,
+				window->last_find,
+				FALSE);
 	}
-	g_list_free (messages);
-
-	/* Scroll to the most recent messages */
-	empathy_chat_view_scroll (window->chatview_find, TRUE);
-
-	/* Highlight and find messages */
-	empathy_chat_view_highlight (window->chatview_find,
-			window->last_find,
-			FALSE);
 	empathy_chat_view_find_next (window->chatview_find,
 			window->last_find,
 			TRUE,
 			FALSE);
-	empathy_chat_view_find_abilities (window->chatview_find,
-			window->last_find,
-			FALSE,
-			&can_do_previous,
-			&can_do_next);
-	gtk_widget_set_sensitive (window->button_previous, can_do_previous);
-	gtk_widget_set_sensitive (window->button_next, can_do_next);
+	log_window_find_update_buttons (window);
 	gtk_widget_set_sensitive (window->button_find, FALSE);
 }
 
@@ -461,6 +677,7 @@ log_window_find_changed_cb (GtkTreeSelection *selection,
 		gtk_widget_set_sensitive (window->button_previous, FALSE);
 		gtk_widget_set_sensitive (window->button_next, FALSE);
 
+		log_render_cancel (&window->render_find);
 		empathy_chat_view_clear (window->chatview_find);
 
 		return;
@@ -477,9 +694,10 @@ log_window_find_changed_cb (GtkTreeSelection *selection,
 			    -1);
 
 	/* Clear all current messages shown in the textview */
+	log_render_cancel (&window->render_find);
 	empathy_chat_view_clear (window->chatview_find);
 
-	/* Turn off scrolling temporarily */
+	/* Turn off scrolling until log_render_finished() */
 	empathy_chat_view_scroll (window->chatview_find, FALSE);
 
 	/* Get messages */
@@ -503,6 +721,45 @@ log_window_find_changed_cb (GtkTreeSelection *selection,
 }
 
 
+static void
+log_window_find_add_hit (GtkListStore *store,
+			 TpAccount    *account,
+			 const gchar  *chat_id,
+			 gboolean      is_chatroom,
+			 GDate        *date,
+			 guint         rank)
+{
+	GtkTreeIter  iter;
+	const gchar *account_name;
+	const gchar *account_icon;
+	gchar        date_readable[255];
+	gchar        tmp[255];
+
+	g_date_strftime (date_readable, sizeof (date_readable),
+		EMPATHY_DATE_FORMAT_DISPLAY_SHORT, date);
+
+	g_date_strftime (tmp, sizeof (tmp),
+		"%Y%m%d", date);
+
+	account_name = tp_account_get_display_name (account);
+	account_icon = tp_account_get_icon_name (account);
+
+	gtk_list_store_append (store, &iter);
+	gtk_list_store_set (store, &iter,
+			COL_FIND_ACCOUNT_ICON, account_icon,
+			COL_FIND_ACCOUNT_NAME, account_name,
+			COL_FIND_ACCOUNT, account,
+			COL_FIND_CHAT_NAME, chat_id, /* FIXME */
+			COL_FIND_CHAT_ID, chat_id,
+			COL_FIND_IS_CHATROOM, is_chatroom,
+			COL_FIND_DATE, tmp,
+			COL_FIND_DATE_READABLE, date_readable,
+			COL_FIND_RANK, rank,
+			-1);
+
+	/* FIXME: Update COL_FIND_CHAT_NAME */
+}
+
 static void
 log_manager_searched_new_cb (GObject *manager,
                              GAsyncResult *result,
@@ -510,7 +767,6 @@ log_manager_searched_new_cb (GObject *manager,
 {
 	GList               *hits;
 	GList               *l;
-	GtkTreeIter          iter;
 	GtkListStore        *store = user_data;
 	GError              *error = NULL;
 
@@ -526,10 +782,6 @@ log_manager_searched_new_cb (GObject *manager,
 
 	for (l = hits; l; l = l->next) {
 			TplLogSearchHit *hit;
-			const gchar         *account_name;
-			const gchar         *account_icon;
-			gchar               date_readable[255];
-			gchar               tmp[255];
 
 			hit = l->data;
 
@@ -538,36 +790,79 @@ log_manager_searched_new_cb (GObject *manager,
 					continue;
 			}
 
-			g_date_strftime (date_readable, sizeof (date_readable),
-				EMPATHY_DATE_FORMAT_DISPLAY_SHORT, hit->date);
+			log_window_find_add_hit (store, hit->account, hit->chat_id,
+				hit->is_chatroom, hit->date, 0);
+	}
 
-			g_date_strftime (tmp, sizeof (tmp),
-				"%Y%m%d", hit->date);
+	if (hits != NULL) {
+			tpl_log_manager_search_free (hits);
+	}
+}
 
-			account_name = tp_account_get_display_name (hit->account);
-			account_icon = tp_account_get_icon_name (hit->account);
+static void
+log_window_find_search_logs (EmpathyLogWindow *window,
+			     const gchar      *search_criteria)
+{
+	GtkTreeModel *model;
 
-			gtk_list_store_append (store, &iter);
-			gtk_list_store_set (store, &iter,
-					COL_FIND_ACCOUNT_ICON, account_icon,
-					COL_FIND_ACCOUNT_NAME, account_name,
-					COL_FIND_ACCOUNT, hit->account,
-					COL_FIND_CHAT_NAME, hit->chat_id, /* FIXME */
-					COL_FIND_CHAT_ID, hit->chat_id,
-					COL_FIND_IS_CHATROOM, hit->is_chatroom,
-					COL_FIND_DATE, tmp,
-					COL_FIND_DATE_READABLE, date_readable,
-					-1);
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW (window->treeview_find));
+	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model),
+					      COL_FIND_DATE,
+					      GTK_SORT_ASCENDING);
 
-			/* FIXME: Update COL_FIND_CHAT_NAME */
-			if (hit->is_chatroom) {
-			} else {
-			}
+	tpl_log_manager_search_async (window->log_manager, search_criteria,
+			log_manager_searched_new_cb, (gpointer) model);
+}
+
+static void
+log_index_searched_cb (GObject      *source,
+		       GAsyncResult *result,
+		       gpointer      user_data)
+{
+	gchar        *search_criteria = user_data;
+	GList        *hits;
+	GList        *l;
+	GtkTreeModel *model;
+	GError       *error = NULL;
+	guint         rank = 0;
+
+	if (log_window == NULL) {
+		g_free (search_criteria);
+		return;
 	}
 
-	if (hits != NULL) {
-			tpl_log_manager_search_free (hits);
+	/* A newer search was started */
+	if (tp_strdiff (search_criteria, log_window->last_find)) {
+		g_free (search_criteria);
+		return;
+	}
+
+	if (!empathy_log_index_search_finish (EMPATHY_LOG_INDEX (source),
+		result, &hits, &error)) {
+		DEBUG ("Can't use the log index: %s", error->message);
+		g_error_free (error);
+
+		log_window_find_search_logs (log_window, search_criteria);
+		g_free (search_criteria);
+		return;
 	}
+
+	model = gtk_tree_view_get_model (GTK_TREE_VIEW (log_window->treeview_find));
+
+	/* Most relevant first */
+	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (model),
+					      COL_FIND_RANK,
+					      GTK_SORT_ASCENDING);
+
+	for (l = hits; l; l = l->next) {
+		EmpathyLogIndexHit *hit = l->data;
+
+		log_window_find_add_hit (GTK_LIST_STORE (model), hit->account,
+			hit->chat_id, hit->is_chatroom, hit->date, rank++);
+	}
+
+	empathy_log_index_hits_free (hits);
+	g_free (search_criteria);
 }
 
 static void
@@ -576,14 +871,13 @@ log_window_find_populate (EmpathyLogWindow *window,
 {
 	GtkTreeView        *view;
 	GtkTreeModel       *model;
-	GtkTreeSelection   *selection;
 	GtkListStore       *store;
 
 	view = GTK_TREE_VIEW (window->treeview_find);
 	model = gtk_tree_view_get_model (view);
-	selection = gtk_tree_view_get_selection (view);
 	store = GTK_LIST_STORE (model);
 
+	log_render_cancel (&window->render_find);
 	empathy_chat_view_clear (window->chatview_find);
 
 	gtk_list_store_clear (store);
@@ -593,8 +887,15 @@ log_window_find_populate (EmpathyLogWindow *window,
 		return;
 	}
 
-	tpl_log_manager_search_async (window->log_manager, search_criteria,
-			log_manager_searched_new_cb, (gpointer) store);
+	if (!empathy_log_index_is_ready (window->log_index)) {
+		/* Search the logs themselves until the index is built */
+		log_window_find_search_logs (window, search_criteria);
+		empathy_log_index_update_async (window->log_index, NULL, NULL);
+		return;
+	}
+
+	empathy_log_index_search_async (window->log_index, search_criteria,
+			log_index_searched_cb, g_strdup (search_criteria));
 }
 
 static void
@@ -621,7 +922,8 @@ log_window_find_setup (EmpathyLogWindow *window)
 				    G_TYPE_STRING,          /* chat id */
 				    G_TYPE_BOOLEAN,         /* is chatroom */
 				    G_TYPE_STRING,          /* date */
-				    G_TYPE_STRING);         /* date_readable */
+				    G_TYPE_STRING,          /* date_readable */
+				    G_TYPE_UINT);           /* rank */
 
 	model = GTK_TREE_MODEL (store);
 	sortable = GTK_TREE_SORTABLE (store);
@@ -723,17 +1025,22 @@ log_window_button_next_clicked_cb (GtkWidget       *widget,
 		gboolean can_do_previous;
 		gboolean can_do_next;
 
-		empathy_chat_view_find_next (window->chatview_find,
-					    window->last_find,
-					    FALSE,
-					    FALSE);
 		empathy_chat_view_find_abilities (window->chatview_find,
 						 window->last_find,
 						 FALSE,
 						 &can_do_previous,
 						 &can_do_next);
-		gtk_widget_set_sensitive (window->button_previous, can_do_previous);
-		gtk_widget_set_sensitive (window->button_next, can_do_next);
+
+		/* The next match is in the messages not rendered yet */
+		if (!can_do_next) {
+			log_render_batch (&window->render_find, -1);
+		}
+
+		empathy_chat_view_find_next (window->chatview_find,
+					    window->last_find,
+					    FALSE,
+					    FALSE);
+		log_window_find_update_buttons (window);
 	}
 }
 
@@ -742,20 +1049,11 @@ log_window_button_previous_clicked_cb (GtkWidget       *widget,
 				       EmpathyLogWindow *window)
 {
 	if (window->last_find) {
-		gboolean can_do_previous;
-		gboolean can_do_next;
-
 		empathy_chat_view_find_previous (window->chatview_find,
 						window->last_find,
 						FALSE,
 						FALSE);
-		empathy_chat_view_find_abilities (window->chatview_find,
-						 window->last_find,
-						 FALSE,
-						 &can_do_previous,
-						 &can_do_next);
-		gtk_widget_set_sensitive (window->button_previous, can_do_previous);
-		gtk_widget_set_sensitive (window->button_next, can_do_next);
+		log_window_find_update_buttons (window);
 	}
 }
 
@@ -943,6 +1241,7 @@ log_window_chats_accounts_changed_cb (GtkWidget       *combobox,
 				      EmpathyLogWindow *window)
 {
 	/* Clear all current messages shown in the textview */
+	log_render_cancel (&window->render_chats);
 	empathy_chat_view_clear (window->chatview_chats);
 
 	log_window_chats_populate (window);
@@ -1049,7 +1348,6 @@ log_window_got_messages_for_date_cb (GObject *manager,
 {
   EmpathyLogWindow *window = user_data;
   GList *messages;
-  GList *l;
   GError *error = NULL;
 
   if (log_window == NULL)
@@ -1065,17 +1363,8 @@ log_window_got_messages_for_date_cb (GObject *manager,
       return;
   }
 
-  for (l = messages; l; l = l->next) {
-      EmpathyMessage *message = empathy_message_from_tpl_log_entry (l->data);
-      g_object_unref (l->data);
-      empathy_chat_view_append_message (window->chatview_chats,
-          message);
-      g_object_unref (message);
-  }
-  g_list_free (messages);
-
-  /* Turn back on scrolling */
-  empathy_chat_view_scroll (window->chatview_find, TRUE);
+  /* The rest is rendered while idle, or when scrolling down to it */
+  log_render_start (&window->render_chats, messages);
 
   /* Give the search entry main focus */
   gtk_widget_grab_focus (window->entry_chats);
@@ -1096,10 +1385,12 @@ log_window_get_messages_for_date (EmpathyLogWindow *window,
   }
 
   /* Clear all current messages shown in the textview */
+  log_render_cancel (&window->render_chats);
   empathy_chat_view_clear (window->chatview_chats);
 
-  /* Turn off scrolling temporarily */
-  empathy_chat_view_scroll (window->chatview_find, FALSE);
+  /* Stay on the first page while the others are rendered, then
+   * log_render_finished() scrolls down to the most recent messages */
+  empathy_chat_view_scroll (window->chatview_chats, FALSE);
 
   /* Get messages */
   tpl_log_manager_get_messages_for_date_async (window->log_manager,
@@ -1111,30 +1402,14 @@ log_window_get_messages_for_date (EmpathyLogWindow *window,
 }
 
 static void
-log_manager_got_dates_cb (GObject *manager,
-                          GAsyncResult *result,
-                          gpointer user_data)
+log_window_chats_show_dates (EmpathyLogWindow *window,
+                             GList *dates)
 {
-  EmpathyLogWindow *window = user_data;
-  GList         *dates;
   GList         *l;
   guint          year_selected;
   guint          month_selected;
   gboolean       day_selected = FALSE;
   GDate         *date = NULL;
-  GError        *error = NULL;
-
-  if (log_window == NULL)
-    return;
-
-  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
-        result, &dates, &error)) {
-    DEBUG ("Unable to retrieve messages' dates: %s. Aborting",
-        error->message);
-    empathy_chat_view_append_event (window->chatview_find,
-        "Unable to retrieve messages' dates");
-      return;
-  }
 
   for (l = dates; l; l = l->next) {
       GDate *d = l->data;
@@ -1185,10 +1460,35 @@ log_manager_got_dates_cb (GObject *manager,
       log_window_get_messages_for_date (window, date);
   }
 
-  g_list_foreach (dates, (GFunc) g_free, NULL);
+  g_list_foreach (dates, (GFunc) g_date_free, NULL);
   g_list_free (dates);
 }
 
+static void
+log_index_got_dates_cb (GObject *index,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+  EmpathyLogWindow *window = user_data;
+  GList         *dates;
+  GError        *error = NULL;
+
+  if (log_window == NULL)
+    return;
+
+  if (!empathy_log_index_get_dates_finish (EMPATHY_LOG_INDEX (index),
+        result, &dates, &error)) {
+    DEBUG ("Unable to retrieve messages' dates: %s. Aborting",
+        error->message);
+    empathy_chat_view_append_event (window->chatview_find,
+        "Unable to retrieve messages' dates");
+      g_error_free (error);
+      return;
+  }
+
+  log_window_chats_show_dates (window, dates);
+}
+
 
 static void
 log_window_chats_get_messages (EmpathyLogWindow *window,
@@ -1213,11 +1513,19 @@ log_window_chats_get_messages (EmpathyLogWindow *window,
 
 	/* Either use the supplied date or get the last */
 	if (date == NULL) {
+		GList *dates;
+
 		/* Get a list of dates and show them on the calendar */
-		tpl_log_manager_get_dates_async (window->log_manager,
-						       account, chat_id,
-						       is_chatroom,
-						       log_manager_got_dates_cb, (gpointer) window);
+		if (empathy_log_index_lookup_dates (window->log_index,
+						    account, chat_id,
+						    is_chatroom, &dates)) {
+			log_window_chats_show_dates (window, dates);
+		} else {
+			empathy_log_index_get_dates_async (window->log_index,
+							   account, chat_id,
+							   is_chatroom,
+							   log_index_got_dates_cb, (gpointer) window);
+		}
     /* signal unblocked at the end of the CB flow */
 	} else {
 		day = g_date_get_day (date);
@@ -1276,28 +1584,12 @@ log_window_calendar_chats_day_selected_cb (GtkWidget       *calendar,
 }
 
 static void
-log_window_updating_calendar_month_cb (GObject *manager,
-		GAsyncResult *result, gpointer user_data)
+log_window_calendar_mark_dates (EmpathyLogWindow *window,
+				GList            *dates)
 {
-	EmpathyLogWindow *window = user_data;
-	GList					*dates;
 	GList					*l;
 	guint					 year_selected;
 	guint					 month_selected;
-	GError				*error = NULL;
-
-	if (log_window == NULL)
-		return;
-
-	if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
-		result, &dates, &error)) {
-			DEBUG ("Unable to retrieve messages' dates: %s. Aborting",
-					error->message);
-			empathy_chat_view_append_event (window->chatview_find,
-					"Unable to retrieve messages' dates");
-			g_error_free (error);
-			return;
-	}
 
 	gtk_calendar_clear_marks (GTK_CALENDAR (window->calendar_chats));
 	g_object_get (window->calendar_chats,
@@ -1319,13 +1611,37 @@ log_window_updating_calendar_month_cb (GObject *manager,
 			}
 	}
 
-	g_list_foreach (dates, (GFunc) g_free, NULL);
+	g_list_foreach (dates, (GFunc) g_date_free, NULL);
 	g_list_free (dates);
 
 	DEBUG ("Currently showing month %d and year %d", month_selected,
 			year_selected);
 }
 
+static void
+log_window_updating_calendar_month_cb (GObject *index,
+		GAsyncResult *result, gpointer user_data)
+{
+	EmpathyLogWindow *window = user_data;
+	GList					*dates;
+	GError				*error = NULL;
+
+	if (log_window == NULL)
+		return;
+
+	if (!empathy_log_index_get_dates_finish (EMPATHY_LOG_INDEX (index),
+		result, &dates, &error)) {
+			DEBUG ("Unable to retrieve messages' dates: %s. Aborting",
+					error->message);
+			empathy_chat_view_append_event (window->chatview_find,
+					"Unable to retrieve messages' dates");
+			g_error_free (error);
+			return;
+	}
+
+	log_window_calendar_mark_dates (window, dates);
+}
+
 static void
 log_window_calendar_chats_month_changed_cb (GtkWidget       *calendar,
 					    EmpathyLogWindow *window)
@@ -1333,6 +1649,7 @@ log_window_calendar_chats_month_changed_cb (GtkWidget       *calendar,
 	TpAccount     *account;
 	gchar         *chat_id;
 	gboolean       is_chatroom;
+	GList         *dates;
 
 	gtk_calendar_clear_marks (GTK_CALENDAR (calendar));
 
@@ -1342,11 +1659,16 @@ log_window_calendar_chats_month_changed_cb (GtkWidget       *calendar,
 		return;
 	}
 
-	/* Get the log object for this contact */
-	tpl_log_manager_get_dates_async (window->log_manager, account,
-					       chat_id, is_chatroom,
-					       log_window_updating_calendar_month_cb,
-					       (gpointer) window);
+	/* Known since the chat was selected, unless that is still going on */
+	if (empathy_log_index_lookup_dates (window->log_index, account,
+					    chat_id, is_chatroom, &dates)) {
+		log_window_calendar_mark_dates (window, dates);
+	} else {
+		empathy_log_index_get_dates_async (window->log_index, account,
+						   chat_id, is_chatroom,
+						   log_window_updating_calendar_month_cb,
+						   (gpointer) window);
+	}
 
 	g_object_unref (account);
 	g_free (chat_id);
@@ -1359,6 +1681,12 @@ log_window_entry_chats_changed_cb (GtkWidget       *entry,
 	const gchar *str;
 
 	str = gtk_entry_get_text (GTK_ENTRY (window->entry_chats));
+
+	/* Search the whole day */
+	if (!EMP_STR_EMPTY (str)) {
+		log_render_batch (&window->render_chats, -1);
+	}
+
 	empathy_chat_view_highlight (window->chatview_chats, str, FALSE);
 
 	if (str != NULL) {
@@ -1378,6 +1706,7 @@ log_window_entry_chats_activate_cb (GtkWidget       *entry,
 	str = gtk_entry_get_text (GTK_ENTRY (window->entry_chats));
 
 	if (str != NULL) {
+		log_render_batch (&window->render_chats, -1);
 		empathy_chat_view_find_next (window->chatview_chats,
 					    str,
 					    FALSE,
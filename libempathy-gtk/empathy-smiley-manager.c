@@ -28,57 +28,247 @@
 #include "empathy-smiley-manager.h"
 #include "empathy-ui-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
-
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
-typedef struct {
-	SmileyManagerTree *tree;
-	GSList            *smileys;
-} EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
+/* Smileys are matched with an Aho-Corasick automaton working on UTF-8 bytes.
+ * A match of a valid UTF-8 string inside valid UTF-8 text always starts on a
+ * character boundary, so we don't need to decode the text. */
+#define SMILEY_NO_OUTPUT G_MAXUINT
+
+typedef struct {
+	gchar       *str;
 	GdkPixbuf   *pixbuf;
 	const gchar *path;
-	GSList      *childrens;
-};
+} SmileyPattern;
+
+typedef struct {
+	guint first_edge; /* Index of the first edge in edge_chars/edge_targets */
+	guint n_edges;
+	guint fail;       /* State of the longest proper suffix */
+	guint output;     /* Closest terminal state through fail links */
+	guint depth;      /* Length in bytes of the prefix this state matches */
+	gint  pattern;    /* Index in priv->patterns, or -1 */
+} SmileyState;
+
+typedef struct {
+	guint        root[256]; /* Dense transitions from the root state */
+	SmileyState *states;    /* In breadth-first order, root is 0 */
+	guint        n_states;
+	guchar      *edge_chars;
+	guint       *edge_targets;
+} SmileyAutomaton;
+
+typedef struct {
+	GArray          *patterns;
+	SmileyAutomaton *automaton; /* NULL if patterns changed since compiled */
+	GSList          *smileys;
+} EmpathySmileyManagerPriv;
 
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
+static void
+smiley_automaton_free (SmileyAutomaton *automaton)
 {
-	SmileyManagerTree *tree;
+	if (!automaton) {
+		return;
+	}
 
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
+	g_free (automaton->states);
+	g_free (automaton->edge_chars);
+	g_free (automaton->edge_targets);
+	g_slice_free (SmileyAutomaton, automaton);
+}
+
+static inline guint
+smiley_automaton_next (const SmileyAutomaton *automaton,
+		       guint                  state,
+		       guchar                 c)
+{
+	while (state != 0) {
+		const SmileyState *s = &automaton->states[state];
+		guint              i;
+
+		for (i = s->first_edge; i < s->first_edge + s->n_edges; i++) {
+			if (automaton->edge_chars[i] == c) {
+				return automaton->edge_targets[i];
+			}
+		}
+		state = s->fail;
+	}
 
-	return tree;
+	return automaton->root[c];
 }
 
-static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+typedef struct {
+	guchar c;
+	guint  target;
+} SmileyBuildEdge;
+
+typedef struct {
+	GArray *edges;
+	guint   depth;
+	gint    pattern;
+} SmileyBuildNode;
+
+static guint
+smiley_build_node_new (GArray *nodes,
+		       guint   depth)
 {
-	GSList *l;
+	SmileyBuildNode node;
 
-	if (!tree) {
-		return;
+	node.edges = g_array_new (FALSE, FALSE, sizeof (SmileyBuildEdge));
+	node.depth = depth;
+	node.pattern = -1;
+	g_array_append_val (nodes, node);
+
+	return nodes->len - 1;
+}
+
+static guint
+smiley_build_node_get_child (GArray *nodes,
+			     guint   parent,
+			     guchar  c)
+{
+	SmileyBuildNode *node = &g_array_index (nodes, SmileyBuildNode, parent);
+	SmileyBuildEdge  edge;
+	guint            i;
+
+	for (i = 0; i < node->edges->len; i++) {
+		edge = g_array_index (node->edges, SmileyBuildEdge, i);
+		if (edge.c == c) {
+			return edge.target;
+		}
 	}
 
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
+	edge.c = c;
+	edge.target = smiley_build_node_new (nodes, node->depth + 1);
+	/* nodes may have been reallocated */
+	node = &g_array_index (nodes, SmileyBuildNode, parent);
+	g_array_append_val (node->edges, edge);
+
+	return edge.target;
+}
+
+static SmileyAutomaton *
+smiley_manager_compile (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyAutomaton          *automaton;
+	GArray                   *nodes;
+	guint                    *order;
+	guint                    *new_ids;
+	guint                     n_order = 0;
+	guint                     n_edges = 0;
+	guint                     i, j;
+
+	/* Build a plain trie of the patterns first */
+	nodes = g_array_new (FALSE, FALSE, sizeof (SmileyBuildNode));
+	smiley_build_node_new (nodes, 0);
+	for (i = 0; i < priv->patterns->len; i++) {
+		SmileyPattern *pattern;
+		const guchar  *c;
+		guint          node = 0;
+
+		pattern = &g_array_index (priv->patterns, SmileyPattern, i);
+		for (c = (const guchar *) pattern->str; *c != '\0'; c++) {
+			node = smiley_build_node_get_child (nodes, node, *c);
+		}
+		g_array_index (nodes, SmileyBuildNode, node).pattern = i;
+	}
+
+	/* Number states in breadth-first order, so a state's fail link is
+	 * always computed before its children are visited, and states close
+	 * to the root (the hot ones) are next to each other in memory. */
+	order = g_new (guint, nodes->len);
+	new_ids = g_new (guint, nodes->len);
+	order[n_order++] = 0;
+	for (i = 0; i < n_order; i++) {
+		SmileyBuildNode *node;
+
+		node = &g_array_index (nodes, SmileyBuildNode, order[i]);
+		new_ids[order[i]] = i;
+		for (j = 0; j < node->edges->len; j++) {
+			order[n_order++] = g_array_index (node->edges,
+				SmileyBuildEdge, j).target;
+		}
 	}
 
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
+	automaton = g_slice_new0 (SmileyAutomaton);
+	automaton->n_states = nodes->len;
+	automaton->states = g_new0 (SmileyState, nodes->len);
+	automaton->edge_chars = g_new (guchar, nodes->len);
+	automaton->edge_targets = g_new (guint, nodes->len);
+
+	for (i = 0; i < n_order; i++) {
+		SmileyBuildNode *node;
+		SmileyState     *state = &automaton->states[i];
+
+		node = &g_array_index (nodes, SmileyBuildNode, order[i]);
+		state->first_edge = n_edges;
+		state->n_edges = node->edges->len;
+		state->depth = node->depth;
+		state->pattern = node->pattern;
+		state->output = SMILEY_NO_OUTPUT;
+
+		for (j = 0; j < node->edges->len; j++) {
+			SmileyBuildEdge *edge;
+
+			edge = &g_array_index (node->edges, SmileyBuildEdge, j);
+			automaton->edge_chars[n_edges] = edge->c;
+			automaton->edge_targets[n_edges] = new_ids[edge->target];
+			n_edges++;
+
+			if (i == 0) {
+				automaton->root[edge->c] = new_ids[edge->target];
+			}
+		}
+
+		g_array_free (node->edges, TRUE);
+	}
+
+	/* Compute fail and output links */
+	for (i = 0; i < automaton->n_states; i++) {
+		SmileyState *state = &automaton->states[i];
+
+		for (j = state->first_edge;
+		     j < state->first_edge + state->n_edges;
+		     j++) {
+			SmileyState *child;
+			SmileyState *fail;
+
+			child = &automaton->states[automaton->edge_targets[j]];
+			if (i == 0) {
+				child->fail = 0;
+			} else {
+				child->fail = smiley_automaton_next (automaton,
+					state->fail, automaton->edge_chars[j]);
+			}
+
+			fail = &automaton->states[child->fail];
+			child->output = fail->pattern >= 0 ?
+				child->fail : fail->output;
+		}
+	}
+
+	g_free (order);
+	g_free (new_ids);
+	g_array_free (nodes, TRUE);
+
+	return automaton;
+}
+
+static SmileyAutomaton *
+smiley_manager_get_automaton (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+
+	if (!priv->automaton) {
+		priv->automaton = smiley_manager_compile (manager);
 	}
-	g_slist_free (tree->childrens);
-	g_slice_free (SmileyManagerTree, tree);
+
+	return priv->automaton;
 }
 
 static EmpathySmiley *
@@ -105,8 +295,17 @@ static void
 smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
+	guint                     i;
+
+	for (i = 0; i < priv->patterns->len; i++) {
+		SmileyPattern *pattern;
 
-	smiley_manager_tree_free (priv->tree);
+		pattern = &g_array_index (priv->patterns, SmileyPattern, i);
+		g_free (pattern->str);
+		g_object_unref (pattern->pixbuf);
+	}
+	g_array_free (priv->patterns, TRUE);
+	smiley_automaton_free (priv->automaton);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -149,7 +348,8 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_array_new (FALSE, FALSE, sizeof (SmileyPattern));
+	priv->automaton = NULL;
 	priv->smileys = NULL;
 
 	empathy_smiley_manager_load (manager);
@@ -161,55 +361,23 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
-{
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
-		}
-	}
-
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
-	}
-
-	return child;
-}
-
 static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
+smiley_manager_add_pattern (EmpathySmileyManager *manager,
+			    GdkPixbuf            *pixbuf,
+			    const gchar          *str,
+			    const gchar          *path)
 {
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyPattern             pattern;
 
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
-	}
+	pattern.str = g_strdup (str);
+	pattern.pixbuf = g_object_ref (pixbuf);
+	pattern.path = path;
+	g_array_append_val (priv->patterns, pattern);
 
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = path;
+	/* Recompiled on next parse */
+	smiley_automaton_free (priv->automaton);
+	priv->automaton = NULL;
 }
 
 static void
@@ -224,7 +392,7 @@ smiley_manager_add_valist (EmpathySmileyManager *manager,
 	EmpathySmiley            *smiley;
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		smiley_manager_add_pattern (manager, pixbuf, str, path);
 	}
 
 	/* We give the ownership of path to the smiley */
@@ -286,22 +454,8 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 	empathy_smiley_manager_add (manager, "face-uncertain",  ":-/",   ":/",   NULL);
 	empathy_smiley_manager_add (manager, "face-wink",       ";-)",   ";)",   NULL);
 	empathy_smiley_manager_add (manager, "face-worried",    ":-S",   ":S",   ":-s", ":s", NULL);
-}
 
-static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
-{
-	EmpathySmileyHit *hit;
-
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
-
-	return hit;
+	smiley_manager_get_automaton (manager);
 }
 
 void
@@ -312,94 +466,121 @@ empathy_smiley_hit_free (EmpathySmileyHit *hit)
 	g_slice_free (EmpathySmileyHit, hit);
 }
 
-GSList *
-empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
-				  const gchar          *text,
-				  gssize                len)
+guint
+empathy_smiley_manager_parse_hits (EmpathySmileyManager *manager,
+				   const gchar          *text,
+				   gssize                len,
+				   EmpathySmileyHit     *hits,
+				   guint                 n_hits)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
-	const gchar              *cur_str;
-	const gchar              *start = NULL;
-
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
+	const SmileyAutomaton    *automaton;
+	const guchar             *str = (const guchar *) text;
+	gsize                     pos = 0;
+	guint                     state = 0;
+	gint                      match = -1;
+	gsize                     match_start = 0;
+	gsize                     match_end = 0;
+	guint                     n = 0;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), 0);
+	g_return_val_if_fail (text != NULL, 0);
+	g_return_val_if_fail (hits != NULL || n_hits == 0, 0);
 
 	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
 		len = G_MAXSSIZE;
 	}
 
-	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
+	automaton = smiley_manager_get_automaton (manager);
+
+	/* We report the leftmost-longest smileys, without overlap. The
+	 * automaton gives us, for each position, the longest smiley ending
+	 * there. We keep the best candidate (smallest start, then longest)
+	 * until the current state proves no better candidate can appear, that
+	 * is until the longest prefix we are tracking starts after it. Then
+	 * we emit it and restart right after it. A restart rescans at most
+	 * the length of the longest smiley, so this is linear in the text
+	 * length, and there is no allocation. */
+	while (n < n_hits) {
+		gboolean at_end;
+
+		at_end = (gssize) pos >= len || str[pos] == '\0';
+		if (!at_end) {
+			const SmileyState *s;
+			guint              out;
+
+			state = smiley_automaton_next (automaton, state, str[pos]);
+			pos++;
+
+			s = &automaton->states[state];
+			out = s->pattern >= 0 ? state : s->output;
+			if (out != SMILEY_NO_OUTPUT) {
+				gsize start = pos - automaton->states[out].depth;
+
+				if (match < 0 || start <= match_start) {
+					match = automaton->states[out].pattern;
+					match_start = start;
+					match_end = pos;
+				}
 			}
-			cur_tree = child;
-			continue;
-		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
+			if (match < 0 ||
+			    match_start + automaton->states[state].depth >= pos) {
+				continue;
 			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
+		} else if (match < 0) {
+			break;
 		}
-	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+		hits[n].pixbuf = g_array_index (priv->patterns,
+			SmileyPattern, match).pixbuf;
+		hits[n].path = g_array_index (priv->patterns,
+			SmileyPattern, match).path;
+		hits[n].start = match_start;
+		hits[n].end = match_end;
+		n++;
+
+		pos = match_end;
+		state = 0;
+		match = -1;
 	}
 
+	return n;
+}
+
+GSList *
+empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
+				  const gchar          *text,
+				  gssize                len)
+{
+	EmpathySmileyHit  buffer[16];
+	GSList           *hits = NULL;
+	guint             offset = 0;
+	guint             n, i;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
+	g_return_val_if_fail (text != NULL, NULL);
+
+	do {
+		n = empathy_smiley_manager_parse_hits (manager, text + offset,
+			len < 0 ? -1 : (gssize) (len - offset),
+			buffer, G_N_ELEMENTS (buffer));
+
+		for (i = 0; i < n; i++) {
+			EmpathySmileyHit *hit;
+
+			hit = g_slice_dup (EmpathySmileyHit, &buffer[i]);
+			hit->start += offset;
+			hit->end += offset;
+			hits = g_slist_prepend (hits, hit);
+		}
+
+		if (n > 0) {
+			offset += buffer[n - 1].end;
+		}
+	} while (n == G_N_ELEMENTS (buffer));
+
 	return g_slist_reverse (hits);
 }
 
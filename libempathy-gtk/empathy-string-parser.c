@@ -49,6 +49,40 @@ uri_regex_dup_singleton (void)
 	return g_regex_ref (uri_regex);
 }
 
+/* Cheap pre-check so we don't run the URI regex on the (very common)
+ * messages which can't contain a link: every branch of URI_REGEX needs
+ * either "://", "www.", "ftp." or '@'. */
+static gboolean
+string_parser_may_contain_link (const gchar *text,
+				gsize len)
+{
+	const gchar *cur;
+	const gchar *end = text + len;
+
+	for (cur = text; cur < end; cur++) {
+		switch (*cur) {
+		case '@':
+			return TRUE;
+		case ':':
+			if (end - cur >= 3 && cur[1] == '/' && cur[2] == '/') {
+				return TRUE;
+			}
+			break;
+		case '.':
+			if (cur - text >= 3 &&
+			    (strncmp (cur - 3, "www", 3) == 0 ||
+			     strncmp (cur - 3, "ftp", 3) == 0)) {
+				return TRUE;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	return FALSE;
+}
+
 void
 empathy_string_parser_substr (const gchar *text,
 			      gssize len,
@@ -209,21 +243,186 @@ empathy_string_replace_escaped (const gchar *text,
 	g_free (escaped);
 }
 
+GArray *
+empathy_string_tokens_new (void)
+{
+	return g_array_sized_new (FALSE, FALSE, sizeof (EmpathyStringToken), 16);
+}
+
+static void
+string_tokens_append (GArray *tokens,
+		      EmpathyStringTokenType type,
+		      guint start,
+		      guint end)
+{
+	EmpathyStringToken token = { type, start, end, NULL, NULL };
+
+	g_array_append_val (tokens, token);
+}
+
+static void
+string_tokenize_text (const gchar *text,
+		      guint start,
+		      guint end,
+		      EmpathyStringTokenizeFlags flags,
+		      GArray *tokens)
+{
+	if (flags & EMPATHY_STRING_TOKENIZE_NEWLINES) {
+		const gchar *nl;
+
+		while (start < end &&
+		       (nl = memchr (text + start, '\n', end - start)) != NULL) {
+			guint pos = nl - text;
+
+			if (pos > start) {
+				string_tokens_append (tokens,
+						      EMPATHY_STRING_TOKEN_TEXT,
+						      start, pos);
+			}
+			string_tokens_append (tokens,
+					      EMPATHY_STRING_TOKEN_NEWLINE,
+					      pos, pos + 1);
+			start = pos + 1;
+		}
+	}
+
+	if (end > start) {
+		string_tokens_append (tokens, EMPATHY_STRING_TOKEN_TEXT,
+				      start, end);
+	}
+}
+
+static void
+string_tokenize_gap (const gchar *text,
+		     guint start,
+		     guint end,
+		     EmpathySmileyManager *smiley_manager,
+		     EmpathyStringTokenizeFlags flags,
+		     GArray *tokens)
+{
+	guint last = start;
+
+	if (start >= end) {
+		return;
+	}
+
+	if (smiley_manager != NULL) {
+		EmpathySmileyHit hits[16];
+		guint            n, i;
+
+		do {
+			guint offset = last;
+
+			n = empathy_smiley_manager_parse_hits (smiley_manager,
+				text + offset, end - offset,
+				hits, G_N_ELEMENTS (hits));
+
+			for (i = 0; i < n; i++) {
+				EmpathyStringToken token;
+
+				token.type = EMPATHY_STRING_TOKEN_SMILEY;
+				token.start = offset + hits[i].start;
+				token.end = offset + hits[i].end;
+				token.pixbuf = hits[i].pixbuf;
+				token.path = hits[i].path;
+
+				string_tokenize_text (text, last, token.start,
+						      flags, tokens);
+				g_array_append_val (tokens, token);
+				last = token.end;
+			}
+		} while (n == G_N_ELEMENTS (hits));
+	}
+
+	string_tokenize_text (text, last, end, flags, tokens);
+}
+
+void
+empathy_string_tokenize (const gchar *text,
+			 gssize len,
+			 EmpathyStringTokenizeFlags flags,
+			 GArray *tokens)
+{
+	EmpathySmileyManager *smiley_manager = NULL;
+	guint                 last = 0;
+
+	g_return_if_fail (text != NULL);
+	g_return_if_fail (tokens != NULL);
+
+	if (len < 0) {
+		len = strlen (text);
+	}
+
+	if (flags & EMPATHY_STRING_TOKENIZE_SMILEYS) {
+		smiley_manager = empathy_smiley_manager_dup_singleton ();
+	}
+
+	/* Links have priority over smileys and newlines, so find them first
+	 * and tokenize the gaps between them. The regex is only run when the
+	 * text could possibly contain a link. */
+	if ((flags & EMPATHY_STRING_TOKENIZE_LINKS) &&
+	    string_parser_may_contain_link (text, len)) {
+		GRegex     *uri_regex;
+		GMatchInfo *match_info;
+
+		uri_regex = uri_regex_dup_singleton ();
+		if (g_regex_match_full (uri_regex, text, len, 0, 0,
+					&match_info, NULL)) {
+			gint s = 0, e = 0;
+
+			do {
+				g_match_info_fetch_pos (match_info, 0, &s, &e);
+
+				string_tokenize_gap (text, last, s,
+						     smiley_manager, flags,
+						     tokens);
+				string_tokens_append (tokens,
+						      EMPATHY_STRING_TOKEN_LINK,
+						      s, e);
+				last = e;
+			} while (g_match_info_next (match_info, NULL));
+		}
+
+		g_match_info_free (match_info);
+		g_regex_unref (uri_regex);
+	}
+
+	string_tokenize_gap (text, last, len, smiley_manager, flags, tokens);
+
+	if (smiley_manager != NULL) {
+		g_object_unref (smiley_manager);
+	}
+}
+
 gchar *
 empathy_add_link_markup (const gchar *text)
 {
-	EmpathyStringParser parsers[] = {
-		{empathy_string_match_link, empathy_string_replace_link},
-		{empathy_string_match_all, empathy_string_replace_escaped},
-		{NULL, NULL}
-	};
+	GArray  *tokens;
 	GString *string;
+	guint    i;
 
 	g_return_val_if_fail (text != NULL, NULL);
 
+	tokens = empathy_string_tokens_new ();
+	empathy_string_tokenize (text, -1, EMPATHY_STRING_TOKENIZE_LINKS,
+				 tokens);
+
 	string = g_string_sized_new (strlen (text));
-	empathy_string_parser_substr (text, -1, parsers, string);
+	for (i = 0; i < tokens->len; i++) {
+		EmpathyStringToken *token;
+
+		token = &g_array_index (tokens, EmpathyStringToken, i);
+		if (token->type == EMPATHY_STRING_TOKEN_LINK) {
+			empathy_string_replace_link (text + token->start,
+						     token->end - token->start,
+						     NULL, string);
+		} else {
+			empathy_string_replace_escaped (text + token->start,
+							token->end - token->start,
+							NULL, string);
+		}
+	}
+	g_array_free (tokens, TRUE);
 
 	return g_string_free (string, FALSE);
 }
-
@@ -22,6 +22,7 @@
 #define __EMPATHY_STRING_PARSER_H__
 
 #include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 G_BEGIN_DECLS
 
@@ -82,6 +83,40 @@ empathy_string_replace_escaped (const gchar *text,
 				gpointer match_data,
 				gpointer user_data);
 
+/* Single-pass tokenizer: splits text into a flat array of spans instead of
+ * calling back into a chain of parsers for each fragment. */
+typedef enum {
+	EMPATHY_STRING_TOKEN_TEXT,
+	EMPATHY_STRING_TOKEN_LINK,
+	EMPATHY_STRING_TOKEN_SMILEY,
+	EMPATHY_STRING_TOKEN_NEWLINE,
+} EmpathyStringTokenType;
+
+typedef enum {
+	EMPATHY_STRING_TOKENIZE_LINKS    = 1 << 0,
+	EMPATHY_STRING_TOKENIZE_SMILEYS  = 1 << 1,
+	EMPATHY_STRING_TOKENIZE_NEWLINES = 1 << 2,
+} EmpathyStringTokenizeFlags;
+
+typedef struct {
+	EmpathyStringTokenType type;
+	guint        start;  /* text[start:end] is covered by this token */
+	guint        end;
+	GdkPixbuf   *pixbuf; /* Only set for EMPATHY_STRING_TOKEN_SMILEY */
+	const gchar *path;   /* Only set for EMPATHY_STRING_TOKEN_SMILEY */
+} EmpathyStringToken;
+
+/* Returns a GArray of EmpathyStringToken, to be reused across calls */
+GArray *
+empathy_string_tokens_new (void);
+
+/* Appends to tokens the spans found in the len first bytes of text */
+void
+empathy_string_tokenize (const gchar *text,
+			 gssize len,
+			 EmpathyStringTokenizeFlags flags,
+			 GArray *tokens);
+
 /* Returns a new string with <a> html tag around links, and escape the rest.
  * To be used with gtk_label_set_markup() for example */
 gchar *
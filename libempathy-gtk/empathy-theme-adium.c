@@ -37,6 +37,8 @@
 #include <libempathy/empathy-utils.h>
 
 #include "empathy-theme-adium.h"
+#include "empathy-adium-template.h"
+#include "empathy-gtk-marshal.h"
 #include "empathy-smiley-manager.h"
 #include "empathy-ui-utils.h"
 #include "empathy-plist.h"
@@ -55,6 +57,106 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Message blocks kept in the page by default, 0 for no limit */
+#define DEFAULT_MAX_MESSAGES 0
+
+#define OLDER_MESSAGES_URI "empathy-older-messages:"
+
+/* Helpers run in the page once it is loaded. Each block appended through
+ * appendMessage() is remembered with the node it starts at, and the
+ * timestamp and body hash of its first message, so that the oldest blocks
+ * can be removed in batches while the user is at the bottom of the
+ * conversation. A sentinel then stands for the pruned messages: scrolling
+ * up to it, or clicking it, asks for the messages older than the first
+ * block still displayed. Themes without a #Chat element are never
+ * pruned. */
+static const gchar theme_adium_support_js[] =
+	"var empathyBlocks = [];\n"
+	"var empathyOlderPending = false;\n"
+	"var empathyOlderLabel = '';\n"
+	"function empathyChat() {\n"
+	"  return document.getElementById('Chat');\n"
+	"}\n"
+	"function empathyBlock(timestamp, hash, append) {\n"
+	"  var chat = empathyChat(), insert, start;\n"
+	"  if (!chat) {\n"
+	"    append();\n"
+	"    return;\n"
+	"  }\n"
+	"  insert = document.getElementById('insert');\n"
+	"  start = chat.childNodes.length;\n"
+	"  if (insert && insert.parentNode == chat) start--;\n"
+	"  append();\n"
+	"  if (chat.childNodes[start])\n"
+	"    empathyBlocks.push({first: chat.childNodes[start],\n"
+	"                        timestamp: timestamp, hash: hash});\n"
+	"}\n"
+	"function empathyNearBottom() {\n"
+	"  return document.body.scrollTop >=\n"
+	"    document.body.scrollHeight - window.innerHeight * 1.2;\n"
+	"}\n"
+	"function empathyRequestOlder() {\n"
+	"  if (empathyOlderPending || empathyBlocks.length == 0) return;\n"
+	"  empathyOlderPending = true;\n"
+	"  window.location = '" OLDER_MESSAGES_URI "' +\n"
+	"    empathyBlocks[0].timestamp + ':' + empathyBlocks[0].hash;\n"
+	"}\n"
+	"function empathyPrune(max, batch) {\n"
+	"  var chat = empathyChat(), n, node, last, sentinel;\n"
+	"  if (!chat || empathyBlocks.length <= max + batch ||\n"
+	"      !empathyNearBottom()) return;\n"
+	"  n = empathyBlocks.length - max;\n"
+	"  last = empathyBlocks[n].first;\n"
+	"  for (node = empathyBlocks[0].first; node && node != last; ) {\n"
+	"    var next = node.nextSibling;\n"
+	"    chat.removeChild(node);\n"
+	"    node = next;\n"
+	"  }\n"
+	"  empathyBlocks.splice(0, n);\n"
+	"  if (document.getElementById('empathy-older-messages')) return;\n"
+	"  sentinel = document.createElement('div');\n"
+	"  sentinel.id = 'empathy-older-messages';\n"
+	"  sentinel.className = 'event';\n"
+	"  sentinel.style.cursor = 'pointer';\n"
+	"  sentinel.textContent = empathyOlderLabel;\n"
+	"  sentinel.onclick = empathyRequestOlder;\n"
+	"  chat.insertBefore(sentinel, chat.firstChild);\n"
+	"}\n"
+	"function empathyPrependMessages(htmls, timestamps, hashes) {\n"
+	"  var chat = empathyChat(), blocks = [], i;\n"
+	"  var sentinel = document.getElementById('empathy-older-messages');\n"
+	"  if (!chat) {\n"
+	"    empathyOlderPending = false;\n"
+	"    return;\n"
+	"  }\n"
+	"  var anchor = sentinel ? sentinel.nextSibling : chat.firstChild;\n"
+	"  var height = document.body.scrollHeight;\n"
+	"  var range = document.createRange();\n"
+	"  range.selectNode(chat);\n"
+	"  for (i = 0; i < htmls.length; i++) {\n"
+	"    var fragment = range.createContextualFragment(htmls[i]);\n"
+	"    var insert = fragment.querySelector('#insert');\n"
+	"    if (insert) insert.parentNode.removeChild(insert);\n"
+	"    if (fragment.firstChild)\n"
+	"      blocks.push({first: fragment.firstChild,\n"
+	"                   timestamp: timestamps[i], hash: hashes[i]});\n"
+	"    chat.insertBefore(fragment, anchor);\n"
+	"  }\n"
+	"  empathyBlocks = blocks.concat(empathyBlocks);\n"
+	"  document.body.scrollTop += document.body.scrollHeight - height;\n"
+	"  empathyOlderPending = false;\n"
+	"}\n"
+	"function empathyNoOlderMessages() {\n"
+	"  var sentinel = document.getElementById('empathy-older-messages');\n"
+	"  if (sentinel) sentinel.parentNode.removeChild(sentinel);\n"
+	"  empathyOlderPending = false;\n"
+	"}\n"
+	"window.addEventListener('scroll', function () {\n"
+	"  if (document.body.scrollTop == 0 &&\n"
+	"      document.getElementById('empathy-older-messages'))\n"
+	"    empathyRequestOlder();\n"
+	"}, false);\n";
+
 typedef struct {
 	EmpathyAdiumData     *data;
 	EmpathySmileyManager *smiley_manager;
@@ -63,8 +165,15 @@ typedef struct {
 	gboolean              last_is_backlog;
 	gboolean              page_loaded;
 	GList                *message_queue;
+	/* JavaScript statements waiting to be run by script_flush_id */
+	GString              *script_queue;
+	guint                 script_flush_id;
+	guint                 n_queued_scripts;
 	GtkWidget            *inspector_window;
 	GSettings            *gsettings_chat;
+	GArray               *tokens;
+	/* Message blocks kept in the page, 0 for no limit */
+	guint                 max_messages;
 } EmpathyThemeAdiumPriv;
 
 struct _EmpathyAdiumData {
@@ -75,24 +184,16 @@ struct _EmpathyAdiumData {
 	gchar *default_incoming_avatar_filename;
 	gchar *default_outgoing_avatar_filename;
 	gchar *template_html;
-	gchar *in_content_html;
-	gsize  in_content_len;
-	gchar *in_context_html;
-	gsize  in_context_len;
-	gchar *in_nextcontent_html;
-	gsize  in_nextcontent_len;
-	gchar *in_nextcontext_html;
-	gsize  in_nextcontext_len;
-	gchar *out_content_html;
-	gsize  out_content_len;
-	gchar *out_context_html;
-	gsize  out_context_len;
-	gchar *out_nextcontent_html;
-	gsize  out_nextcontent_len;
-	gchar *out_nextcontext_html;
-	gsize  out_nextcontext_len;
-	gchar *status_html;
-	gsize  status_len;
+	/* Message templates, parsed once when the theme is loaded */
+	EmpathyAdiumTemplate *in_content;
+	EmpathyAdiumTemplate *in_context;
+	EmpathyAdiumTemplate *in_nextcontent;
+	EmpathyAdiumTemplate *in_nextcontext;
+	EmpathyAdiumTemplate *out_content;
+	EmpathyAdiumTemplate *out_context;
+	EmpathyAdiumTemplate *out_nextcontent;
+	EmpathyAdiumTemplate *out_nextcontext;
+	EmpathyAdiumTemplate *status;
 	GHashTable *info;
 };
 
@@ -101,8 +202,16 @@ static void theme_adium_iface_init (EmpathyChatViewIface *iface);
 enum {
 	PROP_0,
 	PROP_ADIUM_DATA,
+	PROP_MAX_MESSAGES,
 };
 
+enum {
+	OLDER_MESSAGES_NEEDED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 G_DEFINE_TYPE_WITH_CODE (EmpathyThemeAdium, empathy_theme_adium,
 			 WEBKIT_TYPE_WEB_VIEW,
 			 G_IMPLEMENT_INTERFACE (EMPATHY_TYPE_CHAT_VIEW,
@@ -145,6 +254,28 @@ theme_adium_navigation_policy_decision_requested_cb (WebKitWebView             *
 {
 	const gchar *uri;
 
+	/* The page asks for the messages it pruned */
+	uri = webkit_network_request_get_uri (request);
+	if (g_str_has_prefix (uri, OLDER_MESSAGES_URI)) {
+		gint64  before;
+		guint64 body_hash = 0;
+		gchar  *end;
+
+		/* "<timestamp>:<body hash>" of the oldest block */
+		before = g_ascii_strtoll (uri + strlen (OLDER_MESSAGES_URI),
+					  &end, 10);
+		if (*end == ':') {
+			body_hash = g_ascii_strtoull (end + 1, NULL, 10);
+		}
+		DEBUG ("Messages older than %" G_GINT64_FORMAT " (%u) needed",
+		       before, (guint) body_hash);
+		g_signal_emit (view, signals[OLDER_MESSAGES_NEEDED], 0,
+			       (glong) before, (guint) body_hash);
+
+		webkit_web_policy_decision_ignore (decision);
+		return TRUE;
+	}
+
 	/* Only call url_show on clicks */
 	if (webkit_web_navigation_action_get_reason (action) !=
 	    WEBKIT_WEB_NAVIGATION_REASON_LINK_CLICKED) {
@@ -152,7 +283,6 @@ theme_adium_navigation_policy_decision_requested_cb (WebKitWebView             *
 		return TRUE;
 	}
 
-	uri = webkit_network_request_get_uri (request);
 	empathy_url_show (GTK_WIDGET (view), uri);
 
 	webkit_web_policy_decision_ignore (decision);
@@ -192,233 +322,194 @@ theme_adium_open_address_cb (GtkMenuItem *menuitem,
 	g_free (uri);
 }
 
-static void
-theme_adium_match_newline (const gchar *text,
-			   gssize len,
-			   EmpathyStringReplace replace_func,
-			   EmpathyStringParser *sub_parsers,
-			   gpointer user_data)
+static gchar *
+theme_adium_parse_body (EmpathyThemeAdium *theme,
+			const gchar       *text)
 {
-	GString *string = user_data;
-	gint i;
-	gint prev = 0;
+	EmpathyThemeAdiumPriv      *priv = GET_PRIV (theme);
+	EmpathyStringTokenizeFlags  flags;
+	GString                    *string;
+	guint                       i;
 
-	if (len < 0) {
-		len = G_MAXSSIZE;
-	}
+	flags = EMPATHY_STRING_TOKENIZE_LINKS | EMPATHY_STRING_TOKENIZE_NEWLINES;
+
+	/* Check if we have to parse smileys */
+	if (g_settings_get_boolean (priv->gsettings_chat,
+				    EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+		flags |= EMPATHY_STRING_TOKENIZE_SMILEYS;
+
+	g_array_set_size (priv->tokens, 0);
+	empathy_string_tokenize (text, -1, flags, priv->tokens);
 
-	/* Replace \n by <br/> */
-	for (i = 0; i < len && text[i] != '\0'; i++) {
-		if (text[i] == '\n') {
-			empathy_string_parser_substr (text + prev,
-						      i - prev, sub_parsers,
-						      user_data);
+	/* Construct string with links and smileys replaced by html tags.
+	 * Also escape text to make sure html code is displayed verbatim. */
+	string = g_string_sized_new (strlen (text));
+	for (i = 0; i < priv->tokens->len; i++) {
+		EmpathyStringToken *token;
+		const gchar        *str;
+		gint                len;
+
+		token = &g_array_index (priv->tokens, EmpathyStringToken, i);
+		str = text + token->start;
+		len = token->end - token->start;
+
+		switch (token->type) {
+		case EMPATHY_STRING_TOKEN_LINK:
+			empathy_string_replace_link (str, len, NULL, string);
+			break;
+		case EMPATHY_STRING_TOKEN_SMILEY:
+			/* Replace smiley by a <img/> tag */
+			g_string_append_printf (string,
+						"<img src=\"%s\" alt=\"%.*s\" title=\"%.*s\"/>",
+						token->path, len, str, len, str);
+			break;
+		case EMPATHY_STRING_TOKEN_NEWLINE:
+			/* Replace \n by <br/> */
 			g_string_append (string, "<br/>");
-			prev = i + 1;
+			break;
+		case EMPATHY_STRING_TOKEN_TEXT:
+		default:
+			empathy_string_replace_escaped (str, len, NULL, string);
+			break;
 		}
 	}
-	empathy_string_parser_substr (text + prev, i - prev,
-				      sub_parsers, user_data);
+
+	return g_string_free (string, FALSE);
 }
 
 static void
-theme_adium_replace_smiley (const gchar *text,
-			    gssize len,
-			    gpointer match_data,
-			    gpointer user_data)
+theme_adium_flush_scripts (EmpathyThemeAdium *theme)
 {
-	EmpathySmileyHit *hit = match_data;
-	GString *string = user_data;
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 
-	/* Replace smiley by a <img/> tag */
-	g_string_append_printf (string,
-				"<img src=\"%s\" alt=\"%.*s\" title=\"%.*s\"/>",
-				hit->path, (int)len, text, (int)len, text);
-}
+	if (priv->script_flush_id != 0) {
+		g_source_remove (priv->script_flush_id);
+		priv->script_flush_id = 0;
+	}
 
-static EmpathyStringParser string_parsers[] = {
-	{empathy_string_match_link, empathy_string_replace_link},
-	{theme_adium_match_newline, NULL},
-	{empathy_string_match_all, empathy_string_replace_escaped},
-	{NULL, NULL}
-};
+	/* The page doesn't exist yet, theme_adium_load_finished_cb() will
+	 * flush once it does. */
+	if (!priv->page_loaded || priv->script_queue->len == 0) {
+		return;
+	}
 
-static EmpathyStringParser string_parsers_with_smiley[] = {
-	{empathy_string_match_link, empathy_string_replace_link},
-	{empathy_string_match_smiley, theme_adium_replace_smiley},
-	{theme_adium_match_newline, NULL},
-	{empathy_string_match_all, empathy_string_replace_escaped},
-	{NULL, NULL}
-};
+	DEBUG ("Running %u queued scripts", priv->n_queued_scripts);
 
-static gchar *
-theme_adium_parse_body (const gchar *text)
-{
-	EmpathyStringParser *parsers;
-	GString *string;
-	GSettings *gsettings = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
+	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme),
+					priv->script_queue->str);
+	g_string_truncate (priv->script_queue, 0);
+	priv->n_queued_scripts = 0;
+}
 
-	/* Check if we have to parse smileys */
-	if (g_settings_get_boolean (gsettings, EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
-		parsers = string_parsers_with_smiley;
-	else
-		parsers = string_parsers;
-
-	/* Parse text and construct string with links and smileys replaced
-	 * by html tags. Also escape text to make sure html code is
-	 * displayed verbatim. */
-	string = g_string_sized_new (strlen (text));
-	empathy_string_parser_substr (text, -1, parsers, string);
+static gboolean
+theme_adium_flush_scripts_cb (gpointer user_data)
+{
+	EmpathyThemeAdium     *theme = user_data;
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 
-	g_object_unref (gsettings);
+	priv->script_flush_id = 0;
+	theme_adium_flush_scripts (theme);
 
-	return g_string_free (string, FALSE);
+	return FALSE;
 }
 
+/* Statements are batched so that a burst of messages costs a single script
+ * evaluation, layout and scroll per main loop iteration. */
 static void
-escape_and_append_len (GString *string, const gchar *str, gint len)
+theme_adium_schedule_flush (EmpathyThemeAdium *theme)
 {
-	while (*str != '\0' && len != 0) {
-		switch (*str) {
-		case '\\':
-			/* \ becomes \\ */
-			g_string_append (string, "\\\\");
-			break;
-		case '\"':
-			/* " becomes \" */
-			g_string_append (string, "\\\"");
-			break;
-		case '\n':
-			/* Remove end of lines */
-			break;
-		default:
-			g_string_append_c (string, *str);
-		}
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	priv->n_queued_scripts++;
 
-		str++;
-		len--;
+	if (priv->script_flush_id == 0 && priv->page_loaded) {
+		priv->script_flush_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+			theme_adium_flush_scripts_cb, theme, NULL);
 	}
 }
 
-static gboolean
-theme_adium_match (const gchar **str, const gchar *match)
+static void
+theme_adium_queue_script (EmpathyThemeAdium *theme,
+			  const gchar       *script)
 {
-	gint len;
-
-	len = strlen (match);
-	if (strncmp (*str, match, len) == 0) {
-		*str += len - 1;
-		return TRUE;
-	}
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 
-	return FALSE;
+	g_string_append (priv->script_queue, script);
+	g_string_append (priv->script_queue, ";\n");
+	theme_adium_schedule_flush (theme);
 }
 
 static void
-theme_adium_append_html (EmpathyThemeAdium *theme,
-			 const gchar       *func,
-			 const gchar       *html, gsize len,
-		         const gchar       *message,
-		         const gchar       *avatar_filename,
-		         const gchar       *name,
-		         const gchar       *contact_id,
-		         const gchar       *service_name,
-		         const gchar       *message_classes,
-		         time_t             timestamp,
-		         gboolean           is_backlog)
+theme_adium_append_html (EmpathyThemeAdium    *theme,
+			 const gchar          *func,
+			 EmpathyAdiumTemplate *tmpl,
+			 const gchar          *message,
+			 const gchar          *avatar_filename,
+			 const gchar          *name,
+			 const gchar          *contact_id,
+			 const gchar          *service_name,
+			 const gchar          *message_classes,
+			 time_t                timestamp,
+			 guint                 body_hash,
+			 gboolean              is_backlog)
 {
-	GString     *string;
-	const gchar *cur = NULL;
-	gchar       *script;
-
-	/* Make some search-and-replace in the html code */
-	string = g_string_sized_new (len + strlen (message));
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	GString               *string = priv->script_queue;
+	gboolean               new_block;
+
+	/* appendNextMessage() adds to the current block, appendMessage()
+	 * starts a new one */
+	new_block = !tp_strdiff (func, "appendMessage");
+
+	/* Render the template straight into the queued script */
+	if (new_block) {
+		g_string_append_printf (string,
+					"empathyBlock(%" G_GINT64_FORMAT ", %u, "
+					"function () { ", (gint64) timestamp,
+					body_hash);
+	}
 	g_string_append_printf (string, "%s(\"", func);
-	for (cur = html; *cur != '\0'; cur++) {
-		const gchar *replace = NULL;
-		gchar       *dup_replace = NULL;
-
-		if (theme_adium_match (&cur, "%message%")) {
-			replace = message;
-		} else if (theme_adium_match (&cur, "%messageClasses%")) {
-			replace = message_classes;
-		} else if (theme_adium_match (&cur, "%userIconPath%")) {
-			replace = avatar_filename;
-		} else if (theme_adium_match (&cur, "%sender%")) {
-			replace = name;
-		} else if (theme_adium_match (&cur, "%senderScreenName%")) {
-			replace = contact_id;
-		} else if (theme_adium_match (&cur, "%senderDisplayName%")) {
-			/* %senderDisplayName% -
-			 * "The serverside (remotely set) name of the sender,
-			 *  such as an MSN display name."
-			 *
-			 * We don't have access to that yet so we use local
-			 * alias instead.*/
-			replace = name;
-		} else if (theme_adium_match (&cur, "%service%")) {
-			replace = service_name;
-		} else if (theme_adium_match (&cur, "%shortTime%")) {
-			dup_replace = empathy_time_to_string_local (timestamp,
-				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			replace = dup_replace;
-		} else if (theme_adium_match (&cur, "%time")) {
-			gchar *format = NULL;
-			gchar *end;
-			/* Time can be in 2 formats:
-			 * %time% or %time{strftime format}%
-			 * Extract the time format if provided. */
-			if (cur[1] == '{') {
-				cur += 2;
-				end = strstr (cur, "}%");
-				if (!end) {
-					/* Invalid string */
-					continue;
-				}
-				format = g_strndup (cur, end - cur);
-				cur = end + 1;
-			} else {
-				cur++;
-			}
-
-			if (is_backlog) {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					format ? format : EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
-			} else {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					format ? format : EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			}
-			replace = dup_replace;
-			g_free (format);
-		} else {
-			escape_and_append_len (string, cur, 1);
-			continue;
-		}
+	empathy_adium_template_render (tmpl, string, message,
+				       avatar_filename, name, contact_id,
+				       service_name, message_classes,
+				       timestamp, is_backlog);
+	g_string_append (string, "\")");
+	if (new_block) {
+		g_string_append (string, "; })");
+	}
+	g_string_append (string, ";\n");
 
-		/* Here we have a replacement to make */
-		escape_and_append_len (string, replace, -1);
-		g_free (dup_replace);
+	if (new_block && priv->max_messages > 0) {
+		g_string_append_printf (string, "empathyPrune(%u, %u);\n",
+					priv->max_messages,
+					MAX (priv->max_messages / 10, 1));
 	}
-	g_string_append (string, "\")");
 
-	script = g_string_free (string, FALSE);
-	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme), script);
-	g_free (script);
+	theme_adium_schedule_flush (theme);
+}
+
+/* Identifies the message a block starts with, along with its timestamp,
+ * when asking for older messages. 0 is used for events. */
+static guint
+theme_adium_body_hash (const gchar *body)
+{
+	return g_str_hash (body != NULL ? body : "");
 }
 
 static void
 theme_adium_append_event_escaped (EmpathyChatView *view,
-				  const gchar     *escaped)
+				  const gchar     *escaped,
+				  time_t           timestamp,
+				  guint            body_hash)
 {
 	EmpathyThemeAdium     *theme = EMPATHY_THEME_ADIUM (view);
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 
-	if (priv->data->status_html) {
+	if (priv->data->status) {
 		theme_adium_append_html (theme, "appendMessage",
-					 priv->data->status_html,
-					 priv->data->status_len,
+					 priv->data->status,
 					 escaped, NULL, NULL, NULL, NULL,
-					 "event", empathy_time_get_current (), FALSE);
+					 "event", timestamp, body_hash, FALSE);
 	}
 
 	/* There is no last contact */
@@ -428,6 +519,119 @@ theme_adium_append_event_escaped (EmpathyChatView *view,
 	}
 }
 
+static const gchar *
+theme_adium_get_service_name (EmpathyContact *sender)
+{
+	TpAccount   *account;
+	const gchar *service_name;
+
+	account = empathy_contact_get_account (sender);
+	service_name = empathy_protocol_name_to_display_name
+		(tp_account_get_protocol (account));
+	if (service_name == NULL)
+		service_name = tp_account_get_protocol (account);
+
+	return service_name;
+}
+
+static const gchar *
+theme_adium_get_avatar_filename (EmpathyThemeAdium *theme,
+				 EmpathyContact    *sender)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	EmpathyAvatar         *avatar;
+	const gchar           *avatar_filename = NULL;
+
+	/* Get the avatar filename, or a fallback */
+	avatar = empathy_contact_get_avatar (sender);
+	if (avatar) {
+		avatar_filename = avatar->filename;
+	}
+	if (!avatar_filename) {
+		if (empathy_contact_is_user (sender)) {
+			avatar_filename = priv->data->default_outgoing_avatar_filename;
+		} else {
+			avatar_filename = priv->data->default_incoming_avatar_filename;
+		}
+		if (!avatar_filename) {
+			if (!priv->data->default_avatar_filename) {
+				priv->data->default_avatar_filename =
+					empathy_filename_from_icon_name (EMPATHY_IMAGE_AVATAR_DEFAULT,
+									 GTK_ICON_SIZE_DIALOG);
+			}
+			avatar_filename = priv->data->default_avatar_filename;
+		}
+	}
+
+	return avatar_filename;
+}
+
+static EmpathyAdiumTemplate *
+theme_adium_get_template (EmpathyThemeAdium *theme,
+			  gboolean           outgoing,
+			  gboolean           consecutive,
+			  gboolean           is_backlog)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	EmpathyAdiumTemplate  *tmpl = NULL;
+
+	/* Outgoing */
+	if (outgoing) {
+		if (consecutive) {
+			if (is_backlog) {
+				tmpl = priv->data->out_nextcontext;
+			}
+
+			/* Not backlog, or fallback if NextContext.html
+			 * is missing */
+			if (tmpl == NULL) {
+				tmpl = priv->data->out_nextcontent;
+			}
+		}
+
+		/* Not consecutive, or fallback if NextContext.html and/or
+		 * NextContent.html are missing */
+		if (tmpl == NULL) {
+			if (is_backlog) {
+				tmpl = priv->data->out_context;
+			}
+
+			if (tmpl == NULL) {
+				tmpl = priv->data->out_content;
+			}
+		}
+	}
+
+	/* Incoming, or fallback if outgoing files are missing */
+	if (tmpl == NULL) {
+		if (consecutive) {
+			if (is_backlog) {
+				tmpl = priv->data->in_nextcontext;
+			}
+
+			/* Note backlog, or fallback if NextContext.html
+			 * is missing */
+			if (tmpl == NULL) {
+				tmpl = priv->data->in_nextcontent;
+			}
+		}
+
+		/* Not consecutive, or fallback if NextContext.html and/or
+		 * NextContent.html are missing */
+		if (tmpl == NULL) {
+			if (is_backlog) {
+				tmpl = priv->data->in_context;
+			}
+
+			if (tmpl == NULL) {
+				tmpl = priv->data->in_content;
+			}
+		}
+	}
+
+	return tmpl;
+}
+
 static void
 theme_adium_append_message (EmpathyChatView *view,
 			    EmpathyMessage  *msg)
@@ -435,16 +639,13 @@ theme_adium_append_message (EmpathyChatView *view,
 	EmpathyThemeAdium     *theme = EMPATHY_THEME_ADIUM (view);
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 	EmpathyContact        *sender;
-	TpAccount             *account;
 	gchar                 *body_escaped;
 	const gchar           *body;
 	const gchar           *name;
 	const gchar           *contact_id;
-	EmpathyAvatar         *avatar;
-	const gchar           *avatar_filename = NULL;
+	const gchar           *avatar_filename;
 	time_t                 timestamp;
-	gchar                 *html = NULL;
-	gsize                  len = 0;
+	EmpathyAdiumTemplate  *tmpl;
 	const gchar           *func;
 	const gchar           *service_name;
 	GString               *message_classes = NULL;
@@ -459,14 +660,10 @@ theme_adium_append_message (EmpathyChatView *view,
 
 	/* Get information */
 	sender = empathy_message_get_sender (msg);
-	account = empathy_contact_get_account (sender);
-	service_name = empathy_protocol_name_to_display_name
-		(tp_account_get_protocol (account));
-	if (service_name == NULL)
-		service_name = tp_account_get_protocol (account);
+	service_name = theme_adium_get_service_name (sender);
 	timestamp = empathy_message_get_timestamp (msg);
 	body = empathy_message_get_body (msg);
-	body_escaped = theme_adium_parse_body (body);
+	body_escaped = theme_adium_parse_body (theme, body);
 	name = empathy_contact_get_alias (sender);
 	contact_id = empathy_contact_get_id (sender);
 
@@ -475,33 +672,15 @@ theme_adium_append_message (EmpathyChatView *view,
 		gchar *str;
 
 		str = g_strdup_printf ("%s %s", name, body_escaped);
-		theme_adium_append_event_escaped (view, str);
+		theme_adium_append_event_escaped (view, str, timestamp,
+						  theme_adium_body_hash (body));
 
 		g_free (str);
 		g_free (body_escaped);
 		return;
 	}
 
-	/* Get the avatar filename, or a fallback */
-	avatar = empathy_contact_get_avatar (sender);
-	if (avatar) {
-		avatar_filename = avatar->filename;
-	}
-	if (!avatar_filename) {
-		if (empathy_contact_is_user (sender)) {
-			avatar_filename = priv->data->default_outgoing_avatar_filename;
-		} else {
-			avatar_filename = priv->data->default_incoming_avatar_filename;
-		}
-		if (!avatar_filename) {
-			if (!priv->data->default_avatar_filename) {
-				priv->data->default_avatar_filename =
-					empathy_filename_from_icon_name (EMPATHY_IMAGE_AVATAR_DEFAULT,
-									 GTK_ICON_SIZE_DIALOG);
-			}
-			avatar_filename = priv->data->default_avatar_filename;
-		}
-	}
+	avatar_filename = theme_adium_get_avatar_filename (theme, sender);
 
 	/* We want to join this message with the last one if
 	 * - senders are the same contact,
@@ -536,73 +715,16 @@ theme_adium_append_message (EmpathyChatView *view,
 		func = "appendMessage";
 	}
 
-	/* Outgoing */
-	if (empathy_contact_is_user (sender)) {
-		if (consecutive) {
-			if (is_backlog) {
-				html = priv->data->out_nextcontext_html;
-				len = priv->data->out_nextcontext_len;
-			}
-
-			/* Not backlog, or fallback if NextContext.html
-			 * is missing */
-			if (html == NULL) {
-				html = priv->data->out_nextcontent_html;
-				len = priv->data->out_nextcontent_len;
-			}
-		}
-
-		/* Not consecutive, or fallback if NextContext.html and/or
-		 * NextContent.html are missing */
-		if (html == NULL) {
-			if (is_backlog) {
-				html = priv->data->out_context_html;
-				len = priv->data->out_context_len;
-			}
-
-			if (html == NULL) {
-				html = priv->data->out_content_html;
-				len = priv->data->out_content_len;
-			}
-		}
-	}
-
-	/* Incoming, or fallback if outgoing files are missing */
-	if (html == NULL) {
-		if (consecutive) {
-			if (is_backlog) {
-				html = priv->data->in_nextcontext_html;
-				len = priv->data->in_nextcontext_len;
-			}
-
-			/* Note backlog, or fallback if NextContext.html
-			 * is missing */
-			if (html == NULL) {
-				html = priv->data->in_nextcontent_html;
-				len = priv->data->in_nextcontent_len;
-			}
-		}
-
-		/* Not consecutive, or fallback if NextContext.html and/or
-		 * NextContent.html are missing */
-		if (html == NULL) {
-			if (is_backlog) {
-				html = priv->data->in_context_html;
-				len = priv->data->in_context_len;
-			}
-
-			if (html == NULL) {
-				html = priv->data->in_content_html;
-				len = priv->data->in_content_len;
-			}
-		}
-	}
+	tmpl = theme_adium_get_template (theme,
+					 empathy_contact_is_user (sender),
+					 consecutive, is_backlog);
 
-	if (html != NULL) {
-		theme_adium_append_html (theme, func, html, len, body_escaped,
+	if (tmpl != NULL) {
+		theme_adium_append_html (theme, func, tmpl, body_escaped,
 					 avatar_filename, name, contact_id,
 					 service_name, message_classes->str,
-					 timestamp, is_backlog);
+					 timestamp, theme_adium_body_hash (body),
+					 is_backlog);
 	} else {
 		DEBUG ("Couldn't find HTML file for this message");
 	}
@@ -619,6 +741,110 @@ theme_adium_append_message (EmpathyChatView *view,
 	g_string_free (message_classes, TRUE);
 }
 
+/**
+ * empathy_theme_adium_prepend_messages:
+ * @theme: an #EmpathyThemeAdium
+ * @messages: a #GList of #EmpathyMessage, oldest first
+ *
+ * Displays the messages fetched in reply to
+ * #EmpathyThemeAdium::older-messages-needed above the ones already in the
+ * page. An empty list means there are no older messages to show.
+ */
+void
+empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+				      GList             *messages)
+{
+	EmpathyThemeAdiumPriv *priv;
+	GString               *string;
+	GString               *timestamps;
+	GString               *hashes;
+	GList                 *l;
+
+	g_return_if_fail (EMPATHY_IS_THEME_ADIUM (theme));
+
+	priv = GET_PRIV (theme);
+
+	/* The page which asked for them has been replaced since */
+	if (!priv->page_loaded) {
+		return;
+	}
+
+	if (messages == NULL) {
+		theme_adium_queue_script (theme, "empathyNoOlderMessages()");
+		return;
+	}
+
+	string = priv->script_queue;
+	timestamps = g_string_new (NULL);
+	hashes = g_string_new (NULL);
+
+	g_string_append (string, "empathyPrependMessages([");
+	for (l = messages; l != NULL; l = l->next) {
+		EmpathyMessage       *msg = l->data;
+		EmpathyContact       *sender;
+		EmpathyAdiumTemplate *tmpl;
+		const gchar          *name;
+		const gchar          *message_classes;
+		gchar                *body_escaped;
+		time_t                timestamp;
+
+		sender = empathy_message_get_sender (msg);
+		name = empathy_contact_get_alias (sender);
+		timestamp = empathy_message_get_timestamp (msg);
+		body_escaped = theme_adium_parse_body (theme,
+			empathy_message_get_body (msg));
+
+		/* Blocks added above are never joined with each other */
+		if (empathy_message_get_tptype (msg) == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION) {
+			gchar *str;
+
+			str = g_strdup_printf ("%s %s", name, body_escaped);
+			g_free (body_escaped);
+			body_escaped = str;
+
+			tmpl = priv->data->status;
+			message_classes = "event";
+		} else {
+			tmpl = theme_adium_get_template (theme,
+				empathy_contact_is_user (sender), FALSE, TRUE);
+			message_classes = empathy_contact_is_user (sender) ?
+				"message history outgoing" :
+				"message history incoming";
+		}
+
+		if (tmpl == NULL) {
+			g_free (body_escaped);
+			continue;
+		}
+
+		if (timestamps->len > 0) {
+			g_string_append_c (string, ',');
+			g_string_append_c (timestamps, ',');
+			g_string_append_c (hashes, ',');
+		}
+
+		g_string_append_c (string, '"');
+		empathy_adium_template_render (tmpl, string, body_escaped,
+			theme_adium_get_avatar_filename (theme, sender),
+			name, empathy_contact_get_id (sender),
+			theme_adium_get_service_name (sender),
+			message_classes, timestamp, TRUE);
+		g_string_append_c (string, '"');
+		g_string_append_printf (timestamps, "%" G_GINT64_FORMAT,
+					(gint64) timestamp);
+		g_string_append_printf (hashes, "%u",
+			theme_adium_body_hash (empathy_message_get_body (msg)));
+
+		g_free (body_escaped);
+	}
+	g_string_append_printf (string, "], [%s], [%s]);\n",
+				timestamps->str, hashes->str);
+	g_string_free (timestamps, TRUE);
+	g_string_free (hashes, TRUE);
+
+	theme_adium_schedule_flush (theme);
+}
+
 static void
 theme_adium_append_event (EmpathyChatView *view,
 			  const gchar     *str)
@@ -626,7 +852,8 @@ theme_adium_append_event (EmpathyChatView *view,
 	gchar *str_escaped;
 
 	str_escaped = g_markup_escape_text (str, -1);
-	theme_adium_append_event_escaped (view, str_escaped);
+	theme_adium_append_event_escaped (view, str_escaped,
+					  empathy_time_get_current (), 0);
 	g_free (str_escaped);
 }
 
@@ -641,7 +868,8 @@ theme_adium_scroll (EmpathyChatView *view,
 static void
 theme_adium_scroll_down (EmpathyChatView *view)
 {
-	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (view), "scrollToBottom()");
+	/* Queued so that it runs after the messages appended before it */
+	theme_adium_queue_script (EMPATHY_THEME_ADIUM (view), "scrollToBottom()");
 }
 
 static gboolean
@@ -656,6 +884,14 @@ theme_adium_clear (EmpathyChatView *view)
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
 	gchar *basedir_uri;
 
+	/* Scripts still queued were meant for the page being replaced */
+	if (priv->script_flush_id != 0) {
+		g_source_remove (priv->script_flush_id);
+		priv->script_flush_id = 0;
+	}
+	g_string_truncate (priv->script_queue, 0);
+	priv->n_queued_scripts = 0;
+
 	priv->page_loaded = FALSE;
 	basedir_uri = g_strconcat ("file://", priv->data->basedir, NULL);
 	webkit_web_view_load_html_string (WEBKIT_WEB_VIEW (view),
@@ -677,6 +913,9 @@ theme_adium_find_previous (EmpathyChatView *view,
 			   gboolean         new_search,
 			   gboolean         match_case)
 {
+	/* Search the queued messages too */
+	theme_adium_flush_scripts (EMPATHY_THEME_ADIUM (view));
+
 	/* FIXME: Doesn't respect new_search */
 	return webkit_web_view_search_text (WEBKIT_WEB_VIEW (view),
 					    search_criteria, match_case,
@@ -689,6 +928,9 @@ theme_adium_find_next (EmpathyChatView *view,
 		       gboolean         new_search,
 		       gboolean         match_case)
 {
+	/* Search the queued messages too */
+	theme_adium_flush_scripts (EMPATHY_THEME_ADIUM (view));
+
 	/* FIXME: Doesn't respect new_search */
 	return webkit_web_view_search_text (WEBKIT_WEB_VIEW (view),
 					    search_criteria, match_case,
@@ -715,6 +957,9 @@ theme_adium_highlight (EmpathyChatView *view,
 		       const gchar     *text,
 		       gboolean         match_case)
 {
+	/* Highlight the queued messages too */
+	theme_adium_flush_scripts (EMPATHY_THEME_ADIUM (view));
+
 	webkit_web_view_unmark_text_matches (WEBKIT_WEB_VIEW (view));
 	webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (view),
 					   text, match_case, 0);
@@ -859,9 +1104,19 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
 	EmpathyChatView       *chat_view = EMPATHY_CHAT_VIEW (view);
 
+	GString               *label;
+
 	DEBUG ("Page loaded");
 	priv->page_loaded = TRUE;
 
+	/* Install the helpers used to prune old messages */
+	webkit_web_view_execute_script (view, theme_adium_support_js);
+	label = g_string_new ("empathyOlderLabel = \"");
+	empathy_adium_escape_append (label, _("Show older messages"), -1);
+	g_string_append (label, "\";");
+	webkit_web_view_execute_script (view, label->str);
+	g_string_free (label, TRUE);
+
 	/* Display queued messages */
 	priv->message_queue = g_list_reverse (priv->message_queue);
 	while (priv->message_queue) {
@@ -871,6 +1126,8 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 		priv->message_queue = g_list_remove (priv->message_queue, message);
 		g_object_unref (message);
 	}
+
+	theme_adium_flush_scripts (EMPATHY_THEME_ADIUM (view));
 }
 
 static void
@@ -880,6 +1137,8 @@ theme_adium_finalize (GObject *object)
 
 	empathy_adium_data_unref (priv->data);
 	g_object_unref (priv->gsettings_chat);
+	g_array_free (priv->tokens, TRUE);
+	g_string_free (priv->script_queue, TRUE);
 
 	G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
@@ -904,6 +1163,11 @@ theme_adium_dispose (GObject *object)
 		priv->inspector_window = NULL;
 	}
 
+	if (priv->script_flush_id != 0) {
+		g_source_remove (priv->script_flush_id);
+		priv->script_flush_id = 0;
+	}
+
 	G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1087,6 +1351,9 @@ theme_adium_get_property (GObject    *object,
 	case PROP_ADIUM_DATA:
 		g_value_set_boxed (value, priv->data);
 		break;
+	case PROP_MAX_MESSAGES:
+		g_value_set_uint (value, priv->max_messages);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
 		break;
@@ -1106,6 +1373,9 @@ theme_adium_set_property (GObject      *object,
 		g_assert (priv->data == NULL);
 		priv->data = g_value_dup_boxed (value);
 		break;
+	case PROP_MAX_MESSAGES:
+		priv->max_messages = g_value_get_uint (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
 		break;
@@ -1136,6 +1406,39 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
 							      G_PARAM_READWRITE |
 							      G_PARAM_STATIC_STRINGS));
 
+	g_object_class_install_property (object_class,
+					 PROP_MAX_MESSAGES,
+					 g_param_spec_uint ("max-messages",
+							    "Maximum messages",
+							    "Number of message blocks kept "
+							    "displayed, 0 for no limit",
+							    0, G_MAXUINT,
+							    DEFAULT_MAX_MESSAGES,
+							    G_PARAM_READWRITE |
+							    G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * EmpathyThemeAdium::older-messages-needed:
+	 * @theme: the #EmpathyThemeAdium
+	 * @before: the timestamp of the oldest message still displayed
+	 * @body_hash: g_str_hash() of the body of that message, or 0 if it is
+	 *  an event
+	 *
+	 * Emitted when the user scrolls back to messages which have been
+	 * pruned. The handler is expected to fetch the messages preceding
+	 * the one identified by @before and @body_hash, and to pass them to
+	 * empathy_theme_adium_prepend_messages().
+	 */
+	signals[OLDER_MESSAGES_NEEDED] =
+		g_signal_new ("older-messages-needed",
+			      G_TYPE_FROM_CLASS (klass),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      _empathy_gtk_marshal_VOID__LONG_UINT,
+			      G_TYPE_NONE,
+			      2, G_TYPE_LONG, G_TYPE_UINT);
+
 	g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -1148,6 +1451,9 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 	theme->priv = priv;
 
 	priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
+	priv->tokens = empathy_string_tokens_new ();
+	priv->script_queue = g_string_new (NULL);
+	priv->max_messages = DEFAULT_MAX_MESSAGES;
 
 	g_signal_connect (theme, "load-finished",
 			  G_CALLBACK (theme_adium_load_finished_cb),
@@ -1243,6 +1549,24 @@ empathy_adium_data_get_type (void)
   return type_id;
 }
 
+static EmpathyAdiumTemplate *
+adium_data_load_template (const gchar *basedir,
+			  const gchar *filename)
+{
+	EmpathyAdiumTemplate *tmpl = NULL;
+	gchar                *file;
+	gchar                *html;
+
+	file = g_build_filename (basedir, filename, NULL);
+	if (g_file_get_contents (file, &html, NULL, NULL)) {
+		tmpl = empathy_adium_template_new (html);
+		g_free (html);
+	}
+	g_free (file);
+
+	return tmpl;
+}
+
 EmpathyAdiumData  *
 empathy_adium_data_new_with_info (const gchar *path, GHashTable *info)
 {
@@ -1268,41 +1592,24 @@ empathy_adium_data_new_with_info (const gchar *path, GHashTable *info)
 	data->info = g_hash_table_ref (info);
 
 	/* Load html files */
-	file = g_build_filename (data->basedir, "Incoming", "Content.html", NULL);
-	g_file_get_contents (file, &data->in_content_html, &data->in_content_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Incoming", "NextContent.html", NULL);
-	g_file_get_contents (file, &data->in_nextcontent_html, &data->in_nextcontent_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Incoming", "Context.html", NULL);
-	g_file_get_contents (file, &data->in_context_html, &data->in_context_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Incoming", "NextContext.html", NULL);
-	g_file_get_contents (file, &data->in_nextcontext_html, &data->in_nextcontext_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Outgoing", "Content.html", NULL);
-	g_file_get_contents (file, &data->out_content_html, &data->out_content_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Outgoing", "NextContent.html", NULL);
-	g_file_get_contents (file, &data->out_nextcontent_html, &data->out_nextcontent_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Outgoing", "Context.html", NULL);
-	g_file_get_contents (file, &data->out_context_html, &data->out_context_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Outgoing", "NextContext.html", NULL);
-	g_file_get_contents (file, &data->out_nextcontext_html, &data->out_nextcontext_len, NULL);
-	g_free (file);
-
-	file = g_build_filename (data->basedir, "Status.html", NULL);
-	g_file_get_contents (file, &data->status_html, &data->status_len, NULL);
-	g_free (file);
+	data->in_content = adium_data_load_template (data->basedir,
+		"Incoming" G_DIR_SEPARATOR_S "Content.html");
+	data->in_nextcontent = adium_data_load_template (data->basedir,
+		"Incoming" G_DIR_SEPARATOR_S "NextContent.html");
+	data->in_context = adium_data_load_template (data->basedir,
+		"Incoming" G_DIR_SEPARATOR_S "Context.html");
+	data->in_nextcontext = adium_data_load_template (data->basedir,
+		"Incoming" G_DIR_SEPARATOR_S "NextContext.html");
+	data->out_content = adium_data_load_template (data->basedir,
+		"Outgoing" G_DIR_SEPARATOR_S "Content.html");
+	data->out_nextcontent = adium_data_load_template (data->basedir,
+		"Outgoing" G_DIR_SEPARATOR_S "NextContent.html");
+	data->out_context = adium_data_load_template (data->basedir,
+		"Outgoing" G_DIR_SEPARATOR_S "Context.html");
+	data->out_nextcontext = adium_data_load_template (data->basedir,
+		"Outgoing" G_DIR_SEPARATOR_S "NextContext.html");
+	data->status = adium_data_load_template (data->basedir,
+		"Status.html");
 
 	file = g_build_filename (data->basedir, "Footer.html", NULL);
 	g_file_get_contents (file, &footer_html, &footer_len, NULL);
@@ -1417,18 +1724,18 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
 		g_free (data->path);
 		g_free (data->basedir);
 		g_free (data->template_html);
-		g_free (data->in_content_html);
-		g_free (data->in_nextcontent_html);
-		g_free (data->in_context_html);
-		g_free (data->in_nextcontext_html);
-		g_free (data->out_content_html);
-		g_free (data->out_nextcontent_html);
-		g_free (data->out_context_html);
-		g_free (data->out_nextcontext_html);
+		empathy_adium_template_free (data->in_content);
+		empathy_adium_template_free (data->in_nextcontent);
+		empathy_adium_template_free (data->in_context);
+		empathy_adium_template_free (data->in_nextcontext);
+		empathy_adium_template_free (data->out_content);
+		empathy_adium_template_free (data->out_nextcontent);
+		empathy_adium_template_free (data->out_context);
+		empathy_adium_template_free (data->out_nextcontext);
 		g_free (data->default_avatar_filename);
 		g_free (data->default_incoming_avatar_filename);
 		g_free (data->default_outgoing_avatar_filename);
-		g_free (data->status_html);
+		empathy_adium_template_free (data->status);
 		g_hash_table_unref (data->info);
 		g_slice_free (EmpathyAdiumData, data);
 	}
@@ -50,6 +50,8 @@ struct _EmpathyThemeAdiumClass {
 
 GType              empathy_theme_adium_get_type (void) G_GNUC_CONST;
 EmpathyThemeAdium *empathy_theme_adium_new      (EmpathyAdiumData *data);
+void               empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+							  GList             *messages);
 
 gboolean           empathy_adium_path_is_valid (const gchar *path);
 GHashTable        *empathy_adium_info_new (const gchar *path);
@@ -92,7 +92,6 @@ theme_irc_append_message (EmpathyChatTextView *view,
 						  &iter,
 						  tmp,
 						  -1,
-						  "cut",
 						  nick_tag,
 						  NULL);
 	g_free (tmp);
@@ -467,42 +467,182 @@ avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
 	return pixbuf;
 }
 
-GdkPixbuf *
-empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
-				  gint          width,
-				  gint          height)
+/* Decoded and scaled avatars, most recently used first, so that every view
+ * showing the same avatar at the same size doesn't decode it again. Avatar
+ * files are named after their token, so a file name always refers to the
+ * same image. Avatars are always roundified the same way, so that's not
+ * part of the key. */
+#define AVATAR_CACHE_MAX_BYTES (8 * 1024 * 1024)
+
+typedef struct {
+	gchar     *key;
+	GdkPixbuf *pixbuf;
+	gsize      size;
+} AvatarCacheEntry;
+
+/* key -> GList link in avatar_cache_lru */
+static GHashTable *avatar_cache = NULL;
+static GQueue      avatar_cache_lru = G_QUEUE_INIT;
+static gsize       avatar_cache_bytes = 0;
+
+/* Avatars mapped from their file are keyed by content, so the same image
+ * cached by several accounts is only decoded once */
+static gchar *
+avatar_cache_key (EmpathyAvatar *avatar,
+		  gint           width,
+		  gint           height)
 {
-	GdkPixbuf        *pixbuf;
-	GdkPixbufLoader	 *loader;
-	struct SizeData   data;
-	GError           *error = NULL;
+	if (avatar->content_hash != NULL) {
+		return g_strdup_printf ("%dx%d:sha1:%s", width, height,
+					avatar->content_hash);
+	}
 
-	if (!avatar) {
+	if (avatar->filename == NULL) {
+		return NULL;
+	}
+
+	return g_strdup_printf ("%dx%d:%s", width, height, avatar->filename);
+}
+
+static GdkPixbuf *
+avatar_cache_lookup (const gchar *key)
+{
+	GList            *link;
+	AvatarCacheEntry *entry;
+
+	if (key == NULL || avatar_cache == NULL) {
+		return NULL;
+	}
+
+	link = g_hash_table_lookup (avatar_cache, key);
+	if (link == NULL) {
 		return NULL;
 	}
 
-	data.width = width;
-	data.height = height;
-	data.preserve_aspect_ratio = TRUE;
+	g_queue_unlink (&avatar_cache_lru, link);
+	g_queue_push_head_link (&avatar_cache_lru, link);
+
+	entry = link->data;
+	return g_object_ref (entry->pixbuf);
+}
+
+static void
+avatar_cache_insert (const gchar *key,
+		     GdkPixbuf   *pixbuf)
+{
+	AvatarCacheEntry *entry;
+
+	if (key == NULL || pixbuf == NULL) {
+		return;
+	}
+
+	if (avatar_cache == NULL) {
+		avatar_cache = g_hash_table_new (g_str_hash, g_str_equal);
+	} else if (g_hash_table_lookup (avatar_cache, key) != NULL) {
+		return;
+	}
+
+	entry = g_slice_new (AvatarCacheEntry);
+	entry->key = g_strdup (key);
+	entry->pixbuf = g_object_ref (pixbuf);
+	entry->size = gdk_pixbuf_get_rowstride (pixbuf) *
+		gdk_pixbuf_get_height (pixbuf);
+
+	g_queue_push_head (&avatar_cache_lru, entry);
+	g_hash_table_insert (avatar_cache, entry->key, avatar_cache_lru.head);
+	avatar_cache_bytes += entry->size;
+
+	/* Evict the least recently used avatars, keeping the new one */
+	while (avatar_cache_bytes > AVATAR_CACHE_MAX_BYTES &&
+	       avatar_cache_lru.length > 1) {
+		entry = g_queue_pop_tail (&avatar_cache_lru);
+
+		g_hash_table_remove (avatar_cache, entry->key);
+		avatar_cache_bytes -= entry->size;
+
+		g_object_unref (entry->pixbuf);
+		g_free (entry->key);
+		g_slice_free (AvatarCacheEntry, entry);
+	}
+}
+
+/* Decodes and scales an avatar image. Images which are cut short are still
+ * used, as far as they could be decoded. */
+static GdkPixbuf *
+avatar_pixbuf_decode (const guchar  *data,
+		      gsize          len,
+		      gint           width,
+		      gint           height,
+		      GError       **error)
+{
+	GdkPixbuf       *pixbuf = NULL;
+	GdkPixbufLoader *loader;
+	struct SizeData  size_data;
+	GError          *close_error = NULL;
+
+	size_data.width = width;
+	size_data.height = height;
+	size_data.preserve_aspect_ratio = TRUE;
 
 	loader = gdk_pixbuf_loader_new ();
 
 	g_signal_connect (loader, "size-prepared",
 			  G_CALLBACK (pixbuf_from_avatar_size_prepared_cb),
-			  &data);
+			  &size_data);
+
+	if (!gdk_pixbuf_loader_write (loader, data, len, error)) {
+		gdk_pixbuf_loader_close (loader, NULL);
+		goto out;
+	}
+
+	if (!gdk_pixbuf_loader_close (loader, &close_error) &&
+	    gdk_pixbuf_loader_get_pixbuf (loader) == NULL) {
+		g_propagate_error (error, close_error);
+		goto out;
+	}
+	g_clear_error (&close_error);
+
+	pixbuf = avatar_pixbuf_from_loader (loader);
+
+out:
+	g_object_unref (loader);
+
+	return pixbuf;
+}
+
+GdkPixbuf *
+empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
+				  gint          width,
+				  gint          height)
+{
+	GdkPixbuf *pixbuf;
+	GError    *error = NULL;
+	gchar     *key;
+
+	if (!avatar) {
+		return NULL;
+	}
 
-	if (!gdk_pixbuf_loader_write (loader, avatar->data, avatar->len, &error)) {
+	key = avatar_cache_key (avatar, width, height);
+	pixbuf = avatar_cache_lookup (key);
+	if (pixbuf != NULL) {
+		g_free (key);
+		return pixbuf;
+	}
+
+	pixbuf = avatar_pixbuf_decode (avatar->data, avatar->len,
+				       width, height, &error);
+	if (pixbuf == NULL) {
 		g_warning ("Couldn't write avatar image:%p with "
 			   "length:%" G_GSIZE_FORMAT " to pixbuf loader: %s",
 			   avatar->data, avatar->len, error->message);
 		g_error_free (error);
+		g_free (key);
 		return NULL;
 	}
 
-	gdk_pixbuf_loader_close (loader, NULL);
-	pixbuf = avatar_pixbuf_from_loader (loader);
-
-	g_object_unref (loader);
+	avatar_cache_insert (key, pixbuf);
+	g_free (key);
 
 	return pixbuf;
 }
@@ -521,9 +661,263 @@ empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
 	return empathy_pixbuf_from_avatar_scaled (avatar, width, height);
 }
 
+/* Asynchronous avatar decoding, in a thread pool. Requests for the same
+ * avatar at the same size share a job, and jobs whose requests were all
+ * cancelled by the time a thread picks them up, like the ones of rows which
+ * went away, are skipped. */
+#define AVATAR_DECODE_THREADS 2
+
+typedef struct {
+	GSimpleAsyncResult *result;
+	GCancellable       *cancellable;
+} AvatarDecodeWaiter;
+
+typedef struct {
+	gchar         *key;
+	EmpathyAvatar *avatar;
+	gint           width;
+	gint           height;
+	/* AvatarDecodeWaiter, protected by the avatar_decode lock with
+	 * skipped while the job is queued or running */
+	GList         *waiters;
+	gboolean       skipped;
+	GdkPixbuf     *pixbuf;
+	GError        *error;
+} AvatarDecodeJob;
+
+static GThreadPool *avatar_decode_pool = NULL;
+/* key -> queued or running AvatarDecodeJob, only used in the main thread */
+static GHashTable  *avatar_decode_jobs = NULL;
+G_LOCK_DEFINE_STATIC (avatar_decode);
+
+static gboolean
+avatar_decode_waiter_is_cancelled (AvatarDecodeWaiter *waiter)
+{
+	return waiter->cancellable != NULL &&
+		g_cancellable_is_cancelled (waiter->cancellable);
+}
+
+static gboolean
+avatar_decode_job_done_cb (gpointer user_data)
+{
+	AvatarDecodeJob *job = user_data;
+	GList           *l;
+
+	if (job->key != NULL &&
+	    g_hash_table_lookup (avatar_decode_jobs, job->key) == job) {
+		g_hash_table_remove (avatar_decode_jobs, job->key);
+	}
+
+	avatar_cache_insert (job->key, job->pixbuf);
+
+	/* The thread is done with the job, no need to lock anymore */
+	for (l = job->waiters; l != NULL; l = l->next) {
+		AvatarDecodeWaiter *waiter = l->data;
+		GError             *error = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (waiter->cancellable,
+							  &error)) {
+			g_simple_async_result_set_from_error (waiter->result,
+							      error);
+			g_error_free (error);
+		} else if (job->pixbuf != NULL) {
+			g_simple_async_result_set_op_res_gpointer (
+				waiter->result, g_object_ref (job->pixbuf),
+				NULL);
+		} else if (job->error != NULL) {
+			g_simple_async_result_set_from_error (waiter->result,
+							      job->error);
+		} else {
+			g_simple_async_result_set_op_res_gpointer (
+				waiter->result, NULL, NULL);
+		}
+
+		g_simple_async_result_complete (waiter->result);
+
+		g_object_unref (waiter->result);
+		if (waiter->cancellable != NULL) {
+			g_object_unref (waiter->cancellable);
+		}
+		g_slice_free (AvatarDecodeWaiter, waiter);
+	}
+
+	g_list_free (job->waiters);
+	g_clear_error (&job->error);
+	if (job->pixbuf != NULL) {
+		g_object_unref (job->pixbuf);
+	}
+	empathy_avatar_unref (job->avatar);
+	g_free (job->key);
+	g_slice_free (AvatarDecodeJob, job);
+
+	return FALSE;
+}
+
+static void
+avatar_decode_thread (gpointer data,
+		      gpointer user_data)
+{
+	AvatarDecodeJob *job = data;
+	gboolean         wanted = FALSE;
+	GList           *l;
+
+	G_LOCK (avatar_decode);
+	for (l = job->waiters; l != NULL && !wanted; l = l->next) {
+		wanted = !avatar_decode_waiter_is_cancelled (l->data);
+	}
+	job->skipped = !wanted;
+	G_UNLOCK (avatar_decode);
+
+	if (wanted) {
+		job->pixbuf = avatar_pixbuf_decode (job->avatar->data,
+						    job->avatar->len,
+						    job->width, job->height,
+						    &job->error);
+	}
+
+	g_idle_add (avatar_decode_job_done_cb, job);
+}
+
+/* Completes @result with the decoded pixbuf of @avatar, from a thread */
+static void
+avatar_decode_async (EmpathyAvatar      *avatar,
+		     gint                width,
+		     gint                height,
+		     const gchar        *key,
+		     GSimpleAsyncResult *result,
+		     GCancellable       *cancellable)
+{
+	AvatarDecodeWaiter *waiter;
+	AvatarDecodeJob    *job = NULL;
+
+	if (avatar_decode_pool == NULL) {
+		avatar_decode_pool = g_thread_pool_new (avatar_decode_thread,
+							NULL,
+							AVATAR_DECODE_THREADS,
+							FALSE, NULL);
+		avatar_decode_jobs = g_hash_table_new (g_str_hash,
+						       g_str_equal);
+	}
+
+	waiter = g_slice_new (AvatarDecodeWaiter);
+	waiter->result = g_object_ref (result);
+	waiter->cancellable = cancellable != NULL ?
+		g_object_ref (cancellable) : NULL;
+
+	/* Avatars without a file can't be told apart, they get their own job */
+	if (key != NULL) {
+		job = g_hash_table_lookup (avatar_decode_jobs, key);
+	}
+
+	if (job != NULL) {
+		gboolean joined = FALSE;
+
+		G_LOCK (avatar_decode);
+		if (!job->skipped) {
+			job->waiters = g_list_prepend (job->waiters, waiter);
+			joined = TRUE;
+		}
+		G_UNLOCK (avatar_decode);
+
+		if (joined) {
+			return;
+		}
+	}
+
+	job = g_slice_new0 (AvatarDecodeJob);
+	job->key = g_strdup (key);
+	job->avatar = empathy_avatar_ref (avatar);
+	job->width = width;
+	job->height = height;
+	job->waiters = g_list_prepend (NULL, waiter);
+
+	if (key != NULL) {
+		g_hash_table_replace (avatar_decode_jobs, job->key, job);
+	}
+
+	g_thread_pool_push (avatar_decode_pool, job, NULL);
+}
+
+/* Completes @result with @avatar scaled, from the cache or once decoded */
+static void
+avatar_scaled_async (EmpathyAvatar      *avatar,
+		     gint                width,
+		     gint                height,
+		     GSimpleAsyncResult *result,
+		     GCancellable       *cancellable)
+{
+	GdkPixbuf *pixbuf;
+	gchar     *key;
+
+	key = avatar_cache_key (avatar, width, height);
+	pixbuf = avatar_cache_lookup (key);
+
+	if (pixbuf != NULL) {
+		g_simple_async_result_set_op_res_gpointer (result, pixbuf, NULL);
+		g_simple_async_result_complete_in_idle (result);
+	} else {
+		avatar_decode_async (avatar, width, height, key, result,
+				     cancellable);
+	}
+
+	g_free (key);
+}
+
+void
+empathy_pixbuf_avatar_from_contact_scaled_async (EmpathyContact      *contact,
+						 gint                 width,
+						 gint                 height,
+						 GCancellable        *cancellable,
+						 GAsyncReadyCallback  callback,
+						 gpointer             user_data)
+{
+	EmpathyAvatar      *avatar;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail (EMPATHY_IS_CONTACT (contact));
+
+	result = g_simple_async_result_new (G_OBJECT (contact),
+			callback, user_data,
+			empathy_pixbuf_avatar_from_contact_scaled_async);
+
+	avatar = empathy_contact_get_avatar (contact);
+	if (avatar == NULL) {
+		g_simple_async_result_set_op_res_gpointer (result, NULL, NULL);
+		g_simple_async_result_complete_in_idle (result);
+		g_object_unref (result);
+		return;
+	}
+
+	avatar_scaled_async (avatar, width, height, result, cancellable);
+	g_object_unref (result);
+}
+
+GdkPixbuf *
+empathy_pixbuf_avatar_from_contact_scaled_finish (EmpathyContact  *contact,
+						  GAsyncResult    *result,
+						  GError         **error)
+{
+	GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+	gboolean result_valid;
+
+	g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
+	g_return_val_if_fail (G_IS_SIMPLE_ASYNC_RESULT (simple), NULL);
+
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	result_valid = g_simple_async_result_is_valid (result,
+			G_OBJECT (contact),
+			empathy_pixbuf_avatar_from_contact_scaled_async);
+	g_return_val_if_fail (result_valid, NULL);
+
+	return g_simple_async_result_get_op_res_gpointer (simple);
+}
+
 typedef struct {
 	FolksIndividual *individual;
 	GSimpleAsyncResult *result;
+	GCancellable *cancellable;
 	guint width;
 	guint height;
 } PixbufAvatarFromIndividualClosure;
@@ -531,6 +925,7 @@ typedef struct {
 static PixbufAvatarFromIndividualClosure *
 pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
 					   GSimpleAsyncResult *result,
+					   GCancellable       *cancellable,
 					   gint                width,
 					   gint                height)
 {
@@ -542,6 +937,8 @@ pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
 	closure = g_new0 (PixbufAvatarFromIndividualClosure, 1);
 	closure->individual = g_object_ref (individual);
 	closure->result = g_object_ref (result);
+	if (cancellable != NULL)
+		closure->cancellable = g_object_ref (cancellable);
 	closure->width = width;
 	closure->height = height;
 
@@ -554,6 +951,7 @@ pixbuf_avatar_from_individual_closure_free (
 {
 	g_object_unref (closure->individual);
 	g_object_unref (closure->result);
+	tp_clear_object (&closure->cancellable);
 	g_free (closure);
 }
 
@@ -564,53 +962,29 @@ avatar_file_load_contents_cb (GObject      *object,
 {
 	GFile *file = G_FILE (object);
 	PixbufAvatarFromIndividualClosure *closure = user_data;
+	EmpathyAvatar *avatar;
 	char *data = NULL;
 	gsize data_size;
-	struct SizeData size_data;
 	GError *error = NULL;
-	GdkPixbufLoader *loader = NULL;
 
 	if (!g_file_load_contents_finish (file, result, &data, &data_size,
 				NULL, &error)) {
 		DEBUG ("failed to load avatar from file: %s",
 				error->message);
 		g_simple_async_result_set_from_error (closure->result, error);
+		g_simple_async_result_complete (closure->result);
+		g_clear_error (&error);
 		goto out;
 	}
 
-	size_data.width = closure->width;
-	size_data.height = closure->height;
-	size_data.preserve_aspect_ratio = TRUE;
-
-	loader = gdk_pixbuf_loader_new ();
-
-	g_signal_connect (loader, "size-prepared",
-			  G_CALLBACK (pixbuf_from_avatar_size_prepared_cb),
-			  &size_data);
-
-	if (!gdk_pixbuf_loader_write (loader, (guchar *) data, data_size,
-				&error)) {
-		DEBUG ("Failed to write to pixbuf loader: %s",
-			error ? error->message : "No error given");
-		g_simple_async_result_set_from_error (closure->result, error);
-		goto out;
-	}
-	if (!gdk_pixbuf_loader_close (loader, &error)) {
-		DEBUG ("Failed to close pixbuf loader: %s",
-			error ? error->message : "No error given");
-		g_simple_async_result_set_from_error (closure->result, error);
-		goto out;
-	}
-
-	g_simple_async_result_set_op_res_gpointer (closure->result,
-			avatar_pixbuf_from_loader (loader), NULL);
+	/* The avatar takes the data */
+	avatar = empathy_avatar_new ((guchar *) data, data_size, NULL,
+				     g_file_get_path (file));
+	avatar_scaled_async (avatar, closure->width, closure->height,
+			     closure->result, closure->cancellable);
+	empathy_avatar_unref (avatar);
 
 out:
-	g_simple_async_result_complete (closure->result);
-
-	g_clear_error (&error);
-	g_free (data);
-	tp_clear_object (&loader);
 	pixbuf_avatar_from_individual_closure_free (closure);
 }
 
@@ -626,6 +1000,9 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
 	GFile *avatar_file;
 	GSimpleAsyncResult *result;
 	PixbufAvatarFromIndividualClosure *closure;
+	EmpathyAvatar *avatar;
+	gchar *path;
+	GError *error = NULL;
 
 	result = g_simple_async_result_new (G_OBJECT (individual),
 			callback, user_data,
@@ -635,7 +1012,31 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
 	if (avatar_file == NULL)
 		goto out;
 
+	/* Local avatars share the mapping of identical files of other
+	 * accounts, so they are decoded once */
+	path = g_file_get_path (avatar_file);
+	if (path != NULL) {
+		avatar = empathy_avatar_dup_from_file (path, NULL, &error);
+		g_free (path);
+
+		if (avatar == NULL) {
+			DEBUG ("failed to load avatar from file: %s",
+			       error->message);
+			g_simple_async_result_set_from_error (result, error);
+			g_simple_async_result_complete_in_idle (result);
+			g_clear_error (&error);
+		} else {
+			avatar_scaled_async (avatar, width, height, result,
+					     cancellable);
+			empathy_avatar_unref (avatar);
+		}
+
+		g_object_unref (result);
+		return;
+	}
+
 	closure = pixbuf_avatar_from_individual_closure_new (individual, result,
+							     cancellable,
 							     width, height);
 	if (closure == NULL)
 		goto out;
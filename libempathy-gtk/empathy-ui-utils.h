@@ -92,6 +92,16 @@ GdkPixbuf *   empathy_pixbuf_from_avatar_scaled         (EmpathyAvatar    *avata
 GdkPixbuf *   empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact   *contact,
 							 gint              width,
 							 gint              height);
+void empathy_pixbuf_avatar_from_contact_scaled_async (EmpathyContact      *contact,
+							 gint                 width,
+							 gint                 height,
+							 GCancellable        *cancellable,
+							 GAsyncReadyCallback  callback,
+							 gpointer             user_data);
+GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled_finish (
+							 EmpathyContact   *contact,
+							 GAsyncResult     *result,
+							 GError          **error);
 GdkPixbuf *   empathy_pixbuf_protocol_from_contact_scaled (EmpathyContact   *contact,
 							 gint              width,
 							 gint              height);
@@ -0,0 +1,221 @@
+/*
+ * empathy-checksum-stream.c - Source for EmpathyChecksumStream
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A GFilterOutputStream updating a GChecksum with the bytes written to its
+ * base stream, so that data can be hashed while it is being saved instead
+ * of reading it back afterwards.
+ *
+ * The checksum is updated from whatever thread writes to the stream; only
+ * query it once the writing operation has finished. */
+
+#include <config.h>
+
+#include "empathy-checksum-stream.h"
+
+#include "empathy-utils.h"
+
+G_DEFINE_TYPE (EmpathyChecksumStream, empathy_checksum_stream,
+    G_TYPE_FILTER_OUTPUT_STREAM)
+
+#define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChecksumStream)
+
+enum {
+  PROP_CHECKSUM_TYPE = 1,
+
+  LAST_PROPERTY,
+};
+
+typedef struct {
+  GChecksumType checksum_type;
+  GChecksum *checksum;
+  guint64 bytes;
+} EmpathyChecksumStreamPriv;
+
+static gssize
+checksum_stream_write (GOutputStream *stream,
+    const void *buffer,
+    gsize count,
+    GCancellable *cancellable,
+    GError **error)
+{
+  EmpathyChecksumStreamPriv *priv = GET_PRIV (stream);
+  GOutputStream *base_stream;
+  gssize written;
+
+  base_stream = g_filter_output_stream_get_base_stream (
+      G_FILTER_OUTPUT_STREAM (stream));
+
+  written = g_output_stream_write (base_stream, buffer, count,
+      cancellable, error);
+
+  /* only hash what actually reached the base stream */
+  if (written > 0)
+    {
+      g_checksum_update (priv->checksum, buffer, written);
+      priv->bytes += written;
+    }
+
+  return written;
+}
+
+static void
+empathy_checksum_stream_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyChecksumStreamPriv *priv = GET_PRIV (object);
+
+  switch (property_id)
+    {
+      case PROP_CHECKSUM_TYPE:
+        g_value_set_int (value, priv->checksum_type);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_checksum_stream_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  EmpathyChecksumStreamPriv *priv = GET_PRIV (object);
+
+  switch (property_id)
+    {
+      case PROP_CHECKSUM_TYPE:
+        priv->checksum_type = g_value_get_int (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+empathy_checksum_stream_constructed (GObject *object)
+{
+  EmpathyChecksumStreamPriv *priv = GET_PRIV (object);
+
+  priv->checksum = g_checksum_new (priv->checksum_type);
+
+  if (G_OBJECT_CLASS (empathy_checksum_stream_parent_class)->constructed)
+    G_OBJECT_CLASS (empathy_checksum_stream_parent_class)->constructed (
+        object);
+}
+
+static void
+empathy_checksum_stream_finalize (GObject *object)
+{
+  EmpathyChecksumStreamPriv *priv = GET_PRIV (object);
+
+  if (priv->checksum != NULL)
+    g_checksum_free (priv->checksum);
+
+  G_OBJECT_CLASS (empathy_checksum_stream_parent_class)->finalize (object);
+}
+
+static void
+empathy_checksum_stream_init (EmpathyChecksumStream *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_CHECKSUM_STREAM, EmpathyChecksumStreamPriv);
+}
+
+static void
+empathy_checksum_stream_class_init (EmpathyChecksumStreamClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+  GParamSpec *pspec;
+
+  oclass->get_property = empathy_checksum_stream_get_property;
+  oclass->set_property = empathy_checksum_stream_set_property;
+  oclass->constructed = empathy_checksum_stream_constructed;
+  oclass->finalize = empathy_checksum_stream_finalize;
+
+  stream_class->write_fn = checksum_stream_write;
+
+  g_type_class_add_private (klass, sizeof (EmpathyChecksumStreamPriv));
+
+  pspec = g_param_spec_int ("checksum-type", "Checksum type",
+      "The GChecksumType used to hash the written data",
+      G_CHECKSUM_MD5, G_CHECKSUM_SHA256, G_CHECKSUM_MD5,
+      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (oclass, PROP_CHECKSUM_TYPE, pspec);
+}
+
+GOutputStream *
+empathy_checksum_stream_new (GOutputStream *base_stream,
+    GChecksumType checksum_type)
+{
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (base_stream), NULL);
+
+  return g_object_new (EMPATHY_TYPE_CHECKSUM_STREAM,
+      "base-stream", base_stream,
+      "checksum-type", checksum_type,
+      NULL);
+}
+
+/* Returns the hex digest of everything written so far. The checksum can't
+ * be updated anymore afterwards. */
+const gchar *
+empathy_checksum_stream_get_string (EmpathyChecksumStream *self)
+{
+  EmpathyChecksumStreamPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_CHECKSUM_STREAM (self), NULL);
+
+  priv = GET_PRIV (self);
+
+  return g_checksum_get_string (priv->checksum);
+}
+
+guint64
+empathy_checksum_stream_get_bytes (EmpathyChecksumStream *self)
+{
+  EmpathyChecksumStreamPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_CHECKSUM_STREAM (self), 0);
+
+  priv = GET_PRIV (self);
+
+  return priv->bytes;
+}
+
+/* Hashes @data as if it had been written, for data which is already in the
+ * base stream, like the beginning of a resumed file. */
+void
+empathy_checksum_stream_update (EmpathyChecksumStream *self,
+    const guchar *data,
+    gsize length)
+{
+  EmpathyChecksumStreamPriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_CHECKSUM_STREAM (self));
+
+  priv = GET_PRIV (self);
+
+  g_checksum_update (priv->checksum, data, length);
+  priv->bytes += length;
+}
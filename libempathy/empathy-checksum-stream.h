@@ -0,0 +1,72 @@
+/*
+ * empathy-checksum-stream.h - Header for EmpathyChecksumStream
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_CHECKSUM_STREAM_H__
+#define __EMPATHY_CHECKSUM_STREAM_H__
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyChecksumStream EmpathyChecksumStream;
+typedef struct _EmpathyChecksumStreamClass EmpathyChecksumStreamClass;
+
+struct _EmpathyChecksumStreamClass {
+    GFilterOutputStreamClass parent_class;
+};
+
+struct _EmpathyChecksumStream {
+    GFilterOutputStream parent;
+    gpointer priv;
+};
+
+GType empathy_checksum_stream_get_type (void);
+
+#define EMPATHY_TYPE_CHECKSUM_STREAM \
+  (empathy_checksum_stream_get_type ())
+#define EMPATHY_CHECKSUM_STREAM(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), EMPATHY_TYPE_CHECKSUM_STREAM, \
+    EmpathyChecksumStream))
+#define EMPATHY_CHECKSUM_STREAM_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), EMPATHY_TYPE_CHECKSUM_STREAM, \
+  EmpathyChecksumStreamClass))
+#define EMPATHY_IS_CHECKSUM_STREAM(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), EMPATHY_TYPE_CHECKSUM_STREAM))
+#define EMPATHY_IS_CHECKSUM_STREAM_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), EMPATHY_TYPE_CHECKSUM_STREAM))
+#define EMPATHY_CHECKSUM_STREAM_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_CHECKSUM_STREAM, \
+  EmpathyChecksumStreamClass))
+
+GOutputStream * empathy_checksum_stream_new (GOutputStream *base_stream,
+    GChecksumType checksum_type);
+
+const gchar * empathy_checksum_stream_get_string (
+    EmpathyChecksumStream *self);
+
+guint64 empathy_checksum_stream_get_bytes (EmpathyChecksumStream *self);
+
+void empathy_checksum_stream_update (EmpathyChecksumStream *self,
+    const guchar *data,
+    gsize length);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_CHECKSUM_STREAM_H__*/
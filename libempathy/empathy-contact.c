@@ -123,6 +123,28 @@ static guint signals[LAST_SIGNAL];
 /* TpContact* -> EmpathyContact*, both borrowed ref */
 static GHashTable *contacts_table = NULL;
 
+/* filename -> EmpathyAvatar*, both borrowed ref. Contacts showing the same
+ * avatar file share its mapping. */
+static GHashTable *avatars_table = NULL;
+
+/* avatar directories already created, see contact_get_avatar_filename() */
+static GHashTable *avatar_dirs = NULL;
+
+/* Avatar data mapped once for every file having the same content. The same
+ * person's avatar is usually cached once per account. */
+typedef struct {
+  GMappedFile *mapped_file;
+  /* number of EmpathyAvatar using mapped_file */
+  guint n_avatars;
+} AvatarContent;
+
+/* SHA-1 of the avatar data -> owned AvatarContent */
+static GHashTable *avatar_contents = NULL;
+
+/* avatar filename (CM/protocol/token) -> SHA-1 of its data, both owned.
+ * Avatar files never change once written, so entries stay valid. */
+static GHashTable *avatar_hashes = NULL;
+
 static void
 tp_contact_notify_cb (TpContact *tp_contact,
                       GParamSpec *param,
@@ -620,23 +642,35 @@ EmpathyContact *
 empathy_contact_from_tpl_contact (TpAccount *account,
     TplEntity *tpl_entity)
 {
-  EmpathyContact *retval;
-  gboolean is_user;
-
   g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
 
-  is_user = (TPL_ENTITY_SELF == tpl_entity_get_entity_type (tpl_entity));
+  return empathy_contact_from_log_entity (account,
+      tpl_entity_get_identifier (tpl_entity),
+      tpl_entity_get_alias (tpl_entity),
+      tpl_entity_get_avatar_token (tpl_entity),
+      TPL_ENTITY_SELF == tpl_entity_get_entity_type (tpl_entity));
+}
+
+/* Like empathy_contact_from_tpl_contact(), for an entity whose fields were
+ * copied out of its TplEntity */
+EmpathyContact *
+empathy_contact_from_log_entity (TpAccount *account,
+    const gchar *identifier,
+    const gchar *alias,
+    const gchar *avatar_token,
+    gboolean is_user)
+{
+  EmpathyContact *retval;
 
   retval = g_object_new (EMPATHY_TYPE_CONTACT,
-      "id", tpl_entity_get_alias (tpl_entity),
-      "alias", tpl_entity_get_identifier (tpl_entity),
+      "id", alias,
+      "alias", identifier,
       "account", account,
       "is-user", is_user,
       NULL);
 
-  if (!EMP_STR_EMPTY (tpl_entity_get_avatar_token (tpl_entity)))
-    contact_load_avatar_cache (retval,
-        tpl_entity_get_avatar_token (tpl_entity));
+  if (!EMP_STR_EMPTY (avatar_token))
+    contact_load_avatar_cache (retval, avatar_token);
 
   return retval;
 }
@@ -1197,7 +1231,17 @@ contact_get_avatar_filename (EmpathyContact *contact,
       tp_account_get_connection_manager (account),
       tp_account_get_protocol (account),
       NULL);
-  g_mkdir_with_parents (avatar_path, 0700);
+
+  if (avatar_dirs == NULL)
+    avatar_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        NULL);
+
+  if (g_hash_table_lookup (avatar_dirs, avatar_path) == NULL)
+    {
+      g_mkdir_with_parents (avatar_path, 0700);
+      g_hash_table_insert (avatar_dirs, g_strdup (avatar_path),
+          GUINT_TO_POINTER (TRUE));
+    }
 
   avatar_file = g_build_filename (avatar_path, token_escaped, NULL);
 
@@ -1207,14 +1251,152 @@ contact_get_avatar_filename (EmpathyContact *contact,
   return avatar_file;
 }
 
+static void
+avatar_content_free (AvatarContent *content)
+{
+  g_mapped_file_unref (content->mapped_file);
+  g_slice_free (AvatarContent, content);
+}
+
+/* Returns the content already mapped for @filename, or maps it and merges it
+ * with an identical content mapped from another file. Sets @hash to the
+ * SHA-1 of the data. */
+static AvatarContent *
+avatar_content_lookup (const gchar *filename,
+                       const gchar **hash,
+                       GError **error)
+{
+  AvatarContent *content = NULL;
+  GMappedFile *mapped_file;
+  gchar *sha1;
+
+  if (avatar_contents == NULL)
+    {
+      avatar_contents = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, (GDestroyNotify) avatar_content_free);
+      avatar_hashes = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, g_free);
+    }
+
+  /* Known file, no need to even open it if its content is still mapped */
+  *hash = g_hash_table_lookup (avatar_hashes, filename);
+  if (*hash != NULL)
+    content = g_hash_table_lookup (avatar_contents, *hash);
+
+  if (content != NULL)
+    return content;
+
+  mapped_file = g_mapped_file_new (filename, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+
+  if (g_mapped_file_get_length (mapped_file) == 0)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+          "%s is empty", filename);
+      g_mapped_file_unref (mapped_file);
+      return NULL;
+    }
+
+  sha1 = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+      (const guchar *) g_mapped_file_get_contents (mapped_file),
+      g_mapped_file_get_length (mapped_file));
+  g_hash_table_insert (avatar_hashes, g_strdup (filename), sha1);
+  *hash = sha1;
+
+  content = g_hash_table_lookup (avatar_contents, sha1);
+  if (content != NULL)
+    {
+      DEBUG ("%s has the same content as an avatar already loaded",
+          filename);
+      g_mapped_file_unref (mapped_file);
+      return content;
+    }
+
+  content = g_slice_new0 (AvatarContent);
+  content->mapped_file = mapped_file;
+  g_hash_table_insert (avatar_contents, g_strdup (sha1), content);
+
+  return content;
+}
+
+static void
+avatar_content_release (const gchar *hash)
+{
+  AvatarContent *content;
+
+  content = g_hash_table_lookup (avatar_contents, hash);
+  g_return_if_fail (content != NULL);
+
+  content->n_avatars--;
+  if (content->n_avatars == 0)
+    g_hash_table_remove (avatar_contents, hash);
+}
+
+/**
+ * empathy_avatar_dup_from_file:
+ * @filename: the file the avatar is cached in
+ * @format: the mime type of the avatar image, or %NULL if unknown
+ * @error: return location for a GError, or %NULL
+ *
+ * Maps the avatar stored in @filename, or returns the avatar already mapped
+ * from it. Avatars are content-addressed: files having the same data share
+ * a single mapping, identified by #EmpathyAvatar.content_hash. Avatar files
+ * are replaced rather than rewritten when they change, so the mapping stays
+ * valid.
+ *
+ * Returns: a new reference on the #EmpathyAvatar, or %NULL on error
+ */
+EmpathyAvatar *
+empathy_avatar_dup_from_file (const gchar *filename,
+                              const gchar *format,
+                              GError **error)
+{
+  EmpathyAvatar *avatar;
+  AvatarContent *content;
+  const gchar *hash;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  if (avatars_table == NULL)
+    {
+      avatars_table = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+  else
+    {
+      avatar = g_hash_table_lookup (avatars_table, filename);
+      if (avatar != NULL)
+        {
+          if (avatar->format == NULL)
+            avatar->format = g_strdup (format);
+
+          return empathy_avatar_ref (avatar);
+        }
+    }
+
+  content = avatar_content_lookup (filename, &hash, error);
+  if (content == NULL)
+    return NULL;
+
+  avatar = empathy_avatar_new (
+      (guchar *) g_mapped_file_get_contents (content->mapped_file),
+      g_mapped_file_get_length (content->mapped_file), g_strdup (format),
+      g_strdup (filename));
+  avatar->mapped_file = g_mapped_file_ref (content->mapped_file);
+  avatar->content_hash = g_strdup (hash);
+  content->n_avatars++;
+
+  g_hash_table_insert (avatars_table, avatar->filename, avatar);
+
+  return avatar;
+}
+
 static gboolean
 contact_load_avatar_cache (EmpathyContact *contact,
                            const gchar *token)
 {
   EmpathyAvatar *avatar = NULL;
   gchar *filename;
-  gchar *data = NULL;
-  gsize len;
   GError *error = NULL;
 
   g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
@@ -1224,7 +1406,8 @@ contact_load_avatar_cache (EmpathyContact *contact,
   filename = contact_get_avatar_filename (contact, token);
   if (filename && g_file_test (filename, G_FILE_TEST_EXISTS))
     {
-      if (!g_file_get_contents (filename, &data, &len, &error))
+      avatar = empathy_avatar_dup_from_file (filename, NULL, &error);
+      if (avatar == NULL)
         {
           DEBUG ("Failed to load avatar from cache: %s",
             error ? error->message : "No error given");
@@ -1232,19 +1415,16 @@ contact_load_avatar_cache (EmpathyContact *contact,
         }
     }
 
-  if (data)
+  if (avatar)
     {
       DEBUG ("Avatar loaded from %s", filename);
-      avatar = empathy_avatar_new ((guchar *) data, len, NULL, filename);
       contact_set_avatar (contact, avatar);
       empathy_avatar_unref (avatar);
     }
-  else
-    {
-      g_free (filename);
-    }
 
-  return data != NULL;
+  g_free (filename);
+
+  return avatar != NULL;
 }
 
 GType
@@ -1300,7 +1480,19 @@ empathy_avatar_unref (EmpathyAvatar *avatar)
   avatar->refcount--;
   if (avatar->refcount == 0)
     {
-      g_free (avatar->data);
+      if (avatars_table != NULL && avatar->filename != NULL &&
+          g_hash_table_lookup (avatars_table, avatar->filename) == avatar)
+        g_hash_table_remove (avatars_table, avatar->filename);
+
+      if (avatar->mapped_file != NULL)
+        g_mapped_file_unref (avatar->mapped_file);
+      else
+        g_free (avatar->data);
+
+      if (avatar->content_hash != NULL)
+        avatar_content_release (avatar->content_hash);
+
+      g_free (avatar->content_hash);
       g_free (avatar->format);
       g_free (avatar->filename);
       g_slice_free (EmpathyAvatar, avatar);
@@ -1692,15 +1884,28 @@ contact_set_avatar_from_tp_contact (EmpathyContact *contact)
 
   if (file != NULL)
     {
-      EmpathyAvatar *avatar;
-      gchar *data;
-      gsize len;
+      EmpathyAvatar *avatar = NULL;
+      gchar *path;
+      GError *error = NULL;
+
+      /* telepathy-glib keeps the avatars in local files */
+      path = g_file_get_path (file);
+      if (path != NULL)
+        avatar = empathy_avatar_dup_from_file (path, mime, &error);
+
+      if (avatar == NULL)
+        {
+          DEBUG ("Failed to load avatar: %s",
+              error ? error->message : "No local file");
+          g_clear_error (&error);
+        }
 
-      g_file_load_contents (file, NULL, &data, &len, NULL, NULL);
-      avatar = empathy_avatar_new ((guchar *) data, len, g_strdup (mime),
-          g_file_get_path (file));
       contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
+
+      if (avatar != NULL)
+        empathy_avatar_unref (avatar);
+
+      g_free (path);
     }
   else
     {
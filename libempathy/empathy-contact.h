@@ -59,6 +59,10 @@ typedef struct {
   gchar *token;
   gchar *filename;
   guint refcount;
+  /* owns data when the avatar is mapped from its file */
+  GMappedFile *mapped_file;
+  /* SHA-1 of data when mapped from its file, shared by identical avatars */
+  gchar *content_hash;
 } EmpathyAvatar;
 
 typedef enum {
@@ -73,6 +77,11 @@ typedef enum {
 GType empathy_contact_get_type (void) G_GNUC_CONST;
 EmpathyContact * empathy_contact_from_tpl_contact (TpAccount *account,
     TplEntity *tpl_contact);
+EmpathyContact * empathy_contact_from_log_entity (TpAccount *account,
+    const gchar *identifier,
+    const gchar *alias,
+    const gchar *avatar_token,
+    gboolean is_user);
 TpContact * empathy_contact_get_tp_contact (EmpathyContact *contact);
 const gchar * empathy_contact_get_id (EmpathyContact *contact);
 const gchar * empathy_contact_get_alias (EmpathyContact *contact);
@@ -120,6 +129,9 @@ EmpathyAvatar * empathy_avatar_new (guchar *data,
     gchar *filename);
 EmpathyAvatar * empathy_avatar_ref (EmpathyAvatar *avatar);
 void empathy_avatar_unref (EmpathyAvatar *avatar);
+EmpathyAvatar * empathy_avatar_dup_from_file (const gchar *filename,
+    const gchar *format,
+    GError **error);
 
 gboolean empathy_avatar_save_to_file (EmpathyAvatar *avatar,
     const gchar *filename, GError **error);
@@ -0,0 +1,459 @@
+/*
+ * empathy-fd-splice.c - Kernel-side file descriptor copies
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Copies data between a regular file and a socket without bringing it to
+ * userspace, using sendfile() and splice() on Linux. The copy runs in a GIO
+ * worker thread. The socket is made non-blocking meanwhile, and waited for
+ * with poll() along with the cancellable, so that a stalled peer can't hold
+ * the thread once the operation is cancelled.
+ *
+ * When the kernel (or the file system) can't do it before any data has been
+ * moved, the operation fails with G_IO_ERROR_NOT_SUPPORTED and callers are
+ * expected to fall back to g_output_stream_splice_async(). */
+
+/* for splice() */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include "empathy-fd-splice.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_FT
+#include "empathy-debug.h"
+
+#if defined (HAVE_SENDFILE) && defined (HAVE_SPLICE) && \
+    defined (HAVE_SYS_SENDFILE_H)
+#define HAVE_FD_SPLICE 1
+#endif
+
+/* sendfile() has no buffer to fill, let it move big chunks */
+#define SENDFILE_CHUNK_SIZE (1024 * 1024)
+/* the default capacity of a pipe */
+#define PIPE_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+  gint source_fd;
+  gint target_fd;
+  EmpathyFdSpliceDirection direction;
+  gssize copied;
+} SpliceData;
+
+#ifdef HAVE_FD_SPLICE
+
+static void
+splice_data_free (SpliceData *data)
+{
+  g_slice_free (SpliceData, data);
+}
+
+static gboolean
+errno_is_not_supported (gint code)
+{
+  return code == EINVAL || code == ENOSYS || code == EOPNOTSUPP;
+}
+
+static void
+set_error_from_errno (GError **error,
+    gint code)
+{
+  g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (code),
+      g_strerror (code));
+}
+
+/* Waits for @fd to be ready for @condition, or for @cancellable to be
+ * cancelled */
+static gboolean
+wait_for_socket (gint fd,
+    GIOCondition condition,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GPollFD fds[2];
+  guint n_fds = 1;
+  gint res;
+  gint code;
+
+  fds[0].fd = fd;
+  fds[0].events = condition;
+
+  if (g_cancellable_make_pollfd (cancellable, &fds[1]))
+    n_fds++;
+
+  do
+    {
+      res = g_poll (fds, n_fds, -1);
+      code = errno;
+    }
+  while (res < 0 && code == EINTR);
+
+  if (n_fds > 1)
+    g_cancellable_release_fd (cancellable);
+
+  if (res < 0)
+    {
+      set_error_from_errno (error, code);
+      return FALSE;
+    }
+
+  return !g_cancellable_set_error_if_cancelled (cancellable, error);
+}
+
+static gssize
+splice_file_to_socket (SpliceData *data,
+    GCancellable *cancellable,
+    GError **error)
+{
+  gssize total = 0;
+
+  while (TRUE)
+    {
+      gssize res;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return -1;
+
+      /* NULL offset: use and advance the file position, like a read */
+      res = sendfile (data->target_fd, data->source_fd, NULL,
+          SENDFILE_CHUNK_SIZE);
+
+      if (res == 0)
+        break;
+
+      if (res < 0)
+        {
+          gint code = errno;
+
+          if (code == EINTR)
+            continue;
+
+          if (code == EAGAIN)
+            {
+              if (!wait_for_socket (data->target_fd, G_IO_OUT, cancellable,
+                    error))
+                return -1;
+
+              continue;
+            }
+
+          if (total == 0 && errno_is_not_supported (code))
+            g_set_error_literal (error, G_IO_ERROR,
+                G_IO_ERROR_NOT_SUPPORTED, g_strerror (code));
+          else
+            set_error_from_errno (error, code);
+
+          return -1;
+        }
+
+      total += res;
+    }
+
+  return total;
+}
+
+/* Writes what's left in the pipe with plain read() and write() calls */
+static gboolean
+drain_pipe (gint pipe_fd,
+    gint target_fd,
+    gssize len,
+    GError **error)
+{
+  gchar buffer[4096];
+
+  while (len > 0)
+    {
+      gssize n_read, n_written, offset;
+
+      n_read = read (pipe_fd, buffer, MIN (len, (gssize) sizeof (buffer)));
+      if (n_read < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          set_error_from_errno (error, errno);
+          return FALSE;
+        }
+
+      for (offset = 0; offset < n_read; offset += n_written)
+        {
+          n_written = write (target_fd, buffer + offset, n_read - offset);
+          if (n_written < 0)
+            {
+              if (errno == EINTR)
+                {
+                  n_written = 0;
+                  continue;
+                }
+
+              set_error_from_errno (error, errno);
+              return FALSE;
+            }
+        }
+
+      len -= n_read;
+    }
+
+  return TRUE;
+}
+
+static gssize
+splice_socket_to_file (SpliceData *data,
+    GCancellable *cancellable,
+    GError **error)
+{
+  gint pipe_fds[2];
+  gssize total = 0;
+
+  if (pipe (pipe_fds) < 0)
+    {
+      set_error_from_errno (error, errno);
+      return -1;
+    }
+
+  while (TRUE)
+    {
+      gssize in_pipe;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto error;
+
+      in_pipe = splice (data->source_fd, NULL, pipe_fds[1], NULL,
+          PIPE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+      if (in_pipe == 0)
+        break;
+
+      if (in_pipe < 0)
+        {
+          gint code = errno;
+
+          if (code == EINTR)
+            continue;
+
+          /* the pipe is always empty here, so it's the socket */
+          if (code == EAGAIN)
+            {
+              if (!wait_for_socket (data->source_fd, G_IO_IN, cancellable,
+                    error))
+                goto error;
+
+              continue;
+            }
+
+          if (total == 0 && errno_is_not_supported (code))
+            g_set_error_literal (error, G_IO_ERROR,
+                G_IO_ERROR_NOT_SUPPORTED, g_strerror (code));
+          else
+            set_error_from_errno (error, code);
+
+          goto error;
+        }
+
+      while (in_pipe > 0)
+        {
+          gssize res;
+
+          res = splice (pipe_fds[0], NULL, data->target_fd, NULL,
+              in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+          if (res < 0)
+            {
+              gint code = errno;
+
+              if (code == EINTR)
+                continue;
+
+              /* The file system can't splice. The data already read from
+               * the socket is only in the pipe now, so write it the slow
+               * way before letting the caller fall back. */
+              if (total == 0 && errno_is_not_supported (code))
+                {
+                  if (drain_pipe (pipe_fds[0], data->target_fd, in_pipe,
+                        error))
+                    g_set_error_literal (error, G_IO_ERROR,
+                        G_IO_ERROR_NOT_SUPPORTED, g_strerror (code));
+                }
+              else
+                {
+                  set_error_from_errno (error, code);
+                }
+
+              goto error;
+            }
+
+          in_pipe -= res;
+          total += res;
+        }
+    }
+
+  close (pipe_fds[0]);
+  close (pipe_fds[1]);
+
+  return total;
+
+error:
+  close (pipe_fds[0]);
+  close (pipe_fds[1]);
+
+  return -1;
+}
+
+static void
+fd_splice_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  SpliceData *data;
+  GError *error = NULL;
+  gint socket_fd;
+  gint flags;
+  gssize res;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+
+  if (data->direction == EMPATHY_FD_SPLICE_FILE_TO_SOCKET)
+    socket_fd = data->target_fd;
+  else
+    socket_fd = data->source_fd;
+
+  flags = fcntl (socket_fd, F_GETFL);
+  if (flags < 0 || fcntl (socket_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+      set_error_from_errno (&error, errno);
+      g_simple_async_result_set_from_error (simple, error);
+      g_error_free (error);
+      return;
+    }
+
+  if (data->direction == EMPATHY_FD_SPLICE_FILE_TO_SOCKET)
+    res = splice_file_to_socket (data, cancellable, &error);
+  else
+    res = splice_socket_to_file (data, cancellable, &error);
+
+  /* the GIO fallback expects the socket as it was given */
+  fcntl (socket_fd, F_SETFL, flags);
+
+  if (res < 0)
+    {
+      g_simple_async_result_set_from_error (simple, error);
+      g_error_free (error);
+      return;
+    }
+
+  DEBUG ("Copied %" G_GSSIZE_FORMAT " bytes in the kernel", res);
+
+  data->copied = res;
+}
+
+#endif /* HAVE_FD_SPLICE */
+
+/**
+ * empathy_fd_splice_async:
+ * @source_fd: a file descriptor to read from
+ * @target_fd: a file descriptor to write to
+ * @direction: which of @source_fd and @target_fd is the socket
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, %NULL to ignore
+ * @callback: a #GAsyncReadyCallback to call when the copy is done
+ * @user_data: the data to pass to @callback
+ *
+ * Copies data from @source_fd to @target_fd until the end of @source_fd,
+ * without copying it through userspace buffers. The socket is non-blocking
+ * until the copy is done, and cancelling @cancellable interrupts the wait
+ * for it. The file descriptors are not closed.
+ */
+void
+empathy_fd_splice_async (gint source_fd,
+    gint target_fd,
+    EmpathyFdSpliceDirection direction,
+    gint io_priority,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *simple;
+
+  g_return_if_fail (source_fd >= 0);
+  g_return_if_fail (target_fd >= 0);
+
+#ifdef HAVE_FD_SPLICE
+  {
+    SpliceData *data;
+
+    simple = g_simple_async_result_new (NULL, callback, user_data,
+        empathy_fd_splice_async);
+
+    data = g_slice_new0 (SpliceData);
+    data->source_fd = source_fd;
+    data->target_fd = target_fd;
+    data->direction = direction;
+    g_simple_async_result_set_op_res_gpointer (simple, data,
+        (GDestroyNotify) splice_data_free);
+
+    g_simple_async_result_run_in_thread (simple, fd_splice_thread,
+        io_priority, cancellable);
+  }
+#else
+  simple = g_simple_async_result_new (NULL, callback, user_data,
+      empathy_fd_splice_async);
+  g_simple_async_result_set_error (simple, G_IO_ERROR,
+      G_IO_ERROR_NOT_SUPPORTED,
+      "Kernel-side copies are not supported on this system");
+  g_simple_async_result_complete_in_idle (simple);
+#endif
+
+  g_object_unref (simple);
+}
+
+/**
+ * empathy_fd_splice_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore
+ *
+ * Finishes an operation started with empathy_fd_splice_async().
+ *
+ * Return value: the number of bytes copied, or -1 on error. If the error
+ * is %G_IO_ERROR_NOT_SUPPORTED, no data has been lost and the copy can be
+ * done again in userspace.
+ */
+gssize
+empathy_fd_splice_finish (GAsyncResult *result,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  SpliceData *data;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+          empathy_fd_splice_async), -1);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return -1;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+
+  return data->copied;
+}
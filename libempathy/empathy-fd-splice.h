@@ -0,0 +1,47 @@
+/*
+ * empathy-fd-splice.h - Header for kernel-side file descriptor copies
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_FD_SPLICE_H__
+#define __EMPATHY_FD_SPLICE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  /* from a regular file to a socket, with sendfile() */
+  EMPATHY_FD_SPLICE_FILE_TO_SOCKET,
+  /* from a socket to a regular file, with splice() through a pipe */
+  EMPATHY_FD_SPLICE_SOCKET_TO_FILE
+} EmpathyFdSpliceDirection;
+
+void empathy_fd_splice_async (gint source_fd,
+    gint target_fd,
+    EmpathyFdSpliceDirection direction,
+    gint io_priority,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+gssize empathy_fd_splice_finish (GAsyncResult *result,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_FD_SPLICE_H__*/
@@ -30,6 +30,9 @@
 #include "empathy-marshal.h"
 #include "empathy-utils.h"
 
+#define DEBUG_FLAG EMPATHY_DEBUG_FT
+#include "empathy-debug.h"
+
 /**
  * SECTION:empathy-ft-factory
  * @title:EmpathyFTFactory
@@ -45,6 +48,9 @@
  * a file selector), a ::new-incoming-transfer is emitted by the factory when
  * a destination file is needed, which can be set later with
  * empathy_ft_factory_set_destination_for_incoming_handler().
+ * The factory also schedules the transfers started with
+ * empathy_ft_factory_start_transfer(), so that sending many files at once
+ * doesn't make them all hash and offer their file at the same time.
  */
 
 G_DEFINE_TYPE (EmpathyFTFactory, empathy_ft_factory, G_TYPE_OBJECT);
@@ -52,15 +58,39 @@ G_DEFINE_TYPE (EmpathyFTFactory, empathy_ft_factory, G_TYPE_OBJECT);
 enum {
   NEW_FT_HANDLER,
   NEW_INCOMING_TRANSFER,
+  TRANSFER_STATE_CHANGED,
   LAST_SIGNAL
 };
 
+/* transfers running at the same time, in total and for a single contact */
+#define MAX_ACTIVE_TRANSFERS 6
+#define MAX_ACTIVE_TRANSFERS_PER_CONTACT 3
+/* outgoing transfers hashing their file at the same time */
+#define MAX_HASHING_TRANSFERS 2
+
+typedef struct {
+  EmpathyFTHandler *handler;
+  EmpathyContact *contact;
+  gint priority;
+  gboolean needs_hashing;
+  EmpathyFTTransferState state;
+} ScheduledTransfer;
+
 static EmpathyFTFactory *factory_singleton = NULL;
 static guint signals[LAST_SIGNAL] = { 0 };
 
 /* private structure */
 typedef struct {
   TpBaseClient *handler;
+
+  /* EmpathyFTHandler -> owned ScheduledTransfer, queued or active */
+  GHashTable *transfers;
+  /* borrowed ScheduledTransfer, by priority then in FIFO order */
+  GQueue *queued;
+  /* EmpathyContact -> number of active transfers */
+  GHashTable *active_per_contact;
+  guint n_active;
+  guint n_hashing;
 } EmpathyFTFactoryPriv;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTFactory)
@@ -85,6 +115,56 @@ do_constructor (GType type,
 	return retval;
 }
 
+static void ft_factory_transfer_finished_cb (EmpathyFTHandler *handler,
+    gpointer arg1, EmpathyFTFactory *self);
+static void ft_factory_hashing_done_cb (EmpathyFTHandler *handler,
+    EmpathyFTFactory *self);
+
+static void
+scheduled_transfer_free (ScheduledTransfer *transfer)
+{
+  g_object_unref (transfer->handler);
+  g_object_unref (transfer->contact);
+  g_slice_free (ScheduledTransfer, transfer);
+}
+
+static void
+ft_factory_disconnect_transfer (EmpathyFTFactory *self,
+    ScheduledTransfer *transfer)
+{
+  g_signal_handlers_disconnect_by_func (transfer->handler,
+      ft_factory_transfer_finished_cb, self);
+  g_signal_handlers_disconnect_by_func (transfer->handler,
+      ft_factory_hashing_done_cb, self);
+}
+
+static void
+do_dispose (GObject *object)
+{
+  EmpathyFTFactory *self = EMPATHY_FT_FACTORY (object);
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+  GHashTableIter iter;
+  gpointer value;
+
+  if (priv->transfers != NULL)
+    {
+      g_hash_table_iter_init (&iter, priv->transfers);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        ft_factory_disconnect_transfer (self, value);
+
+      g_queue_free (priv->queued);
+      priv->queued = NULL;
+      g_hash_table_destroy (priv->transfers);
+      priv->transfers = NULL;
+      g_hash_table_destroy (priv->active_per_contact);
+      priv->active_per_contact = NULL;
+    }
+
+  tp_clear_object (&priv->handler);
+
+  G_OBJECT_CLASS (empathy_ft_factory_parent_class)->dispose (object);
+}
+
 static void
 empathy_ft_factory_class_init (EmpathyFTFactoryClass *klass)
 {
@@ -93,6 +173,7 @@ empathy_ft_factory_class_init (EmpathyFTFactoryClass *klass)
   g_type_class_add_private (klass, sizeof (EmpathyFTFactoryPriv));
 
   object_class->constructor = do_constructor;
+  object_class->dispose = do_dispose;
 
   /**
    * EmpathyFTFactory::new-ft-handler
@@ -135,6 +216,168 @@ empathy_ft_factory_class_init (EmpathyFTFactoryClass *klass)
       NULL, NULL,
       _empathy_marshal_VOID__OBJECT_POINTER,
       G_TYPE_NONE, 2, EMPATHY_TYPE_FT_HANDLER, G_TYPE_POINTER);
+
+  /**
+   * EmpathyFTFactory::transfer-state-changed
+   * @factory: the object which received the signal
+   * @handler: the #EmpathyFTHandler whose state changed
+   * @state: the new #EmpathyFTTransferState of @handler
+   *
+   * The signal is emitted when a transfer started with
+   * empathy_ft_factory_start_transfer() is queued, starts hashing or
+   * transferring, or is done with (%EMPATHY_FT_TRANSFER_STATE_NONE).
+   */
+  signals[TRANSFER_STATE_CHANGED] =
+    g_signal_new ("transfer-state-changed",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0,
+      NULL, NULL,
+      _empathy_marshal_VOID__OBJECT_UINT,
+      G_TYPE_NONE, 2, EMPATHY_TYPE_FT_HANDLER, G_TYPE_UINT);
+}
+
+static void
+ft_factory_set_state (EmpathyFTFactory *self,
+    ScheduledTransfer *transfer,
+    EmpathyFTTransferState state)
+{
+  transfer->state = state;
+
+  g_signal_emit (self, signals[TRANSFER_STATE_CHANGED], 0,
+      transfer->handler, state);
+}
+
+static guint
+ft_factory_get_active_for_contact (EmpathyFTFactory *self,
+    EmpathyContact *contact)
+{
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (priv->active_per_contact,
+      contact));
+}
+
+static void
+ft_factory_start_scheduled (EmpathyFTFactory *self,
+    ScheduledTransfer *transfer)
+{
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+  guint n_contact;
+
+  n_contact = ft_factory_get_active_for_contact (self, transfer->contact);
+  g_hash_table_insert (priv->active_per_contact,
+      g_object_ref (transfer->contact), GUINT_TO_POINTER (n_contact + 1));
+  priv->n_active++;
+
+  g_signal_connect (transfer->handler, "transfer-done",
+      G_CALLBACK (ft_factory_transfer_finished_cb), self);
+  g_signal_connect (transfer->handler, "transfer-error",
+      G_CALLBACK (ft_factory_transfer_finished_cb), self);
+
+  if (transfer->needs_hashing)
+    {
+      priv->n_hashing++;
+      g_signal_connect (transfer->handler, "hashing-done",
+          G_CALLBACK (ft_factory_hashing_done_cb), self);
+      ft_factory_set_state (self, transfer, EMPATHY_FT_TRANSFER_STATE_HASHING);
+    }
+  else
+    {
+      ft_factory_set_state (self, transfer,
+          EMPATHY_FT_TRANSFER_STATE_TRANSFERRING);
+    }
+
+  DEBUG ("Starting transfer of %s, %u active, %u hashing",
+      empathy_ft_handler_get_filename (transfer->handler), priv->n_active,
+      priv->n_hashing);
+
+  empathy_ft_handler_start_transfer (transfer->handler);
+}
+
+/* Starts the queued transfers which fit in the limits, highest priority
+ * first. A transfer held back by its contact's limit or by the hashing one
+ * doesn't block the ones after it. */
+static void
+ft_factory_schedule (EmpathyFTFactory *self)
+{
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+  GList *l, *next;
+
+  for (l = priv->queued->head;
+       l != NULL && priv->n_active < MAX_ACTIVE_TRANSFERS;
+       l = next)
+    {
+      ScheduledTransfer *transfer = l->data;
+
+      next = l->next;
+
+      if (ft_factory_get_active_for_contact (self, transfer->contact) >=
+          MAX_ACTIVE_TRANSFERS_PER_CONTACT)
+        continue;
+
+      if (transfer->needs_hashing &&
+          priv->n_hashing >= MAX_HASHING_TRANSFERS)
+        continue;
+
+      g_queue_delete_link (priv->queued, l);
+      ft_factory_start_scheduled (self, transfer);
+    }
+}
+
+static void
+ft_factory_hashing_done_cb (EmpathyFTHandler *handler,
+    EmpathyFTFactory *self)
+{
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+  ScheduledTransfer *transfer;
+
+  transfer = g_hash_table_lookup (priv->transfers, handler);
+  if (transfer == NULL ||
+      transfer->state != EMPATHY_FT_TRANSFER_STATE_HASHING)
+    return;
+
+  priv->n_hashing--;
+  ft_factory_set_state (self, transfer,
+      EMPATHY_FT_TRANSFER_STATE_TRANSFERRING);
+
+  ft_factory_schedule (self);
+}
+
+/* Handles both ::transfer-done and ::transfer-error */
+static void
+ft_factory_transfer_finished_cb (EmpathyFTHandler *handler,
+    gpointer arg1,
+    EmpathyFTFactory *self)
+{
+  EmpathyFTFactoryPriv *priv = GET_PRIV (self);
+  ScheduledTransfer *transfer;
+  guint n_contact;
+
+  transfer = g_hash_table_lookup (priv->transfers, handler);
+  if (transfer == NULL)
+    return;
+
+  if (transfer->state == EMPATHY_FT_TRANSFER_STATE_HASHING)
+    priv->n_hashing--;
+
+  n_contact = ft_factory_get_active_for_contact (self, transfer->contact);
+  if (n_contact <= 1)
+    g_hash_table_remove (priv->active_per_contact, transfer->contact);
+  else
+    g_hash_table_insert (priv->active_per_contact,
+        g_object_ref (transfer->contact), GUINT_TO_POINTER (n_contact - 1));
+  priv->n_active--;
+
+  ft_factory_disconnect_transfer (self, transfer);
+
+  /* keep the handler alive while the signal is emitted */
+  g_object_ref (handler);
+  g_hash_table_remove (priv->transfers, handler);
+  g_signal_emit (self, signals[TRANSFER_STATE_CHANGED], 0, handler,
+      EMPATHY_FT_TRANSFER_STATE_NONE);
+  g_object_unref (handler);
+
+  ft_factory_schedule (self);
 }
 
 static void
@@ -195,6 +438,12 @@ empathy_ft_factory_init (EmpathyFTFactory *self)
 
   self->priv = priv;
 
+  priv->transfers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, (GDestroyNotify) scheduled_transfer_free);
+  priv->queued = g_queue_new ();
+  priv->active_per_contact = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, g_object_unref, NULL);
+
   dbus = tp_dbus_daemon_dup (&error);
   if (dbus == NULL)
     {
@@ -298,3 +547,137 @@ empathy_ft_factory_register (EmpathyFTFactory *self,
 
   return tp_base_client_register (priv->handler, error);
 }
+
+/**
+ * empathy_ft_factory_start_transfer:
+ * @factory: an #EmpathyFTFactory
+ * @handler: the #EmpathyFTHandler to start
+ * @priority: the priority of the transfer; as with GLib priorities, lower
+ * values go first
+ *
+ * Schedules the start of @handler with empathy_ft_handler_start_transfer().
+ * Outgoing transfers are queued until fewer transfers are running, in total
+ * and to the same contact, and until fewer files are being hashed. Incoming
+ * transfers start right away as the other participant is already waiting,
+ * but count as running transfers.
+ * The ::transfer-state-changed signal tells when @handler actually starts.
+ */
+void
+empathy_ft_factory_start_transfer (EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler,
+    gint priority)
+{
+  EmpathyFTFactoryPriv *priv;
+  ScheduledTransfer *transfer;
+  GList *l;
+
+  g_return_if_fail (EMPATHY_IS_FT_FACTORY (factory));
+  g_return_if_fail (EMPATHY_IS_FT_HANDLER (handler));
+
+  priv = GET_PRIV (factory);
+
+  g_return_if_fail (g_hash_table_lookup (priv->transfers, handler) == NULL);
+
+  transfer = g_slice_new0 (ScheduledTransfer);
+  transfer->handler = g_object_ref (handler);
+  transfer->contact = g_object_ref (empathy_ft_handler_get_contact (handler));
+  transfer->priority = priority;
+  transfer->needs_hashing = !empathy_ft_handler_is_incoming (handler) &&
+      empathy_ft_handler_get_use_hash (handler);
+
+  g_hash_table_insert (priv->transfers, handler, transfer);
+
+  if (empathy_ft_handler_is_incoming (handler))
+    {
+      ft_factory_start_scheduled (factory, transfer);
+      return;
+    }
+
+  /* after the transfers of the same priority, to keep them in order */
+  for (l = priv->queued->head; l != NULL; l = l->next)
+    {
+      ScheduledTransfer *queued = l->data;
+
+      if (queued->priority > priority)
+        break;
+    }
+
+  g_queue_insert_before (priv->queued, l, transfer);
+  ft_factory_set_state (factory, transfer, EMPATHY_FT_TRANSFER_STATE_QUEUED);
+
+  ft_factory_schedule (factory);
+}
+
+/**
+ * empathy_ft_factory_cancel_transfer:
+ * @factory: an #EmpathyFTFactory
+ * @handler: an #EmpathyFTHandler
+ *
+ * Cancels @handler with empathy_ft_handler_cancel_transfer(), removing it
+ * from the queue first if it didn't start yet. Note that a queued handler
+ * never emits ::transfer-error, as it didn't start.
+ */
+void
+empathy_ft_factory_cancel_transfer (EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler)
+{
+  EmpathyFTFactoryPriv *priv;
+  ScheduledTransfer *transfer;
+
+  g_return_if_fail (EMPATHY_IS_FT_FACTORY (factory));
+  g_return_if_fail (EMPATHY_IS_FT_HANDLER (handler));
+
+  priv = GET_PRIV (factory);
+
+  transfer = g_hash_table_lookup (priv->transfers, handler);
+
+  if (transfer != NULL &&
+      transfer->state == EMPATHY_FT_TRANSFER_STATE_QUEUED)
+    {
+      DEBUG ("Cancelling queued transfer of %s",
+          empathy_ft_handler_get_filename (handler));
+
+      g_queue_remove (priv->queued, transfer);
+
+      g_object_ref (handler);
+      g_hash_table_remove (priv->transfers, handler);
+      empathy_ft_handler_cancel_transfer (handler);
+      g_signal_emit (factory, signals[TRANSFER_STATE_CHANGED], 0, handler,
+          EMPATHY_FT_TRANSFER_STATE_NONE);
+      g_object_unref (handler);
+
+      return;
+    }
+
+  empathy_ft_handler_cancel_transfer (handler);
+}
+
+/**
+ * empathy_ft_factory_get_transfer_state:
+ * @factory: an #EmpathyFTFactory
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns where @handler is in the schedule of @factory.
+ *
+ * Return value: the #EmpathyFTTransferState of @handler;
+ * %EMPATHY_FT_TRANSFER_STATE_NONE if it wasn't started with
+ * empathy_ft_factory_start_transfer() or is done with.
+ */
+EmpathyFTTransferState
+empathy_ft_factory_get_transfer_state (EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler)
+{
+  EmpathyFTFactoryPriv *priv;
+  ScheduledTransfer *transfer;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_FACTORY (factory),
+      EMPATHY_FT_TRANSFER_STATE_NONE);
+
+  priv = GET_PRIV (factory);
+
+  transfer = g_hash_table_lookup (priv->transfers, handler);
+  if (transfer == NULL)
+    return EMPATHY_FT_TRANSFER_STATE_NONE;
+
+  return transfer->state;
+}
@@ -47,6 +47,13 @@ G_BEGIN_DECLS
   (G_TYPE_INSTANCE_GET_CLASS ((obj), \
    EMPATHY_TYPE_FT_FACTORY, EmpathyFTFactoryClass))
 
+typedef enum {
+  EMPATHY_FT_TRANSFER_STATE_NONE,
+  EMPATHY_FT_TRANSFER_STATE_QUEUED,
+  EMPATHY_FT_TRANSFER_STATE_HASHING,
+  EMPATHY_FT_TRANSFER_STATE_TRANSFERRING
+} EmpathyFTTransferState;
+
 typedef struct {
   GObject parent;
   gpointer priv;
@@ -71,6 +78,15 @@ void empathy_ft_factory_set_destination_for_incoming_handler (
 gboolean empathy_ft_factory_register (EmpathyFTFactory *self,
     GError **error);
 
+void empathy_ft_factory_start_transfer (EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler,
+    gint priority);
+void empathy_ft_factory_cancel_transfer (EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler);
+EmpathyFTTransferState empathy_ft_factory_get_transfer_state (
+    EmpathyFTFactory *factory,
+    EmpathyFTHandler *handler);
+
 G_END_DECLS
 
 #endif /* __EMPATHY_FT_FACTORY_H__ */
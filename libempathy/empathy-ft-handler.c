@@ -21,8 +21,14 @@
 
 /* empathy-ft-handler.c */
 
+#include <config.h>
+
+#include <fcntl.h>
+
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <gio/gfiledescriptorbased.h>
 #include <telepathy-glib/account-channel-request.h>
 #include <telepathy-glib/util.h>
 #include <telepathy-glib/dbus.h>
@@ -38,6 +44,15 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
 #include "empathy-debug.h"
 
+/* An interrupted incoming transfer leaves a key file next to its
+ * destination, so that it can be resumed when the same contact offers the
+ * same file again */
+#define RESUME_SUFFIX ".empathy-resume"
+#define RESUME_GROUP "Resume"
+/* the received data hashed to check the partial file is still the one the
+ * record was written for, ending at the offset */
+#define RESUME_FINGERPRINT_SIZE (64 * 1024)
+
 /**
  * SECTION:empathy-ft-handler
  * @title: EmpathyFTHandler
@@ -64,7 +79,9 @@
  * In addition, if the handler is created with checksumming enabled,
  * other three signals (::hashing-started, ::hashing-progress, ::hashing-done)
  * will be emitted before or after the transfer, depending on the direction
- * (respectively outgoing and incoming) of the handler.
+ * (respectively outgoing and incoming) of the handler. Incoming data is
+ * hashed while it's being written, so the checksum is checked as soon as
+ * the transfer is done.
  * At any time between the call to empathy_ft_handler_start_transfer() and
  * the last signal, a ::transfer-error can be emitted, indicating that an
  * error has happened in the operation. The message of the error is localized
@@ -75,7 +92,11 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* bounds of the buffer used when hashing, see hash_buffer_size() */
+#define MIN_HASH_BUFFER_SIZE (64 * 1024)
+#define MAX_HASH_BUFFER_SIZE (1024 * 1024)
+/* minimum delay between two ::hashing-progress, in seconds */
+#define HASH_PROGRESS_INTERVAL 0.1
 
 enum {
   PROP_TP_FILE = 1,
@@ -104,10 +125,16 @@ typedef struct {
   GInputStream *stream;
   GError *error /* comment to make the style checker happy */;
   guchar *buffer;
+  gsize buffer_size;
   GChecksum *checksum;
-  gssize total_read;
+  guint64 total_read;
   guint64 total_bytes;
   EmpathyFTHandler *handler;
+
+  /* set by the job while a progress notification is queued, only then
+   * is progress_bytes owned by the main loop */
+  volatile gint progress_pending;
+  guint64 progress_bytes;
 } HashingData;
 
 typedef struct {
@@ -146,14 +173,15 @@ typedef struct {
   guint remaining_time;
   time_t last_update_time;
 
+  /* set once the contact sent data for an incoming transfer, so the
+   * destination holds what we received rather than some unrelated file */
+  gboolean received_data;
+
   gboolean is_completed;
 } EmpathyFTHandlerPriv;
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
-static gboolean do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable, gpointer user_data);
-
 /* GObject implementations */
 static void
 do_get_property (GObject *object,
@@ -595,38 +623,390 @@ tp_file_hash_to_g_checksum (TpFileHashType type)
 }
 
 static void
-check_hash_incoming (EmpathyFTHandler *handler)
+emit_error_signal (EmpathyFTHandler *handler,
+    const GError *error)
 {
-  HashingData *hash_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-  if (!EMP_STR_EMPTY (priv->content_hash))
+  DEBUG ("Error in transfer: %s\n", error->message);
+
+  if (!g_cancellable_is_cancelled (priv->cancellable))
+    g_cancellable_cancel (priv->cancellable);
+
+  g_signal_emit (handler, signals[TRANSFER_ERROR], 0, error);
+}
+
+static void
+check_hash_incoming (EmpathyFTHandler *handler,
+    EmpathyTpFile *tp_file)
+{
+  const gchar *checksum;
+  GError *error;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  /* the EmpathyTpFile hashed the data while writing it */
+  checksum = empathy_tp_file_get_checksum (tp_file);
+
+  DEBUG ("Got file hash %s", checksum);
+
+  if (tp_strdiff (checksum, priv->content_hash))
     {
-      hash_data = g_slice_new0 (HashingData);
-      hash_data->total_bytes = priv->total_bytes;
-      hash_data->handler = g_object_ref (handler);
-      hash_data->checksum = g_checksum_new
-        (tp_file_hash_to_g_checksum (priv->content_hash_type));
+      DEBUG ("Hash mismatch when checking incoming handler: "
+             "received %s, calculated %s", priv->content_hash, checksum);
 
-      g_signal_emit (handler, signals[HASHING_STARTED], 0);
+      error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
+          EMPATHY_FT_ERROR_HASH_MISMATCH,
+          _("File transfer completed, but the file was corrupted"));
+      emit_error_signal (handler, error);
+      g_error_free (error);
 
-      g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
-                               G_PRIORITY_DEFAULT, priv->cancellable);
+      return;
     }
+
+  DEBUG ("Hash verification matched, received %s, calculated %s",
+         priv->content_hash, checksum);
+
+  g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+      priv->total_bytes, priv->total_bytes);
+  g_signal_emit (handler, signals[HASHING_DONE], 0);
 }
 
+/* What the resume record of a transfer is about, copied from the handler
+ * as the record is read and written in a GIO worker thread */
+typedef struct {
+  GFile *gfile;
+  gchar *path;
+  gchar *account_path;
+  gchar *contact_id;
+  gchar *filename;
+  gchar *content_hash;
+  guint64 total_bytes;
+  /* the offset the transfer can be resumed at, once loaded */
+  guint64 offset;
+} ResumeRecord;
+
 static void
-emit_error_signal (EmpathyFTHandler *handler,
-    const GError *error)
+resume_record_free (ResumeRecord *record)
+{
+  g_object_unref (record->gfile);
+  g_free (record->path);
+  g_free (record->account_path);
+  g_free (record->contact_id);
+  g_free (record->filename);
+  g_free (record->content_hash);
+  g_slice_free (ResumeRecord, record);
+}
+
+static ResumeRecord *
+ft_handler_dup_resume_record (EmpathyFTHandler *handler)
 {
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  ResumeRecord *record;
+  gchar *path;
+
+  /* GKeyFile only deals with local files */
+  path = g_file_get_path (priv->gfile);
+  if (path == NULL)
+    return NULL;
+
+  record = g_slice_new0 (ResumeRecord);
+  record->gfile = g_object_ref (priv->gfile);
+  record->path = g_strconcat (path, RESUME_SUFFIX, NULL);
+  record->account_path = g_strdup (tp_proxy_get_object_path (
+      empathy_contact_get_account (priv->contact)));
+  record->contact_id = g_strdup (empathy_contact_get_id (priv->contact));
+  record->filename = g_strdup (priv->filename);
+  record->content_hash = g_strdup (priv->content_hash);
+  record->total_bytes = priv->total_bytes;
+
+  g_free (path);
+
+  return record;
+}
 
-  DEBUG ("Error in transfer: %s\n", error->message);
+static gchar *
+resume_record_dup_prefix_fingerprint (ResumeRecord *record,
+    guint64 offset)
+{
+  GFileInputStream *stream;
+  GChecksum *checksum;
+  guchar *buffer;
+  gsize length, n_read;
+  gchar *retval = NULL;
 
-  if (!g_cancellable_is_cancelled (priv->cancellable))
-    g_cancellable_cancel (priv->cancellable);
+  stream = g_file_read (record->gfile, NULL, NULL);
+  if (stream == NULL)
+    return NULL;
 
-  g_signal_emit (handler, signals[TRANSFER_ERROR], 0, error);
+  length = MIN (offset, RESUME_FINGERPRINT_SIZE);
+  buffer = g_malloc (length);
+
+  if (g_seekable_seek (G_SEEKABLE (stream), offset - length, G_SEEK_SET,
+          NULL, NULL) &&
+      g_input_stream_read_all (G_INPUT_STREAM (stream), buffer, length,
+          &n_read, NULL, NULL) &&
+      n_read == length)
+    {
+      checksum = g_checksum_new (G_CHECKSUM_SHA1);
+      g_checksum_update (checksum, buffer, length);
+      retval = g_strdup (g_checksum_get_string (checksum));
+      g_checksum_free (checksum);
+    }
+
+  g_free (buffer);
+  g_object_unref (stream);
+
+  return retval;
+}
+
+/* Runs @func on the resume record of @handler in a GIO worker thread. It
+ * doesn't run if the transfer is cancelled first; once it does, it runs to
+ * the end, as a failed read would otherwise discard a valid record. */
+static void
+ft_handler_resume_record_run (EmpathyFTHandler *handler,
+    GSimpleAsyncThreadFunc func,
+    GAsyncReadyCallback callback,
+    gpointer source_tag)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GSimpleAsyncResult *result;
+  ResumeRecord *record;
+
+  result = g_simple_async_result_new (G_OBJECT (handler), callback, NULL,
+      source_tag);
+
+  record = ft_handler_dup_resume_record (handler);
+  if (record == NULL)
+    {
+      /* nothing to resume */
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  g_simple_async_result_set_op_res_gpointer (result, record,
+      (GDestroyNotify) resume_record_free);
+  g_simple_async_result_run_in_thread (result, func, G_PRIORITY_DEFAULT,
+      priv->cancellable);
+  g_object_unref (result);
+}
+
+static void
+remove_resume_record_thread (GSimpleAsyncResult *result,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ResumeRecord *record = g_simple_async_result_get_op_res_gpointer (result);
+
+  g_unlink (record->path);
+}
+
+static void
+ft_handler_remove_resume_record (EmpathyFTHandler *handler)
+{
+  ft_handler_resume_record_run (handler, remove_resume_record_thread, NULL,
+      ft_handler_remove_resume_record);
+}
+
+/* Records how much of the file we received, after an error */
+static void
+save_resume_record_thread (GSimpleAsyncResult *result,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ResumeRecord *record = g_simple_async_result_get_op_res_gpointer (result);
+  GFileInfo *info;
+  GKeyFile *key_file;
+  GError *error = NULL;
+  gchar *fingerprint, *data;
+  gsize length;
+  guint64 offset;
+
+  info = g_file_query_info (record->gfile, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL)
+    return;
+
+  offset = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  if (offset == 0 || offset >= record->total_bytes)
+    {
+      g_unlink (record->path);
+      return;
+    }
+
+  fingerprint = resume_record_dup_prefix_fingerprint (record, offset);
+  if (fingerprint == NULL)
+    return;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_string (key_file, RESUME_GROUP, "Account",
+      record->account_path);
+  g_key_file_set_string (key_file, RESUME_GROUP, "Contact",
+      record->contact_id);
+  g_key_file_set_string (key_file, RESUME_GROUP, "Filename",
+      record->filename);
+  g_key_file_set_uint64 (key_file, RESUME_GROUP, "Size", record->total_bytes);
+  if (record->content_hash != NULL)
+    g_key_file_set_string (key_file, RESUME_GROUP, "ContentHash",
+        record->content_hash);
+  g_key_file_set_uint64 (key_file, RESUME_GROUP, "Offset", offset);
+  g_key_file_set_string (key_file, RESUME_GROUP, "Fingerprint", fingerprint);
+
+  data = g_key_file_to_data (key_file, &length, NULL);
+
+  DEBUG ("Saving resume record %s at offset %" G_GUINT64_FORMAT,
+      record->path, offset);
+
+  if (!g_file_set_contents (record->path, data, length, &error))
+    {
+      DEBUG ("Failed to save the resume record: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (data);
+  g_key_file_free (key_file);
+  g_free (fingerprint);
+}
+
+static void
+ft_handler_save_resume_record (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GSimpleAsyncResult *result;
+  ResumeRecord *record;
+
+  record = ft_handler_dup_resume_record (handler);
+  if (record == NULL)
+    return;
+
+  /* not cancellable: the transfer's cancellable is likely why we're
+   * saving it */
+  result = g_simple_async_result_new (G_OBJECT (handler), NULL, NULL,
+      ft_handler_save_resume_record);
+  g_simple_async_result_set_op_res_gpointer (result, record,
+      (GDestroyNotify) resume_record_free);
+  g_simple_async_result_run_in_thread (result, save_resume_record_thread,
+      G_PRIORITY_DEFAULT, NULL);
+  g_object_unref (result);
+}
+
+static gboolean
+resume_record_matches (GKeyFile *key_file,
+    const gchar *key,
+    const gchar *value)
+{
+  gchar *str;
+  gboolean retval;
+
+  str = g_key_file_get_string (key_file, RESUME_GROUP, key, NULL);
+  retval = !tp_strdiff (str, value);
+  g_free (str);
+
+  return retval;
+}
+
+/* Finds the offset the incoming transfer can be resumed at, or 0 if it
+ * has to start over. Records which don't match anymore are removed. */
+static void
+load_resume_record_thread (GSimpleAsyncResult *result,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ResumeRecord *record = g_simple_async_result_get_op_res_gpointer (result);
+  GKeyFile *key_file;
+  GFileInfo *info;
+  gchar *fingerprint;
+  guint64 offset = 0;
+
+  key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, record->path, G_KEY_FILE_NONE,
+          NULL))
+    goto out;
+
+  if (!resume_record_matches (key_file, "Account", record->account_path) ||
+      !resume_record_matches (key_file, "Contact", record->contact_id) ||
+      !resume_record_matches (key_file, "Filename", record->filename) ||
+      !resume_record_matches (key_file, "ContentHash",
+          record->content_hash) ||
+      g_key_file_get_uint64 (key_file, RESUME_GROUP, "Size", NULL) !=
+          record->total_bytes)
+    {
+      DEBUG ("Resume record %s is for another transfer", record->path);
+      goto invalid;
+    }
+
+  offset = g_key_file_get_uint64 (key_file, RESUME_GROUP, "Offset", NULL);
+  if (offset == 0 || offset >= record->total_bytes)
+    goto invalid;
+
+  /* we may have written a bit more after saving the record, that's
+   * dropped when resuming */
+  info = g_file_query_info (record->gfile, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL || (guint64) g_file_info_get_size (info) < offset)
+    {
+      if (info != NULL)
+        g_object_unref (info);
+
+      DEBUG ("Partial file is shorter than its resume record");
+      goto invalid;
+    }
+  g_object_unref (info);
+
+  fingerprint = resume_record_dup_prefix_fingerprint (record, offset);
+  if (!resume_record_matches (key_file, "Fingerprint", fingerprint))
+    {
+      DEBUG ("Partial file changed since its resume record was saved");
+      g_free (fingerprint);
+      goto invalid;
+    }
+  g_free (fingerprint);
+
+  DEBUG ("Resuming %s at offset %" G_GUINT64_FORMAT, record->filename,
+      offset);
+  goto out;
+
+invalid:
+  offset = 0;
+  g_unlink (record->path);
+
+out:
+  record->offset = offset;
+  g_key_file_free (key_file);
+}
+
+static void
+ft_handler_load_resume_record_async (EmpathyFTHandler *handler,
+    GAsyncReadyCallback callback)
+{
+  ft_handler_resume_record_run (handler, load_resume_record_thread,
+      callback, ft_handler_load_resume_record_async);
+}
+
+static gboolean
+ft_handler_load_resume_record_finish (EmpathyFTHandler *handler,
+    GAsyncResult *result,
+    guint64 *offset,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  ResumeRecord *record;
+
+  *offset = 0;
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+
+  record = g_simple_async_result_get_op_res_gpointer (simple);
+  if (record != NULL)
+    *offset = record->offset;
+
+  return TRUE;
 }
 
 static void
@@ -641,10 +1021,18 @@ ft_transfer_operation_callback (EmpathyTpFile *tp_file,
 
   if (error != NULL)
     {
+      /* Failing before receiving anything leaves the destination, and the
+       * record we may have resumed from, as they were */
+      if (empathy_ft_handler_is_incoming (handler) && priv->received_data)
+        ft_handler_save_resume_record (handler);
+
       emit_error_signal (handler, error);
     }
   else
     {
+      if (empathy_ft_handler_is_incoming (handler))
+        ft_handler_remove_resume_record (handler);
+
       priv->is_completed = TRUE;
       g_signal_emit (handler, signals[TRANSFER_DONE], 0, tp_file);
 
@@ -652,7 +1040,7 @@ ft_transfer_operation_callback (EmpathyTpFile *tp_file,
 
       if (empathy_ft_handler_is_incoming (handler) && priv->use_hash)
         {
-          check_hash_incoming (handler);
+          check_hash_incoming (handler, tp_file);
         }
     }
 }
@@ -695,6 +1083,10 @@ ft_transfer_progress_callback (EmpathyTpFile *tp_file,
   if (empathy_ft_handler_is_cancelled (handler))
     return;
 
+  /* Only reported once the destination was opened and data came in */
+  if (transferred_bytes > 0)
+    priv->received_data = TRUE;
+
   if (transferred_bytes == 0)
     {
       priv->last_update_time = empathy_time_get_current ();
@@ -816,36 +1208,12 @@ hash_job_done (gpointer user_data)
 
   DEBUG ("Got file hash %s", g_checksum_get_string (hash_data->checksum));
 
-  if (empathy_ft_handler_is_incoming (handler))
-    {
-      if (g_strcmp0 (g_checksum_get_string (hash_data->checksum),
-                     priv->content_hash))
-        {
-          DEBUG ("Hash mismatch when checking incoming handler: "
-                 "received %s, calculated %s", priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
-
-          error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
-              EMPATHY_FT_ERROR_HASH_MISMATCH,
-              _("File transfer completed, but the file was corrupted"));
-          goto cleanup;
-        }
-      else
-        {
-          DEBUG ("Hash verification matched, received %s, calculated %s",
-                 priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
-        }
-    }
-  else
-    {
-      /* set the checksum in the request...
-       * org.freedesktop.Telepathy.Channel.Type.FileTransfer.ContentHash
-       */
-      tp_asv_set_string (priv->request,
-          TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH,
-          g_checksum_get_string (hash_data->checksum));
-    }
+  /* set the checksum in the request...
+   * org.freedesktop.Telepathy.Channel.Type.FileTransfer.ContentHash
+   */
+  tp_asv_set_string (priv->request,
+      TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH,
+      g_checksum_get_string (hash_data->checksum));
 
 cleanup:
 
@@ -858,9 +1226,8 @@ cleanup:
     {
       g_signal_emit (handler, signals[HASHING_DONE], 0);
 
-      if (!empathy_ft_handler_is_incoming (handler))
-        /* the request is complete now, push it to the dispatcher */
-        ft_handler_push_to_dispatcher (handler);
+      /* the request is complete now, push it to the dispatcher */
+      ft_handler_push_to_dispatcher (handler);
     }
 
   hash_data_free (hash_data);
@@ -874,11 +1241,42 @@ emit_hashing_progress (gpointer user_data)
   HashingData *hash_data = user_data;
 
   g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
+      hash_data->progress_bytes, hash_data->total_bytes);
+
+  g_atomic_int_set (&hash_data->progress_pending, FALSE);
 
   return FALSE;
 }
 
+/* Small files are read in a few calls anyway, big ones are read in big
+ * chunks so that hashing isn't dominated by the syscalls */
+static gsize
+hash_buffer_size (guint64 total_bytes)
+{
+  gsize size = MIN_HASH_BUFFER_SIZE;
+
+  while (size < MAX_HASH_BUFFER_SIZE && size * 256 < total_bytes)
+    size *= 2;
+
+  return size;
+}
+
+static void
+hash_data_advise_sequential (HashingData *hash_data)
+{
+#ifdef HAVE_POSIX_FADVISE
+  gint fd;
+
+  if (!G_IS_FILE_DESCRIPTOR_BASED (hash_data->stream))
+    return;
+
+  /* lets the kernel read ahead more aggressively */
+  fd = g_file_descriptor_based_get_fd (
+      G_FILE_DESCRIPTOR_BASED (hash_data->stream));
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
 static gboolean
 do_hash_job (GIOSchedulerJob *job,
     GCancellable *cancellable,
@@ -886,40 +1284,44 @@ do_hash_job (GIOSchedulerJob *job,
 {
   HashingData *hash_data = user_data;
   gssize bytes_read;
-  EmpathyFTHandlerPriv *priv;
+  GTimer *progress_timer;
   GError *error = NULL;
 
-  priv = GET_PRIV (hash_data->handler);
+  hash_data->buffer_size = hash_buffer_size (hash_data->total_bytes);
+  hash_data->buffer = g_malloc (hash_data->buffer_size);
+  hash_data_advise_sequential (hash_data);
 
-again:
-  if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
+  progress_timer = g_timer_new ();
 
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
+  while (TRUE)
+    {
+      bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
+          hash_data->buffer_size, cancellable, &error);
 
-  hash_data->total_read += bytes_read;
+      if (bytes_read <= 0)
+        break;
 
-  /* we now have the chunk */
-  if (bytes_read > 0)
-    {
       g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+      hash_data->total_read += bytes_read;
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+      /* don't flood the main loop with notifications on fast disks */
+      if (g_timer_elapsed (progress_timer, NULL) >= HASH_PROGRESS_INTERVAL &&
+          g_atomic_int_compare_and_exchange (&hash_data->progress_pending,
+              FALSE, TRUE))
+        {
+          hash_data->progress_bytes = hash_data->total_read;
+          g_io_scheduler_job_send_to_mainloop_async (job,
+              emit_hashing_progress, hash_data, NULL);
 
-      goto again;
+          g_timer_start (progress_timer);
+        }
     }
-  else
-  {
+
+  g_timer_destroy (progress_timer);
+
+  if (error == NULL)
     g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
 
-out:
   if (error != NULL)
     hash_data->error = error;
 
@@ -929,33 +1331,6 @@ out:
   return FALSE;
 }
 
-static gboolean
-do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable,
-    gpointer user_data)
-{
-  HashingData *hash_data = user_data;
-  EmpathyFTHandler *handler = hash_data->handler;
-  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  GError *error = NULL;
-
-  DEBUG ("checking integrity for incoming handler");
-
-  /* need to get the stream first */
-  hash_data->stream =
-    G_INPUT_STREAM (g_file_read (priv->gfile, cancellable, &error));
-
-  if (error != NULL)
-    {
-      hash_data->error = error;
-      g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-          hash_data, NULL);
-      return FALSE;
-    }
-
-  return do_hash_job (job, cancellable, user_data);
-}
-
 static void
 ft_handler_read_async_cb (GObject *source,
     GAsyncResult *res,
@@ -1382,12 +1757,43 @@ empathy_ft_handler_new_incoming (EmpathyTpFile *tp_file,
       channel_get_all_properties_cb, data, NULL, G_OBJECT (handler));
 }
 
+static void
+ft_handler_resume_record_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = EMPATHY_FT_HANDLER (source);
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GError *error = NULL;
+  guint64 offset;
+
+  if (!ft_handler_load_resume_record_finish (handler, result, &offset,
+          &error))
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          DEBUG ("Transfer cancelled while loading its resume record");
+          g_error_free (error);
+          return;
+        }
+
+      DEBUG ("Failed to load the resume record: %s", error->message);
+      g_error_free (error);
+    }
+
+  empathy_tp_file_accept (priv->tpfile, offset, priv->gfile,
+      priv->cancellable, ft_transfer_progress_callback, handler,
+      ft_transfer_operation_callback, handler);
+}
+
 /**
  * empathy_ft_handler_start_transfer:
  * @handler: an #EmpathyFTHandler
  *
  * Starts the transfer machinery. After this call, the transfer and hashing
  * signals will be emitted by the handler.
+ * An incoming transfer which was interrupted before is resumed where it
+ * stopped if the same contact offers the same file to the same destination.
  */
 void
 empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
@@ -1404,10 +1810,12 @@ empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
     }
   else
     {
-      /* TODO: add support for resume. */
-      empathy_tp_file_accept (priv->tpfile, 0, priv->gfile, priv->cancellable,
-          ft_transfer_progress_callback, handler,
-          ft_transfer_operation_callback, handler);
+      if (priv->use_hash)
+        empathy_tp_file_set_checksum_type (priv->tpfile,
+            tp_file_hash_to_g_checksum (priv->content_hash_type));
+
+      ft_handler_load_resume_record_async (handler,
+          ft_handler_resume_record_loaded_cb);
     }
 }
 
@@ -61,6 +61,7 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_CHAT_NICK_COMPLETION_CHAR    "nick-completion-char"
 #define EMPATHY_PREFS_CHAT_AVATAR_IN_ICON          "avatar-in-icon"
 #define EMPATHY_PREFS_CHAT_WEBKIT_DEVELOPER_TOOLS  "enable-webkit-developer-tools"
+#define EMPATHY_PREFS_CHAT_BACKLOG_LENGTH          "backlog-length"
 
 #define EMPATHY_PREFS_UI_SCHEMA EMPATHY_PREFS_SCHEMA ".ui"
 #define EMPATHY_PREFS_UI_SEPARATE_CHAT_WINDOWS     "separate-chat-windows"
@@ -0,0 +1,1775 @@
+/*
+ * empathy-log-index.c - Source for EmpathyLogIndex
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A full-text index of the conversations logged by telepathy-logger, so
+ * searching them doesn't read every log file.
+ *
+ * The index maps each word of the messages to the log files it appears in,
+ * one file per account, chat and day. It is saved in the user cache dir, read
+ * back into memory the first time it is needed, and brought up to date before
+ * searches by indexing again the log files which changed since. Loading,
+ * updating and querying the index all happen in a GIO worker thread.
+ *
+ * The index only narrows a search down to the files having words which
+ * contain those searched. As in telepathy-logger's own search, a file only
+ * matches if one of its messages contains the searched text, case
+ * insensitively, which is checked by reading the few files left.
+ *
+ * It also caches the days with logs of each chat, so browsing the log
+ * window calendar asks telepathy-logger for them only once. */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/account-manager.h>
+#include <telepathy-glib/defs.h>
+#include <telepathy-glib/util.h>
+
+#include <telepathy-logger/log-manager.h>
+
+#include "empathy-log-index.h"
+#include "empathy-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Bump when the format or the tokenizer change */
+#define INDEX_VERSION 2
+#define INDEX_TYPE "(ua(sttssbs)a(sa(uu)))"
+
+/* Longer tokens are most likely not words */
+#define MAX_TOKEN_LEN 64
+
+/* Searches made while typing don't look for new logs more often than this,
+ * in seconds */
+#define UPDATE_INTERVAL 10
+/* Only the files of the last days are written to, so the older ones are only
+ * checked for changes that often, in seconds */
+#define FULL_CHECK_INTERVAL (60 * 60)
+
+typedef struct {
+  guint id;
+  /* relative to the logs dir */
+  gchar *path;
+  guint64 mtime;
+  guint64 size;
+  gchar *account_path;
+  gchar *chat_id;
+  gboolean is_chatroom;
+  /* YYYYMMDD */
+  gchar *date;
+  /* replaced or removed, dropped by log_index_compact() */
+  gboolean stale;
+} IndexedFile;
+
+/* Stored as is in the a(uu) arrays of the index */
+typedef struct {
+  guint32 file;
+  /* number of messages of the file containing the token */
+  guint32 count;
+} Posting;
+
+#define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyLogIndex)
+typedef struct {
+  /* Only used from worker threads, with the log_index lock held */
+  gboolean loaded;
+  /* IndexedFile, indexed by their id */
+  GPtrArray *files;
+  /* path -> IndexedFile, borrowed */
+  GHashTable *files_by_path;
+  /* token -> GArray of Posting */
+  GHashTable *postings;
+  /* the tokens of @postings, borrowed, and the trigrams of their bytes ->
+   * GArray of the guint32 indexes in @vocabulary of the tokens containing
+   * them. Built by the first search after the tokens changed. */
+  GPtrArray *vocabulary;
+  GHashTable *trigrams;
+  gboolean dirty;
+  time_t last_update;
+  time_t last_full_check;
+
+  /* Main thread only */
+  TplLogManager *log_manager;
+  /* "account path/[chatrooms/]chat id" -> GArray of the julian days which
+   * have logs, sorted */
+  GHashTable *dates;
+} EmpathyLogIndexPriv;
+
+typedef struct {
+  /* NULL when only updating */
+  gchar *text;
+  /* look for new logs even if it was done a moment ago */
+  gboolean force_update;
+  /* log dir name -> account object path */
+  GHashTable *account_dirs;
+  /* SearchHit, most relevant first */
+  GList *hits;
+} IndexJob;
+
+typedef struct {
+  gchar *account_path;
+  gchar *chat_id;
+  gboolean is_chatroom;
+  gchar *date;
+  gdouble score;
+} SearchHit;
+
+typedef void (*TokenFunc) (const gchar *token,
+    gpointer user_data);
+
+G_LOCK_DEFINE_STATIC (log_index);
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *log_index_singleton = NULL;
+
+static gchar *
+log_index_dup_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "empathy", "log-index",
+      NULL);
+}
+
+static gchar *
+log_index_dup_logs_dir (void)
+{
+  /* Where telepathy-logger's XML store keeps its files */
+  return g_build_filename (g_get_user_data_dir (), "TpLogger", "logs", NULL);
+}
+
+static void
+indexed_file_free (IndexedFile *file)
+{
+  g_free (file->path);
+  g_free (file->account_path);
+  g_free (file->chat_id);
+  g_free (file->date);
+  g_slice_free (IndexedFile, file);
+}
+
+static void
+search_hit_free (SearchHit *hit)
+{
+  g_free (hit->account_path);
+  g_free (hit->chat_id);
+  g_free (hit->date);
+  g_slice_free (SearchHit, hit);
+}
+
+static void
+index_job_free (IndexJob *job)
+{
+  g_free (job->text);
+  g_hash_table_unref (job->account_dirs);
+  g_list_foreach (job->hits, (GFunc) search_hit_free, NULL);
+  g_list_free (job->hits);
+  g_slice_free (IndexJob, job);
+}
+
+/* Calls @func for each lowercased alphanumeric word of @text. With @markup,
+ * entities are separators like the characters they stand for. */
+static void
+log_index_tokenize (const gchar *text,
+    gsize len,
+    gboolean markup,
+    TokenFunc func,
+    gpointer user_data)
+{
+  GString *token = g_string_sized_new (MAX_TOKEN_LEN);
+  const gchar *p = text;
+  const gchar *end = text + len;
+
+  while (p <= end)
+    {
+      gunichar c = 0;
+
+      if (p < end)
+        c = g_utf8_get_char_validated (p, end - p);
+
+      if (p < end && c != (gunichar) -1 && c != (gunichar) -2 &&
+          g_unichar_isalnum (c))
+        {
+          g_string_append_unichar (token, g_unichar_tolower (c));
+          p = g_utf8_next_char (p);
+          continue;
+        }
+
+      if (token->len > 0 && token->len <= MAX_TOKEN_LEN)
+        func (token->str, user_data);
+      g_string_truncate (token, 0);
+
+      if (p == end)
+        break;
+
+      if (c == (gunichar) -1 || c == (gunichar) -2)
+        {
+          p++;
+        }
+      else if (markup && c == '&')
+        {
+          const gchar *semicolon;
+
+          semicolon = memchr (p, ';', MIN (end - p, 10));
+          p = semicolon != NULL ? semicolon + 1 : p + 1;
+        }
+      else
+        {
+          p = g_utf8_next_char (p);
+        }
+    }
+
+  g_string_free (token, TRUE);
+}
+
+static void
+log_index_add_file (EmpathyLogIndex *self,
+    IndexedFile *file)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+
+  file->id = priv->files->len;
+  g_ptr_array_add (priv->files, file);
+  g_hash_table_insert (priv->files_by_path, file->path, file);
+}
+
+static void
+log_index_load (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GMappedFile *mapped_file;
+  GVariant *variant;
+  GVariant *files;
+  GVariant *postings;
+  GVariantIter iter;
+  GVariant *child;
+  GError *error = NULL;
+  gchar *filename;
+  guint32 version;
+  gsize i, n;
+
+  priv->loaded = TRUE;
+
+  filename = log_index_dup_filename ();
+  mapped_file = g_mapped_file_new (filename, FALSE, &error);
+  g_free (filename);
+
+  if (mapped_file == NULL)
+    {
+      DEBUG ("No log index: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* Not trusted: a broken file gives an empty index. The mapping only lasts
+   * until everything is copied into the tables updates modify. */
+  variant = g_variant_new_from_data (G_VARIANT_TYPE (INDEX_TYPE),
+      g_mapped_file_get_contents (mapped_file),
+      g_mapped_file_get_length (mapped_file), FALSE,
+      (GDestroyNotify) g_mapped_file_unref, mapped_file);
+  g_variant_ref_sink (variant);
+
+  g_variant_get_child (variant, 0, "u", &version);
+  if (version != INDEX_VERSION)
+    {
+      DEBUG ("Discarding log index version %u", version);
+      g_variant_unref (variant);
+      return;
+    }
+
+  files = g_variant_get_child_value (variant, 1);
+  n = g_variant_n_children (files);
+  for (i = 0; i < n; i++)
+    {
+      IndexedFile *file = g_slice_new0 (IndexedFile);
+
+      g_variant_get_child (files, i, "(sttssbs)", &file->path,
+          &file->mtime, &file->size, &file->account_path, &file->chat_id,
+          &file->is_chatroom, &file->date);
+      log_index_add_file (self, file);
+    }
+  g_variant_unref (files);
+
+  postings = g_variant_get_child_value (variant, 2);
+  g_variant_iter_init (&iter, postings);
+  while ((child = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      const gchar *token;
+      GVariant *array;
+      const Posting *elements;
+      GArray *postings_array;
+      gsize n_elements;
+
+      g_variant_get (child, "(&s@a(uu))", &token, &array);
+      elements = g_variant_get_fixed_array (array, &n_elements,
+          sizeof (Posting));
+
+      postings_array = g_array_sized_new (FALSE, FALSE, sizeof (Posting),
+          n_elements);
+      for (i = 0; i < n_elements; i++)
+        {
+          if (elements[i].file < priv->files->len)
+            g_array_append_val (postings_array, elements[i]);
+        }
+
+      g_hash_table_insert (priv->postings, g_strdup (token), postings_array);
+
+      g_variant_unref (array);
+      g_variant_unref (child);
+    }
+  g_variant_unref (postings);
+  g_variant_unref (variant);
+
+  DEBUG ("Log index loaded: %u files, %u tokens", priv->files->len,
+      g_hash_table_size (priv->postings));
+}
+
+static void
+log_index_save (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GVariantBuilder files_builder;
+  GVariantBuilder postings_builder;
+  GHashTableIter iter;
+  gpointer key, value;
+  GVariant *variant;
+  GFile *file;
+  GFileOutputStream *stream;
+  GCancellable *cancellable;
+  GError *error = NULL;
+  gchar *filename;
+  gchar *dirname;
+  guint i;
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(sttssbs)"));
+  for (i = 0; i < priv->files->len; i++)
+    {
+      IndexedFile *file = g_ptr_array_index (priv->files, i);
+
+      g_variant_builder_add (&files_builder, "(sttssbs)", file->path,
+          file->mtime, file->size, file->account_path, file->chat_id,
+          file->is_chatroom, file->date);
+    }
+
+  g_variant_builder_init (&postings_builder, G_VARIANT_TYPE ("a(sa(uu))"));
+  g_hash_table_iter_init (&iter, priv->postings);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GArray *postings_array = value;
+      gsize size = postings_array->len * sizeof (Posting);
+      GVariant *array;
+
+      /* Fixed size elements are serialized back to back */
+      array = g_variant_new_from_data (G_VARIANT_TYPE ("a(uu)"),
+          g_memdup (postings_array->data, size), size, TRUE, g_free,
+          NULL);
+      g_variant_builder_add (&postings_builder, "(s@a(uu))", key, array);
+    }
+
+  variant = g_variant_new (INDEX_TYPE, (guint32) INDEX_VERSION,
+      &files_builder, &postings_builder);
+  g_variant_ref_sink (variant);
+
+  filename = log_index_dup_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+
+  /* The words of the conversations are as private as the logs: replaced
+   * atomically by a file only the user can read */
+  file = g_file_new_for_path (filename);
+  cancellable = g_cancellable_new ();
+  stream = g_file_replace (file, NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL,
+      &error);
+
+  if (stream != NULL)
+    {
+      if (!g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+              g_variant_get_data (variant), g_variant_get_size (variant),
+              NULL, NULL, &error))
+        {
+          /* Closing a cancelled stream keeps the previous index */
+          g_cancellable_cancel (cancellable);
+        }
+
+      if (g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable,
+              error == NULL ? &error : NULL))
+        priv->dirty = FALSE;
+
+      g_object_unref (stream);
+    }
+
+  if (error != NULL)
+    {
+      DEBUG ("Failed to save the log index: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (cancellable);
+  g_object_unref (file);
+  g_variant_unref (variant);
+  g_free (dirname);
+  g_free (filename);
+}
+
+typedef struct {
+  guint count;
+  /* number of the last message which contained the token */
+  guint message;
+} FileToken;
+
+typedef struct {
+  GHashTable *tokens;
+  guint message;
+} ParseContext;
+
+static void
+log_index_clear_vocabulary (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+
+  if (priv->vocabulary != NULL)
+    {
+      g_ptr_array_free (priv->vocabulary, TRUE);
+      priv->vocabulary = NULL;
+      g_hash_table_destroy (priv->trigrams);
+      priv->trigrams = NULL;
+    }
+}
+
+static void
+log_index_parse_token_cb (const gchar *token,
+    gpointer user_data)
+{
+  ParseContext *ctx = user_data;
+  FileToken *file_token;
+
+  file_token = g_hash_table_lookup (ctx->tokens, token);
+  if (file_token == NULL)
+    {
+      file_token = g_slice_new0 (FileToken);
+      g_hash_table_insert (ctx->tokens, g_strdup (token), file_token);
+    }
+
+  if (file_token->message != ctx->message)
+    {
+      file_token->count++;
+      file_token->message = ctx->message;
+    }
+}
+
+static void
+file_token_free (FileToken *file_token)
+{
+  g_slice_free (FileToken, file_token);
+}
+
+static void
+log_index_parse_file (EmpathyLogIndex *self,
+    IndexedFile *file,
+    const gchar *filename)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  ParseContext ctx = { NULL, 0 };
+  GHashTableIter iter;
+  gpointer key, value;
+  gchar *contents;
+  const gchar *cur;
+  const gchar *start;
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    return;
+
+  ctx.tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) file_token_free);
+
+  /* <message time='...' ...>escaped body</message> */
+  cur = contents;
+  while ((start = strstr (cur, "<message ")) != NULL)
+    {
+      const gchar *body;
+      const gchar *end;
+
+      body = strchr (start, '>');
+      if (body == NULL)
+        break;
+      body++;
+
+      end = strstr (body, "</message>");
+      if (end == NULL)
+        break;
+
+      ctx.message++;
+      log_index_tokenize (body, end - body, TRUE, log_index_parse_token_cb,
+          &ctx);
+
+      cur = end;
+    }
+
+  g_hash_table_iter_init (&iter, ctx.tokens);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      FileToken *file_token = value;
+      GArray *postings_array;
+      Posting posting;
+
+      postings_array = g_hash_table_lookup (priv->postings, key);
+      if (postings_array == NULL)
+        {
+          postings_array = g_array_new (FALSE, FALSE, sizeof (Posting));
+          g_hash_table_insert (priv->postings, g_strdup (key),
+              postings_array);
+          log_index_clear_vocabulary (self);
+        }
+
+      posting.file = file->id;
+      posting.count = file_token->count;
+      g_array_append_val (postings_array, posting);
+    }
+
+  g_hash_table_destroy (ctx.tokens);
+  g_free (contents);
+}
+
+/* Drops the stale files and their postings, renumbering the others */
+static void
+log_index_compact (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GPtrArray *files;
+  GHashTableIter iter;
+  gpointer value;
+  guint *ids;
+  guint i;
+
+  ids = g_new (guint, priv->files->len);
+  files = g_ptr_array_sized_new (priv->files->len);
+
+  for (i = 0; i < priv->files->len; i++)
+    {
+      IndexedFile *file = g_ptr_array_index (priv->files, i);
+
+      if (file->stale)
+        {
+          ids[i] = G_MAXUINT;
+          indexed_file_free (file);
+        }
+      else
+        {
+          ids[i] = files->len;
+          file->id = files->len;
+          g_ptr_array_add (files, file);
+        }
+    }
+
+  g_hash_table_iter_init (&iter, priv->postings);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GArray *postings_array = value;
+      guint kept = 0;
+
+      for (i = 0; i < postings_array->len; i++)
+        {
+          Posting posting = g_array_index (postings_array, Posting, i);
+
+          if (ids[posting.file] == G_MAXUINT)
+            continue;
+
+          posting.file = ids[posting.file];
+          g_array_index (postings_array, Posting, kept++) = posting;
+        }
+
+      if (kept == 0)
+        {
+          g_hash_table_iter_remove (&iter);
+          log_index_clear_vocabulary (self);
+        }
+      else
+        g_array_set_size (postings_array, kept);
+    }
+
+  g_ptr_array_free (priv->files, TRUE);
+  priv->files = files;
+  priv->dirty = TRUE;
+  g_free (ids);
+}
+
+/* Indexes the new log files of a chat, and those which changed. The known
+ * files of days before @recent, a YYYYMMDD date, aren't checked for changes;
+ * they all are if it is %NULL. */
+static void
+log_index_update_chat (EmpathyLogIndex *self,
+    const gchar *logs_dir,
+    const gchar *rel_dir,
+    const gchar *account_path,
+    const gchar *chat_id,
+    gboolean is_chatroom,
+    const gchar *recent,
+    GHashTable *seen)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GDir *dir;
+  const gchar *name;
+  gchar *path;
+
+  path = g_build_filename (logs_dir, rel_dir, NULL);
+  dir = g_dir_open (path, 0, NULL);
+  g_free (path);
+
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      IndexedFile *file;
+      struct stat st;
+      gchar *rel_path;
+
+      /* YYYYMMDD.log */
+      if (strlen (name) != 12 || !g_str_has_suffix (name, ".log"))
+        continue;
+
+      rel_path = g_build_filename (rel_dir, name, NULL);
+      file = g_hash_table_lookup (priv->files_by_path, rel_path);
+
+      if (file != NULL && recent != NULL && strncmp (name, recent, 8) < 0)
+        {
+          g_hash_table_insert (seen, file, file);
+          g_free (rel_path);
+          continue;
+        }
+
+      path = g_build_filename (logs_dir, rel_path, NULL);
+
+      if (g_stat (path, &st) != 0)
+        {
+          g_free (rel_path);
+          g_free (path);
+          continue;
+        }
+
+      if (file != NULL && file->mtime == (guint64) st.st_mtime &&
+          file->size == (guint64) st.st_size)
+        {
+          g_hash_table_insert (seen, file, file);
+          g_free (rel_path);
+          g_free (path);
+          continue;
+        }
+
+      if (file != NULL)
+        {
+          file->stale = TRUE;
+          g_hash_table_remove (priv->files_by_path, rel_path);
+        }
+
+      file = g_slice_new0 (IndexedFile);
+      file->path = rel_path;
+      file->mtime = st.st_mtime;
+      file->size = st.st_size;
+      file->account_path = g_strdup (account_path);
+      file->chat_id = g_strdup (chat_id);
+      file->is_chatroom = is_chatroom;
+      file->date = g_strndup (name, 8);
+
+      log_index_add_file (self, file);
+      log_index_parse_file (self, file, path);
+      g_hash_table_insert (seen, file, file);
+      priv->dirty = TRUE;
+
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+}
+
+/* Indexes the log files of @account_dirs which changed since last time and
+ * forgets the removed ones. Unless @force, does nothing if that was done a
+ * moment ago. */
+static void
+log_index_update (EmpathyLogIndex *self,
+    GHashTable *account_dirs,
+    gboolean force)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GHashTable *seen;
+  GHashTable *scanned;
+  GHashTableIter iter;
+  gpointer key, value;
+  gboolean removed = FALSE;
+  gchar recent_date[9];
+  const gchar *recent = NULL;
+  gchar *logs_dir;
+  time_t now;
+  guint i;
+
+  if (!priv->loaded)
+    log_index_load (self);
+
+  now = time (NULL);
+  if (!force && priv->last_update != 0 && now >= priv->last_update &&
+      now - priv->last_update < UPDATE_INTERVAL)
+    return;
+
+  priv->last_update = now;
+
+  if (priv->last_full_check != 0 && now >= priv->last_full_check &&
+      now - priv->last_full_check < FULL_CHECK_INTERVAL)
+    {
+      struct tm tm;
+      time_t yesterday = now - 24 * 60 * 60;
+
+      /* The logs are split by UTC day, and the day before might still get
+       * the last messages of a conversation */
+      gmtime_r (&yesterday, &tm);
+      strftime (recent_date, sizeof (recent_date), "%Y%m%d", &tm);
+      recent = recent_date;
+    }
+  else
+    {
+      priv->last_full_check = now;
+    }
+
+  logs_dir = log_index_dup_logs_dir ();
+  seen = g_hash_table_new (NULL, NULL);
+  scanned = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_iter_init (&iter, account_dirs);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *account_dir = key;
+      const gchar *account_path = value;
+      const gchar *name;
+      GDir *dir;
+      gchar *path;
+
+      g_hash_table_insert (scanned, value, value);
+
+      path = g_build_filename (logs_dir, account_dir, NULL);
+      dir = g_dir_open (path, 0, NULL);
+      g_free (path);
+
+      if (dir == NULL)
+        continue;
+
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *rel_dir;
+
+          rel_dir = g_build_filename (account_dir, name, NULL);
+
+          if (!tp_strdiff (name, "chatrooms"))
+            {
+              GDir *rooms;
+              const gchar *room;
+
+              path = g_build_filename (logs_dir, rel_dir, NULL);
+              rooms = g_dir_open (path, 0, NULL);
+              g_free (path);
+
+              while (rooms != NULL && (room = g_dir_read_name (rooms)) != NULL)
+                {
+                  gchar *room_dir = g_build_filename (rel_dir, room, NULL);
+
+                  log_index_update_chat (self, logs_dir, room_dir,
+                      account_path, room, TRUE, recent, seen);
+                  g_free (room_dir);
+                }
+
+              if (rooms != NULL)
+                g_dir_close (rooms);
+            }
+          else
+            {
+              log_index_update_chat (self, logs_dir, rel_dir, account_path,
+                  name, FALSE, recent, seen);
+            }
+
+          g_free (rel_dir);
+        }
+
+      g_dir_close (dir);
+    }
+
+  for (i = 0; i < priv->files->len; i++)
+    {
+      IndexedFile *file = g_ptr_array_index (priv->files, i);
+
+      if (!file->stale &&
+          g_hash_table_lookup (seen, file) == NULL &&
+          g_hash_table_lookup (scanned, file->account_path) != NULL)
+        {
+          file->stale = TRUE;
+          g_hash_table_remove (priv->files_by_path, file->path);
+        }
+
+      removed |= file->stale;
+    }
+
+  if (removed)
+    log_index_compact (self);
+
+  if (priv->dirty)
+    {
+      DEBUG ("Log index updated: %u files, %u tokens", priv->files->len,
+          g_hash_table_size (priv->postings));
+      log_index_save (self);
+    }
+
+  g_hash_table_destroy (scanned);
+  g_hash_table_destroy (seen);
+  g_free (logs_dir);
+}
+
+typedef struct {
+  gdouble score;
+  guint count;
+  /* number of words of the search found so far */
+  guint n_words;
+} FileScore;
+
+static void
+file_score_free (FileScore *score)
+{
+  g_slice_free (FileScore, score);
+}
+
+static void
+log_index_add_word_cb (const gchar *token,
+    gpointer user_data)
+{
+  GPtrArray *words = user_data;
+  guint i;
+
+  for (i = 0; i < words->len; i++)
+    {
+      if (!tp_strdiff (g_ptr_array_index (words, i), token))
+        return;
+    }
+
+  g_ptr_array_add (words, g_strdup (token));
+}
+
+static gint
+search_hit_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const SearchHit *hit_a = a;
+  const SearchHit *hit_b = b;
+
+  if (hit_a->score != hit_b->score)
+    return hit_a->score > hit_b->score ? -1 : 1;
+
+  /* Most recent first */
+  return -strcmp (hit_a->date, hit_b->date);
+}
+
+#define TRIGRAM(p) (((guint) (guchar) (p)[0] << 16) | \
+    ((guint) (guchar) (p)[1] << 8) | (guint) (guchar) (p)[2])
+
+static void
+log_index_ensure_vocabulary (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GHashTableIter iter;
+  gpointer key;
+  guint32 t;
+
+  if (priv->vocabulary != NULL)
+    return;
+
+  priv->vocabulary = g_ptr_array_sized_new (
+      g_hash_table_size (priv->postings));
+  priv->trigrams = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_array_unref);
+
+  g_hash_table_iter_init (&iter, priv->postings);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (priv->vocabulary, key);
+
+  for (t = 0; t < priv->vocabulary->len; t++)
+    {
+      const gchar *token = g_ptr_array_index (priv->vocabulary, t);
+      gsize i, len = strlen (token);
+
+      for (i = 0; i + 3 <= len; i++)
+        {
+          gpointer trigram = GUINT_TO_POINTER (TRIGRAM (token + i));
+          GArray *tokens;
+
+          tokens = g_hash_table_lookup (priv->trigrams, trigram);
+          if (tokens == NULL)
+            {
+              tokens = g_array_new (FALSE, FALSE, sizeof (guint32));
+              g_hash_table_insert (priv->trigrams, trigram, tokens);
+            }
+
+          /* once per token, even if it repeats the trigram */
+          if (tokens->len == 0 ||
+              g_array_index (tokens, guint32, tokens->len - 1) != t)
+            g_array_append_val (tokens, t);
+        }
+    }
+}
+
+/* Adds the tokens containing @word to @matched. Only those having the least
+ * common trigram of @word are looked at, unless it is too short to have
+ * any; it then matches so many tokens that looking at all of them is not
+ * what costs most. */
+static void
+log_index_match_tokens (EmpathyLogIndex *self,
+    const gchar *word,
+    GPtrArray *matched)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GArray *rarest = NULL;
+  gsize i, len = strlen (word);
+
+  log_index_ensure_vocabulary (self);
+
+  if (len < 3)
+    {
+      for (i = 0; i < priv->vocabulary->len; i++)
+        {
+          const gchar *token = g_ptr_array_index (priv->vocabulary, i);
+
+          if (strstr (token, word) != NULL)
+            g_ptr_array_add (matched, (gpointer) token);
+        }
+
+      return;
+    }
+
+  for (i = 0; i + 3 <= len; i++)
+    {
+      GArray *tokens;
+
+      tokens = g_hash_table_lookup (priv->trigrams,
+          GUINT_TO_POINTER (TRIGRAM (word + i)));
+
+      /* no token contains the whole word then */
+      if (tokens == NULL)
+        return;
+
+      if (rarest == NULL || tokens->len < rarest->len)
+        rarest = tokens;
+    }
+
+  for (i = 0; i < rarest->len; i++)
+    {
+      const gchar *token = g_ptr_array_index (priv->vocabulary,
+          g_array_index (rarest, guint32, i));
+
+      if (strstr (token, word) != NULL)
+        g_ptr_array_add (matched, (gpointer) token);
+    }
+}
+
+/* Whether a message of the log file @filename contains @folded, casefolded
+ * and escaped like the bodies of the file */
+static gboolean
+log_index_file_contains (const gchar *filename,
+    const gchar *folded)
+{
+  gchar *contents;
+  gchar *folded_contents;
+  gsize length;
+  const gchar *cur;
+  const gchar *start;
+  gboolean found = FALSE;
+
+  if (!g_file_get_contents (filename, &contents, &length, NULL))
+    return FALSE;
+
+  folded_contents = g_utf8_casefold (contents, length);
+  g_free (contents);
+
+  /* <message time='...' ...>escaped body</message> */
+  cur = folded_contents;
+  while (!found && (start = strstr (cur, "<message ")) != NULL)
+    {
+      const gchar *body;
+      const gchar *end;
+
+      body = strchr (start, '>');
+      if (body == NULL)
+        break;
+      body++;
+
+      end = strstr (body, "</message>");
+      if (end == NULL)
+        break;
+
+      found = g_strstr_len (body, end - body, folded) != NULL;
+      cur = end;
+    }
+
+  g_free (folded_contents);
+
+  return found;
+}
+
+/* Returns the log files with a message containing @text, case insensitively,
+ * ranked by tf-idf. The index gives the files having words containing each
+ * of those of @text, and unless @text is a single word, they are read to
+ * only keep those where the words follow each other like in @text. */
+static gboolean
+log_index_query (EmpathyLogIndex *self,
+    const gchar *text,
+    GList **hits)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GPtrArray *matched;
+  GPtrArray *words;
+  GHashTable *scores;
+  GHashTableIter iter;
+  gpointer key, value;
+  gchar *folded = NULL;
+  gchar *lowered;
+  gchar *logs_dir;
+  guint w;
+
+  words = g_ptr_array_new ();
+  log_index_tokenize (text, strlen (text), FALSE, log_index_add_word_cb,
+      words);
+
+  if (words->len == 0)
+    {
+      g_ptr_array_free (words, TRUE);
+      return FALSE;
+    }
+
+  /* A word matches the same messages as the tokens containing it */
+  lowered = g_utf8_strdown (text, -1);
+  if (words->len > 1 ||
+      tp_strdiff (g_ptr_array_index (words, 0), lowered))
+    {
+      gchar *escaped = g_markup_escape_text (text, -1);
+
+      folded = g_utf8_casefold (escaped, -1);
+      g_free (escaped);
+    }
+  g_free (lowered);
+
+  matched = g_ptr_array_new ();
+  scores = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) file_score_free);
+
+  for (w = 0; w < words->len; w++)
+    {
+      const gchar *word = g_ptr_array_index (words, w);
+      GHashTable *matches;
+      gdouble idf;
+      guint t;
+
+      /* file id -> FileScore of this word */
+      matches = g_hash_table_new_full (NULL, NULL, NULL,
+          (GDestroyNotify) file_score_free);
+
+      g_ptr_array_set_size (matched, 0);
+      log_index_match_tokens (self, word, matched);
+
+      for (t = 0; t < matched->len; t++)
+        {
+          GArray *postings_array;
+          guint i;
+
+          postings_array = g_hash_table_lookup (priv->postings,
+              g_ptr_array_index (matched, t));
+
+          for (i = 0; i < postings_array->len; i++)
+            {
+              Posting *posting;
+              FileScore *match;
+
+              posting = &g_array_index (postings_array, Posting, i);
+              match = g_hash_table_lookup (matches,
+                  GUINT_TO_POINTER (posting->file));
+
+              if (match == NULL)
+                {
+                  match = g_slice_new0 (FileScore);
+                  g_hash_table_insert (matches,
+                      GUINT_TO_POINTER (posting->file), match);
+                }
+
+              match->count += posting->count;
+            }
+        }
+
+      idf = log ((priv->files->len + 1.0) /
+          (g_hash_table_size (matches) + 1.0)) + 1.0;
+
+      g_hash_table_iter_init (&iter, matches);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          FileScore *match = value;
+          FileScore *score;
+
+          score = g_hash_table_lookup (scores, key);
+
+          if (w == 0)
+            {
+              score = g_slice_new0 (FileScore);
+              g_hash_table_insert (scores, key, score);
+            }
+          else if (score == NULL || score->n_words != w)
+            {
+              /* missing a previous word */
+              continue;
+            }
+
+          score->score += match->count * idf;
+          score->n_words++;
+        }
+
+      g_hash_table_destroy (matches);
+    }
+
+  logs_dir = log_index_dup_logs_dir ();
+
+  *hits = NULL;
+  g_hash_table_iter_init (&iter, scores);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      FileScore *score = value;
+      IndexedFile *file;
+      SearchHit *hit;
+
+      if (score->n_words != words->len)
+        continue;
+
+      file = g_ptr_array_index (priv->files, GPOINTER_TO_UINT (key));
+
+      if (folded != NULL)
+        {
+          gchar *filename;
+          gboolean found;
+
+          filename = g_build_filename (logs_dir, file->path, NULL);
+          found = log_index_file_contains (filename, folded);
+          g_free (filename);
+
+          if (!found)
+            continue;
+        }
+
+      hit = g_slice_new (SearchHit);
+      hit->account_path = g_strdup (file->account_path);
+      hit->chat_id = g_strdup (file->chat_id);
+      hit->is_chatroom = file->is_chatroom;
+      hit->date = g_strdup (file->date);
+      hit->score = score->score;
+      *hits = g_list_prepend (*hits, hit);
+    }
+
+  *hits = g_list_sort (*hits, search_hit_compare);
+
+  g_free (logs_dir);
+  g_free (folded);
+  g_ptr_array_free (matched, TRUE);
+  g_hash_table_destroy (scores);
+  g_ptr_array_foreach (words, (GFunc) g_free, NULL);
+  g_ptr_array_free (words, TRUE);
+
+  return TRUE;
+}
+
+static void
+log_index_job_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+  IndexJob *job = g_simple_async_result_get_op_res_gpointer (simple);
+  gboolean searched = TRUE;
+
+  G_LOCK (log_index);
+
+  log_index_update (self, job->account_dirs, job->force_update);
+
+  if (job->text != NULL)
+    searched = log_index_query (self, job->text, &job->hits);
+
+  G_UNLOCK (log_index);
+
+  if (!searched)
+    g_simple_async_result_set_error (simple, G_IO_ERROR,
+        G_IO_ERROR_NOT_SUPPORTED, "No word to look for in '%s'", job->text);
+}
+
+/* The log dirs of the accounts, named after their object path */
+static GHashTable *
+log_index_dup_account_dirs (void)
+{
+  TpAccountManager *manager;
+  GHashTable *account_dirs;
+  GList *accounts, *l;
+
+  account_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+
+  manager = tp_account_manager_dup ();
+  if (!tp_proxy_is_prepared (manager, TP_ACCOUNT_MANAGER_FEATURE_CORE))
+    {
+      g_object_unref (manager);
+      return account_dirs;
+    }
+
+  accounts = tp_account_manager_get_valid_accounts (manager);
+  for (l = accounts; l != NULL; l = l->next)
+    {
+      const gchar *path = tp_proxy_get_object_path (l->data);
+      gchar *name;
+
+      name = g_strdup (path + strlen (TP_ACCOUNT_OBJECT_PATH_BASE));
+      g_strdelimit (name, "/", '_');
+      g_hash_table_insert (account_dirs, name, g_strdup (path));
+    }
+
+  g_list_free (accounts);
+  g_object_unref (manager);
+
+  return account_dirs;
+}
+
+static void
+log_index_run_job (EmpathyLogIndex *self,
+    const gchar *text,
+    GAsyncReadyCallback callback,
+    gpointer user_data,
+    gpointer source_tag)
+{
+  GSimpleAsyncResult *simple;
+  IndexJob *job;
+
+  job = g_slice_new0 (IndexJob);
+  job->text = g_strdup (text);
+  job->force_update = text == NULL;
+  job->account_dirs = log_index_dup_account_dirs ();
+
+  simple = g_simple_async_result_new (G_OBJECT (self), callback, user_data,
+      source_tag);
+  g_simple_async_result_set_op_res_gpointer (simple, job,
+      (GDestroyNotify) index_job_free);
+  g_simple_async_result_run_in_thread (simple, log_index_job_thread,
+      G_PRIORITY_LOW, NULL);
+  g_object_unref (simple);
+}
+
+static void
+empathy_log_index_finalize (GObject *object)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (object);
+
+  g_ptr_array_foreach (priv->files, (GFunc) indexed_file_free, NULL);
+  g_ptr_array_free (priv->files, TRUE);
+  g_hash_table_destroy (priv->files_by_path);
+  log_index_clear_vocabulary (EMPATHY_LOG_INDEX (object));
+  g_hash_table_destroy (priv->postings);
+  g_hash_table_destroy (priv->dates);
+  g_object_unref (priv->log_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static GObject *
+empathy_log_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (log_index_singleton != NULL)
+    {
+      retval = g_object_ref (log_index_singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_log_index_parent_class)->constructor
+          (type, n_props, props);
+
+      log_index_singleton = EMPATHY_LOG_INDEX (retval);
+      g_object_add_weak_pointer (retval, (gpointer) &log_index_singleton);
+    }
+
+  return retval;
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructor = empathy_log_index_constructor;
+  object_class->finalize = empathy_log_index_finalize;
+
+  g_type_class_add_private (klass, sizeof (EmpathyLogIndexPriv));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  EmpathyLogIndexPriv *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  self->priv = priv;
+  priv->files = g_ptr_array_new ();
+  priv->files_by_path = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->postings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_array_unref);
+  priv->log_manager = tpl_log_manager_dup_singleton ();
+  priv->dates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_array_unref);
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+}
+
+/**
+ * empathy_log_index_is_ready:
+ * @self: the #EmpathyLogIndex
+ *
+ * Returns: %TRUE if the index has been built, and can be searched instead
+ * of the logs themselves
+ */
+gboolean
+empathy_log_index_is_ready (EmpathyLogIndex *self)
+{
+  gboolean ready;
+  gchar *filename;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  /* It is saved as soon as it indexed something */
+  filename = log_index_dup_filename ();
+  ready = g_file_test (filename, G_FILE_TEST_EXISTS);
+  g_free (filename);
+
+  return ready;
+}
+
+/**
+ * empathy_log_index_update_async:
+ * @self: the #EmpathyLogIndex
+ * @callback: called once the index is up to date, or %NULL
+ * @user_data: data for @callback
+ *
+ * Builds the index, or indexes the messages logged since it was last updated.
+ */
+void
+empathy_log_index_update_async (EmpathyLogIndex *self,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  log_index_run_job (self, NULL, callback, user_data,
+      empathy_log_index_update_async);
+}
+
+gboolean
+empathy_log_index_update_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+      G_OBJECT (self), empathy_log_index_update_async), FALSE);
+
+  return !g_simple_async_result_propagate_error (
+      G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+/**
+ * empathy_log_index_search_async:
+ * @self: the #EmpathyLogIndex
+ * @text: the words to look for
+ * @callback: called with the results
+ * @user_data: data for @callback
+ *
+ * Updates the index and looks for the days of conversation with a message
+ * containing @text, case insensitively, like telepathy-logger's search does.
+ * Fails with %G_IO_ERROR_NOT_SUPPORTED if @text has no word the index knows
+ * how to look for.
+ */
+void
+empathy_log_index_search_async (EmpathyLogIndex *self,
+    const gchar *text,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (text != NULL);
+
+  log_index_run_job (self, text, callback, user_data,
+      empathy_log_index_search_async);
+}
+
+/**
+ * empathy_log_index_search_finish:
+ * @self: the #EmpathyLogIndex
+ * @result: the #GAsyncResult
+ * @hits: return location for a list of #EmpathyLogIndexHit, most relevant
+ *  first, to free with empathy_log_index_hits_free()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+empathy_log_index_search_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GList **hits,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  TpAccountManager *manager;
+  IndexJob *job;
+  GList *l;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+      G_OBJECT (self), empathy_log_index_search_async), FALSE);
+  g_return_val_if_fail (hits != NULL, FALSE);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+
+  job = g_simple_async_result_get_op_res_gpointer (simple);
+  manager = tp_account_manager_dup ();
+
+  *hits = NULL;
+  for (l = job->hits; l != NULL; l = l->next)
+    {
+      SearchHit *search_hit = l->data;
+      EmpathyLogIndexHit *hit;
+      guint date;
+
+      date = strtoul (search_hit->date, NULL, 10);
+      if (!g_date_valid_dmy (date % 100, (date / 100) % 100, date / 10000))
+        continue;
+
+      hit = g_slice_new (EmpathyLogIndexHit);
+      hit->account = g_object_ref (tp_account_manager_ensure_account (
+          manager, search_hit->account_path));
+      hit->chat_id = g_strdup (search_hit->chat_id);
+      hit->is_chatroom = search_hit->is_chatroom;
+      hit->date = g_date_new_dmy (date % 100, (date / 100) % 100,
+          date / 10000);
+      hit->score = search_hit->score;
+
+      *hits = g_list_prepend (*hits, hit);
+    }
+
+  *hits = g_list_reverse (*hits);
+  g_object_unref (manager);
+
+  return TRUE;
+}
+
+static void
+log_index_hit_free (EmpathyLogIndexHit *hit)
+{
+  g_object_unref (hit->account);
+  g_free (hit->chat_id);
+  g_date_free (hit->date);
+  g_slice_free (EmpathyLogIndexHit, hit);
+}
+
+void
+empathy_log_index_hits_free (GList *hits)
+{
+  g_list_foreach (hits, (GFunc) log_index_hit_free, NULL);
+  g_list_free (hits);
+}
+
+static gchar *
+log_index_dup_dates_key (TpAccount *account,
+    const gchar *chat_id,
+    gboolean is_chatroom)
+{
+  return g_strdup_printf ("%s/%s%s", tp_proxy_get_object_path (account),
+      is_chatroom ? "chatrooms/" : "", chat_id);
+}
+
+static GList *
+log_index_dates_to_list (GArray *dates)
+{
+  GList *list = NULL;
+  guint i;
+
+  for (i = dates->len; i > 0; i--)
+    list = g_list_prepend (list,
+        g_date_new_julian (g_array_index (dates, guint32, i - 1)));
+
+  return list;
+}
+
+static gint
+julian_compare (gconstpointer a,
+    gconstpointer b)
+{
+  guint32 julian_a = *(const guint32 *) a;
+  guint32 julian_b = *(const guint32 *) b;
+
+  return julian_a < julian_b ? -1 : julian_a > julian_b;
+}
+
+/**
+ * empathy_log_index_lookup_dates:
+ * @self: the #EmpathyLogIndex
+ * @account: the account of the chat
+ * @chat_id: the id of the chat
+ * @is_chatroom: whether the chat is a chat room
+ * @dates: return location for a list of #GDate, oldest first, to free with
+ *  g_date_free()
+ *
+ * Gives the days with logs of a chat without any I/O, if they have been
+ * retrieved with empathy_log_index_get_dates_async() already.
+ *
+ * Returns: %TRUE if the days of the chat are known
+ */
+gboolean
+empathy_log_index_lookup_dates (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *chat_id,
+    gboolean is_chatroom,
+    GList **dates)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GArray *julians;
+  gchar *key;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+  g_return_val_if_fail (dates != NULL, FALSE);
+
+  key = log_index_dup_dates_key (account, chat_id, is_chatroom);
+  julians = g_hash_table_lookup (priv->dates, key);
+  g_free (key);
+
+  if (julians == NULL)
+    return FALSE;
+
+  *dates = log_index_dates_to_list (julians);
+  return TRUE;
+}
+
+typedef struct {
+  GSimpleAsyncResult *simple;
+  gchar *key;
+} GetDatesContext;
+
+static void
+log_index_got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GetDatesContext *ctx = user_data;
+  EmpathyLogIndex *self;
+  EmpathyLogIndexPriv *priv;
+  GList *dates, *l;
+  GArray *julians;
+  GError *error = NULL;
+
+  self = EMPATHY_LOG_INDEX (g_async_result_get_source_object (
+      G_ASYNC_RESULT (ctx->simple)));
+  priv = GET_PRIV (self);
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager), result,
+          &dates, &error))
+    {
+      g_simple_async_result_set_from_error (ctx->simple, error);
+      g_error_free (error);
+      goto out;
+    }
+
+  julians = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+      g_list_length (dates));
+  for (l = dates; l != NULL; l = l->next)
+    {
+      guint32 julian = g_date_get_julian (l->data);
+
+      g_array_append_val (julians, julian);
+      g_date_free (l->data);
+    }
+  g_list_free (dates);
+
+  g_array_sort (julians, julian_compare);
+
+  g_hash_table_replace (priv->dates, ctx->key, g_array_ref (julians));
+  ctx->key = NULL;
+
+  g_simple_async_result_set_op_res_gpointer (ctx->simple, julians,
+      (GDestroyNotify) g_array_unref);
+
+out:
+  g_simple_async_result_complete (ctx->simple);
+  g_object_unref (ctx->simple);
+  g_object_unref (self);
+  g_free (ctx->key);
+  g_slice_free (GetDatesContext, ctx);
+}
+
+/**
+ * empathy_log_index_get_dates_async:
+ * @self: the #EmpathyLogIndex
+ * @account: the account of the chat
+ * @chat_id: the id of the chat
+ * @is_chatroom: whether the chat is a chat room
+ * @callback: called with the days
+ * @user_data: data for @callback
+ *
+ * Retrieves the days with logs of a chat. They are only asked to
+ * telepathy-logger the first time, and kept up to date in memory by
+ * empathy_log_index_message_logged() then.
+ */
+void
+empathy_log_index_get_dates_async (EmpathyLogIndex *self,
+    TpAccount *account,
+    const gchar *chat_id,
+    gboolean is_chatroom,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  EmpathyLogIndexPriv *priv = GET_PRIV (self);
+  GSimpleAsyncResult *simple;
+  GetDatesContext *ctx;
+  GArray *julians;
+  gchar *key;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (chat_id != NULL);
+
+  simple = g_simple_async_result_new (G_OBJECT (self), callback, user_data,
+      empathy_log_index_get_dates_async);
+
+  key = log_index_dup_dates_key (account, chat_id, is_chatroom);
+  julians = g_hash_table_lookup (priv->dates, key);
+
+  if (julians != NULL)
+    {
+      g_simple_async_result_set_op_res_gpointer (simple,
+          g_array_ref (julians), (GDestroyNotify) g_array_unref);
+      g_simple_async_result_complete_in_idle (simple);
+      g_object_unref (simple);
+      g_free (key);
+      return;
+    }
+
+  ctx = g_slice_new (GetDatesContext);
+  ctx->simple = simple;
+  ctx->key = key;
+
+  tpl_log_manager_get_dates_async (priv->log_manager, account, chat_id,
+      is_chatroom, log_index_got_dates_cb, ctx);
+}
+
+/**
+ * empathy_log_index_get_dates_finish:
+ * @self: the #EmpathyLogIndex
+ * @result: the #GAsyncResult
+ * @dates: return location for a list of #GDate, oldest first, to free with
+ *  g_date_free()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+empathy_log_index_get_dates_finish (EmpathyLogIndex *self,
+    GAsyncResult *result,
+    GList **dates,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+      G_OBJECT (self), empathy_log_index_get_dates_async), FALSE);
+  g_return_val_if_fail (dates != NULL, FALSE);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+
+  *dates = log_index_dates_to_list (
+      g_simple_async_result_get_op_res_gpointer (simple));
+  return TRUE;
+}
+
+/**
+ * empathy_log_index_message_logged:
+ * @account: the account of the chat
+ * @chat_id: the id of the chat
+ * @is_chatroom: whether the chat is a chat room
+ * @timestamp: when the message was sent or received
+ *
+ * Adds the day of a new message to the days with logs of its chat, if they
+ * are known. Does nothing if there is no #EmpathyLogIndex.
+ */
+void
+empathy_log_index_message_logged (TpAccount *account,
+    const gchar *chat_id,
+    gboolean is_chatroom,
+    time_t timestamp)
+{
+  EmpathyLogIndexPriv *priv;
+  GArray *julians;
+  GDate date;
+  struct tm tm;
+  guint32 julian;
+  gchar *key;
+  guint i;
+
+  if (log_index_singleton == NULL || account == NULL || chat_id == NULL)
+    return;
+
+  priv = GET_PRIV (log_index_singleton);
+
+  key = log_index_dup_dates_key (account, chat_id, is_chatroom);
+  julians = g_hash_table_lookup (priv->dates, key);
+  g_free (key);
+
+  if (julians == NULL)
+    return;
+
+  /* The logs are split by UTC day */
+  gmtime_r (&timestamp, &tm);
+  g_date_clear (&date, 1);
+  g_date_set_dmy (&date, tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900);
+  julian = g_date_get_julian (&date);
+
+  /* New messages are about today, so look from the end */
+  for (i = julians->len; i > 0; i--)
+    {
+      guint32 known = g_array_index (julians, guint32, i - 1);
+
+      if (known == julian)
+        return;
+
+      if (known < julian)
+        break;
+    }
+
+  g_array_insert_val (julians, i, julian);
+}
@@ -0,0 +1,270 @@
+/*
+ * empathy-message-batch.c - Source for EmpathyMessageBatch
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* empathy_message_from_tpl_log_entry() builds an EmpathyMessage, two
+ * EmpathyContact and a few strings for each entry, which adds up when
+ * replaying a day of logs. A batch instead copies the entries into one
+ * array of records, their strings into one GStringChunk, and interns the
+ * senders and receivers: they only become an EmpathyContact, shared by all
+ * their messages, once one of those is displayed. */
+
+#include <config.h>
+
+#include <telepathy-glib/account-manager.h>
+
+#include <telepathy-logger/entry-text.h>
+
+#include "empathy-message-batch.h"
+#include "empathy-utils.h"
+
+struct _EmpathyMessageIdentity {
+  /* borrowed from the account manager */
+  TpAccount *account;
+  /* in the batch's GStringChunk */
+  const gchar *identifier;
+  const gchar *alias;
+  const gchar *avatar_token;
+  gboolean is_user;
+  /* created the first time it is displayed */
+  EmpathyContact *contact;
+};
+
+struct _EmpathyMessageBatch {
+  EmpathyMessageRecord *records;
+  guint n_records;
+  /* bodies, identities' strings and account paths */
+  GStringChunk *strings;
+  /* "account path\nidentifier\nalias\navatar token\nis user" ->
+   * EmpathyMessageIdentity */
+  GHashTable *identities;
+  /* account path -> TpAccount, borrowed */
+  GHashTable *accounts;
+  TpAccountManager *account_manager;
+};
+
+static void
+message_identity_free (EmpathyMessageIdentity *identity)
+{
+  tp_clear_object (&identity->contact);
+  g_slice_free (EmpathyMessageIdentity, identity);
+}
+
+static TpAccount *
+message_batch_ensure_account (EmpathyMessageBatch *batch,
+    const gchar *path)
+{
+  TpAccount *account;
+
+  account = g_hash_table_lookup (batch->accounts, path);
+  if (account == NULL)
+    {
+      /* See empathy_message_from_tpl_log_entry() about removed accounts */
+      account = tp_account_manager_ensure_account (batch->account_manager,
+          path);
+      g_hash_table_insert (batch->accounts,
+          g_string_chunk_insert_const (batch->strings, path), account);
+    }
+
+  return account;
+}
+
+static EmpathyMessageIdentity *
+message_batch_intern_identity (EmpathyMessageBatch *batch,
+    GString *key,
+    const gchar *account_path,
+    TplEntity *entity)
+{
+  EmpathyMessageIdentity *identity;
+  const gchar *identifier;
+  const gchar *alias;
+  const gchar *avatar_token;
+  gboolean is_user;
+
+  if (entity == NULL)
+    return NULL;
+
+  identifier = tpl_entity_get_identifier (entity);
+  alias = tpl_entity_get_alias (entity);
+  avatar_token = tpl_entity_get_avatar_token (entity);
+  is_user = tpl_entity_get_entity_type (entity) == TPL_ENTITY_SELF;
+
+  /* Reuses the buffer of @key, so known identities cost no allocation */
+  g_string_printf (key, "%s\n%s\n%s\n%s\n%d", account_path,
+      identifier != NULL ? identifier : "", alias != NULL ? alias : "",
+      avatar_token != NULL ? avatar_token : "", is_user);
+
+  identity = g_hash_table_lookup (batch->identities, key->str);
+  if (identity != NULL)
+    return identity;
+
+  identity = g_slice_new0 (EmpathyMessageIdentity);
+  identity->account = message_batch_ensure_account (batch, account_path);
+  identity->identifier = identifier == NULL ? NULL :
+      g_string_chunk_insert_const (batch->strings, identifier);
+  identity->alias = alias == NULL ? NULL :
+      g_string_chunk_insert_const (batch->strings, alias);
+  identity->avatar_token = avatar_token == NULL ? NULL :
+      g_string_chunk_insert_const (batch->strings, avatar_token);
+  identity->is_user = is_user;
+
+  g_hash_table_insert (batch->identities, g_strdup (key->str), identity);
+
+  return identity;
+}
+
+/**
+ * empathy_message_batch_new:
+ * @entries: a list of #TplEntry, oldest first
+ *
+ * Copies the text entries of @entries into a batch, so they can be released
+ * right away. Other entries are skipped.
+ *
+ * Returns: a new #EmpathyMessageBatch, to free with
+ *  empathy_message_batch_free()
+ */
+EmpathyMessageBatch *
+empathy_message_batch_new (GList *entries)
+{
+  EmpathyMessageBatch *batch;
+  GString *key;
+  GList *l;
+
+  batch = g_slice_new0 (EmpathyMessageBatch);
+  batch->records = g_new0 (EmpathyMessageRecord, g_list_length (entries));
+  batch->strings = g_string_chunk_new (4096);
+  batch->identities = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) message_identity_free);
+  batch->accounts = g_hash_table_new (g_str_hash, g_str_equal);
+  batch->account_manager = tp_account_manager_dup ();
+
+  key = g_string_sized_new (128);
+
+  for (l = entries; l != NULL; l = l->next)
+    {
+      TplEntry *entry = l->data;
+      EmpathyMessageRecord *record;
+      const gchar *account_path;
+      const gchar *body;
+
+      if (!TPL_IS_ENTRY_TEXT (entry))
+        continue;
+
+      record = &batch->records[batch->n_records++];
+      account_path = tpl_entry_get_account_path (entry);
+
+      body = tpl_entry_text_get_message (TPL_ENTRY_TEXT (entry));
+      record->body = g_string_chunk_insert (batch->strings,
+          body != NULL ? body : "");
+      record->timestamp = tpl_entry_get_timestamp (entry);
+      record->id = tpl_entry_text_get_pending_msg_id (TPL_ENTRY_TEXT (entry));
+      record->sender = message_batch_intern_identity (batch, key,
+          account_path, tpl_entry_get_sender (entry));
+      record->receiver = message_batch_intern_identity (batch, key,
+          account_path, tpl_entry_get_receiver (entry));
+    }
+
+  g_string_free (key, TRUE);
+
+  return batch;
+}
+
+void
+empathy_message_batch_free (EmpathyMessageBatch *batch)
+{
+  if (batch == NULL)
+    return;
+
+  g_hash_table_destroy (batch->identities);
+  g_hash_table_destroy (batch->accounts);
+  g_object_unref (batch->account_manager);
+  g_string_chunk_free (batch->strings);
+  g_free (batch->records);
+  g_slice_free (EmpathyMessageBatch, batch);
+}
+
+guint
+empathy_message_batch_get_length (EmpathyMessageBatch *batch)
+{
+  g_return_val_if_fail (batch != NULL, 0);
+
+  return batch->n_records;
+}
+
+/**
+ * empathy_message_batch_get_record:
+ * @batch: an #EmpathyMessageBatch
+ * @index_: the index of a record
+ *
+ * Returns: the record, valid as long as @batch
+ */
+const EmpathyMessageRecord *
+empathy_message_batch_get_record (EmpathyMessageBatch *batch,
+    guint index_)
+{
+  g_return_val_if_fail (batch != NULL, NULL);
+  g_return_val_if_fail (index_ < batch->n_records, NULL);
+
+  return &batch->records[index_];
+}
+
+static EmpathyContact *
+message_identity_get_contact (EmpathyMessageIdentity *identity)
+{
+  if (identity->contact == NULL)
+    identity->contact = empathy_contact_from_log_entity (identity->account,
+        identity->identifier, identity->alias, identity->avatar_token,
+        identity->is_user);
+
+  return identity->contact;
+}
+
+/**
+ * empathy_message_batch_dup_message:
+ * @batch: an #EmpathyMessageBatch
+ * @index_: the index of a record
+ *
+ * Returns: a new #EmpathyMessage for the record, as would
+ *  empathy_message_from_tpl_log_entry() for its entry
+ */
+EmpathyMessage *
+empathy_message_batch_dup_message (EmpathyMessageBatch *batch,
+    guint index_)
+{
+  const EmpathyMessageRecord *record;
+  EmpathyMessage *message;
+
+  g_return_val_if_fail (batch != NULL, NULL);
+  g_return_val_if_fail (index_ < batch->n_records, NULL);
+
+  record = &batch->records[index_];
+
+  message = empathy_message_new (record->body);
+  if (record->receiver != NULL)
+    empathy_message_set_receiver (message,
+        message_identity_get_contact (record->receiver));
+  if (record->sender != NULL)
+    empathy_message_set_sender (message,
+        message_identity_get_contact (record->sender));
+
+  empathy_message_set_timestamp (message, record->timestamp);
+  empathy_message_set_id (message, record->id);
+  empathy_message_set_is_backlog (message, TRUE);
+
+  return message;
+}
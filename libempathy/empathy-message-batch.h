@@ -0,0 +1,59 @@
+/*
+ * empathy-message-batch.h - Header for EmpathyMessageBatch
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_MESSAGE_BATCH_H__
+#define __EMPATHY_MESSAGE_BATCH_H__
+
+#include <time.h>
+
+#include <glib.h>
+
+#include "empathy-message.h"
+
+G_BEGIN_DECLS
+
+/* Logged messages, copied out of their TplEntry into plain records sharing
+ * a few allocations, and turned into EmpathyMessage when displayed */
+typedef struct _EmpathyMessageBatch EmpathyMessageBatch;
+
+/* A sender or receiver, shared by all the records where it appears */
+typedef struct _EmpathyMessageIdentity EmpathyMessageIdentity;
+
+typedef struct {
+  const gchar *body;
+  time_t timestamp;
+  guint id;
+  EmpathyMessageIdentity *sender;
+  EmpathyMessageIdentity *receiver;
+} EmpathyMessageRecord;
+
+EmpathyMessageBatch * empathy_message_batch_new (GList *entries);
+void empathy_message_batch_free (EmpathyMessageBatch *batch);
+
+guint empathy_message_batch_get_length (EmpathyMessageBatch *batch);
+const EmpathyMessageRecord * empathy_message_batch_get_record (
+    EmpathyMessageBatch *batch,
+    guint index_);
+EmpathyMessage * empathy_message_batch_dup_message (
+    EmpathyMessageBatch *batch,
+    guint index_);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_MESSAGE_BATCH_H__ */
@@ -37,6 +37,17 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_TP | EMPATHY_DEBUG_CHAT
 #include "empathy-debug.h"
 
+/* Handles whose contact is requested during a main loop iteration, resolved
+ * together by a single request */
+typedef struct {
+	/* TpHandle set of the added members */
+	GHashTable *members;
+	/* TpHandle -> GList of EmpathyMessage waiting for their sender. The
+	 * messages are owned by messages_queue. */
+	GHashTable *senders;
+	GArray     *handles;
+} ContactsBatch;
+
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyTpChat)
 typedef struct {
 	gboolean               dispose_has_run;
@@ -45,6 +56,11 @@ typedef struct {
 	EmpathyContact        *user;
 	EmpathyContact        *remote_contact;
 	GList                 *members;
+	/* TpHandle -> GList link in members */
+	GHashTable            *members_links;
+	/* Contacts to resolve in the next batch, see tp_chat_resolve_handle() */
+	ContactsBatch         *batch;
+	guint                  batch_id;
 	TpChannel             *channel;
 	gboolean               listing_pending_messages;
 	/* Queue of messages not signalled yet */
@@ -257,24 +273,232 @@ tp_chat_emit_queued_messages (EmpathyTpChat *chat)
 	check_ready (chat);
 }
 
+static EmpathyContact *
+tp_chat_get_known_contact (EmpathyTpChat *chat,
+			   TpHandle       handle)
+{
+	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	GList             *link;
+
+	if (priv->user != NULL &&
+	    empathy_contact_get_handle (priv->user) == handle) {
+		return priv->user;
+	}
+
+	link = g_hash_table_lookup (priv->members_links,
+				    GUINT_TO_POINTER (handle));
+	if (link != NULL) {
+		return link->data;
+	}
+
+	if (priv->remote_contact != NULL &&
+	    empathy_contact_get_handle (priv->remote_contact) == handle) {
+		return priv->remote_contact;
+	}
+
+	return NULL;
+}
+
+static void
+tp_chat_add_member (EmpathyTpChat  *chat,
+		    EmpathyContact *contact)
+{
+	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+
+	priv->members = g_list_prepend (priv->members,
+		g_object_ref (contact));
+	g_hash_table_insert (priv->members_links,
+		GUINT_TO_POINTER (empathy_contact_get_handle (contact)),
+		priv->members);
+}
+
+static ContactsBatch *
+contacts_batch_new (void)
+{
+	ContactsBatch *batch = g_slice_new (ContactsBatch);
+
+	batch->members = g_hash_table_new (NULL, NULL);
+	batch->senders = g_hash_table_new_full (NULL, NULL, NULL,
+		(GDestroyNotify) g_list_free);
+	batch->handles = g_array_new (FALSE, FALSE, sizeof (TpHandle));
+
+	return batch;
+}
+
+static void
+contacts_batch_free (ContactsBatch *batch)
+{
+	g_hash_table_destroy (batch->members);
+	g_hash_table_destroy (batch->senders);
+	g_array_free (batch->handles, TRUE);
+	g_slice_free (ContactsBatch, batch);
+}
+
+static void
+tp_chat_drop_messages (EmpathyTpChat *chat,
+		       GList         *messages)
+{
+	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	GList             *l;
+
+	/* Do not block the message queue, just drop these messages */
+	for (l = messages; l != NULL; l = l->next) {
+		g_queue_remove (priv->messages_queue, l->data);
+		g_object_unref (l->data);
+	}
+}
+
+static void tp_chat_update_remote_contact (EmpathyTpChat *chat);
+static void check_almost_ready (EmpathyTpChat *chat);
+
 static void
-tp_chat_got_sender_cb (TpConnection            *connection,
-		       EmpathyContact          *contact,
-		       const GError            *error,
-		       gpointer                 message,
-		       GObject                 *chat)
+tp_chat_got_batch_contacts_cb (TpConnection            *connection,
+			       guint                    n_contacts,
+			       EmpathyContact * const * contacts,
+			       guint                    n_failed,
+			       const TpHandle          *failed,
+			       const GError            *error,
+			       gpointer                 user_data,
+			       GObject                 *object)
 {
+	EmpathyTpChat     *chat = EMPATHY_TP_CHAT (object);
 	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	ContactsBatch     *batch = user_data;
+	GPtrArray         *added;
+	const TpIntSet    *members = NULL;
+	guint              i;
 
 	if (error) {
+		GHashTableIter iter;
+		gpointer       value;
+
 		DEBUG ("Error: %s", error->message);
-		/* Do not block the message queue, just drop this message */
-		g_queue_remove (priv->messages_queue, message);
+
+		g_hash_table_iter_init (&iter, batch->senders);
+		while (g_hash_table_iter_next (&iter, NULL, &value)) {
+			tp_chat_drop_messages (chat, value);
+		}
+		tp_chat_emit_queued_messages (chat);
+		return;
+	}
+
+	if (priv->channel != NULL &&
+	    tp_proxy_has_interface_by_id (priv->channel,
+					  TP_IFACE_QUARK_CHANNEL_INTERFACE_GROUP)) {
+		members = tp_channel_group_get_members (priv->channel);
+	}
+
+	added = g_ptr_array_sized_new (n_contacts);
+	for (i = 0; i < n_contacts; i++) {
+		EmpathyContact *contact = contacts[i];
+		TpHandle        handle = empathy_contact_get_handle (contact);
+		GList          *l;
+
+		/* Make sure the contact is still member */
+		if (members != NULL &&
+		    g_hash_table_lookup (batch->members,
+					 GUINT_TO_POINTER (handle)) != NULL &&
+		    tp_intset_is_member (members, handle) &&
+		    g_hash_table_lookup (priv->members_links,
+					 GUINT_TO_POINTER (handle)) == NULL) {
+			tp_chat_add_member (chat, contact);
+			g_ptr_array_add (added, contact);
+		}
+
+		l = g_hash_table_lookup (batch->senders,
+					 GUINT_TO_POINTER (handle));
+		for (; l != NULL; l = l->next) {
+			empathy_message_set_sender (l->data, contact);
+		}
+	}
+
+	for (i = 0; i < n_failed; i++) {
+		DEBUG ("Failed to resolve handle %u", failed[i]);
+		tp_chat_drop_messages (chat, g_hash_table_lookup (batch->senders,
+			GUINT_TO_POINTER (failed[i])));
+	}
+
+	/* Listeners get the whole batch at once, in the same main loop
+	 * iteration */
+	if (added->len > 0) {
+		DEBUG ("%u members added", added->len);
+	}
+
+	for (i = 0; i < added->len; i++) {
+		g_signal_emit_by_name (chat, "members-changed",
+				       g_ptr_array_index (added, i), NULL, 0,
+				       NULL, TRUE);
+	}
+	g_ptr_array_free (added, TRUE);
+
+	tp_chat_update_remote_contact (chat);
+	check_almost_ready (chat);
+	tp_chat_emit_queued_messages (chat);
+}
+
+static gboolean
+tp_chat_resolve_batch_cb (gpointer user_data)
+{
+	EmpathyTpChat     *chat = user_data;
+	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	ContactsBatch     *batch = priv->batch;
+
+	priv->batch = NULL;
+	priv->batch_id = 0;
+
+	empathy_tp_contact_factory_get_from_handles (priv->connection,
+		batch->handles->len, (TpHandle *) batch->handles->data,
+		tp_chat_got_batch_contacts_cb,
+		batch, (GDestroyNotify) contacts_batch_free,
+		G_OBJECT (chat));
+
+	return FALSE;
+}
+
+/* Queues @handle to be resolved with every other handle requested during
+ * this main loop iteration, so joining a big room or receiving its backlog
+ * only makes a few requests. @message, if not %NULL, gets the contact as
+ * sender. Otherwise the contact is added to the members. */
+static void
+tp_chat_resolve_handle (EmpathyTpChat  *chat,
+			TpHandle        handle,
+			EmpathyMessage *message)
+{
+	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	ContactsBatch     *batch;
+	gboolean           known;
+
+	if (priv->batch == NULL) {
+		priv->batch = contacts_batch_new ();
+		priv->batch_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+			tp_chat_resolve_batch_cb, chat, NULL);
+	}
+
+	batch = priv->batch;
+	known = g_hash_table_lookup (batch->members,
+				     GUINT_TO_POINTER (handle)) != NULL ||
+		g_hash_table_lookup (batch->senders,
+				     GUINT_TO_POINTER (handle)) != NULL;
+
+	if (message != NULL) {
+		GList *messages;
+
+		/* Steal the list, replacing the entry would free it */
+		messages = g_hash_table_lookup (batch->senders,
+						GUINT_TO_POINTER (handle));
+		g_hash_table_steal (batch->senders, GUINT_TO_POINTER (handle));
+		messages = g_list_prepend (messages, message);
+		g_hash_table_insert (batch->senders,
+				     GUINT_TO_POINTER (handle), messages);
 	} else {
-		empathy_message_set_sender (message, contact);
+		g_hash_table_insert (batch->members,
+				     GUINT_TO_POINTER (handle),
+				     GUINT_TO_POINTER (TRUE));
 	}
 
-	tp_chat_emit_queued_messages (EMPATHY_TP_CHAT (chat));
+	if (!known) {
+		g_array_append_val (batch->handles, handle);
+	}
 }
 
 static void
@@ -309,10 +533,15 @@ tp_chat_build_message (EmpathyTpChat *chat,
 		empathy_message_set_sender (message, priv->user);
 		tp_chat_emit_queued_messages (chat);
 	} else {
-		empathy_tp_contact_factory_get_from_handle (priv->connection,
-			from_handle,
-			tp_chat_got_sender_cb,
-			message, NULL, G_OBJECT (chat));
+		EmpathyContact *sender;
+
+		sender = tp_chat_get_known_contact (chat, from_handle);
+		if (sender != NULL) {
+			empathy_message_set_sender (message, sender);
+			tp_chat_emit_queued_messages (chat);
+		} else {
+			tp_chat_resolve_handle (chat, from_handle, message);
+		}
 	}
 }
 
@@ -459,6 +688,14 @@ tp_chat_state_changed_cb (TpChannel *channel,
 			  GObject   *chat)
 {
 	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	EmpathyContact    *contact;
+
+	contact = tp_chat_get_known_contact (EMPATHY_TP_CHAT (chat), handle);
+	if (contact != NULL) {
+		tp_chat_state_changed_got_contact_cb (priv->connection, contact,
+			NULL, GUINT_TO_POINTER (state), chat);
+		return;
+	}
 
 	empathy_tp_contact_factory_get_from_handle (priv->connection, handle,
 		tp_chat_state_changed_got_contact_cb, GUINT_TO_POINTER (state),
@@ -778,6 +1015,16 @@ tp_chat_dispose (GObject *object)
 
 	priv->dispose_has_run = TRUE;
 
+	if (priv->batch_id != 0) {
+		g_source_remove (priv->batch_id);
+		priv->batch_id = 0;
+	}
+
+	if (priv->batch != NULL) {
+		contacts_batch_free (priv->batch);
+		priv->batch = NULL;
+	}
+
 	tp_clear_object (&priv->account);
 
 	if (priv->connection != NULL)
@@ -835,6 +1082,10 @@ tp_chat_finalize (GObject *object)
 	g_queue_free (priv->messages_queue);
 	g_queue_free (priv->pending_messages_queue);
 
+	g_hash_table_destroy (priv->members_links);
+	g_list_foreach (priv->members, (GFunc) g_object_unref, NULL);
+	g_list_free (priv->members);
+
 	G_OBJECT_CLASS (empathy_tp_chat_parent_class)->finalize (object);
 }
 
@@ -916,7 +1167,10 @@ tp_chat_update_remote_contact (EmpathyTpChat *chat)
 	 * there are more, set the "remote-contact" property to NULL and the
 	 * UI will display a contact list. */
 	self_handle = tp_channel_group_get_self_handle (priv->channel);
-	for (l = priv->members; l; l = l->next) {
+	/* Skip the walk of big rooms: with more than the self contact and
+	 * another member, there is more than one remote contact */
+	l = g_hash_table_size (priv->members_links) > 2 ? NULL : priv->members;
+	for (; l; l = l->next) {
 		/* Skip self contact if member */
 		if (empathy_contact_get_handle (l->data) == self_handle) {
 			continue;
@@ -947,71 +1201,32 @@ tp_chat_update_remote_contact (EmpathyTpChat *chat)
 	g_object_notify (G_OBJECT (chat), "remote-contact");
 }
 
-static void
-tp_chat_got_added_contacts_cb (TpConnection            *connection,
-			       guint                    n_contacts,
-			       EmpathyContact * const * contacts,
-			       guint                    n_failed,
-			       const TpHandle          *failed,
-			       const GError            *error,
-			       gpointer                 user_data,
-			       GObject                 *chat)
-{
-	EmpathyTpChatPriv *priv = GET_PRIV (chat);
-	guint i;
-	const TpIntSet *members;
-	TpHandle handle;
-	EmpathyContact *contact;
-
-	if (error) {
-		DEBUG ("Error: %s", error->message);
-		return;
-	}
-
-	members = tp_channel_group_get_members (priv->channel);
-	for (i = 0; i < n_contacts; i++) {
-		contact = contacts[i];
-		handle = empathy_contact_get_handle (contact);
-
-		/* Make sure the contact is still member */
-		if (tp_intset_is_member (members, handle)) {
-			priv->members = g_list_prepend (priv->members,
-				g_object_ref (contact));
-			g_signal_emit_by_name (chat, "members-changed",
-					       contact, NULL, 0, NULL, TRUE);
-		}
-	}
-
-	tp_chat_update_remote_contact (EMPATHY_TP_CHAT (chat));
-	check_almost_ready (EMPATHY_TP_CHAT (chat));
-}
-
 static EmpathyContact *
 chat_lookup_contact (EmpathyTpChat *chat,
 		     TpHandle       handle,
 		     gboolean       remove_)
 {
 	EmpathyTpChatPriv *priv = GET_PRIV (chat);
+	EmpathyContact *c;
 	GList *l;
 
-	for (l = priv->members; l; l = l->next) {
-		EmpathyContact *c = l->data;
-
-		if (empathy_contact_get_handle (c) != handle) {
-			continue;
-		}
+	l = g_hash_table_lookup (priv->members_links, GUINT_TO_POINTER (handle));
+	if (l == NULL) {
+		return NULL;
+	}
 
-		if (remove_) {
-			/* Caller takes the reference. */
-			priv->members = g_list_delete_link (priv->members, l);
-		} else {
-			g_object_ref (c);
-		}
+	c = l->data;
 
-		return c;
+	if (remove_) {
+		/* Caller takes the reference. */
+		g_hash_table_remove (priv->members_links,
+				     GUINT_TO_POINTER (handle));
+		priv->members = g_list_delete_link (priv->members, l);
+	} else {
+		g_object_ref (c);
 	}
 
-	return NULL;
+	return c;
 }
 
 typedef struct
@@ -1075,8 +1290,7 @@ tp_chat_got_renamed_contacts_cb (TpConnection            *connection,
 
 	/* Make sure the contact is still member */
 	if (tp_intset_is_member (members, handle)) {
-		priv->members = g_list_prepend (priv->members,
-			g_object_ref (new));
+		tp_chat_add_member (EMPATHY_TP_CHAT (chat), new);
 
 		if (old != NULL) {
 			g_signal_emit_by_name (chat, "member-renamed",
@@ -1160,11 +1374,9 @@ tp_chat_group_members_changed_cb (TpChannel     *self,
 	}
 
 	/* Request added contacts */
-	if (added->len > 0) {
-		empathy_tp_contact_factory_get_from_handles (priv->connection,
-			added->len, (TpHandle *) added->data,
-			tp_chat_got_added_contacts_cb, NULL, NULL,
-			G_OBJECT (chat));
+	for (i = 0; i < added->len; i++) {
+		tp_chat_resolve_handle (chat,
+			g_array_index (added, TpHandle, i), NULL);
 	}
 
 	tp_chat_update_remote_contact (chat);
@@ -1277,7 +1489,8 @@ tp_chat_constructor (GType                  type,
 	if (tp_proxy_has_interface_by_id (priv->channel,
 					  TP_IFACE_QUARK_CHANNEL_INTERFACE_GROUP)) {
 		const TpIntSet *members;
-		GArray *handles;
+		TpIntSetFastIter iter;
+		TpHandle member;
 
 		/* Get self contact from the group's self handle */
 		handle = tp_channel_group_get_self_handle (priv->channel);
@@ -1287,10 +1500,11 @@ tp_chat_constructor (GType                  type,
 
 		/* Get initial member contacts */
 		members = tp_channel_group_get_members (priv->channel);
-		handles = tp_intset_to_array (members);
-		empathy_tp_contact_factory_get_from_handles (priv->connection,
-			handles->len, (TpHandle *) handles->data,
-			tp_chat_got_added_contacts_cb, NULL, NULL, chat);
+		tp_intset_fast_iter_init (&iter, members);
+		while (tp_intset_fast_iter_next (&iter, &member)) {
+			tp_chat_resolve_handle (EMPATHY_TP_CHAT (chat),
+				member, NULL);
+		}
 
 		priv->can_upgrade_to_muc = FALSE;
 
@@ -1534,6 +1748,7 @@ empathy_tp_chat_init (EmpathyTpChat *chat)
 	chat->priv = priv;
 	priv->messages_queue = g_queue_new ();
 	priv->pending_messages_queue = g_queue_new ();
+	priv->members_links = g_hash_table_new (NULL, NULL);
 }
 
 static void
@@ -35,6 +35,7 @@
 #include <glib/gi18n-lib.h>
 
 #include <gio/gio.h>
+#include <gio/gfiledescriptorbased.h>
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 
@@ -44,6 +45,8 @@
 #include <telepathy-glib/interfaces.h>
 
 #include "empathy-tp-file.h"
+#include "empathy-checksum-stream.h"
+#include "empathy-fd-splice.h"
 #include "empathy-marshal.h"
 #include "empathy-time.h"
 #include "empathy-utils.h"
@@ -51,6 +54,9 @@
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
 #include "empathy-debug.h"
 
+/* size of the reads when hashing the beginning of a resumed file */
+#define PREFIX_BUFFER_SIZE (256 * 1024)
+
 /**
  * SECTION:empathy-tp-file
  * @title: EmpathyTpFile
@@ -68,6 +74,7 @@
 typedef struct {
   TpChannel *channel;
 
+  GFile *gfile;
   GInputStream *in_stream;
   GOutputStream *out_stream;
 
@@ -82,7 +89,20 @@ typedef struct {
   time_t start_time;
   GArray *socket_address;
   guint port;
+  /* the offset we asked to resume at, and the one the CM agreed to */
   guint64 offset;
+  guint64 initial_offset;
+  gboolean initial_offset_defined;
+
+  /* hash incoming data while it's written, see
+   * empathy_tp_file_set_checksum_type() */
+  gboolean use_checksum;
+  GChecksumType checksum_type;
+  gboolean splice_done;
+  gboolean completed_pending;
+
+  /* the socket while the data is copied in the kernel, or -1 */
+  gint socket_fd;
 
   /* GCancellable we're passed when offering/accepting the transfer */
   GCancellable *cancellable;
@@ -236,28 +256,287 @@ ft_operation_close_with_error (EmpathyTpFile *tp_file,
     priv->op_callback (tp_file, error, priv->op_user_data);
 }
 
+static void
+tp_file_splice_done (EmpathyTpFile *tp_file,
+    const GError *error)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+
+  priv->splice_done = TRUE;
+
+  if (error != NULL)
+    {
+      if (!priv->is_closing)
+        ft_operation_close_with_error (tp_file, (GError *) error);
+
+      return;
+    }
+
+  /* the channel completed before we were done copying the data, report
+   * it now that the file is complete */
+  if (priv->completed_pending)
+    ft_operation_close_clean (tp_file);
+}
+
 static void
 splice_stream_ready_cb (GObject *source,
     GAsyncResult *res,
     gpointer user_data)
 {
   EmpathyTpFile *tp_file;
-  EmpathyTpFilePriv *priv;
   GError *error = NULL;
 
   tp_file = user_data;
-  priv = GET_PRIV (tp_file);
 
   g_output_stream_splice_finish (G_OUTPUT_STREAM (source), res, &error);
 
   DEBUG ("Splice stream ready cb, error %p", error);
 
-  if (error != NULL && !priv->is_closing)
+  tp_file_splice_done (tp_file, error);
+  g_clear_error (&error);
+}
+
+/* Copies the data between the file and the socket @fd with GIO, which
+ * takes ownership of @fd */
+static void
+tp_file_splice_streams (EmpathyTpFile *tp_file,
+    gint fd)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+
+  if (priv->incoming)
     {
-      ft_operation_close_with_error (tp_file, error);
+      GInputStream *socket_stream;
+
+      socket_stream = g_unix_input_stream_new (fd, TRUE);
+
+      g_output_stream_splice_async (priv->out_stream, socket_stream,
+          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+          G_PRIORITY_DEFAULT, priv->cancellable,
+          splice_stream_ready_cb, tp_file);
+
+      g_object_unref (socket_stream);
+    }
+  else
+    {
+      GOutputStream *socket_stream;
+
+      socket_stream = g_unix_output_stream_new (fd, TRUE);
+
+      g_output_stream_splice_async (socket_stream, priv->in_stream,
+          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+          G_PRIORITY_DEFAULT, priv->cancellable,
+          splice_stream_ready_cb, tp_file);
+
+      g_object_unref (socket_stream);
+    }
+}
+
+static void
+fd_splice_ready_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  EmpathyTpFile *tp_file = user_data;
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+  GError *error = NULL;
+  gint fd;
+
+  empathy_fd_splice_finish (res, &error);
+
+  fd = priv->socket_fd;
+  priv->socket_fd = -1;
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED) &&
+      !priv->is_closing)
+    {
+      DEBUG ("Can't copy the data in the kernel, using GIO: %s",
+          error->message);
+
+      tp_file_splice_streams (tp_file, fd);
+      goto out;
+    }
+
+  DEBUG ("Kernel copy ready cb, error %p", error);
+
+  close (fd);
+
+  if (priv->incoming)
+    g_output_stream_close (priv->out_stream, NULL, NULL);
+  else
+    g_input_stream_close (priv->in_stream, NULL, NULL);
+
+  tp_file_splice_done (tp_file, error);
+
+out:
+  g_clear_error (&error);
+  g_object_unref (tp_file);
+}
+
+/* Copies the data between the file and the socket @fd without going
+ * through userspace when possible. Returns FALSE if the GIO path should
+ * be used instead. */
+static gboolean
+tp_file_try_fd_splice (EmpathyTpFile *tp_file,
+    gint fd)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+  GObject *file_stream;
+  gint file_fd;
+
+  /* the checksum needs to see the data */
+  if (priv->use_checksum)
+    return FALSE;
+
+  /* splice() refuses files opened for appending */
+  if (priv->incoming && priv->offset > 0)
+    return FALSE;
+
+  if (priv->incoming)
+    file_stream = G_OBJECT (priv->out_stream);
+  else
+    file_stream = G_OBJECT (priv->in_stream);
+
+  /* only local files have a file descriptor */
+  if (!G_IS_FILE_DESCRIPTOR_BASED (file_stream))
+    return FALSE;
+
+  file_fd = g_file_descriptor_based_get_fd (
+      G_FILE_DESCRIPTOR_BASED (file_stream));
+
+  priv->socket_fd = fd;
+
+  if (priv->incoming)
+    empathy_fd_splice_async (fd, file_fd, EMPATHY_FD_SPLICE_SOCKET_TO_FILE,
+        G_PRIORITY_DEFAULT, priv->cancellable, fd_splice_ready_cb,
+        g_object_ref (tp_file));
+  else
+    empathy_fd_splice_async (file_fd, fd, EMPATHY_FD_SPLICE_FILE_TO_SOCKET,
+        G_PRIORITY_DEFAULT, priv->cancellable, fd_splice_ready_cb,
+        g_object_ref (tp_file));
+
+  return TRUE;
+}
+
+static void
+tp_file_splice (EmpathyTpFile *tp_file,
+    gint fd)
+{
+  if (!tp_file_try_fd_splice (tp_file, fd))
+    tp_file_splice_streams (tp_file, fd);
+}
+
+/* Feeds the part of the file received before the transfer was resumed to
+ * the checksum, so that it covers the whole file */
+static void
+hash_prefix_thread (GSimpleAsyncResult *result,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (object);
+  GFileInputStream *stream;
+  guchar *buffer;
+  guint64 remaining;
+  GError *error = NULL;
+
+  stream = g_file_read (priv->gfile, cancellable, &error);
+
+  if (stream == NULL)
+    goto out;
+
+  buffer = g_malloc (PREFIX_BUFFER_SIZE);
+
+  for (remaining = priv->initial_offset; remaining > 0; )
+    {
+      gssize n_read;
+
+      n_read = g_input_stream_read (G_INPUT_STREAM (stream), buffer,
+          MIN (remaining, PREFIX_BUFFER_SIZE), cancellable, &error);
+
+      if (n_read < 0)
+        break;
+
+      if (n_read == 0)
+        {
+          error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+              _("The partially received file is incomplete"));
+          break;
+        }
+
+      empathy_checksum_stream_update (
+          EMPATHY_CHECKSUM_STREAM (priv->out_stream), buffer, n_read);
+      remaining -= n_read;
+    }
+
+  g_free (buffer);
+  g_object_unref (stream);
+
+out:
+  if (error != NULL)
+    {
+      g_simple_async_result_set_from_error (result, error);
+      g_error_free (error);
+    }
+}
+
+static void
+hash_prefix_ready_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  EmpathyTpFile *tp_file = EMPATHY_TP_FILE (source);
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+  GError *error = NULL;
+  gint fd;
+
+  fd = priv->socket_fd;
+  priv->socket_fd = -1;
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res),
+          &error))
+    {
+      DEBUG ("Failed to hash the resumed part of the file: %s",
+          error->message);
+
+      close (fd);
+
+      if (!priv->is_closing)
+        ft_operation_close_with_error (tp_file, error);
+
       g_clear_error (&error);
       return;
     }
+
+  /* the transfer has been cancelled meanwhile */
+  if (priv->is_closing)
+    {
+      close (fd);
+      return;
+    }
+
+  tp_file_splice (tp_file, fd);
+}
+
+/* Drops what we may have written past the offset the CM agreed to resume
+ * at, as the file is appended to */
+static gboolean
+tp_file_truncate_to_initial_offset (EmpathyTpFile *tp_file,
+    GError **error)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (tp_file);
+  GOutputStream *file_stream = priv->out_stream;
+
+  DEBUG ("Resuming at offset %" G_GUINT64_FORMAT ", asked for %"
+      G_GUINT64_FORMAT, priv->initial_offset, priv->offset);
+
+  if (EMPATHY_IS_CHECKSUM_STREAM (file_stream))
+    file_stream = g_filter_output_stream_get_base_stream (
+        G_FILTER_OUTPUT_STREAM (file_stream));
+
+  return g_seekable_truncate (G_SEEKABLE (file_stream),
+      priv->initial_offset, NULL, error);
 }
 
 static void
@@ -350,6 +629,26 @@ tp_file_start_transfer (EmpathyTpFile *tp_file)
       return;
     }
 
+  /* without InitialOffsetDefined, the CM resumes where we asked it to */
+  if (priv->incoming && priv->offset > 0 && !priv->initial_offset_defined)
+    {
+      DEBUG ("No initial offset defined, resuming at %" G_GUINT64_FORMAT,
+          priv->offset);
+      priv->initial_offset = priv->offset;
+    }
+
+  if (priv->incoming && priv->offset > 0 && priv->initial_offset_defined &&
+      !tp_file_truncate_to_initial_offset (tp_file, &error))
+    {
+      DEBUG ("Failed to truncate the resumed file, closing channel");
+
+      ft_operation_close_with_error (tp_file, error);
+      close (fd);
+      g_clear_error (&error);
+
+      return;
+    }
+
   DEBUG ("Start the transfer");
 
   priv->start_time = empathy_time_get_current ();
@@ -358,34 +657,23 @@ tp_file_start_transfer (EmpathyTpFile *tp_file)
   if (priv->progress_callback != NULL)
     priv->progress_callback (tp_file, 0, priv->progress_user_data);
 
-  if (priv->incoming)
+  if (priv->use_checksum && priv->initial_offset > 0)
     {
-      GInputStream *socket_stream;
+      GSimpleAsyncResult *result;
 
-      socket_stream = g_unix_input_stream_new (fd, TRUE);
+      /* the socket waits while we catch up with the data we already have */
+      priv->socket_fd = fd;
 
-      g_output_stream_splice_async (priv->out_stream, socket_stream,
-          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-          G_PRIORITY_DEFAULT, priv->cancellable,
-          splice_stream_ready_cb, tp_file);
+      result = g_simple_async_result_new (G_OBJECT (tp_file),
+          hash_prefix_ready_cb, NULL, tp_file_start_transfer);
+      g_simple_async_result_run_in_thread (result, hash_prefix_thread,
+          G_PRIORITY_DEFAULT, priv->cancellable);
+      g_object_unref (result);
 
-      g_object_unref (socket_stream);
+      return;
     }
-  else
-    {
-      GOutputStream *socket_stream;
-
-      socket_stream = g_unix_output_stream_new (fd, TRUE);
 
-      g_output_stream_splice_async (socket_stream, priv->in_stream,
-          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-          G_PRIORITY_DEFAULT, priv->cancellable,
-          splice_stream_ready_cb, tp_file);
-
-      g_object_unref (socket_stream);
-    }
+  tp_file_splice (tp_file, fd);
 }
 
 static GError *
@@ -460,7 +748,19 @@ tp_file_state_changed_cb (TpChannel *proxy,
     tp_file_start_transfer (EMPATHY_TP_FILE (weak_object));
 
   if (state == TP_FILE_TRANSFER_STATE_COMPLETED)
-    ft_operation_close_clean (EMPATHY_TP_FILE (weak_object));
+    {
+      /* the CM may be done before we finished copying the last chunks,
+       * which may still fail, and have to be hashed too */
+      if (priv->socket_address != NULL && !priv->splice_done)
+        {
+          DEBUG ("Transfer completed, waiting for the data to be written");
+          priv->completed_pending = TRUE;
+        }
+      else
+        {
+          ft_operation_close_clean (EMPATHY_TP_FILE (weak_object));
+        }
+    }
 
   if (state == TP_FILE_TRANSFER_STATE_CANCELLED)
     {
@@ -470,6 +770,20 @@ tp_file_state_changed_cb (TpChannel *proxy,
     }
 }
 
+static void
+tp_file_initial_offset_defined_cb (TpChannel *proxy,
+    guint64 initial_offset,
+    gpointer user_data,
+    GObject *weak_object)
+{
+  EmpathyTpFilePriv *priv = GET_PRIV (weak_object);
+
+  DEBUG ("Initial offset defined: %" G_GUINT64_FORMAT, initial_offset);
+
+  priv->initial_offset = initial_offset;
+  priv->initial_offset_defined = TRUE;
+}
+
 static void
 tp_file_transferred_bytes_changed_cb (TpChannel *proxy,
     guint64 count,
@@ -616,7 +930,7 @@ file_read_async_cb (GObject *source,
 }
 
 static void
-file_replace_async_cb (GObject *source,
+file_write_async_cb (GObject *source,
     GAsyncResult *res,
     gpointer user_data)
 {
@@ -628,7 +942,10 @@ file_replace_async_cb (GObject *source,
 
   priv = GET_PRIV (tp_file);
 
-  out_stream = g_file_replace_finish (G_FILE (source), res, &error);
+  if (priv->offset > 0)
+    out_stream = g_file_append_to_finish (G_FILE (source), res, &error);
+  else
+    out_stream = g_file_replace_finish (G_FILE (source), res, &error);
 
   if (error != NULL)
     {
@@ -638,7 +955,16 @@ file_replace_async_cb (GObject *source,
       return;
     }
 
-  priv->out_stream = G_OUTPUT_STREAM (out_stream);
+  if (priv->use_checksum)
+    {
+      priv->out_stream = empathy_checksum_stream_new (
+          G_OUTPUT_STREAM (out_stream), priv->checksum_type);
+      g_object_unref (out_stream);
+    }
+  else
+    {
+      priv->out_stream = G_OUTPUT_STREAM (out_stream);
+    }
 
   /* we don't impose specific interface/port requirements even
    * if we're not using UNIX sockets.
@@ -694,6 +1020,7 @@ empathy_tp_file_init (EmpathyTpFile *tp_file)
       EMPATHY_TYPE_TP_FILE, EmpathyTpFilePriv);
 
   tp_file->priv = priv;
+  priv->socket_fd = -1;
 }
 
 static void
@@ -714,6 +1041,9 @@ do_dispose (GObject *object)
       priv->channel = NULL;
     }
 
+  if (priv->gfile != NULL)
+    g_object_unref (priv->gfile);
+
   if (priv->in_stream != NULL)
     g_object_unref (priv->in_stream);
 
@@ -803,6 +1133,10 @@ do_constructed (GObject *object)
       priv->channel, tp_file_transferred_bytes_changed_cb,
       NULL, NULL, object, NULL);
 
+  tp_cli_channel_type_file_transfer_connect_to_initial_offset_defined (
+      priv->channel, tp_file_initial_offset_defined_cb,
+      NULL, NULL, object, NULL);
+
   tp_cli_dbus_properties_call_get (priv->channel,
       -1, TP_IFACE_CHANNEL_TYPE_FILE_TRANSFER, "State", tp_file_get_state_cb,
       NULL, NULL, object);
@@ -897,6 +1231,9 @@ empathy_tp_file_new (TpChannel *channel)
  * @op_user_data: user_data to pass to @op_callback
  *
  * Accepts an incoming file transfer, saving the result into @gfile.
+ * If @offset is not 0, @gfile already holds the first @offset bytes of the
+ * file and the transfer is resumed, appending to it; if the sender can't
+ * resume that far, @gfile is truncated to where it resumes instead.
  * The callback @op_callback will be called both when the transfer is
  * successful and in case of an error. Note that cancelling @cancellable,
  * closes the socket of the file operation in progress, but doesn't
@@ -926,9 +1263,14 @@ empathy_tp_file_accept (EmpathyTpFile *tp_file,
   priv->op_callback = op_callback;
   priv->op_user_data = op_user_data;
   priv->offset = offset;
+  priv->gfile = g_object_ref (gfile);
 
-  g_file_replace_async (gfile, NULL, FALSE, G_FILE_CREATE_NONE,
-      G_PRIORITY_DEFAULT, cancellable, file_replace_async_cb, tp_file);
+  if (offset > 0)
+    g_file_append_to_async (gfile, G_FILE_CREATE_NONE,
+        G_PRIORITY_DEFAULT, cancellable, file_write_async_cb, tp_file);
+  else
+    g_file_replace_async (gfile, NULL, FALSE, G_FILE_CREATE_NONE,
+        G_PRIORITY_DEFAULT, cancellable, file_write_async_cb, tp_file);
 }
 
 
@@ -975,6 +1317,59 @@ empathy_tp_file_offer (EmpathyTpFile *tp_file,
       file_read_async_cb, tp_file);
 }
 
+/**
+ * empathy_tp_file_set_checksum_type:
+ * @tp_file: an incoming #EmpathyTpFile
+ * @checksum_type: the #GChecksumType to use
+ *
+ * Makes @tp_file hash the data it receives while writing it, using
+ * @checksum_type. This must be called before empathy_tp_file_accept(); the
+ * result is available with empathy_tp_file_get_checksum() once the
+ * operation callback is called without error.
+ */
+void
+empathy_tp_file_set_checksum_type (EmpathyTpFile *tp_file,
+    GChecksumType checksum_type)
+{
+  EmpathyTpFilePriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_TP_FILE (tp_file));
+
+  priv = GET_PRIV (tp_file);
+
+  g_return_if_fail (priv->incoming);
+  g_return_if_fail (priv->out_stream == NULL);
+
+  priv->use_checksum = TRUE;
+  priv->checksum_type = checksum_type;
+}
+
+/**
+ * empathy_tp_file_get_checksum:
+ * @tp_file: an #EmpathyTpFile
+ *
+ * Returns the checksum of the data received by @tp_file, as requested
+ * with empathy_tp_file_set_checksum_type().
+ *
+ * Return value: the hexadecimal checksum, or %NULL if @tp_file wasn't
+ * hashing the data it received.
+ */
+const gchar *
+empathy_tp_file_get_checksum (EmpathyTpFile *tp_file)
+{
+  EmpathyTpFilePriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_TP_FILE (tp_file), NULL);
+
+  priv = GET_PRIV (tp_file);
+
+  if (!priv->use_checksum || priv->out_stream == NULL)
+    return NULL;
+
+  return empathy_checksum_stream_get_string (
+      EMPATHY_CHECKSUM_STREAM (priv->out_stream));
+}
+
 /**
  * empathy_tp_file_is_incoming:
  * @tp_file: an #EmpathyTpFile
@@ -114,6 +114,10 @@ void empathy_tp_file_offer (EmpathyTpFile *tp_file,
     EmpathyTpFileOperationCallback op_callback,
     gpointer op_user_data);
 
+void empathy_tp_file_set_checksum_type (EmpathyTpFile *tp_file,
+    GChecksumType checksum_type);
+const gchar * empathy_tp_file_get_checksum (EmpathyTpFile *tp_file);
+
 void empathy_tp_file_cancel (EmpathyTpFile *tp_file);
 void empathy_tp_file_close (EmpathyTpFile *tp_file);
 
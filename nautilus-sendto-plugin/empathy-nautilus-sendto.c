@@ -178,7 +178,7 @@ handler_ready_cb (EmpathyFTFactory *fact,
       g_signal_connect (handler, "transfer-error",
           G_CALLBACK (transfer_error_cb), plugin);
 
-      empathy_ft_handler_start_transfer (handler);
+      empathy_ft_factory_start_transfer (factory, handler, G_PRIORITY_DEFAULT);
     }
 }
 
@@ -37,6 +37,7 @@
 
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
 #include <libempathy/empathy-debug.h>
+#include <libempathy/empathy-ft-factory.h>
 #include <libempathy/empathy-tp-file.h>
 #include <libempathy/empathy-utils.h>
 
@@ -55,9 +56,28 @@ enum
   COL_FT_OBJECT
 };
 
+/* transfers progress is sampled at 4 Hz rather than shown on each update */
+#define PROGRESS_UPDATE_INTERVAL 250
+/* weight of the last sample in the smoothed speed */
+#define SPEED_SMOOTHING 0.2
+
+typedef struct {
+  guint64 bytes;
+  gdouble time;
+  gdouble speed;
+  guint remaining_time;
+} ProgressSample;
+
 typedef struct {
   GtkTreeModel *model;
   GHashTable *ft_handler_to_row_ref;
+  /* schedules the transfers, see empathy_ft_factory_start_transfer() */
+  EmpathyFTFactory *factory;
+
+  /* EmpathyFTHandler -> ProgressSample, for the running transfers */
+  GHashTable *progress_samples;
+  GTimer *progress_timer;
+  guint progress_timeout_id;
 
   /* Widgets */
   GtkWidget *window;
@@ -83,6 +103,12 @@ static EmpathyFTManager *manager_singleton = NULL;
 static void ft_handler_hashing_started_cb (EmpathyFTHandler *handler,
     EmpathyFTManager *manager);
 
+static void
+progress_sample_free (ProgressSample *sample)
+{
+  g_slice_free (ProgressSample, sample);
+}
+
 static gchar *
 ft_manager_format_interval (guint interval)
 {
@@ -376,48 +402,134 @@ ft_manager_update_handler_message (EmpathyFTManager *manager,
 }
 
 static void
-ft_manager_update_handler_progress (EmpathyFTManager *manager,
-                                    GtkTreeRowReference *row_ref,
-                                    int percentage)
+ft_manager_update_handler_transfer_progress (EmpathyFTManager *manager,
+                                             EmpathyFTHandler *handler,
+                                             guint64 current_bytes,
+                                             guint64 total_bytes,
+                                             guint remaining_time,
+                                             gdouble speed)
 {
+  GtkTreeRowReference *row_ref;
   GtkTreePath *path;
   GtkTreeIter iter;
   EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  char *first_line, *second_line, *message;
+  char *remaining_str = NULL;
+  int percentage;
 
-  /* Set new value in the store */
+  row_ref = ft_manager_get_row_from_handler (manager, handler);
+  g_return_if_fail (row_ref != NULL);
+
+  first_line = ft_manager_format_contact_info (handler);
+  second_line = ft_manager_format_progress_bytes_and_percentage
+    (current_bytes, total_bytes, speed, &percentage);
+
+  message = g_strdup_printf ("%s\n%s", first_line, second_line);
+
+  if (remaining_time > 0)
+    remaining_str = ft_manager_format_interval (remaining_time);
+
+  /* Set all the new values in the store at once */
   path = gtk_tree_row_reference_get_path (row_ref);
   gtk_tree_model_get_iter (priv->model, &iter, path);
   gtk_list_store_set (GTK_LIST_STORE (priv->model),
       &iter,
+      COL_MESSAGE, message,
       COL_PERCENT, percentage,
+      COL_REMAINING, remaining_str,
       -1);
 
   gtk_tree_path_free (path);
+  g_free (remaining_str);
+  g_free (message);
+  g_free (first_line);
+  g_free (second_line);
+}
 
+static gboolean
+ft_manager_progress_timeout_cb (gpointer user_data)
+{
+  EmpathyFTManager *manager = user_data;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GHashTableIter iter;
+  gpointer key, value;
+  gdouble now;
+
+  now = g_timer_elapsed (priv->progress_timer, NULL);
+
+  g_hash_table_iter_init (&iter, priv->progress_samples);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      EmpathyFTHandler *handler = key;
+      ProgressSample *sample = value;
+      guint64 bytes, total_bytes;
+      gdouble speed = 0;
+      guint remaining_time = 0;
+
+      bytes = empathy_ft_handler_get_transferred_bytes (handler);
+      total_bytes = empathy_ft_handler_get_total_bytes (handler);
+
+      if (now > sample->time && bytes >= sample->bytes)
+        speed = (bytes - sample->bytes) / (now - sample->time);
+
+      /* exponentially weighted moving average, so that the speed and the
+       * remaining time don't jump around with every sample */
+      if (sample->speed > 0)
+        speed = SPEED_SMOOTHING * speed +
+            (1 - SPEED_SMOOTHING) * sample->speed;
+
+      if (speed > 0 && total_bytes > bytes)
+        remaining_time = (total_bytes - bytes) / speed;
+
+      if (bytes != sample->bytes || remaining_time != sample->remaining_time)
+        ft_manager_update_handler_transfer_progress (manager, handler, bytes,
+            total_bytes, remaining_time, speed);
+
+      sample->bytes = bytes;
+      sample->time = now;
+      sample->speed = speed;
+      sample->remaining_time = remaining_time;
+    }
+
+  return TRUE;
 }
 
 static void
-ft_manager_update_handler_time (EmpathyFTManager *manager,
-                                GtkTreeRowReference *row_ref,
-                                guint remaining_time)
+ft_manager_start_progress (EmpathyFTManager *manager,
+                           EmpathyFTHandler *handler)
 {
-  GtkTreePath *path;
-  GtkTreeIter iter;
   EmpathyFTManagerPriv *priv = GET_PRIV (manager);
-  char *remaining_str;
+  ProgressSample *sample;
 
-  remaining_str = ft_manager_format_interval (remaining_time);
+  sample = g_slice_new0 (ProgressSample);
+  sample->bytes = empathy_ft_handler_get_transferred_bytes (handler);
+  sample->time = g_timer_elapsed (priv->progress_timer, NULL);
 
-  /* Set new value in the store */
-  path = gtk_tree_row_reference_get_path (row_ref);
-  gtk_tree_model_get_iter (priv->model, &iter, path);
-  gtk_list_store_set (GTK_LIST_STORE (priv->model),
-      &iter,
-      COL_REMAINING, remaining_str,
-      -1);
+  g_hash_table_insert (priv->progress_samples, g_object_ref (handler),
+      sample);
 
-  gtk_tree_path_free (path);
-  g_free (remaining_str);
+  if (priv->progress_timeout_id == 0)
+    priv->progress_timeout_id = g_timeout_add (PROGRESS_UPDATE_INTERVAL,
+        ft_manager_progress_timeout_cb, manager);
+
+  ft_manager_update_handler_transfer_progress (manager, handler,
+      sample->bytes, empathy_ft_handler_get_total_bytes (handler), 0, -1);
+}
+
+static void
+ft_manager_stop_progress (EmpathyFTManager *manager,
+                          EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  g_hash_table_remove (priv->progress_samples, handler);
+
+  if (g_hash_table_size (priv->progress_samples) == 0 &&
+      priv->progress_timeout_id != 0)
+    {
+      g_source_remove (priv->progress_timeout_id);
+      priv->progress_timeout_id = 0;
+    }
 }
 
 static void
@@ -449,6 +561,8 @@ ft_handler_transfer_error_cb (EmpathyFTHandler *handler,
 
   DEBUG ("Transfer error %s", error->message);
 
+  ft_manager_stop_progress (manager, handler);
+
   row_ref = ft_manager_get_row_from_handler (manager, handler);
   g_return_if_fail (row_ref != NULL);
 
@@ -520,6 +634,14 @@ ft_handler_transfer_done_cb (EmpathyFTHandler *handler,
                              EmpathyTpFile *tp_file,
                              EmpathyFTManager *manager)
 {
+  guint64 total_bytes;
+
+  /* the last samples may be behind, show the transfer as complete */
+  ft_manager_stop_progress (manager, handler);
+  total_bytes = empathy_ft_handler_get_total_bytes (handler);
+  ft_manager_update_handler_transfer_progress (manager, handler, total_bytes,
+      total_bytes, 0, -1);
+
   if (empathy_ft_handler_is_incoming (handler) &&
       empathy_ft_handler_get_use_hash (handler))
     {
@@ -537,59 +659,17 @@ ft_handler_transfer_done_cb (EmpathyFTHandler *handler,
   do_real_transfer_done (manager, handler);
 }
 
-static void
-ft_handler_transfer_progress_cb (EmpathyFTHandler *handler,
-                                 guint64 current_bytes,
-                                 guint64 total_bytes,
-                                 guint remaining_time,
-                                 gdouble speed,
-                                 EmpathyFTManager *manager)
-{
-  char *first_line, *second_line, *message;
-  int percentage;
-  GtkTreeRowReference *row_ref;
-
-  DEBUG ("Transfer progress");
-
-  row_ref = ft_manager_get_row_from_handler (manager, handler);
-  g_return_if_fail (row_ref != NULL);
-
-  first_line = ft_manager_format_contact_info (handler);
-  second_line = ft_manager_format_progress_bytes_and_percentage
-    (current_bytes, total_bytes, speed, &percentage);
-
-  message = g_strdup_printf ("%s\n%s", first_line, second_line);
-
-  ft_manager_update_handler_message (manager, row_ref, message);
-  ft_manager_update_handler_progress (manager, row_ref, percentage);
-
-  if (remaining_time > 0)
-    ft_manager_update_handler_time (manager, row_ref, remaining_time);
-
-  g_free (message);
-  g_free (first_line);
-  g_free (second_line);
-}
-
 static void
 ft_handler_transfer_started_cb (EmpathyFTHandler *handler,
                                 EmpathyTpFile *tp_file,
                                 EmpathyFTManager *manager)
 {
-  guint64 transferred_bytes, total_bytes;
-
   DEBUG ("Transfer started");
 
-  g_signal_connect (handler, "transfer-progress",
-      G_CALLBACK (ft_handler_transfer_progress_cb), manager);
   g_signal_connect (handler, "transfer-done",
       G_CALLBACK (ft_handler_transfer_done_cb), manager);
 
-  transferred_bytes = empathy_ft_handler_get_transferred_bytes (handler);
-  total_bytes = empathy_ft_handler_get_total_bytes (handler);
-
-  ft_handler_transfer_progress_cb (handler, transferred_bytes, total_bytes,
-      0, -1, manager);
+  ft_manager_start_progress (manager, handler);
 }
 
 static void
@@ -691,6 +771,39 @@ ft_handler_hashing_started_cb (EmpathyFTHandler *handler,
   g_free (message);
 }
 
+static void
+ft_manager_transfer_state_changed_cb (EmpathyFTFactory *factory,
+                                      EmpathyFTHandler *handler,
+                                      EmpathyFTTransferState state,
+                                      EmpathyFTManager *manager)
+{
+  GtkTreeRowReference *row_ref;
+  const char *second_line;
+  char *first_line, *message;
+
+  row_ref = ft_manager_get_row_from_handler (manager, handler);
+  if (row_ref == NULL)
+    return;
+
+  /* hashing and the transfer itself update the row with their own signals */
+  if (state == EMPATHY_FT_TRANSFER_STATE_QUEUED)
+    second_line = _("Queued");
+  else if (state == EMPATHY_FT_TRANSFER_STATE_TRANSFERRING &&
+      !empathy_ft_handler_is_incoming (handler) &&
+      !empathy_ft_handler_get_use_hash (handler))
+    second_line = _("Waiting for the other participant's response");
+  else
+    return;
+
+  first_line = ft_manager_format_contact_info (handler);
+  message = g_strdup_printf ("%s\n%s", first_line, second_line);
+
+  ft_manager_update_handler_message (manager, row_ref, message);
+
+  g_free (first_line);
+  g_free (message);
+}
+
 static void
 ft_manager_start_transfer (EmpathyFTManager *manager,
                            EmpathyFTHandler *handler)
@@ -718,7 +831,9 @@ ft_manager_start_transfer (EmpathyFTManager *manager,
         G_CALLBACK (ft_handler_transfer_started_cb), manager);
   }
 
-  empathy_ft_handler_start_transfer (handler);
+  /* incoming transfers have the other participant waiting for us */
+  empathy_ft_factory_start_transfer (priv->factory, handler,
+      is_outgoing ? G_PRIORITY_DEFAULT : G_PRIORITY_HIGH);
 }
 
 static void
@@ -860,7 +975,23 @@ ft_manager_stop (EmpathyFTManager *manager)
       empathy_contact_get_alias (empathy_ft_handler_get_contact (handler)),
       empathy_ft_handler_get_filename (handler));
 
-  empathy_ft_handler_cancel_transfer (handler);
+  if (empathy_ft_factory_get_transfer_state (priv->factory, handler) ==
+      EMPATHY_FT_TRANSFER_STATE_QUEUED)
+    {
+      GError *error;
+
+      /* a queued transfer didn't start, so it won't report the error */
+      empathy_ft_factory_cancel_transfer (priv->factory, handler);
+
+      error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+          _("You canceled the file transfer"));
+      ft_handler_transfer_error_cb (handler, error, manager);
+      g_error_free (error);
+    }
+  else
+    {
+      empathy_ft_factory_cancel_transfer (priv->factory, handler);
+    }
 
   g_object_unref (handler);
 }
@@ -1054,6 +1185,15 @@ empathy_ft_manager_finalize (GObject *object)
 
   g_hash_table_destroy (priv->ft_handler_to_row_ref);
 
+  if (priv->progress_timeout_id != 0)
+    g_source_remove (priv->progress_timeout_id);
+  g_hash_table_destroy (priv->progress_samples);
+  g_timer_destroy (priv->progress_timer);
+
+  g_signal_handlers_disconnect_by_func (priv->factory,
+      ft_manager_transfer_state_changed_cb, object);
+  g_object_unref (priv->factory);
+
   G_OBJECT_CLASS (empathy_ft_manager_parent_class)->finalize (object);
 }
 
@@ -1071,6 +1211,15 @@ empathy_ft_manager_init (EmpathyFTManager *manager)
       g_direct_equal, (GDestroyNotify) g_object_unref,
       (GDestroyNotify) gtk_tree_row_reference_free);
 
+  priv->progress_samples = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, (GDestroyNotify) g_object_unref,
+      (GDestroyNotify) progress_sample_free);
+  priv->progress_timer = g_timer_new ();
+
+  priv->factory = empathy_ft_factory_dup_singleton ();
+  g_signal_connect (priv->factory, "transfer-state-changed",
+      G_CALLBACK (ft_manager_transfer_state_changed_cb), manager);
+
   ft_manager_build_ui (manager);
 }
 
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <libempathy/empathy-contact.h>
+#include "test-helper.h"
+
+static gchar *
+write_avatar (const gchar *dir,
+    const gchar *name,
+    const gchar *data)
+{
+  gchar *filename;
+
+  filename = g_build_filename (dir, name, NULL);
+  g_assert (g_file_set_contents (filename, data, -1, NULL));
+
+  return filename;
+}
+
+static void
+test_dedup (void)
+{
+  gchar *dir;
+  gchar *jabber, *msn, *other;
+  EmpathyAvatar *a, *b, *c, *again;
+
+  dir = g_build_filename (g_get_tmp_dir (), "empathy-avatar-test-XXXXXX",
+      NULL);
+  g_assert (g_mkdtemp (dir) != NULL);
+
+  jabber = write_avatar (dir, "jabber", "same image");
+  msn = write_avatar (dir, "msn", "same image");
+  other = write_avatar (dir, "other", "another image");
+
+  a = empathy_avatar_dup_from_file (jabber, "image/png", NULL);
+  b = empathy_avatar_dup_from_file (msn, NULL, NULL);
+  c = empathy_avatar_dup_from_file (other, NULL, NULL);
+  g_assert (a != NULL && b != NULL && c != NULL);
+
+  /* Identical files share their data */
+  g_assert (a != b);
+  g_assert (a->data == b->data);
+  g_assert_cmpstr (a->content_hash, ==, b->content_hash);
+  g_assert_cmpstr (b->filename, ==, msn);
+
+  g_assert (a->data != c->data);
+  g_assert_cmpstr (a->content_hash, !=, c->content_hash);
+
+  /* The same file gives the same avatar */
+  again = empathy_avatar_dup_from_file (jabber, NULL, NULL);
+  g_assert (again == a);
+  empathy_avatar_unref (again);
+
+  /* The data stays mapped while one of the avatars uses it */
+  empathy_avatar_unref (a);
+  g_assert (memcmp (b->data, "same image", b->len) == 0);
+
+  empathy_avatar_unref (b);
+  empathy_avatar_unref (c);
+
+  a = empathy_avatar_dup_from_file (jabber, NULL, NULL);
+  g_assert (a != NULL);
+  g_assert_cmpuint (a->len, ==, strlen ("same image"));
+  empathy_avatar_unref (a);
+
+  g_unlink (jabber);
+  g_unlink (msn);
+  g_unlink (other);
+  g_rmdir (dir);
+  g_free (jabber);
+  g_free (msn);
+  g_free (other);
+  g_free (dir);
+}
+
+static void
+test_missing (void)
+{
+  GError *error = NULL;
+
+  g_assert (empathy_avatar_dup_from_file ("/nonexistent/avatar", NULL,
+        &error) == NULL);
+  g_assert (error != NULL);
+  g_clear_error (&error);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/avatar/dedup", test_dedup);
+  g_test_add_func ("/avatar/missing", test_missing);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
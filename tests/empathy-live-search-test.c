@@ -59,6 +59,11 @@ test_live_search (void)
       match = empathy_live_search_match_string (tests[i].string, tests[i].prefix);
       ok = (match == tests[i].should_match);
 
+      /* Matching pre-stripped words must give the same result */
+      match = empathy_live_search_match_string_words (tests[i].string,
+          tests[i].prefix);
+      ok = ok && (match == tests[i].should_match);
+
       DEBUG ("'%s' - '%s' %s: %s", tests[i].string, tests[i].prefix,
           tests[i].should_match ? "should match" : "should NOT match",
           ok ? "OK" : "FAILED");
@@ -24,77 +24,80 @@ test_replace_match (const gchar *text,
   g_string_append_c (string, ']');
 }
 
+static const gchar *tests[] =
+  {
+    /* Basic link matches */
+    "http://foo.com", "[http://foo.com]",
+    "http://foo.com\nhttp://bar.com", "[http://foo.com]\n[http://bar.com]",
+    "http://foo.com/test?id=bar?", "[http://foo.com/test?id=bar]?",
+    "git://foo.com", "[git://foo.com]",
+    "git+ssh://foo.com", "[git+ssh://foo.com]",
+    "mailto:user@server.com", "[mailto:user@server.com]",
+    "www.foo.com", "[www.foo.com]",
+    "ftp.foo.com", "[ftp.foo.com]",
+    "user@server.com", "[user@server.com]",
+    "first.last@server.com", "[first.last@server.com]",
+    "http://foo.com. bar", "[http://foo.com]. bar",
+    "http://foo.com; bar", "[http://foo.com]; bar",
+    "http://foo.com: bar", "[http://foo.com]: bar",
+    "http://foo.com:bar", "[http://foo.com:bar]",
+    "http://apos'foo.com", "[http://apos'foo.com]",
+    "mailto:bar'?user@server.com", "[mailto:bar'?user@server.com]",
+
+    /* They are not links! */
+    "http://", "http[:/]/", /* Hm... */
+    "www.", "www.",
+    "w.foo.com", "w.foo.com",
+    "@server.com", "@server.com",
+    "mailto:user@", "mailto:user@",
+    "mailto:user@.com", "mailto:user@.com",
+    "user@.com", "user@.com",
+
+    /* Links inside (), {}, [], <>, "" or '' */
+    /* FIXME: How to test if the ending ] is matched or not? */
+    "Foo (www.foo.com)", "Foo ([www.foo.com])",
+    "Foo {www.foo.com}", "Foo {[www.foo.com]}",
+    "Foo [www.foo.com]", "Foo [[www.foo.com]]",
+    "Foo <www.foo.com>", "Foo &lt;[www.foo.com]&gt;",
+    "Foo \"www.foo.com\"", "Foo &quot;[www.foo.com]&quot;",
+    "Foo (www.foo.com/bar(123)baz)", "Foo ([www.foo.com/bar(123)baz])",
+    "<a href=\"http://foo.com\">bar</a>", "&lt;a href=&quot;[http://foo.com]&quot;&gt;bar&lt;/a&gt;",
+    "Foo (user@server.com)", "Foo ([user@server.com])",
+    "Foo {user@server.com}", "Foo {[user@server.com]}",
+    "Foo [user@server.com]", "Foo [[user@server.com]]",
+    "Foo <user@server.com>", "Foo &lt;[user@server.com]&gt;",
+    "Foo \"user@server.com\"", "Foo &quot;[user@server.com]&quot;",
+    "<a href='http://apos'foo.com'>bar</a>", "&lt;a href=&apos;[http://apos'foo.com]&apos;&gt;bar&lt;/a&gt;",
+    "Foo 'bar'?user@server.com'", "Foo &apos;[bar'?user@server.com]&apos;",
+
+    /* Basic smileys */
+    "a:)b", "a[:)]b",
+    ">:)", "[>:)]",
+    ">:(", "&gt;[:(]",
+    ">:>:>:)", "&gt;:&gt;:[>:)]",
+    ":-(|", "[:-(]|",
+
+    /* Smileys and links mixed */
+    ":)http://foo.com", "[:)][http://foo.com]",
+    "a :) b http://foo.com c :( d www.test.com e", "a [:)] b [http://foo.com] c [:(] d [www.test.com] e",
+
+    /* '\r' should be stripped */
+    "badger\n\rmushroom", "badger\nmushroom",
+    "badger\r\nmushroom", "badger\nmushroom",
+
+    /* FIXME: Known issue: Brackets should be counted by the parser */
+    //"Foo www.bar.com/test(123)", "Foo [www.bar.com/test(123)]",
+    //"Foo (www.bar.com/test(123))", "Foo ([www.bar.com/test(123)])",
+    //"Foo www.bar.com/test{123}", "Foo [www.bar.com/test{123}]",
+    //"Foo (:))", "Foo ([:)])",
+    //"Foo <a href=\"http://foo.com\">:)</a>", "Foo <a href=\"[http://foo.com]\">[:)]</a>",
+
+    NULL, NULL
+  };
+
 static void
 test_parsers (void)
 {
-  gchar *tests[] =
-    {
-      /* Basic link matches */
-      "http://foo.com", "[http://foo.com]",
-      "http://foo.com\nhttp://bar.com", "[http://foo.com]\n[http://bar.com]",
-      "http://foo.com/test?id=bar?", "[http://foo.com/test?id=bar]?",
-      "git://foo.com", "[git://foo.com]",
-      "git+ssh://foo.com", "[git+ssh://foo.com]",
-      "mailto:user@server.com", "[mailto:user@server.com]",
-      "www.foo.com", "[www.foo.com]",
-      "ftp.foo.com", "[ftp.foo.com]",
-      "user@server.com", "[user@server.com]",
-      "first.last@server.com", "[first.last@server.com]",
-      "http://foo.com. bar", "[http://foo.com]. bar",
-      "http://foo.com; bar", "[http://foo.com]; bar",
-      "http://foo.com: bar", "[http://foo.com]: bar",
-      "http://foo.com:bar", "[http://foo.com:bar]",
-      "http://apos'foo.com", "[http://apos'foo.com]",
-      "mailto:bar'?user@server.com", "[mailto:bar'?user@server.com]",
-
-      /* They are not links! */
-      "http://", "http[:/]/", /* Hm... */
-      "www.", "www.",
-      "w.foo.com", "w.foo.com",
-      "@server.com", "@server.com",
-      "mailto:user@", "mailto:user@",
-      "mailto:user@.com", "mailto:user@.com",
-      "user@.com", "user@.com",
-
-      /* Links inside (), {}, [], <>, "" or '' */
-      /* FIXME: How to test if the ending ] is matched or not? */
-      "Foo (www.foo.com)", "Foo ([www.foo.com])",
-      "Foo {www.foo.com}", "Foo {[www.foo.com]}",
-      "Foo [www.foo.com]", "Foo [[www.foo.com]]",
-      "Foo <www.foo.com>", "Foo &lt;[www.foo.com]&gt;",
-      "Foo \"www.foo.com\"", "Foo &quot;[www.foo.com]&quot;",
-      "Foo (www.foo.com/bar(123)baz)", "Foo ([www.foo.com/bar(123)baz])",
-      "<a href=\"http://foo.com\">bar</a>", "&lt;a href=&quot;[http://foo.com]&quot;&gt;bar&lt;/a&gt;",
-      "Foo (user@server.com)", "Foo ([user@server.com])",
-      "Foo {user@server.com}", "Foo {[user@server.com]}",
-      "Foo [user@server.com]", "Foo [[user@server.com]]",
-      "Foo <user@server.com>", "Foo &lt;[user@server.com]&gt;",
-      "Foo \"user@server.com\"", "Foo &quot;[user@server.com]&quot;",
-      "<a href='http://apos'foo.com'>bar</a>", "&lt;a href=&apos;[http://apos'foo.com]&apos;&gt;bar&lt;/a&gt;",
-      "Foo 'bar'?user@server.com'", "Foo &apos;[bar'?user@server.com]&apos;",
-
-      /* Basic smileys */
-      "a:)b", "a[:)]b",
-      ">:)", "[>:)]",
-      ">:(", "&gt;[:(]",
-
-      /* Smileys and links mixed */
-      ":)http://foo.com", "[:)][http://foo.com]",
-      "a :) b http://foo.com c :( d www.test.com e", "a [:)] b [http://foo.com] c [:(] d [www.test.com] e",
-
-      /* '\r' should be stripped */
-      "badger\n\rmushroom", "badger\nmushroom",
-      "badger\r\nmushroom", "badger\nmushroom",
-
-      /* FIXME: Known issue: Brackets should be counted by the parser */
-      //"Foo www.bar.com/test(123)", "Foo [www.bar.com/test(123)]",
-      //"Foo (www.bar.com/test(123))", "Foo ([www.bar.com/test(123)])",
-      //"Foo www.bar.com/test{123}", "Foo [www.bar.com/test{123}]",
-      //"Foo (:))", "Foo ([:)])",
-      //"Foo <a href=\"http://foo.com\">:)</a>", "Foo <a href=\"[http://foo.com]\">[:)]</a>",
-
-      NULL, NULL
-    };
   EmpathyStringParser parsers[] =
     {
       {empathy_string_match_link, test_replace_match},
@@ -121,6 +124,76 @@ test_parsers (void)
     }
 }
 
+static void
+test_tokenizer (void)
+{
+  GArray *tokens;
+  guint i;
+
+  DEBUG ("Started");
+  tokens = empathy_string_tokens_new ();
+  for (i = 0; tests[i] != NULL; i += 2)
+    {
+      GString *string;
+      gboolean ok;
+      guint j;
+
+      g_array_set_size (tokens, 0);
+      empathy_string_tokenize (tests[i], -1,
+          EMPATHY_STRING_TOKENIZE_LINKS | EMPATHY_STRING_TOKENIZE_SMILEYS,
+          tokens);
+
+      string = g_string_new (NULL);
+      for (j = 0; j < tokens->len; j++)
+        {
+          EmpathyStringToken *token;
+
+          token = &g_array_index (tokens, EmpathyStringToken, j);
+          if (token->type == EMPATHY_STRING_TOKEN_TEXT)
+            empathy_string_replace_escaped (tests[i] + token->start,
+                token->end - token->start, NULL, string);
+          else
+            test_replace_match (tests[i] + token->start,
+                token->end - token->start, NULL, string);
+        }
+
+      ok = !tp_strdiff (tests[i + 1], string->str);
+      DEBUG ("'%s' => '%s': %s", tests[i], string->str, ok ? "OK" : "FAILED");
+      g_assert (ok);
+
+      g_string_free (string, TRUE);
+    }
+  g_array_free (tokens, TRUE);
+}
+
+static void
+test_tokenizer_newlines (void)
+{
+  const gchar *text = "a\n:)\nhttp://foo.com\n";
+  EmpathyStringTokenType expected[] = {
+      EMPATHY_STRING_TOKEN_TEXT,
+      EMPATHY_STRING_TOKEN_NEWLINE,
+      EMPATHY_STRING_TOKEN_SMILEY,
+      EMPATHY_STRING_TOKEN_NEWLINE,
+      EMPATHY_STRING_TOKEN_LINK,
+      EMPATHY_STRING_TOKEN_NEWLINE,
+  };
+  GArray *tokens;
+  guint i;
+
+  tokens = empathy_string_tokens_new ();
+  empathy_string_tokenize (text, -1, EMPATHY_STRING_TOKENIZE_LINKS |
+      EMPATHY_STRING_TOKENIZE_SMILEYS | EMPATHY_STRING_TOKENIZE_NEWLINES,
+      tokens);
+
+  g_assert_cmpuint (tokens->len, ==, G_N_ELEMENTS (expected));
+  for (i = 0; i < tokens->len; i++)
+    g_assert_cmpint (g_array_index (tokens, EmpathyStringToken, i).type, ==,
+        expected[i]);
+
+  g_array_free (tokens, TRUE);
+}
+
 int
 main (int argc,
     char **argv)
@@ -130,6 +203,8 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/tokenizer", test_tokenizer);
+  g_test_add_func ("/parsers/tokenizer-newlines", test_tokenizer_newlines);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Compares rendering Adium message templates by scanning them for every
+ * message with rendering their precompiled form, over the Content.html of
+ * installed message styles.
+ *
+ * Usage: bench-adium-template [n_messages] [style path...]
+ *
+ * Without style paths, every installed Adium message style is used. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <telepathy-glib/util.h>
+
+#include <libempathy/empathy-time.h>
+
+#include <libempathy-gtk/empathy-ui-utils.h>
+#include <libempathy-gtk/empathy-adium-template.h>
+#include <libempathy-gtk/empathy-theme-manager.h>
+
+#define N_ROUNDS 5
+
+#define MESSAGE "yeah :) the build is broken again, " \
+    "see <a href=\\\"http://build.example.org/log/1234\\\">the log</a>"
+
+/* The per-message scan which the precompiled templates replaced */
+static gboolean
+legacy_match (const gchar **str,
+    const gchar *match)
+{
+  gint len;
+
+  len = strlen (match);
+  if (strncmp (*str, match, len) == 0)
+    {
+      *str += len - 1;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+legacy_render (const gchar *html,
+    GString *string,
+    time_t timestamp)
+{
+  const gchar *cur;
+
+  for (cur = html; *cur != '\0'; cur++)
+    {
+      const gchar *replace = NULL;
+      gchar *dup_replace = NULL;
+
+      if (legacy_match (&cur, "%message%"))
+        replace = MESSAGE;
+      else if (legacy_match (&cur, "%messageClasses%"))
+        replace = "message incoming";
+      else if (legacy_match (&cur, "%userIconPath%"))
+        replace = "/usr/share/empathy/avatar.png";
+      else if (legacy_match (&cur, "%sender%"))
+        replace = "Someone";
+      else if (legacy_match (&cur, "%senderScreenName%"))
+        replace = "someone@example.com";
+      else if (legacy_match (&cur, "%senderDisplayName%"))
+        replace = "Someone";
+      else if (legacy_match (&cur, "%service%"))
+        replace = "Jabber";
+      else if (legacy_match (&cur, "%shortTime%"))
+        {
+          dup_replace = empathy_time_to_string_local (timestamp,
+              EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+          replace = dup_replace;
+        }
+      else if (legacy_match (&cur, "%time"))
+        {
+          gchar *format = NULL;
+          gchar *end;
+
+          if (cur[1] == '{')
+            {
+              cur += 2;
+              end = strstr (cur, "}%");
+              if (!end)
+                continue;
+              format = g_strndup (cur, end - cur);
+              cur = end + 1;
+            }
+          else
+            {
+              cur++;
+            }
+
+          dup_replace = empathy_time_to_string_local (timestamp,
+              format ? format : EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+          replace = dup_replace;
+          g_free (format);
+        }
+      else
+        {
+          empathy_adium_escape_append (string, cur, 1);
+          continue;
+        }
+
+      empathy_adium_escape_append (string, replace, -1);
+      g_free (dup_replace);
+    }
+}
+
+static gdouble
+bench_legacy (const gchar *html,
+    guint n_messages,
+    gsize *out_bytes)
+{
+  GString *string = g_string_sized_new (4096);
+  GTimer *timer = g_timer_new ();
+  time_t timestamp = empathy_time_get_current ();
+  gsize bytes = 0;
+  gdouble seconds;
+  guint i;
+
+  for (i = 0; i < n_messages; i++)
+    {
+      g_string_truncate (string, 0);
+      legacy_render (html, string, timestamp);
+      bytes += string->len;
+    }
+
+  seconds = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  *out_bytes = bytes;
+  g_string_free (string, TRUE);
+
+  return seconds;
+}
+
+static gdouble
+bench_compiled (const gchar *html,
+    guint n_messages,
+    gsize *out_bytes)
+{
+  EmpathyAdiumTemplate *tmpl;
+  GString *string = g_string_sized_new (4096);
+  GTimer *timer = g_timer_new ();
+  time_t timestamp = empathy_time_get_current ();
+  gsize bytes = 0;
+  gdouble seconds;
+  guint i;
+
+  /* Compiling is part of loading the theme, but count it anyway */
+  tmpl = empathy_adium_template_new (html);
+
+  for (i = 0; i < n_messages; i++)
+    {
+      g_string_truncate (string, 0);
+      empathy_adium_template_render (tmpl, string, MESSAGE,
+          "/usr/share/empathy/avatar.png", "Someone", "someone@example.com",
+          "Jabber", "message incoming", timestamp, FALSE);
+      bytes += string->len;
+    }
+
+  seconds = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  *out_bytes = bytes;
+  empathy_adium_template_free (tmpl);
+  g_string_free (string, TRUE);
+
+  return seconds;
+}
+
+static void
+report (const gchar *name,
+    gdouble seconds,
+    guint n_messages,
+    gsize bytes)
+{
+  g_print ("  %-10s %8.3f s  %10.0f msg/s  %8.2f MB/s\n", name, seconds,
+      n_messages / seconds, bytes / seconds / (1024 * 1024));
+}
+
+static void
+bench_style (const gchar *path,
+    guint n_messages)
+{
+  gchar *file;
+  gchar *html;
+  guint i;
+
+  file = g_build_filename (path, "Contents", "Resources", "Incoming",
+      "Content.html", NULL);
+
+  if (!g_file_get_contents (file, &html, NULL, NULL))
+    {
+      g_printerr ("Can't read %s\n", file);
+      g_free (file);
+      return;
+    }
+
+  g_print ("%s (%" G_GSIZE_FORMAT " bytes)\n", path, strlen (html));
+
+  for (i = 0; i < N_ROUNDS; i++)
+    {
+      gsize bytes;
+      gdouble seconds;
+
+      seconds = bench_legacy (html, n_messages, &bytes);
+      report ("scan", seconds, n_messages, bytes);
+
+      seconds = bench_compiled (html, n_messages, &bytes);
+      report ("compiled", seconds, n_messages, bytes);
+    }
+
+  g_free (html);
+  g_free (file);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint n_messages = 100000;
+  gint i;
+
+  gtk_init (&argc, &argv);
+  empathy_gtk_init ();
+
+  if (argc > 1)
+    n_messages = atoi (argv[1]);
+
+  if (argc > 2)
+    {
+      for (i = 2; i < argc; i++)
+        bench_style (argv[i], n_messages);
+    }
+  else
+    {
+      GList *themes, *l;
+
+      themes = empathy_theme_manager_get_adium_themes ();
+      if (themes == NULL)
+        g_printerr ("No Adium message style installed, "
+            "pass style paths on the command line\n");
+
+      for (l = themes; l != NULL; l = l->next)
+        {
+          bench_style (tp_asv_get_string (l->data, "path"), n_messages);
+          g_hash_table_unref (l->data);
+        }
+      g_list_free (themes);
+    }
+
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Compares the way EmpathyFTHandler used to hash outgoing files, a 4 KiB
+ * buffer allocated per chunk and a main loop notification per chunk, with
+ * the adaptive buffer and throttled notifications it uses now.
+ *
+ * Usage: bench-ft-hash [file]
+ *        bench-ft-hash --size [size in MiB]
+ *
+ * Without a file, a 4 GiB temporary file is created. Drop the page cache
+ * between runs (echo 3 > /proc/sys/vm/drop_caches) to measure cold reads. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gio/gfiledescriptorbased.h>
+
+#include <telepathy-glib/util.h>
+
+#define N_ROUNDS 3
+#define LEGACY_BUFFER_SIZE 4096
+#define MIN_HASH_BUFFER_SIZE (64 * 1024)
+#define MAX_HASH_BUFFER_SIZE (1024 * 1024)
+#define HASH_PROGRESS_INTERVAL 0.1
+
+typedef struct {
+  GFile *file;
+  guint64 total_bytes;
+  gboolean legacy;
+
+  GMainLoop *loop;
+  guint n_notifications;
+  volatile gint progress_pending;
+  gchar *checksum;
+  GError *error;
+} HashData;
+
+static gboolean
+progress_cb (gpointer user_data)
+{
+  HashData *data = user_data;
+
+  data->n_notifications++;
+  g_atomic_int_set (&data->progress_pending, FALSE);
+
+  return FALSE;
+}
+
+static gboolean
+done_cb (gpointer user_data)
+{
+  HashData *data = user_data;
+
+  g_main_loop_quit (data->loop);
+
+  return FALSE;
+}
+
+static gsize
+hash_buffer_size (guint64 total_bytes)
+{
+  gsize size = MIN_HASH_BUFFER_SIZE;
+
+  while (size < MAX_HASH_BUFFER_SIZE && size * 256 < total_bytes)
+    size *= 2;
+
+  return size;
+}
+
+static void
+hash_legacy (HashData *data,
+    GInputStream *stream,
+    GChecksum *checksum)
+{
+  guchar *buffer;
+  gssize bytes_read;
+
+  while (TRUE)
+    {
+      buffer = g_malloc0 (LEGACY_BUFFER_SIZE);
+      bytes_read = g_input_stream_read (stream, buffer, LEGACY_BUFFER_SIZE,
+          NULL, &data->error);
+
+      if (bytes_read <= 0)
+        {
+          g_free (buffer);
+          break;
+        }
+
+      g_checksum_update (checksum, buffer, bytes_read);
+      g_idle_add (progress_cb, data);
+      g_free (buffer);
+    }
+}
+
+static void
+hash_adaptive (HashData *data,
+    GInputStream *stream,
+    GChecksum *checksum)
+{
+  guchar *buffer;
+  gsize buffer_size;
+  gssize bytes_read;
+  GTimer *timer;
+
+  buffer_size = hash_buffer_size (data->total_bytes);
+  buffer = g_malloc (buffer_size);
+  timer = g_timer_new ();
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (g_file_descriptor_based_get_fd (
+        G_FILE_DESCRIPTOR_BASED (stream)), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  while (TRUE)
+    {
+      bytes_read = g_input_stream_read (stream, buffer, buffer_size,
+          NULL, &data->error);
+
+      if (bytes_read <= 0)
+        break;
+
+      g_checksum_update (checksum, buffer, bytes_read);
+
+      if (g_timer_elapsed (timer, NULL) >= HASH_PROGRESS_INTERVAL &&
+          g_atomic_int_compare_and_exchange (&data->progress_pending,
+              FALSE, TRUE))
+        {
+          g_idle_add (progress_cb, data);
+          g_timer_start (timer);
+        }
+    }
+
+  g_timer_destroy (timer);
+  g_free (buffer);
+}
+
+static gpointer
+hash_thread (gpointer user_data)
+{
+  HashData *data = user_data;
+  GFileInputStream *stream;
+  GChecksum *checksum;
+
+  stream = g_file_read (data->file, NULL, &data->error);
+  if (stream == NULL)
+    goto out;
+
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+  if (data->legacy)
+    hash_legacy (data, G_INPUT_STREAM (stream), checksum);
+  else
+    hash_adaptive (data, G_INPUT_STREAM (stream), checksum);
+
+  data->checksum = g_strdup (g_checksum_get_string (checksum));
+
+  g_checksum_free (checksum);
+  g_object_unref (stream);
+
+out:
+  g_idle_add (done_cb, data);
+
+  return NULL;
+}
+
+static void
+bench_hash (GFile *file,
+    guint64 total_bytes,
+    gboolean legacy)
+{
+  HashData data = { file, total_bytes, legacy, NULL, 0, FALSE, NULL, NULL };
+  GThread *thread;
+  GTimer *timer;
+  gdouble seconds;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  timer = g_timer_new ();
+
+  /* the main loop dispatches the notifications, like the UI would */
+  thread = g_thread_create (hash_thread, &data, TRUE, NULL);
+  g_main_loop_run (data.loop);
+  g_thread_join (thread);
+
+  /* notifications still queued would have been dispatched by the UI too */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  seconds = g_timer_elapsed (timer, NULL);
+
+  if (data.error != NULL)
+    {
+      g_printerr ("Can't hash the file: %s\n", data.error->message);
+      g_error_free (data.error);
+    }
+  else
+    {
+      g_print ("  %-9s %8.3f s  %8.2f MB/s  %9u notifications  %s\n",
+          legacy ? "legacy" : "adaptive", seconds,
+          total_bytes / seconds / (1024 * 1024), data.n_notifications,
+          data.checksum);
+    }
+
+  g_free (data.checksum);
+  g_timer_destroy (timer);
+  g_main_loop_unref (data.loop);
+}
+
+static GFile *
+create_file (guint64 size)
+{
+  GFile *file;
+  gchar *path;
+  guint32 *buffer;
+  guint64 written = 0;
+  gint fd;
+  guint i;
+
+  fd = g_file_open_tmp ("bench-ft-hash-XXXXXX", &path, NULL);
+  if (fd < 0)
+    g_error ("Can't create a temporary file");
+
+  buffer = g_malloc (MAX_HASH_BUFFER_SIZE);
+  for (i = 0; i < MAX_HASH_BUFFER_SIZE / sizeof (guint32); i++)
+    buffer[i] = g_random_int ();
+
+  while (written < size)
+    {
+      gssize len;
+
+      len = write (fd, buffer, MIN (MAX_HASH_BUFFER_SIZE, size - written));
+      if (len <= 0)
+        g_error ("Can't write the temporary file: %s", g_strerror (errno));
+
+      written += len;
+    }
+
+  close (fd);
+  g_free (buffer);
+
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  return file;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GFile *file = NULL;
+  GFileInfo *info;
+  guint64 size = 4096;
+  gboolean temporary = TRUE;
+  guint i;
+
+  g_thread_init (NULL);
+  g_type_init ();
+
+  if (argc > 2 && !tp_strdiff (argv[1], "--size"))
+    {
+      size = atoi (argv[2]);
+    }
+  else if (argc > 1)
+    {
+      file = g_file_new_for_commandline_arg (argv[1]);
+      temporary = FALSE;
+    }
+
+  if (temporary)
+    {
+      g_print ("Creating a %" G_GUINT64_FORMAT " MiB file...\n", size);
+      file = create_file (size * 1024 * 1024);
+    }
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL)
+    g_error ("Can't stat the file");
+
+  size = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  g_print ("Hashing %" G_GUINT64_FORMAT " bytes, %" G_GSIZE_FORMAT
+      " bytes per read\n", size, hash_buffer_size (size));
+
+  for (i = 0; i < N_ROUNDS; i++)
+    {
+      bench_hash (file, size, TRUE);
+      bench_hash (file, size, FALSE);
+    }
+
+  if (temporary)
+    g_file_delete (file, NULL, NULL);
+
+  g_object_unref (file);
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Compares the throughput of the chained EmpathyStringParser callbacks with
+ * the single-pass tokenizer, on a synthetic IRC-like corpus.
+ *
+ * Usage: bench-string-parser [n_messages] */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include <libempathy-gtk/empathy-ui-utils.h>
+#include <libempathy-gtk/empathy-string-parser.h>
+
+#define N_ROUNDS 5
+
+static const gchar *samples[] = {
+  "hey, anyone around?",
+  "yeah :) what's up",
+  "the build is broken again on trunk, see http://build.example.org/log/1234",
+  "lol :D",
+  "can you mail me at someone@example.com about it",
+  "I pushed a fix to git://git.example.org/project.git >:)",
+  "ok, brb",
+  "www.example.com/foo?bar=baz looks down :(",
+  "multi\nline\nmessage with a smiley ;) at the end",
+  "no links or smileys in this one, just some plain text people type",
+};
+
+static void
+bench_replace_smiley (const gchar *text,
+    gssize len,
+    gpointer match_data,
+    gpointer user_data)
+{
+  EmpathySmileyHit *hit = match_data;
+
+  g_string_append (user_data, hit->path);
+}
+
+static gdouble
+bench_chain (GPtrArray *messages,
+    gsize *out_bytes)
+{
+  EmpathyStringParser parsers[] = {
+      {empathy_string_match_link, empathy_string_replace_link},
+      {empathy_string_match_smiley, bench_replace_smiley},
+      {empathy_string_match_all, empathy_string_replace_escaped},
+      {NULL, NULL}
+  };
+  GString *string = g_string_sized_new (4096);
+  GTimer *timer = g_timer_new ();
+  gsize bytes = 0;
+  gdouble seconds;
+  guint i;
+
+  for (i = 0; i < messages->len; i++)
+    {
+      const gchar *text = g_ptr_array_index (messages, i);
+
+      g_string_truncate (string, 0);
+      empathy_string_parser_substr (text, -1, parsers, string);
+      bytes += strlen (text);
+    }
+
+  seconds = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  *out_bytes = bytes;
+  g_string_free (string, TRUE);
+
+  return seconds;
+}
+
+static gdouble
+bench_tokenizer (GPtrArray *messages,
+    gsize *out_bytes)
+{
+  GString *string = g_string_sized_new (4096);
+  GArray *tokens = empathy_string_tokens_new ();
+  GTimer *timer = g_timer_new ();
+  gsize bytes = 0;
+  gdouble seconds;
+  guint i, j;
+
+  for (i = 0; i < messages->len; i++)
+    {
+      const gchar *text = g_ptr_array_index (messages, i);
+
+      g_string_truncate (string, 0);
+      g_array_set_size (tokens, 0);
+      empathy_string_tokenize (text, -1,
+          EMPATHY_STRING_TOKENIZE_LINKS | EMPATHY_STRING_TOKENIZE_SMILEYS,
+          tokens);
+
+      for (j = 0; j < tokens->len; j++)
+        {
+          EmpathyStringToken *token;
+
+          token = &g_array_index (tokens, EmpathyStringToken, j);
+          switch (token->type)
+            {
+              case EMPATHY_STRING_TOKEN_LINK:
+                empathy_string_replace_link (text + token->start,
+                    token->end - token->start, NULL, string);
+                break;
+              case EMPATHY_STRING_TOKEN_SMILEY:
+                g_string_append (string, token->path);
+                break;
+              default:
+                empathy_string_replace_escaped (text + token->start,
+                    token->end - token->start, NULL, string);
+                break;
+            }
+        }
+      bytes += strlen (text);
+    }
+
+  seconds = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  *out_bytes = bytes;
+  g_array_free (tokens, TRUE);
+  g_string_free (string, TRUE);
+
+  return seconds;
+}
+
+static void
+report (const gchar *name,
+    gdouble seconds,
+    gsize bytes)
+{
+  g_print ("%-10s %8.3f s  %8.2f MB/s\n", name, seconds,
+      bytes / seconds / (1024 * 1024));
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GPtrArray *messages;
+  guint n_messages = 200000;
+  guint i;
+
+  gtk_init (&argc, &argv);
+  empathy_gtk_init ();
+
+  if (argc > 1)
+    n_messages = atoi (argv[1]);
+
+  messages = g_ptr_array_sized_new (n_messages);
+  for (i = 0; i < n_messages; i++)
+    g_ptr_array_add (messages,
+        (gpointer) samples[g_random_int_range (0, G_N_ELEMENTS (samples))]);
+
+  for (i = 0; i < N_ROUNDS; i++)
+    {
+      gsize bytes;
+      gdouble seconds;
+
+      seconds = bench_chain (messages, &bytes);
+      report ("chain", seconds, bytes);
+
+      seconds = bench_tokenizer (messages, &bytes);
+      report ("tokenizer", seconds, bytes);
+    }
+
+  g_ptr_array_free (messages, TRUE);
+
+  return 0;
+}
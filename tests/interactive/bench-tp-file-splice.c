@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2011 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Compares the two data paths of EmpathyTpFile: g_output_stream_splice_async()
+ * and the kernel-side copy of empathy_fd_splice_async(). A thread on the
+ * other end of a socketpair stands in for the connection manager, draining
+ * outgoing data or feeding incoming data.
+ *
+ * Usage: bench-tp-file-splice [size in MiB] */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <gio/gio.h>
+#include <gio/gfiledescriptorbased.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+
+#include <libempathy/empathy-fd-splice.h>
+
+#define N_ROUNDS 3
+#define CHUNK_SIZE (1024 * 1024)
+
+typedef struct {
+  gint fd;
+  guint64 size;
+  guint64 done;
+} PeerData;
+
+typedef struct {
+  GMainLoop *loop;
+  gssize copied;
+  GError *error;
+} ResultData;
+
+/* The connection manager side of an outgoing transfer */
+static gpointer
+drain_thread (gpointer user_data)
+{
+  PeerData *peer = user_data;
+  gchar *buffer = g_malloc (CHUNK_SIZE);
+  gssize len;
+
+  while ((len = read (peer->fd, buffer, CHUNK_SIZE)) > 0)
+    peer->done += len;
+
+  close (peer->fd);
+  g_free (buffer);
+
+  return NULL;
+}
+
+/* The connection manager side of an incoming transfer */
+static gpointer
+feed_thread (gpointer user_data)
+{
+  PeerData *peer = user_data;
+  gchar *buffer = g_malloc0 (CHUNK_SIZE);
+
+  while (peer->done < peer->size)
+    {
+      gssize len;
+
+      len = write (peer->fd, buffer, MIN (CHUNK_SIZE, peer->size - peer->done));
+      if (len <= 0)
+        break;
+
+      peer->done += len;
+    }
+
+  close (peer->fd);
+  g_free (buffer);
+
+  return NULL;
+}
+
+static void
+gio_splice_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  ResultData *result = user_data;
+
+  result->copied = g_output_stream_splice_finish (G_OUTPUT_STREAM (source),
+      res, &result->error);
+  g_main_loop_quit (result->loop);
+}
+
+static void
+fd_splice_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  ResultData *result = user_data;
+
+  result->copied = empathy_fd_splice_finish (res, &result->error);
+  g_main_loop_quit (result->loop);
+}
+
+static gdouble
+bench_outgoing (GFile *file,
+    guint64 size,
+    gboolean kernel,
+    GError **error)
+{
+  GFileInputStream *in_stream;
+  PeerData peer = { -1, size, 0 };
+  ResultData result = { NULL, 0, NULL };
+  GThread *thread;
+  GTimer *timer;
+  gdouble seconds;
+  gint sv[2];
+
+  in_stream = g_file_read (file, NULL, error);
+  if (in_stream == NULL)
+    return -1;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    g_error ("socketpair failed: %s", g_strerror (errno));
+
+  peer.fd = sv[1];
+  thread = g_thread_create (drain_thread, &peer, TRUE, NULL);
+  result.loop = g_main_loop_new (NULL, FALSE);
+  timer = g_timer_new ();
+
+  if (kernel)
+    {
+      empathy_fd_splice_async (
+          g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (in_stream)),
+          sv[0], EMPATHY_FD_SPLICE_FILE_TO_SOCKET, G_PRIORITY_DEFAULT, NULL,
+          fd_splice_cb, &result);
+      g_main_loop_run (result.loop);
+      close (sv[0]);
+    }
+  else
+    {
+      GOutputStream *socket_stream;
+
+      socket_stream = g_unix_output_stream_new (sv[0], TRUE);
+      g_output_stream_splice_async (socket_stream, G_INPUT_STREAM (in_stream),
+          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+          G_PRIORITY_DEFAULT, NULL, gio_splice_cb, &result);
+      g_main_loop_run (result.loop);
+      g_object_unref (socket_stream);
+    }
+
+  g_thread_join (thread);
+  seconds = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+  g_main_loop_unref (result.loop);
+  g_object_unref (in_stream);
+
+  if (result.error != NULL)
+    {
+      g_propagate_error (error, result.error);
+      return -1;
+    }
+
+  if (peer.done != size)
+    g_printerr ("outgoing: %" G_GUINT64_FORMAT " bytes received, expected %"
+        G_GUINT64_FORMAT "\n", peer.done, size);
+
+  return seconds;
+}
+
+static gdouble
+bench_incoming (GFile *file,
+    guint64 size,
+    gboolean kernel,
+    GError **error)
+{
+  GFileOutputStream *out_stream;
+  PeerData peer = { -1, size, 0 };
+  ResultData result = { NULL, 0, NULL };
+  GThread *thread;
+  GTimer *timer;
+  gdouble seconds;
+  gint sv[2];
+
+  out_stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+      error);
+  if (out_stream == NULL)
+    return -1;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    g_error ("socketpair failed: %s", g_strerror (errno));
+
+  peer.fd = sv[1];
+  thread = g_thread_create (feed_thread, &peer, TRUE, NULL);
+  result.loop = g_main_loop_new (NULL, FALSE);
+  timer = g_timer_new ();
+
+  if (kernel)
+    {
+      empathy_fd_splice_async (sv[0],
+          g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (out_stream)),
+          EMPATHY_FD_SPLICE_SOCKET_TO_FILE, G_PRIORITY_DEFAULT, NULL,
+          fd_splice_cb, &result);
+      g_main_loop_run (result.loop);
+      close (sv[0]);
+      g_output_stream_close (G_OUTPUT_STREAM (out_stream), NULL, NULL);
+    }
+  else
+    {
+      GInputStream *socket_stream;
+
+      socket_stream = g_unix_input_stream_new (sv[0], TRUE);
+      g_output_stream_splice_async (G_OUTPUT_STREAM (out_stream),
+          socket_stream,
+          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+          G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+          G_PRIORITY_DEFAULT, NULL, gio_splice_cb, &result);
+      g_main_loop_run (result.loop);
+      g_object_unref (socket_stream);
+    }
+
+  g_thread_join (thread);
+  seconds = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+  g_main_loop_unref (result.loop);
+  g_object_unref (out_stream);
+
+  if (result.error != NULL)
+    {
+      g_propagate_error (error, result.error);
+      return -1;
+    }
+
+  if ((guint64) result.copied != size)
+    g_printerr ("incoming: %" G_GSSIZE_FORMAT " bytes written, expected %"
+        G_GUINT64_FORMAT "\n", result.copied, size);
+
+  return seconds;
+}
+
+static void
+report (const gchar *name,
+    gdouble seconds,
+    guint64 size,
+    GError *error)
+{
+  if (error != NULL)
+    {
+      g_print ("  %-16s %s\n", name, error->message);
+      return;
+    }
+
+  g_print ("  %-16s %8.3f s  %8.2f MB/s\n", name, seconds,
+      size / seconds / (1024 * 1024));
+}
+
+static GFile *
+create_source_file (guint64 size)
+{
+  GFile *file;
+  gchar *path;
+  gchar *buffer;
+  guint64 written = 0;
+  gint fd;
+  guint i;
+
+  fd = g_file_open_tmp ("bench-tp-file-splice-XXXXXX", &path, NULL);
+  if (fd < 0)
+    g_error ("Can't create a temporary file");
+
+  /* not compressible, in case the file system would notice */
+  buffer = g_malloc (CHUNK_SIZE);
+  for (i = 0; i < CHUNK_SIZE / sizeof (guint32); i++)
+    ((guint32 *) buffer)[i] = g_random_int ();
+
+  while (written < size)
+    {
+      gssize len;
+
+      len = write (fd, buffer, MIN (CHUNK_SIZE, size - written));
+      if (len <= 0)
+        g_error ("Can't write the temporary file: %s", g_strerror (errno));
+
+      written += len;
+    }
+
+  close (fd);
+  g_free (buffer);
+
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  return file;
+}
+
+static GFile *
+create_target_file (void)
+{
+  GFile *file;
+  gchar *path;
+  gint fd;
+
+  fd = g_file_open_tmp ("bench-tp-file-splice-XXXXXX", &path, NULL);
+  if (fd < 0)
+    g_error ("Can't create a temporary file");
+
+  close (fd);
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  return file;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GFile *source, *target;
+  guint64 size = 256;
+  guint i;
+
+  g_thread_init (NULL);
+  g_type_init ();
+
+  if (argc > 1)
+    size = atoi (argv[1]);
+
+  size *= 1024 * 1024;
+
+  source = create_source_file (size);
+  target = create_target_file ();
+
+  g_print ("%" G_GUINT64_FORMAT " MiB over a socketpair\n",
+      size / (1024 * 1024));
+
+  for (i = 0; i < N_ROUNDS; i++)
+    {
+      GError *error = NULL;
+      gdouble seconds;
+
+      seconds = bench_outgoing (source, size, FALSE, &error);
+      report ("outgoing gio", seconds, size, error);
+      g_clear_error (&error);
+
+      seconds = bench_outgoing (source, size, TRUE, &error);
+      report ("outgoing kernel", seconds, size, error);
+      g_clear_error (&error);
+
+      seconds = bench_incoming (target, size, FALSE, &error);
+      report ("incoming gio", seconds, size, error);
+      g_clear_error (&error);
+
+      seconds = bench_incoming (target, size, TRUE, &error);
+      report ("incoming kernel", seconds, size, error);
+      g_clear_error (&error);
+    }
+
+  g_file_delete (source, NULL, NULL);
+  g_file_delete (target, NULL, NULL);
+  g_object_unref (source);
+  g_object_unref (target);
+
+  return 0;
+}